@@ -100,3 +100,17 @@ double BH1750_getLx(int fd)
 	   See page 7 of the datasheet */
 	return lx / BH1750_SCALING_FACTOR;
 }
+
+/* BH1750: read latest luminance value (continuous mode, no waiting) */
+double BH1750_readLx(int fd)
+{
+	unsigned int lx;
+	unsigned char buf[2];
+
+	if (!datawait)
+		return -1.0;
+
+	read(fd, buf, 2);
+	lx = (buf [0] << 8) | buf [1];
+	return lx / BH1750_SCALING_FACTOR;
+}
@@ -31,4 +31,8 @@ void BH1750_setMode(int fd, int cont, int res);
 /* Get luminance */
 double BH1750_getLx(int fd);
 
+/* Read latest luminance in continuous mode without waiting for */
+/* conversion (first one must be complete, e.g. by BH1750_getLx()) */
+double BH1750_readLx(int fd);
+
 #endif
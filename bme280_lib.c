@@ -54,6 +54,7 @@
 
 /* Timing information (rounded) - see sensor datasheet */
 #define	BME280_STARTUP_TIME_MS		2
+#define	BME280_FORCED_1X_MAX_TIME_MS	10	/* all values, OSS x1 */
 
 /* BME280 calibration values, see datasheet pages 22-23 for details */
 static signed short dig_T2, dig_T3, dig_P2, dig_P3, dig_P4, dig_P5, dig_P6,
@@ -222,6 +223,14 @@ void BME280_setupFullMode(int fd)
 	wiringPiI2CWriteReg8(fd, BME280_REG_CONFIG, (b8 & 0x1c) | (BME280_FILTER_COEFF_OFF << 2));
 }
 
+/* BME280: start forced measurement with settings of BME280_setupFullMode() */
+int BME280_startForced(int fd)
+{
+	wiringPiI2CWriteReg8(fd, BME280_REG_CTRL_MEAS, (BME280_OVERSAMPLING_1X << 5) \
+			     | (BME280_OVERSAMPLING_1X << 2) | BME280_FORCED_MODE );
+	return BME280_FORCED_1X_MAX_TIME_MS;
+}
+
 /* BME280: get values using official Bosch floating point formula */
 int BME280_getSensorData(int fd, double *temp, double *press, double *humid)
 {
@@ -66,6 +66,10 @@ void BME280_dumpCalibrationData(void);
  */
 void BME280_setupFullMode(int fd);
 
+/* Start next forced measurement after BME280_setupFullMode(), returns its */
+/* maximum time in ms; values are read by BME280_getSensorData() */
+int BME280_startForced(int fd);
+
 /* Get all 3 sensor values using official Bosch floating point formula */
 /* Pressure in hPa, temperature in Celsius, humidity in percent */
 /* Return 0 if readings are OK */
@@ -154,6 +154,31 @@ void BMP180_dumpCalibrationData(void)
 	printf(" MD = %d\n", cal_MD);
 }
 
+/* BMP180: start temperature conversion */
+int BMP180_startTemperature(int fd)
+{
+	wiringPiI2CWriteReg8(fd, BMP180_REG_MEAS_CTL, BMP180_VAL_TEMP);
+	return BMP180_TEMP_MAX_TIME_MS;
+}
+
+/* BMP180: read uncompensated temperature */
+int BMP180_readRawTemperature(int fd)
+{
+	int msb, lsb;
+
+	msb = wiringPiI2CReadReg8(fd, BMP180_REG_OUT_MSB);
+	lsb = wiringPiI2CReadReg8(fd, BMP180_REG_OUT_LSB);
+	return (msb << 8) + lsb;
+}
+
+/* BMP180: start pressure conversion */
+int BMP180_startPressure(int fd, int oss)
+{
+	wiringPiI2CWriteReg8(fd, BMP180_REG_MEAS_CTL, \
+			     BMP180_VAL_PRESS + (oss << 6));
+	return osswait[oss];
+}
+
 /* BMP180: get values using official Bosch formula */
 double BMP180_getPressure(int fd, int oss, double *temp)
 {
@@ -162,15 +187,10 @@ double BMP180_getPressure(int fd, int oss, double *temp)
 	int x1, x2, x3, b3, b5, b6, b8, p;
 	unsigned int b4, b7;
 
-	wiringPiI2CWriteReg8(fd, BMP180_REG_MEAS_CTL, BMP180_VAL_TEMP);
-	delay(BMP180_TEMP_MAX_TIME_MS);
-	msb = wiringPiI2CReadReg8(fd, BMP180_REG_OUT_MSB);
-	lsb = wiringPiI2CReadReg8(fd, BMP180_REG_OUT_LSB);
-	ut = (msb << 8) + lsb;
+	delay(BMP180_startTemperature(fd));
+	ut = BMP180_readRawTemperature(fd);
 
-	wiringPiI2CWriteReg8(fd, BMP180_REG_MEAS_CTL, \
-			     BMP180_VAL_PRESS + (oss << 6));
-	delay(osswait[oss]);
+	delay(BMP180_startPressure(fd, oss));
 	msb = wiringPiI2CReadReg8(fd, BMP180_REG_OUT_MSB);
 	lsb = wiringPiI2CReadReg8(fd, BMP180_REG_OUT_LSB);
 	xlsb = wiringPiI2CReadReg8(fd, BMP180_REG_OUT_XLSB);
@@ -205,21 +225,24 @@ double BMP180_getPressure(int fd, int oss, double *temp)
 
 /* BMP180: get pressure using alternate (floating point) formula */
 double BMP180_getPressureFP(int fd, int oss, double *temp)
+{
+	int ut;
+
+	delay(BMP180_startTemperature(fd));
+	ut = BMP180_readRawTemperature(fd);
+	delay(BMP180_startPressure(fd, oss));
+	return BMP180_readPressureFP(fd, ut, temp);
+}
+
+/* BMP180: read pressure conversion result (floating point formula) */
+double BMP180_readPressureFP(int fd, int ut, double *temp)
 {
 	int msb, lsb, xlsb;
 	double tu, pu, alpha, t, s, x, y, z;
 	double c3, c4, b1, c5, c6, mc, md;
 	double x0, x1, x2, y0, y1, y2, p0, p1, p2;
 
-	wiringPiI2CWriteReg8(fd, BMP180_REG_MEAS_CTL, BMP180_VAL_TEMP);
-	delay(BMP180_TEMP_MAX_TIME_MS);
-	msb = wiringPiI2CReadReg8(fd, BMP180_REG_OUT_MSB);
-	lsb = wiringPiI2CReadReg8(fd, BMP180_REG_OUT_LSB);
-	tu = msb * 256.0 + lsb;
-
-	wiringPiI2CWriteReg8(fd, BMP180_REG_MEAS_CTL, \
-			     BMP180_VAL_PRESS + (oss << 6));
-	delay(osswait[oss]);
+	tu = ut;
 	msb = wiringPiI2CReadReg8(fd, BMP180_REG_OUT_MSB);
 	lsb = wiringPiI2CReadReg8(fd, BMP180_REG_OUT_LSB);
 	xlsb = wiringPiI2CReadReg8(fd, BMP180_REG_OUT_XLSB);
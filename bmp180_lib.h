@@ -40,4 +40,12 @@ double BMP180_getPressure(int fd, int oss, double *temp);
 /* Temperature unit: Celsius */
 double BMP180_getPressureFP(int fd, int oss, double *temp);
 
+/* Split measurement: start conversion (returns its maximum time in ms), */
+/* read result when it is done; temperature must be read first as it is */
+/* needed for pressure compensation (single converter) */
+int BMP180_startTemperature(int fd);
+int BMP180_readRawTemperature(int fd);
+int BMP180_startPressure(int fd, int oss);
+double BMP180_readPressureFP(int fd, int ut, double *temp);
+
 #endif
@@ -66,6 +66,9 @@
 #include <wiringPi.h>
 
 #include "radio433_dev.h"
+#include "radio433_msg.h"
+#include "daemonlog_lib.h"
+#include "radio433_shm.h"
 
 /* *************** */
 /* *  Constants  * */
@@ -76,18 +79,9 @@
 #define MAX_NGROUPS		(NGROUPS_MAX >> 10)	/* reasonable maximum */
 #define GPIO_PINS		28	/* number of Pi GPIO pins */
 #define RADIO_PORT		5433	/* default radio433daemon TCP port */
-#define RADMSG_SIZE		128	/* radio daemon message size */
-#define RADBUF_SIZE		(RADMSG_SIZE * 8)
-#define RADMSG_HDR		"<RX>"
-#define RADMSG_EOT		"<ZZ>"
 #define RECONNECT_DELAY_SEC	15
 #define FILE_UMASK		(S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)
 #define PID_DIR			"/var/run/"
-#define LOG_DEBUG		"debug"
-#define LOG_INFO		"info"
-#define LOG_NOTICE		"notice"
-#define LOG_WARN		"warn"
-#define LOG_ERROR		"error"
 #define POLL_INTERVAL_MS	50	/* main loop poll interval (ms), (>debounce) */
 #define GPIOBTN_DEBNC_MS	20	/* debounce interval */
 #define RADBTN_CODES_NUM	2	/* wait for these number of codes to accept keypress */
@@ -139,11 +133,13 @@ extern char *optarg;
 extern int optind, opterr, optopt;
 pid_t procpid;
 char progname[PATH_MAX + 1], logfname[PATH_MAX + 1], pidfname[PATH_MAX + 1];
-sem_t logsem;			/* log file semaphore */
 volatile int logfd, radfd;	/* files and sockets */
 volatile int radflag, debugflag, netclrun, gpiodlen, raddlen;
 pthread_t netclthread;
 struct sockaddr_in radsin;
+struct in_addr radmcgroup;	/* radio multicast group (optional) */
+int radmcport;
+char radshmname[64];		/* radio shared memory ring (optional) */
 sem_t pollsem;	/* polling loop control */
 char *eqtc[3] = { "(null)", "gpio", "radio" };
 char *eqac[2] = { "pressed", "released" };
@@ -262,7 +258,7 @@ struct isrftentry isrtable[] = {
 /* Show help */
 void help(void)
 {
-	printf("Usage:\n\t%s [-V] [-d | -l logfile] [-u user] [-P pidfile] [-r radioip [-t radioport] -c codestr] [-g gpiostr] script\n\n", progname);
+	printf("Usage:\n\t%s [-V] [-d | -l logfile] [-u user] [-P pidfile] [-r radioip [-t radioport] | -m group:port | -s shmname] [-c codestr] [-g gpiostr] script\n\n", progname);
 	puts("Where:");
 	puts("\t-V            - show version and exit");
 	puts("\t-d            - debug mode, stay foreground and show activity (optional)");
@@ -271,6 +267,8 @@ void help(void)
 	printf("\t-P pidfile    - path to PID file (optional, default is %s%s.pid)\n", PID_DIR, progname);
 	puts("\t-r radioip    - IPv4 address of radio server (optional)");
 	printf("\t-t radioport  - TCP port of radio server (optional, default is %d)\n", RADIO_PORT);
+	puts("\t-m g:p        - receive radio codes from multicast group g port p (optional)");
+	puts("\t-s shmname    - read radio codes from local shared memory ring (optional)");
 	puts("\t-c codestr    - radio codes definition string (optional, see below)");
 	puts("\t-g gpiostr    - GPIO buttons definition string (optional, see below)");
 	puts("\tscript        - full path to program called for button events\n");
@@ -296,28 +294,6 @@ void verShow(void)
 #endif
 }
 
-/* Log line header */
-void logprintf(int fd, const char *level, const char *fmt, ...)
-{
-        struct timeval ts;
-        struct tm *tl;
-	va_list ap;
-
-	if (fd < 0)
-		return;
-	sem_wait(&logsem);
-	gettimeofday(&ts, NULL);
-	tl = localtime(&ts.tv_sec);
-	dprintf(fd, "%d-%02d-%02d %02d:%02d:%02d.%03u %s[%d] %s: ",
-		1900 + tl->tm_year, tl->tm_mon + 1, tl->tm_mday,
-		tl->tm_hour, tl->tm_min, tl->tm_sec, ts.tv_usec / 1000,
-		progname, procpid, level);
-	va_start(ap, fmt);
-	vdprintf(fd, fmt, ap);
-	va_end(ap);
-	sem_post(&logsem);
-}
-
 /* change ownership of log and pid files */
 void chownFiles(uid_t uid, gid_t gid)
 {
@@ -422,7 +398,8 @@ int callHandler(char *hprog, struct eventqentry *eq)
  */
 int connectRadioSrv(struct sockaddr_in *s)
 {
-	int fd;
+	int i, n, fd;
+	char cmd[MAX_RADIO_CODES * 48 + 16];
 
 	for(;;) {
 		fd = socket(AF_INET, SOCK_STREAM, 0);
@@ -442,6 +419,13 @@ int connectRadioSrv(struct sockaddr_in *s)
 			logprintf(logfd, LOG_NOTICE,
 				  "connected successfully to radio server %s port %d\n",
 				  inet_ntoa(s->sin_addr), ntohs(s->sin_port));
+			/* request binary records of configured codes only */
+			/* (older servers ignore it and send all as text) */
+			n = sprintf(cmd, "%s", RADIO433_CMD_BINARY);
+			for(i = 0; i < raddlen; i++)
+				n += sprintf(cmd + n, "SUB CODE 0x%04X 0x%llX\n",
+					     raddesc[i].type, raddesc[i].code);
+			send(fd, cmd, n, MSG_NOSIGNAL);
 			break;
 		}
 	}
@@ -529,7 +513,7 @@ void endProcess(int status)
 	if (logfd >= 0) {
 		logprintf(logfd, LOG_NOTICE, "server shut down with code %d\n",
 			  status);
-		close(logfd);
+		DaemonLog_close();
 	}
 
 	/* exit process */
@@ -543,19 +527,43 @@ void signalQuit(int sig)
 	endProcess(0);
 }
 
-/* SIGHUP - reopen log file, useful for logrotate */
+/* SIGHUP - reopen log file, useful for logrotate (done by log writer) */
 void signalReopenLog(int sig)
 {
-	if (!debugflag && logfd >= 0) {
-		logprintf(logfd, LOG_NOTICE, "signal %d received\n", sig);
-		logprintf(logfd, LOG_NOTICE, "closing log file\n");
-		fsync(logfd);	/* never hurts */
-		close(logfd);
-		logfd = open(logfname, O_CREAT | O_TRUNC | O_SYNC | O_WRONLY, FILE_UMASK);
-		if (logfd == -1)
-			endProcess(EXIT_FAILURE);
-		logprintf(logfd, LOG_NOTICE, "log file flushed after receiving signal %d\n", sig);
-	}
+	DaemonLog_reopen();
+}
+
+/* Queue event for radio code if it is monitored */
+void radioButtonEvent(struct radio433_msg *m)
+{
+	int i;
+	struct raddentry *rd;
+	struct timeval ts;
+
+	for (i = 0; i < raddlen; i++)
+		if (raddesc[i].status && \
+		    raddesc[i].type == m->type && \
+		    raddesc[i].code == m->code) {
+			rd = &raddesc[i];
+			sem_wait(&rd->locksem);
+			if (rd->status == QSTATUS_IDLE) {
+				gettimeofday(&ts, NULL);
+				rd->status = QSTATUS_NEW;
+				rd->codelen = m->codetime;
+				rd->repeats = MAX(m->repeats, RADBTN_CODES_NUM);
+				rd->interval = m->interval;
+				rd->bits = m->bits;
+				rd->nrcod = 0;
+				rd->tsec = ts.tv_sec;
+				rd->tmsec = ts.tv_usec / 1000;
+			}
+			rd->nrcod++;
+			/* ttl window is twice tx period */
+			rd->ttl = (rd->repeats * rd->codelen) << 1;
+			sem_post(&rd->locksem);
+			sem_post(&pollsem);
+			break;
+		}
 }
 
 /* ************* */
@@ -564,72 +572,85 @@ void signalReopenLog(int sig)
 
 void *radioDaemonThread(void *arg)
 {
-	char radbuf[RADBUF_SIZE + 1];
-	char *msgptr, *msgend;
-	int i, msglen;
+	struct radio433_msgbuf mb;
+	struct radio433_msg m;
 	sigset_t blkset;
-	unsigned long tss;
-	int tsms;
-	int codelen, repeats, interval;
-	int type, bits;
-	unsigned long long code;
-	struct raddentry *rd;
-	struct timeval ts;
 
 	sigfillset(&blkset);
 	pthread_sigmask(SIG_BLOCK, &blkset, NULL);
 
+	Radio433_initMsgBuf(&mb);
+
 	/* function loop - never ends, send signal to exit */
 	for(;;) {
-		do
-			msglen = recv(radfd, radbuf, RADBUF_SIZE, 0);
-		while (msglen == -1 && errno == EINTR);
-		if (msglen <= 0) {
+		if (Radio433_recvMsgBuf(radfd, &mb) <= 0) {
 			close(radfd);
 			radfd = connectRadioSrv(&radsin);
+			Radio433_initMsgBuf(&mb);
 			continue;
 		}
-		radbuf[msglen] = 0;
-		msgptr = radbuf;
-		do {
-			msgptr = strstr(msgptr, RADMSG_HDR);
-			if (msgptr == NULL)
-				break;
-			msgend = strstr(msgptr, RADMSG_EOT);
-			if (msgend == NULL)
-				break;
-			if (sscanf(msgptr + 4, "%lu.%u;%d;%d;%d;0x%X;%d;0x%llX;",
-			    &tss, &tsms, &codelen, &repeats, &interval, &type,
-			    &bits, &code) == 8)
-				for (i = 0; i < raddlen; i++)
-					if (raddesc[i].status && \
-					    raddesc[i].type == type && \
-					    raddesc[i].code == code) {
-						rd = &raddesc[i];
-						sem_wait(&rd->locksem);
-						if (rd->status == QSTATUS_IDLE) {
-							gettimeofday(&ts, NULL);
-							rd->status = QSTATUS_NEW;
-							rd->codelen = codelen;
-							rd->repeats = MAX(repeats, RADBTN_CODES_NUM);
-							rd->interval = interval;
-							rd->bits = bits;
-							rd->nrcod = 0;
-							rd->tsec = ts.tv_sec;
-							rd->tmsec = ts.tv_usec / 1000;
-						}
-						rd->nrcod++;
-						/* ttl window is twice tx period */
-						rd->ttl = (rd->repeats * rd->codelen) << 1;
-						sem_post(&rd->locksem);
-						sem_post(&pollsem);
-						break;
-					}
-			msgptr = msgend + 5;
-		} while (msgptr < radbuf + msglen);
+		while (Radio433_nextMsg(&mb, &m))
+			radioButtonEvent(&m);
 	}	/* thread main loop ends here */
 }
 
+void *radioMcastThread(void *arg)
+{
+	struct radio433_mcast mc;
+	struct radio433_msg m;
+	sigset_t blkset;
+
+	sigfillset(&blkset);
+	pthread_sigmask(SIG_BLOCK, &blkset, NULL);
+
+	while (Radio433_openMcast(&mc, radmcgroup, radmcport) == -1) {
+		logprintf(logfd, LOG_WARN,
+			  "unable to join radio multicast group %s port %d: %s\n",
+			  inet_ntoa(radmcgroup), radmcport, strerror(errno));
+		logprintf(logfd, LOG_WARN, "retrying in %d seconds...\n",
+			  RECONNECT_DELAY_SEC);
+		sleep(RECONNECT_DELAY_SEC);
+	}
+	radfd = mc.fd;
+	logprintf(logfd, LOG_NOTICE, "joined radio multicast group %s port %d\n",
+		  inet_ntoa(radmcgroup), radmcport);
+
+	/* function loop - never ends, send signal to exit */
+	while (Radio433_recvMcast(&mc, &m) > 0)
+		radioButtonEvent(&m);
+	logprintf(logfd, LOG_ERROR, "radio multicast receive failed: %s\n",
+		  strerror(errno));
+	return NULL;
+}
+
+void *radioShmThread(void *arg)
+{
+	struct radio433_shm sh;
+	struct radio433_msg m;
+	sigset_t blkset;
+
+	sigfillset(&blkset);
+	pthread_sigmask(SIG_BLOCK, &blkset, NULL);
+
+	/* function loop - never ends, send signal to exit */
+	for(;;) {
+		while (Radio433_openShm(&sh, radshmname) == -1) {
+			logprintf(logfd, LOG_WARN,
+				  "unable to open radio shared memory ring %s: %s\n",
+				  radshmname, strerror(errno));
+			logprintf(logfd, LOG_WARN, "retrying in %d seconds...\n",
+				  RECONNECT_DELAY_SEC);
+			sleep(RECONNECT_DELAY_SEC);
+		}
+		logprintf(logfd, LOG_NOTICE, "reading radio shared memory ring %s\n",
+			  radshmname);
+		while (Radio433_readShm(&sh, &m) > 0)
+			radioButtonEvent(&m);
+		Radio433_closeShm(&sh);
+		logprintf(logfd, LOG_WARN, "radio server closed shared memory ring, reopening\n");
+	}
+}
+
 /* ************ */
 /* ************ */
 /* **  MAIN  ** */
@@ -656,6 +677,7 @@ int main(int argc, char *argv[])
 	uid_t uid;
 	gid_t gid;
 	char hscript[PATH_MAX + 1];
+	char mcaddr[INET_ADDRSTRLEN];
 
 	/* get process name */
 	strncpy(progname, basename(argv[0]), PATH_MAX);
@@ -675,6 +697,7 @@ int main(int argc, char *argv[])
 	radfd = -1;
 	netclrun = 0;
 	radflag = 0;
+	radmcport = 0;
 	gpiodlen = 0;
 	raddlen = 0;
 	gettimeofday(&ts, NULL);
@@ -694,7 +717,7 @@ int main(int argc, char *argv[])
 	memset((char *)raddesc, 0, sizeof(raddesc));
 	memset((char *)gpiodesc, 0, sizeof(gpiodesc));
 
-	while((opt = getopt(argc, argv, "dl:u:P:c:r:t:g:V")) != -1) {
+	while((opt = getopt(argc, argv, "dl:u:P:c:r:t:m:s:g:V")) != -1) {
 		if (opt == 'd')
 			debugflag = 1;
 		else if (opt == 'l')
@@ -714,6 +737,22 @@ int main(int argc, char *argv[])
 		}
 		else if (opt == 't')
 			sscanf(optarg, "%d", &radport);
+		else if (opt == 'm') {
+			if (sscanf(optarg, "%15[0-9.]:%d", mcaddr, &radmcport) != 2 ||
+			    !inet_aton(mcaddr, &radmcgroup) ||
+			    !IN_MULTICAST(ntohl(radmcgroup.s_addr))) {
+				dprintf(STDERR_FILENO, "Invalid multicast group specification.\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if (opt == 's') {
+			if (optarg[0] != '/' ||
+			    strlen(optarg) >= sizeof(radshmname)) {
+				dprintf(STDERR_FILENO, "Invalid shared memory name (must be /name).\n");
+				exit(EXIT_FAILURE);
+			}
+			strcpy(radshmname, optarg);
+		}
 		else if (opt == 'g') {
 			tmparg = strdup(optarg);
 			cptr = &tmparg;
@@ -771,6 +810,18 @@ int main(int argc, char *argv[])
 		help();
 		exit(0);
 	}
+	if (radmcport && radport) {
+		dprintf(STDERR_FILENO, "Flags -r and -m are mutually exclusive.\n");
+		exit(EXIT_FAILURE);
+	}
+	if ((radmcport || radport) && radshmname[0]) {
+		dprintf(STDERR_FILENO, "Flag -s excludes -r and -m.\n");
+		exit(EXIT_FAILURE);
+	}
+	if (radmcport)
+		radflag = 2;
+	else if (radshmname[0])
+		radflag = 3;
 	if (raddlen && !radflag)
 		raddlen = 0;
 	if (getuid()) {
@@ -801,20 +852,12 @@ int main(int argc, char *argv[])
 	radsin.sin_port = htons(radport);
 
 	/* initialize log */
-	if (debugflag)
-		logfd = STDOUT_FILENO;
-	else {
-		if (logfname[0]) {
-			logfd = open(logfname, O_CREAT | O_APPEND | O_SYNC | O_WRONLY, FILE_UMASK);
-			if (logfd == -1) {
-				dprintf(STDERR_FILENO, "Unable to open log file '%s': %s\n",
-					logfname, strerror(errno));
-				exit(EXIT_FAILURE);
-			}
-		} else
-			logfd = -1;
+	logfd = DaemonLog_open(progname, logfname, debugflag);
+	if (logfd == -2) {
+		dprintf(STDERR_FILENO, "Unable to open log file '%s': %s\n",
+			logfname, strerror(errno));
+		exit(EXIT_FAILURE);
 	}
-	sem_init(&logsem, 0, 1);
 
 	/* put banner in log */
 #ifdef BUILDSTAMP
@@ -833,7 +876,7 @@ int main(int argc, char *argv[])
 		if (!debugflag)
 			logprintf(logfd, LOG_ERROR, "unable to create PID file %s\n",
 				  pidfname);
-		close(logfd);
+		DaemonLog_close();
 		exit(EXIT_FAILURE);
 	}
 
@@ -844,7 +887,7 @@ int main(int argc, char *argv[])
 				strerror(errno));
 			logprintf(logfd, LOG_ERROR, "unable to fork to background: %s\n",
 				  strerror(errno));
-			close(logfd);
+			DaemonLog_close();
 			exit(EXIT_FAILURE);
 		} else {
 			procpid = getpid();
@@ -852,6 +895,10 @@ int main(int argc, char *argv[])
 				  procpid);
 		}
 
+	/* start log writer (threads do not survive fork) */
+	if (DaemonLog_start())
+		logprintf(logfd, LOG_WARN, "unable to start log writer thread\n");
+
 	/* populate pid file (new PID after daemonize()) */
 	pidfd = open(pidfname, O_CREAT | O_WRONLY, FILE_UMASK);
 	if (pidfd < 0) {
@@ -882,7 +929,9 @@ int main(int argc, char *argv[])
 
 	/* start network thread (optional) */
 	if (raddlen) {
-		if (pthread_create(&netclthread, NULL, radioDaemonThread, NULL)) {
+		if (pthread_create(&netclthread, NULL, radflag == 3 ? radioShmThread :
+				   radflag == 2 ? radioMcastThread : radioDaemonThread,
+				   NULL)) {
 			if (!debugflag)
 				logprintf(logfd, LOG_ERROR, "cannot start network listener thread\n");
 			else
@@ -940,7 +989,7 @@ int main(int argc, char *argv[])
 		} else
 			logprintf(logfd, LOG_NOTICE,
 				  "dropping super-user privileges, running as UID=%ld GID=%ld\n",
-				  uid, gid);
+				  (long)uid, (long)gid);
 	}
 
 	/* Main Event Thread */
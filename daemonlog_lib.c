@@ -0,0 +1,401 @@
+/*
+ * ***********************************************
+ *  This library contains asynchronous log used
+ *  by radio433daemon, sensorproxy, buttonhandler
+ * ***********************************************
+ */
+
+/*
+ * Each thread owns single-producer ring of fixed size records:
+ * logprintf() takes timestamp, formats message into next free
+ * record and advances ring head, no locks or memory allocation.
+ * Writer thread wakes up periodically (or when ring fills up or
+ * error is logged), merges records from all rings in timestamp
+ * order, adds cached date prefix and writes whole batch at once.
+ * Messages logged too often with the same format are suppressed
+ * and summarized by writer. Log file is reopened by writer thread,
+ * signal handler only sets request flag.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <semaphore.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <linux/limits.h>
+
+#include "daemonlog_lib.h"
+
+#define LOG_UMASK	(S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)
+#define LOG_BATCH	8192	/* writer buffer size */
+#define LOG_PREFIX	(64 + NAME_MAX)	/* maximum line prefix size */
+
+struct logrec {
+	struct timespec ts;
+	int level;
+	int len;
+	char msg[DAEMONLOG_MSGSIZE];
+};
+
+struct logring {
+	volatile unsigned int head;	/* written by owner thread */
+	volatile unsigned int tail;	/* written by writer thread */
+	volatile unsigned long dropped;	/* ring full */
+	struct logrec recs[DAEMONLOG_RING];
+};
+
+struct logclass {
+	const char *volatile fmt;
+	volatile time_t sec;
+	volatile int cnt;
+	volatile unsigned long suppressed;
+};
+
+static const char *levelname[] = { "debug", "info", "notice", "warn", "error" };
+
+static char logname[PATH_MAX + 1], logident[NAME_MAX + 1];
+static volatile int logfd = -1;
+static pid_t logpid;
+static volatile int running, stopflag, reopenflag;
+static pthread_t writerthread;
+static sem_t wakesem;
+
+static struct logring rings[DAEMONLOG_THREADS];
+static volatile unsigned int nrings;
+static volatile unsigned long ringless;	/* dropped, no ring left */
+static __thread struct logring *myring;
+static __thread int myringset;
+static __thread volatile int inlog;	/* signal handler interrupted logprintf() */
+
+static struct logclass classes[DAEMONLOG_CLASSES];
+
+static time_t cachesec;		/* writer: cached date prefix */
+static char cachedate[32];
+
+/* Write whole buffer */
+static void writeAll(const char *buf, int len)
+{
+	int n;
+
+	while (len > 0 && logfd >= 0) {
+		n = write(logfd, buf, len);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+		buf += n;
+		len -= n;
+	}
+}
+
+/* Format line prefix, date part changes once per second */
+static int formatPrefix(char *buf, const struct timespec *ts, int level)
+{
+	struct tm tl;
+
+	if (ts->tv_sec != cachesec) {
+		localtime_r(&ts->tv_sec, &tl);
+		strftime(cachedate, sizeof(cachedate), "%Y-%m-%d %H:%M:%S", &tl);
+		cachesec = ts->tv_sec;
+	}
+	return snprintf(buf, LOG_PREFIX, "%s.%03u %s[%d] %s: ", cachedate,
+			(unsigned int)(ts->tv_nsec / 1000000), logident, logpid,
+			levelname[level]);
+}
+
+/* Check message rate for format string, returns 1 if message is dropped */
+static int rateLimited(const char *fmt, time_t sec)
+{
+	struct logclass *c;
+	const char *f;
+
+	c = &classes[((uintptr_t)fmt >> 2) % DAEMONLOG_CLASSES];
+	f = __atomic_load_n(&c->fmt, __ATOMIC_ACQUIRE);
+	if (f == NULL) {
+		if (!__atomic_compare_exchange_n(&c->fmt, &f, fmt, 0,
+						 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) &&
+		    f != fmt)
+			return 0;
+	} else if (f != fmt)
+		return 0;	/* hash collision, not limited */
+	if (c->sec != sec) {
+		c->sec = sec;
+		c->cnt = 0;
+	}
+	if (__atomic_add_fetch(&c->cnt, 1, __ATOMIC_RELAXED) <= DAEMONLOG_RATE)
+		return 0;
+	__atomic_add_fetch(&c->suppressed, 1, __ATOMIC_RELAXED);
+	return 1;
+}
+
+/* Get ring of calling thread */
+static struct logring *threadRing(void)
+{
+	unsigned int i;
+
+	if (!myringset) {
+		myringset = 1;
+		i = __atomic_fetch_add(&nrings, 1, __ATOMIC_ACQ_REL);
+		myring = i < DAEMONLOG_THREADS ? &rings[i] : NULL;
+	}
+	return myring;
+}
+
+/* Log message */
+void logprintf(int fd, int level, const char *fmt, ...)
+{
+	struct timespec ts;
+	struct logring *r;
+	struct logrec *e;
+	unsigned int h;
+	char buf[LOG_PREFIX + DAEMONLOG_MSGSIZE];
+	va_list ap;
+	int n;
+
+	if (fd < 0 || logfd < 0)
+		return;
+	if (level < LOG_DEBUG || level > LOG_ERROR)
+		level = LOG_ERROR;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	if (level != LOG_ERROR && rateLimited(fmt, ts.tv_sec))
+		return;
+
+	/* single thread before writer starts or after it stops */
+	if (!running) {
+		n = formatPrefix(buf, &ts, level);
+		va_start(ap, fmt);
+		n += vsnprintf(buf + n, DAEMONLOG_MSGSIZE, fmt, ap);
+		va_end(ap);
+		writeAll(buf, n < (int)sizeof(buf) ? n : (int)sizeof(buf) - 1);
+		return;
+	}
+
+	r = threadRing();
+	if (r == NULL) {
+		__atomic_add_fetch(&ringless, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	if (inlog) {
+		__atomic_add_fetch(&r->dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	inlog = 1;
+	h = r->head;
+	if (h - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= DAEMONLOG_RING) {
+		__atomic_add_fetch(&r->dropped, 1, __ATOMIC_RELAXED);
+		sem_post(&wakesem);
+		inlog = 0;
+		return;
+	}
+	e = &r->recs[h % DAEMONLOG_RING];
+	e->ts = ts;
+	e->level = level;
+	va_start(ap, fmt);
+	n = vsnprintf(e->msg, DAEMONLOG_MSGSIZE, fmt, ap);
+	va_end(ap);
+	if (n >= DAEMONLOG_MSGSIZE) {
+		n = DAEMONLOG_MSGSIZE - 1;
+		e->msg[n - 1] = '\n';	/* truncated */
+	}
+	e->len = n < 0 ? 0 : n;
+	__atomic_store_n(&r->head, h + 1, __ATOMIC_RELEASE);
+	inlog = 0;
+	if (level >= LOG_WARN || h + 1 - r->tail >= (DAEMONLOG_RING >> 1))
+		sem_post(&wakesem);
+}
+
+/* Append own message to writer batch */
+static int writerMsg(char *buf, int len, const char *fmt, ...)
+{
+	struct timespec ts;
+	va_list ap;
+
+	if (len > LOG_BATCH - LOG_PREFIX - DAEMONLOG_MSGSIZE) {
+		writeAll(buf, len);
+		len = 0;
+	}
+	clock_gettime(CLOCK_REALTIME, &ts);
+	len += formatPrefix(buf + len, &ts, LOG_WARN);
+	va_start(ap, fmt);
+	len += vsnprintf(buf + len, DAEMONLOG_MSGSIZE, fmt, ap);
+	va_end(ap);
+	return len;
+}
+
+/* Write pending records of all threads in timestamp order */
+static void drainRings(void)
+{
+	static char buf[LOG_BATCH];
+	struct logring *r, *min;
+	struct logrec *e, *emin;
+	unsigned int i, n;
+	unsigned long d;
+	int len;
+
+	len = 0;
+	n = __atomic_load_n(&nrings, __ATOMIC_ACQUIRE);
+	if (n > DAEMONLOG_THREADS)
+		n = DAEMONLOG_THREADS;
+	for(;;) {
+		min = NULL;
+		emin = NULL;
+		for(i = 0; i < n; i++) {
+			r = &rings[i];
+			if (r->tail == __atomic_load_n(&r->head, __ATOMIC_ACQUIRE))
+				continue;
+			e = &r->recs[r->tail % DAEMONLOG_RING];
+			if (emin == NULL || e->ts.tv_sec < emin->ts.tv_sec ||
+			    (e->ts.tv_sec == emin->ts.tv_sec &&
+			     e->ts.tv_nsec < emin->ts.tv_nsec)) {
+				min = r;
+				emin = e;
+			}
+		}
+		if (min == NULL)
+			break;
+		if (len > LOG_BATCH - LOG_PREFIX - DAEMONLOG_MSGSIZE) {
+			writeAll(buf, len);
+			len = 0;
+		}
+		len += formatPrefix(buf + len, &emin->ts, emin->level);
+		memcpy(buf + len, emin->msg, emin->len);
+		len += emin->len;
+		__atomic_store_n(&min->tail, min->tail + 1, __ATOMIC_RELEASE);
+	}
+
+	/* report losses */
+	for(i = 0; i < n; i++)
+		if (rings[i].dropped) {
+			d = __atomic_exchange_n(&rings[i].dropped, 0, __ATOMIC_RELAXED);
+			len = writerMsg(buf, len, "%lu log message(s) dropped, thread buffer full or busy\n", d);
+		}
+	if (ringless) {
+		d = __atomic_exchange_n(&ringless, 0, __ATOMIC_RELAXED);
+		len = writerMsg(buf, len, "%lu log message(s) dropped, too many threads\n", d);
+	}
+	for(i = 0; i < DAEMONLOG_CLASSES; i++)
+		if (classes[i].suppressed) {
+			d = __atomic_exchange_n(&classes[i].suppressed, 0, __ATOMIC_RELAXED);
+			len = writerMsg(buf, len, "%lu message(s) suppressed (rate limit): %.48s%s",
+					d, classes[i].fmt, strchr(classes[i].fmt, '\n') ? "" : "\n");
+		}
+	if (len)
+		writeAll(buf, len);
+}
+
+/* Truncate and reopen log file */
+static void reopenLog(void)
+{
+	int fd;
+
+	if (!logname[0])
+		return;
+	fd = open(logname, O_CREAT | O_TRUNC | O_APPEND | O_WRONLY | O_CLOEXEC,
+		  LOG_UMASK);
+	if (fd == -1)
+		return;		/* keep writing to old file */
+	fdatasync(logfd);
+	dup2(fd, logfd);	/* descriptor number stays valid for callers */
+	close(fd);
+	logprintf(logfd, LOG_NOTICE, "log file truncated and reopened\n");
+}
+
+/* Writer thread */
+static void *writerThread(void *arg)
+{
+	struct timespec ts;
+	sigset_t blkset;
+
+	sigfillset(&blkset);
+	pthread_sigmask(SIG_BLOCK, &blkset, NULL);
+
+	for(;;) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += DAEMONLOG_FLUSH_MS * 1000000L;
+		if (ts.tv_nsec >= 1000000000L) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000L;
+		}
+		sem_timedwait(&wakesem, &ts);
+		while (!sem_trywait(&wakesem))
+			;	/* coalesce wakeups */
+		if (reopenflag) {
+			drainRings();
+			reopenflag = 0;
+			reopenLog();
+		}
+		drainRings();
+		if (stopflag)
+			break;
+	}
+	return NULL;
+}
+
+/* Open log */
+int DaemonLog_open(const char *ident, const char *fname, int debug)
+{
+	strncpy(logident, ident, NAME_MAX);
+	logpid = getpid();
+	logname[0] = 0;
+	if (debug)
+		logfd = STDOUT_FILENO;
+	else if (fname != NULL && fname[0]) {
+		logfd = open(fname, O_CREAT | O_APPEND | O_WRONLY | O_CLOEXEC,
+			     LOG_UMASK);
+		if (logfd == -1)
+			return -2;
+		strncpy(logname, fname, PATH_MAX);
+	} else
+		logfd = -1;
+	return logfd;
+}
+
+/* Start writer thread */
+int DaemonLog_start(void)
+{
+	if (running || logfd < 0)
+		return 0;
+	logpid = getpid();
+	sem_init(&wakesem, 0, 0);
+	stopflag = 0;
+	if (pthread_create(&writerthread, NULL, writerThread, NULL))
+		return -1;
+	running = 1;
+	return 0;
+}
+
+/* Request log reopen */
+void DaemonLog_reopen(void)
+{
+	if (!running || !logname[0])
+		return;
+	reopenflag = 1;
+	sem_post(&wakesem);	/* async-signal-safe */
+}
+
+/* Flush and close log */
+void DaemonLog_close(void)
+{
+	if (running && !pthread_equal(pthread_self(), writerthread)) {
+		stopflag = 1;
+		sem_post(&wakesem);
+		pthread_join(writerthread, NULL);
+		running = 0;
+	}
+	if (logfd >= 0 && logfd != STDOUT_FILENO) {
+		fdatasync(logfd);
+		close(logfd);
+	}
+	logfd = -1;
+}
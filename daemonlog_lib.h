@@ -0,0 +1,41 @@
+#ifndef _DAEMONLOG_LIB_H_
+#define _DAEMONLOG_LIB_H_
+
+/* Asynchronous log shared by daemons: callers only format message into
+   their own thread ring, background writer adds timestamps and writes
+   batches to log file */
+
+/* Log levels */
+#define LOG_DEBUG		0
+#define LOG_INFO		1
+#define LOG_NOTICE		2
+#define LOG_WARN		3
+#define LOG_ERROR		4
+
+#define DAEMONLOG_THREADS	8	/* threads with own record ring */
+#define DAEMONLOG_RING		64	/* records per thread (power of 2) */
+#define DAEMONLOG_MSGSIZE	224	/* maximum message length */
+#define DAEMONLOG_FLUSH_MS	200	/* writer flush interval */
+#define DAEMONLOG_RATE		20	/* messages per second per format */
+#define DAEMONLOG_CLASSES	64	/* rate limited formats (hash size) */
+
+/* Open log: stdout in debug mode, file if name is not empty, none otherwise */
+/* Returns log descriptor (-1 if logging is disabled) or -2 on error */
+int DaemonLog_open(const char *ident, const char *fname, int debug);
+
+/* Start writer thread, call after fork() (messages are written */
+/* synchronously until then), returns 0 on success */
+int DaemonLog_start(void);
+
+/* Request truncating and reopening log file (safe in signal handler) */
+void DaemonLog_reopen(void);
+
+/* Write all pending messages, stop writer and close log */
+void DaemonLog_close(void);
+
+/* Log message with given level (fd is descriptor from DaemonLog_open(), */
+/* negative value drops message); errors are never rate limited */
+void logprintf(int fd, int level, const char *fmt, ...)
+	__attribute__((format(printf, 3, 4)));
+
+#endif
@@ -54,15 +54,20 @@ void HTU21D_softReset(int fd)
         delay(HTU21D_SOFT_RST_MAX_TIME_MS);
 }
 
-/* Get temperature */
-double HTU21D_getTemperature(int fd)
+/* Start temperature measurement */
+int HTU21D_startTemperature(int fd)
+{
+	wiringPiI2CWrite(fd, HTU21D_REG_TEMP_NH);
+	return HTU21D_TEMP_MAX_TIME_MS;
+}
+
+/* Read measured temperature */
+double HTU21D_readTemperature(int fd)
 {
 	unsigned int temp;
 	double tSensorTemp;
         unsigned char buf[4];
 
-	wiringPiI2CWrite(fd, HTU21D_REG_TEMP_NH);
-	delay(HTU21D_TEMP_MAX_TIME_MS);
 	read(fd, buf, 3);
 	temp = (buf [0] << 8 | buf [1]) & 0xFFFC;
         /* Convert sensor reading into temperature.
@@ -71,15 +76,20 @@ double HTU21D_getTemperature(int fd)
 	return -46.85 + (175.72 * tSensorTemp);
 }
 
-/* Get humidity */
-double HTU21D_getHumidity(int fd)
+/* Start humidity measurement */
+int HTU21D_startHumidity(int fd)
+{
+        wiringPiI2CWrite(fd, HTU21D_REG_HUMID_NH);
+        return HTU21D_HUMID_MAX_TIME_MS;
+}
+
+/* Read measured humidity */
+double HTU21D_readHumidity(int fd)
 {
 	unsigned int humid;
 	double tSensorHumid;
         unsigned char buf[4];
 
-        wiringPiI2CWrite(fd, HTU21D_REG_HUMID_NH);
-        delay(HTU21D_HUMID_MAX_TIME_MS);
         read(fd, buf, 3);
         humid = (buf [0] << 8 | buf [1]) & 0xFFFC;
         /* Convert sensor reading into humidity.
@@ -88,3 +98,16 @@ double HTU21D_getHumidity(int fd)
         return -6.0 + (125.0 * tSensorHumid);
 }
 
+/* Get temperature */
+double HTU21D_getTemperature(int fd)
+{
+	delay(HTU21D_startTemperature(fd));
+	return HTU21D_readTemperature(fd);
+}
+
+/* Get humidity */
+double HTU21D_getHumidity(int fd)
+{
+	delay(HTU21D_startHumidity(fd));
+	return HTU21D_readHumidity(fd);
+}
@@ -16,6 +16,14 @@ void HTU21D_softReset(int fd);
 /* Unit: Celsius */
 double HTU21D_getTemperature(int fd);
 
+/* Split measurement: start conversion (returns its maximum time in ms), */
+/* read result when it is done; temperature and humidity share converter, */
+/* so only one of them may be measured at a time */
+int HTU21D_startTemperature(int fd);
+double HTU21D_readTemperature(int fd);
+int HTU21D_startHumidity(int fd);
+double HTU21D_readHumidity(int fd);
+
 /* Get relative humidity */
 /* Unit: Percent (0-100%) */
 double HTU21D_getHumidity(int fd);
@@ -8,6 +8,8 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <sched.h>
 
 #include <wiringPi.h>
@@ -34,12 +36,13 @@ struct cmd {
 /* Show help */
 void help(char *progname)
 {
-	printf("\nUsage:\n\t%s [-V] [-g gpio] [-c count] {oper0} [oper1] ...\n\n", progname);
+	printf("\nUsage:\n\t%s [-V] [-g gpio | -d socket] [-c count] {oper0} [oper1] ...\n\n", progname);
 	puts("Where:");
-	puts("\t-V       - show version and exit");
-	printf("\t-g gpio  - BCM GPIO pin with external RF transmitter connected (optional, default is %d)\n", DEF_GPIO_TX);
-	printf("\t-c count - number of codes sent in one transmission (optional, default is %d)\n", CODE_RETRANS);
-	puts("\toper     - operation defined as system:device:{on|off} (at least one)\n");
+	puts("\t-V        - show version and exit");
+	printf("\t-g gpio   - BCM GPIO pin with external RF transmitter connected (optional, default is %d)\n", DEF_GPIO_TX);
+	puts("\t-d socket - send via radio433daemon transmit control socket instead of GPIO (optional)");
+	printf("\t-c count  - number of codes sent in one transmission (optional, default is %d)\n", CODE_RETRANS);
+	puts("\toper      - operation defined as system:device:{on|off} (at least one)\n");
 }
 
 /* show version */
@@ -111,6 +114,70 @@ unsigned int getDevMask(char *s)
 	return a;
 }
 
+/* send codes through radio433daemon transmitter, returns 0 if all were sent */
+int sendViaDaemon(const char *path, struct cmd *codes, int ncode, int cnt)
+{
+	int i, fd, n, len, pending, failed;
+	struct sockaddr_un sun;
+	char buf[256], *eol;
+
+	if (strlen(path) >= sizeof(sun.sun_path)) {
+		fprintf(stderr, "Socket path too long.\n");
+		return -1;
+	}
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	strcpy(sun.sun_path, path);
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1 || connect(fd, (struct sockaddr *)&sun, sizeof(sun)) == -1) {
+		fprintf(stderr, "Unable to connect to %s: %s\n", path, strerror(errno));
+		if (fd != -1)
+			close(fd);
+		return -1;
+	}
+
+	/* queue all requests at once, daemon sends them in order */
+	for(i = 0; i < ncode; i++)
+		if (dprintf(fd, "TX TYPE %d 0x%llX %d\n", RADIO433_DEVICE_KEMOTURZ1226,
+			    Radio433_pwrGetCode(codes[i].sys, codes[i].dev, codes[i].oper),
+			    cnt) < 0) {
+			fprintf(stderr, "Unable to send request: %s\n", strerror(errno));
+			close(fd);
+			return -1;
+		}
+
+	/* one reply line per request */
+	pending = ncode;
+	failed = 0;
+	len = 0;
+	while (pending) {
+		n = read(fd, buf + len, sizeof(buf) - 1 - len);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		len += n;
+		buf[len] = 0;
+		while (pending && (eol = strchr(buf, '\n')) != NULL) {
+			*eol = 0;
+			if (strncmp(buf, "OK", 2)) {
+				fprintf(stderr, "Transmission rejected by daemon: %s\n", buf);
+				failed++;
+			}
+			pending--;
+			len -= eol + 1 - buf;
+			memmove(buf, eol + 1, len + 1);
+		}
+		if (len == sizeof(buf) - 1)
+			len = 0;
+	}
+	close(fd);
+	if (pending)
+		fprintf(stderr, "Connection to daemon lost, %d command%s not confirmed.\n",
+			pending, pending > 1 ? "s" : "");
+	return pending || failed ? -1 : 0;
+}
+
 /* ********** */
 /* *  MAIN  * */
 /* ********** */
@@ -121,6 +188,7 @@ int main(int argc, char *argv[])
 	struct cmd *codes;
 	char parmbuf[16];
 	char *pdev, *pbtn;
+	char *sockpath;
 	int opt;
 
 	/* show help */
@@ -132,9 +200,12 @@ int main(int argc, char *argv[])
 	/* get parameters */
 	gpio = DEF_GPIO_TX;
 	cnt = CODE_RETRANS;
-	while((opt = getopt(argc, argv, "g:c:V")) != -1) {
+	sockpath = NULL;
+	while((opt = getopt(argc, argv, "g:d:c:V")) != -1) {
 		if (opt == 'g')
 			sscanf(optarg, "%d", &gpio);
+		else if (opt == 'd')
+			sockpath = optarg;
 		else if (opt == 'c')
 			sscanf(optarg, "%d", &cnt);
 		else if (opt == 'V') {
@@ -185,6 +256,15 @@ int main(int argc, char *argv[])
                 exit(EXIT_FAILURE);
 	}
 
+	/* daemon owns transmitter, let it do the timing */
+	if (sockpath != NULL) {
+		printf("Sending %d command%s (code retransmissions: %d) via %s.\n",
+		       ncode, ncode > 1 ? "s" : "", cnt, sockpath);
+		i = sendViaDaemon(sockpath, codes, ncode, cnt);
+		free(codes);
+		exit(i ? EXIT_FAILURE : EXIT_SUCCESS);
+	}
+
         /* change scheduling priority */
         if (changeSched()) {
                 fprintf(stderr, "Unable to change process scheduling priority: %s\n",
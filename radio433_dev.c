@@ -222,3 +222,41 @@ unsigned long long Radio433_thmGetCode(int sysid, int thmid, int ch,
 
 	return code;
 }
+
+/*
+ * ********
+ * Messages
+ * ********
+ */
+
+/* Decode message of known device */
+int Radio433_decodeMsg(struct radio433_msg *m)
+{
+	struct radio433_dec *d;
+	int valid;
+
+	if (m->flags & RADIO433_MSG_FLAG_DECODED)
+		return 1;
+	if (m->flags & RADIO433_MSG_FLAG_BADCODE)
+		return 0;
+
+	d = &m->dec;
+	memset(d, 0, sizeof(*d));
+	if (m->type == RADIO433_DEVICE_KEMOTURZ1226)
+		valid = Radio433_pwrGetCommand(m->code, &d->sysid, &d->devid,
+					       &d->button);
+	else if (m->type == RADIO433_DEVICE_HYUWSSENZOR77TH)
+		valid = Radio433_thmGetData(m->code, &d->sysid, &d->devid,
+					    &d->ch, &d->batlow, &d->trend,
+					    &d->temp, &d->humid);
+	else
+		return 0;	/* unknown device, nothing to validate */
+
+	if (valid)
+		m->flags |= RADIO433_MSG_FLAG_DECODED;
+	else {
+		m->flags |= RADIO433_MSG_FLAG_BADCODE;
+		memset(d, 0, sizeof(*d));
+	}
+	return valid;
+}
@@ -2,6 +2,7 @@
 #define _RADIO433_DEV_H_
 
 #include "radio433_types.h"
+#include "radio433_msg.h"
 
 /* Decode power command from raw code */
 int Radio433_pwrGetCommand(unsigned long long code,
@@ -23,4 +24,9 @@ unsigned long long Radio433_thmGetCode(int sysid, int thmid, int ch,
 				       int batlow, int tdir, double temp,
 				       int humid);
 
+/* Decode message of known device into its decoded fields and set flags */
+/* (messages already decoded by server are not decoded again) */
+/* Return 1 if decoded fields are valid */
+int Radio433_decodeMsg(struct radio433_msg *m);
+
 #endif
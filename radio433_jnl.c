@@ -0,0 +1,222 @@
+/*
+ * **********************************************
+ *  This library contains journal of radio codes
+ *  published by radio433daemon (segment files
+ *  with time index) and its sequential reader
+ * **********************************************
+ */
+
+/*
+ * Writer appends fixed size binary records to current
+ * segment, every RADIO433_JNL_INDEX_STEP records it notes
+ * timestamp and record number in index file. Full segment
+ * is closed, next one starts with following record and
+ * oldest segments above limit are removed. Reader finds
+ * segment by its name, record by index and skips the
+ * few records before requested time.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "radio433_jnl.h"
+
+static const struct segfile_fmt jnlfmt = {
+	RADIO433_JNL_PREFIX, RADIO433_JNL_SEGMENT, RADIO433_JNL_MAGIC,
+	RADIO433_JNL_VERSION, RADIO433_MSG_BINSIZE
+};
+
+/* Create segment starting with record timestamp */
+static int newSegment(struct radio433_jnl *j, unsigned long long ts)
+{
+	if (SegFile_create(&jnlfmt, j->dir, ts, j->maxsegs, &j->fd, &j->idxfd))
+		return -1;
+	j->segrecs = 0;
+	return 0;
+}
+
+/* Prepare writer */
+int Radio433_openJournal(struct radio433_jnl *j, const char *dir,
+			 unsigned long long maxrecs, int maxsegs)
+{
+	if (SegFile_checkDir(&jnlfmt, dir, sizeof(j->dir)))
+		return -1;
+	if (eaccess(dir, W_OK | X_OK) == -1)	/* as privileged user */
+		return -1;
+	strcpy(j->dir, dir);
+	j->fd = -1;
+	j->idxfd = -1;
+	j->segrecs = 0;
+	j->maxrecs = maxrecs;
+	j->maxsegs = maxsegs;
+	j->records = 0;
+	j->segs = NULL;
+	j->nsegs = 0;
+	return 0;
+}
+
+/* Append binary records */
+int Radio433_writeJournal(struct radio433_jnl *j, const unsigned char *recs,
+			  int count)
+{
+	unsigned long long n, ts;
+
+	while (count > 0) {
+		ts = SegFile_getLE(recs + 8, 8);
+		if (j->fd < 0 && newSegment(j, ts))
+			return -1;
+		/* up to next index point or end of segment */
+		n = RADIO433_JNL_INDEX_STEP - j->segrecs % RADIO433_JNL_INDEX_STEP;
+		if (n > j->maxrecs - j->segrecs)
+			n = j->maxrecs - j->segrecs;
+		if (n > count)
+			n = count;
+		if (!(j->segrecs % RADIO433_JNL_INDEX_STEP))
+			SegFile_indexAdd(j->idxfd, ts, j->segrecs);
+		if (SegFile_writeAll(j->fd, recs, n * RADIO433_MSG_BINSIZE)) {
+			/* record may be partial, never append after it */
+			Radio433_closeJournal(j);
+			return -1;
+		}
+		j->segrecs += n;
+		j->records += n;
+		recs += n * RADIO433_MSG_BINSIZE;
+		count -= n;
+		if (j->segrecs >= j->maxrecs)
+			Radio433_closeJournal(j);
+	}
+	return 0;
+}
+
+/* Close current segment */
+void Radio433_closeJournal(struct radio433_jnl *j)
+{
+	if (j->fd >= 0)
+		close(j->fd);
+	if (j->idxfd >= 0)
+		close(j->idxfd);
+	j->fd = -1;
+	j->idxfd = -1;
+}
+
+/* List segments */
+int Radio433_openJournalReader(struct radio433_jnl *j, const char *dir)
+{
+	int n;
+
+	if (SegFile_checkDir(&jnlfmt, dir, sizeof(j->dir)))
+		return -1;
+	n = SegFile_list(&jnlfmt, dir, &j->segs);
+	if (n < 0)
+		return -1;
+	strcpy(j->dir, dir);
+	j->nsegs = n;
+	j->cur = -1;
+	j->fd = -1;
+	j->idxfd = -1;
+	j->seekts = 0;
+	j->bufpos = 0;
+	j->buflen = 0;
+	return n;
+}
+
+/* Open segment for reading and verify its header */
+static int openSegment(struct radio433_jnl *j, int i)
+{
+	char path[PATH_MAX];
+	unsigned char hdr[SEGFILE_HDRSIZE];
+
+	Radio433_closeJournal(j);
+	j->cur = i;
+	j->bufpos = 0;
+	j->buflen = 0;
+	if (j->segs[i] == NULL)
+		return -1;
+	SegFile_path(path, &jnlfmt, j->dir, j->segs[i], RADIO433_JNL_SEGMENT);
+	j->fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (j->fd < 0)
+		return -1;
+	if (read(j->fd, hdr, sizeof(hdr)) != sizeof(hdr) ||
+	    SegFile_checkHeader(&jnlfmt, hdr)) {
+		Radio433_closeJournal(j);
+		errno = EPROTO;
+		return -1;
+	}
+	return 0;
+}
+
+/* Position reader at first record not older than ts */
+int Radio433_seekJournal(struct radio433_jnl *j, unsigned long long ts)
+{
+	unsigned long long rec;
+	int i;
+
+	/* last segment started before ts */
+	for(i = j->nsegs - 1; i > 0; i--)
+		if (j->segs[i] != NULL && SegFile_time(&jnlfmt, j->segs[i]) <= ts)
+			break;
+	if (!j->nsegs || openSegment(j, i))
+		return -1;
+	j->seekts = ts;
+
+	/* last index point before ts */
+	rec = SegFile_indexFind(&jnlfmt, j->dir, j->segs[i], ts);
+	if (lseek(j->fd, RADIO433_JNL_HDRSIZE + rec * RADIO433_MSG_BINSIZE,
+		  SEEK_SET) == -1)
+		return -1;
+	return 0;
+}
+
+/* Read next record */
+int Radio433_readJournal(struct radio433_jnl *j, struct radio433_msg *m)
+{
+	ssize_t n;
+	unsigned char *p;
+
+	for(;;) {
+		if (j->bufpos < j->buflen) {
+			p = j->buf + j->bufpos++ * RADIO433_MSG_BINSIZE;
+			if (Radio433_unpackMsg(p, m))
+				continue;	/* damaged record */
+			if (m->ts < j->seekts)
+				continue;
+			j->seekts = 0;
+			return 1;
+		}
+		if (j->fd < 0) {
+			if (j->cur + 1 >= j->nsegs)
+				return 0;
+			if (openSegment(j, j->cur + 1))
+				continue;	/* skip unreadable segment */
+		}
+		n = read(j->fd, j->buf, sizeof(j->buf));
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n == -1)
+			return -1;
+		if (n % RADIO433_MSG_BINSIZE)	/* record being written */
+			lseek(j->fd, -(n % RADIO433_MSG_BINSIZE), SEEK_CUR);
+		j->bufpos = 0;
+		j->buflen = n / RADIO433_MSG_BINSIZE;
+		if (!j->buflen)
+			Radio433_closeJournal(j);	/* end of segment */
+	}
+}
+
+/* Close segment and free segment list */
+void Radio433_closeJournalReader(struct radio433_jnl *j)
+{
+	Radio433_closeJournal(j);
+	if (j->segs != NULL)
+		SegFile_freeList(j->segs, j->nsegs);
+	j->segs = NULL;
+	j->nsegs = 0;
+}
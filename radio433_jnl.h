@@ -0,0 +1,69 @@
+#ifndef _RADIO433_JNL_H_
+#define _RADIO433_JNL_H_
+
+#include <limits.h>
+
+#include "radio433_msg.h"
+#include "segfile_lib.h"
+
+/* Append-only journal of codes published by radio433daemon */
+
+/* Journal directory holds segments (see segfile_lib.h) named
+     r433-TTTTTTTTTTTTTTTT.jnl   timestamp of first record in us
+     r433-TTTTTTTTTTTTTTTT.idx   index entry every RADIO433_JNL_INDEX_STEP
+                                 records, timestamp is that of the record
+   Segment header has magic "RJNL". Records are binary messages (see
+   radio433_msg.h), partial record at the end of segment (writer crashed)
+   is ignored. */
+
+#define RADIO433_JNL_MAGIC	0x4C4E4A52	/* "RJNL" */
+#define RADIO433_JNL_VERSION	1
+#define RADIO433_JNL_HDRSIZE	SEGFILE_HDRSIZE
+#define RADIO433_JNL_INDEX_STEP	256	/* records per index entry */
+#define RADIO433_JNL_PREFIX	"r433-"
+#define RADIO433_JNL_SEGMENT	".jnl"
+#define RADIO433_JNL_BUFRECS	256	/* reader buffer (records) */
+
+struct radio433_jnl {
+	char dir[PATH_MAX];
+	int fd, idxfd;			/* current segment, -1 if none */
+	unsigned long long segrecs;	/* records in current segment */
+	unsigned long long maxrecs;	/* writer: segment size limit */
+	int maxsegs;			/* writer: segments kept (0 - all) */
+	unsigned long long records;	/* writer: records written */
+	char **segs;			/* reader: segment names, sorted */
+	int nsegs, cur;			/* reader: current segment */
+	unsigned long long seekts;	/* reader: skip records older than it */
+	int bufpos, buflen;		/* reader: buffered records */
+	unsigned char buf[RADIO433_JNL_BUFRECS * RADIO433_MSG_BINSIZE];
+};
+
+/* Prepare writer for journal directory (writer), segment is created */
+/* with first record, returns 0 on success */
+int Radio433_openJournal(struct radio433_jnl *j, const char *dir,
+			 unsigned long long maxrecs, int maxsegs);
+
+/* Append binary records (RADIO433_MSG_BINSIZE each), segment is rotated */
+/* when full (writer), returns 0 on success */
+int Radio433_writeJournal(struct radio433_jnl *j, const unsigned char *recs,
+			  int count);
+
+/* Close current segment, next record starts new one (writer) */
+void Radio433_closeJournal(struct radio433_jnl *j);
+
+/* List segments in journal directory (reader), returns number of segments */
+/* or -1 on error */
+int Radio433_openJournalReader(struct radio433_jnl *j, const char *dir);
+
+/* Position reader at first record not older than ts (in us) (reader) */
+/* returns 0 on success */
+int Radio433_seekJournal(struct radio433_jnl *j, unsigned long long ts);
+
+/* Read next record (reader) */
+/* (returns 1 if message is available, 0 at end of journal, -1 on error) */
+int Radio433_readJournal(struct radio433_jnl *j, struct radio433_msg *m);
+
+/* Close segment and free segment list (reader) */
+void Radio433_closeJournalReader(struct radio433_jnl *j);
+
+#endif
@@ -24,6 +24,7 @@
  *
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -33,6 +34,7 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/time.h>
+#include <sched.h>
 #include <semaphore.h>
 #include <pthread.h>
 
@@ -47,6 +49,9 @@
 /* ring buffer size for timings */
 #define RADIO433_RING_BUFFER_ENTRIES	32
 
+/* stack touched by real-time threads, so it is resident (and locked) */
+#define RADIO433_STACK_PREFAULT		(32 * 1024)
+
 /* noise detection - smaller spikes will not affect pulse recording */
 #define RADIO433_MAX_NOISE_TIME		105	/* noise time in us */
 
@@ -151,12 +156,23 @@ static volatile int synctmin, synctmax;	/* time range: sync pulses */
 static volatile int npulsemin, npulsemax;  /* qty range: non-sync pulses */
 static volatile int pulsetmin, pulsetmax;  /* time range: non-sync pulses */
 static volatile int codetmin, codetmax; /* time range: codes */
+static unsigned int rxdevices = ~0U;	/* received devices (tDevInfo bits) */
 static volatile unsigned long tsprev, tclen;
 static volatile int incode, pulscount;
 static int txgpio, rxgpio;
 static struct timeval tstart;
 static sem_t timingready, codeready;
 static pthread_t codeanalyzer;
+/* statistics, each counter has single writer: ISR, analyzer or reader */
+static volatile unsigned long stedges, stnoise, stframes, stanalyzed;
+static volatile unsigned long strejected, stcodes, stconsumed;
+static volatile unsigned long stdecodes[RADIO433_DEVICES];
+static volatile unsigned long stfailbit[RADIO433_STATS_BITS];
+static volatile int sttimingmax, stcodemax;
+static volatile unsigned long sttimingover, stcodeover;
+/* real-time profile, state: 1 applied, 0 pending, -errno failed */
+static int rtisrprio, rtanaprio, rtcpu = -1;
+static volatile int rtisrpending, rtisrstate, rtanastate;
 
 /*
  *  ******************
@@ -164,6 +180,34 @@ static pthread_t codeanalyzer;
  *  ******************
  */
 
+/* Switch calling thread to SCHED_FIFO and pin it to CPU */
+/* (returns 1 on success or -errno) */
+static int Radio433_setThreadRealtime(int prio, int cpu)
+{
+	struct sched_param sp;
+	cpu_set_t cs;
+	volatile char stack[RADIO433_STACK_PREFAULT];
+	int i, r;
+
+	/* fault in stack pages now, not in the middle of a frame */
+	for(i = 0; i < RADIO433_STACK_PREFAULT; i += 256)
+		stack[i] = stack[i];
+	if (cpu >= 0) {
+		CPU_ZERO(&cs);
+		CPU_SET(cpu, &cs);
+		r = pthread_setaffinity_np(pthread_self(), sizeof(cs), &cs);
+		if (r)
+			return -r;
+	}
+	if (prio > 0) {
+		sp.sched_priority = prio;
+		r = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+		if (r)
+			return -r;
+	}
+	return 1;
+}
+
 /* Set global variables used mainly by ISR to speed-up */
 /* signal analysis (although they are used elsewhere also)*/
 static void Radio433_setTimingVars(void)
@@ -180,8 +224,10 @@ static void Radio433_setTimingVars(void)
 	pulsetmax = 0;
 	codetmin = 99999;
 	codetmax = 0;
-	/* find min and max values for all codes (ISR speedup) */
+	/* find min and max values for received codes (ISR speedup) */
 	for(i = 0; i < RADIO433_DEVICES; i++) {
+		if (!(rxdevices & 1U << i))
+			continue;
 		td = &tDevInfo[i];
 		if (td->coding == RADIO433_CODING_HIGHLOW) {
 			np = td->bits << 1;	/* 2 * bits (no sync) */
@@ -236,16 +282,46 @@ static void Radio433_setTimingVars(void)
 static void handleGpioInt(void);
 static void *codeAnalyzerThread(void *);
 
+/* Set real-time profile for receiver threads */
+void Radio433_setRealtime(int isrprio, int anaprio, int cpu)
+{
+	rtisrprio = isrprio;
+	rtanaprio = anaprio;
+	rtcpu = cpu;
+}
+
+/* Select devices recognized by receiver */
+int Radio433_setDevices(const int *types, int count)
+{
+	int i, j;
+	unsigned int mask;
+
+	if (!count) {
+		rxdevices = ~0U;
+		return RADIO433_DEVICES;
+	}
+	mask = 0;
+	for(i = 0; i < RADIO433_DEVICES; i++)
+		for(j = 0; j < count; j++)
+			if (types[j] == tDevInfo[i].type ||
+			    (!(types[j] & 0xFF) && (types[j] & tDevInfo[i].type))) {
+				mask |= 1U << i;
+				break;
+			}
+	if (mask)
+		rxdevices = mask;
+	return __builtin_popcount(mask);
+}
+
 /* Initialize library */
 int Radio433_init(int tx_gpio, int rx_gpio)
 {
 	int i;
 
-	/* transmission GPIO pin */
-	if (tx_gpio >=0 ) {
-		txgpio = tx_gpio;
+	/* transmission GPIO pin (-1 disables sending) */
+	txgpio = tx_gpio;
+	if (txgpio >= 0)
 		pinMode(txgpio, OUTPUT);
-	}
 	/* receiving GPIO pin */
 	if (rx_gpio >= 0) {
 		rxgpio = rx_gpio;
@@ -256,6 +332,9 @@ int Radio433_init(int tx_gpio, int rx_gpio)
 		tclen = 0;
 		incode = 0;
 		Radio433_setTimingVars();
+		rtisrstate = 0;
+		rtanastate = 0;
+		rtisrpending = rtisrprio > 0 || rtcpu >= 0;
 		/* initialize buffers */
 		tri = 0;
 		twi = 0;
@@ -265,13 +344,14 @@ int Radio433_init(int tx_gpio, int rx_gpio)
 		memset(cbuf, 0, sizeof(cbuf));
 		for(i = 0; i < RADIO433_RING_BUFFER_ENTRIES; i++)
 			tbuf[i].timbuf = (unsigned long*)malloc(npulsemax * sizeof(unsigned long));
-		/* initialize system structures */
+		/* initialize system structures (semaphores before threads */
+		/* wait on them, re-init would lose waiter and its wakeups) */
+		sem_init(&timingready, 0, 0);
+		sem_init(&codeready, 0, 0);
 		if (pthread_create(&codeanalyzer, NULL, codeAnalyzerThread, NULL))
 			return -1;
 		pinMode(rxgpio, INPUT);
 		wiringPiISR(rxgpio, INT_EDGE_BOTH, handleGpioInt);
-		sem_init(&timingready, 0, 0);
-		sem_init(&codeready, 0, 0);
 	}
 	return 0;
 }
@@ -291,6 +371,7 @@ unsigned long long Radio433_getCode(struct timeval *ts,
 	if (bits)
 		*bits = tDevInfo[cb->devidx].bits;
 	cri = (cri + 1) % RADIO433_RING_BUFFER_ENTRIES;
+	stconsumed++;
 	return cb->code;
 }
 
@@ -316,6 +397,7 @@ unsigned long long Radio433_getCodeExt(struct timeval *ts,
 	if (interval)
 		*interval = tDevInfo[cb->devidx].interval;
 	cri = (cri + 1) % RADIO433_RING_BUFFER_ENTRIES;
+	stconsumed++;
 	return cb->code;
 }
 
@@ -352,13 +434,15 @@ int Radio433_sendRawCode(unsigned long long code, int coding, int bits, int repe
 	if (txgpio < 0)
 		return -1;
 
-	if (bits < 0 || bits > (sizeof(unsigned long long) << 3) || repeats <= 0)
+	if (bits <= 0 || bits > (sizeof(unsigned long long) << 3) || repeats <= 0)
 		return -2;
 
 	/* construct timing table */
 	txlen = 2 + (bits << 1);	/* sync + 2 * bits */
-	txbuf = (unsigned long*)malloc(txlen);
-	codemask = 1 << ( bits - 1);
+	txbuf = (unsigned long*)malloc(txlen * sizeof(unsigned long));
+	if (txbuf == NULL)
+		return -4;
+	codemask = 1ULL << (bits - 1);
 	if (coding == RADIO433_CODING_HIGHLOW) {
 		/* sync */
 		txbuf[0] = kemotPulse.pulse_short;
@@ -434,6 +518,31 @@ int Radio433_sendDeviceCode(unsigned long long code, int type, int repeats)
 				    repeats ? repeats : tDevInfo[i].repeats);
 }
 
+/* Get receiver statistics */
+void Radio433_getStats(struct radio433_stats *st)
+{
+	int i;
+
+	st->edges = stedges;
+	st->noise = stnoise;
+	st->frames = stframes;
+	st->rejected = strejected;
+	for(i = 0; i < RADIO433_DEVICES; i++) {
+		st->types[i] = tDevInfo[i].type;
+		st->decodes[i] = stdecodes[i];
+	}
+	for(i = 0; i < RADIO433_STATS_BITS; i++)
+		st->failbit[i] = stfailbit[i];
+	st->timingdepth = stframes - stanalyzed;
+	st->timingmax = sttimingmax;
+	st->timingoverruns = sttimingover;
+	st->codedepth = stcodes - stconsumed;
+	st->codemax = stcodemax;
+	st->codeoverruns = stcodeover;
+	st->isrsched = rtisrstate;
+	st->anasched = rtanastate;
+}
+
 /*
  * *********************
  * Code analyzing thread
@@ -461,6 +570,9 @@ static void *codeAnalyzerThread(void *arg)
 	struct timingBuf *tb;
 	struct codeBuf *cb;
 
+	if (rtanaprio > 0 || rtcpu >= 0)
+		rtanastate = Radio433_setThreadRealtime(rtanaprio, rtcpu);
+
 	/* endless loop, sleeps on semaphore */
 	for(;;) {
 		sem_wait(&timingready);
@@ -471,6 +583,8 @@ static void *codeAnalyzerThread(void *arg)
 		memset(tmpcode, 0, sizeof(tmpcode));
 		/* check timing */
 		for(i = 0; i < RADIO433_DEVICES; i++) {
+			if (!(rxdevices & 1U << i))
+				continue;
 			td = &tDevInfo[i];
 			if (td->coding == RADIO433_CODING_HIGHLOW) {
 				/* HIGH-LOW coding, 2 pulses per bit */
@@ -504,6 +618,9 @@ static void *codeAnalyzerThread(void *arg)
 						tmpcode[i] = (tmpcode[i] << 1) | 1;
 						metric[i] += 2;
 					} else {
+						if (metric[i] > npulsemax &&
+						    (j >> 1) < RADIO433_STATS_BITS)
+							stfailbit[j >> 1]++;
 						metric[i] = 0;
 						break;
 					}
@@ -538,6 +655,9 @@ static void *codeAnalyzerThread(void *arg)
 						tmpcode[i] = (tmpcode[i] << 1) | 1;
 						metric[i] += 2;
 					} else {
+						if (metric[i] > npulsemax &&
+						    (j >> 1) < RADIO433_STATS_BITS)
+							stfailbit[j >> 1]++;
 						metric[i] = 0;
 						break;
 					}
@@ -560,8 +680,17 @@ static void *codeAnalyzerThread(void *arg)
 			       sizeof(struct timeval));
 			sem_post(&codeready);
 			cwi = (cwi + 1) % RADIO433_RING_BUFFER_ENTRIES;
-		}
+			stdecodes[dmax]++;
+			stcodes++;
+			i = stcodes - stconsumed;
+			if (i > stcodemax)
+				stcodemax = i;
+			if (i > RADIO433_RING_BUFFER_ENTRIES)
+				stcodeover++;
+		} else
+			strejected++;
 		tri = (tri + 1) % RADIO433_RING_BUFFER_ENTRIES;
+		stanalyzed++;
 	}
 }
 
@@ -571,6 +700,19 @@ static void *codeAnalyzerThread(void *arg)
  * *********
 */
 
+/* Count frame passed to analyzer (ISR only) */
+static inline void frameQueued(void)
+{
+	int depth;
+
+	stframes++;
+	depth = stframes - stanalyzed;
+	if (depth > sttimingmax)
+		sttimingmax = depth;
+	if (depth >= RADIO433_RING_BUFFER_ENTRIES)
+		sttimingover++;
+}
+
 /* Keep it fast and simple, code analysis is performed in separate thread */
 static void handleGpioInt(void)
 {
@@ -579,6 +721,12 @@ static void handleGpioInt(void)
 	struct timingBuf *tptr;
 
 	gettimeofday(&t, NULL);
+	stedges++;
+	if (rtisrpending) {
+		/* wiringPi created this thread, switch it on first edge */
+		rtisrstate = Radio433_setThreadRealtime(rtisrprio, rtcpu);
+		rtisrpending = 0;
+	}
 
 	tscur = (t.tv_sec - tstart.tv_sec) * 1000000 + t.tv_usec - tstart.tv_usec;
 	tsdiff = tscur - tsprev;
@@ -590,6 +738,7 @@ static void handleGpioInt(void)
 			/* if we were 'incode', mark it as complete */
 			sem_post(&timingready);
 			twi = (twi + 1) % RADIO433_RING_BUFFER_ENTRIES;
+			frameQueued();
 		}
 		incode = 1;
 		tptr = &tbuf[twi];
@@ -614,10 +763,12 @@ static void handleGpioInt(void)
 				/* code completed */
 				sem_post(&timingready);
 				twi = (twi + 1) % RADIO433_RING_BUFFER_ENTRIES;
+				frameQueued();
 			}
 			/* we're done, code OK or too much noise */
 			incode = 0;
 		}
-	}
+	} else if (incode)
+		stnoise++;
 	tsprev = tscur;
 }
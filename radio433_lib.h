@@ -22,4 +22,37 @@ int Radio433_sendRawCode(unsigned long long code, int coding, int bits, int repe
 /* Send device-specific code (repeats == 0 - use default number of packets) */
 int Radio433_sendDeviceCode(unsigned long long code, int type, int repeats);
 
+/* Select devices recognized by receiver, call before Radio433_init() */
+/* (entries are device types or classes, count 0 selects all; pulse limits */
+/* checked by ISR are narrowed to selected devices, so other frames are */
+/* dropped early; returns number of devices selected, 0 keeps previous) */
+int Radio433_setDevices(const int *types, int count);
+
+/* Real-time profile for receiver threads, call before Radio433_init() */
+/* (SCHED_FIFO priority 0 keeps default policy, cpu -1 disables pinning; */
+/* ISR thread belongs to wiringPi, so it switches itself on first edge) */
+void Radio433_setRealtime(int isrprio, int anaprio, int cpu);
+
+/* Receiver statistics, counters since Radio433_init() */
+#define RADIO433_STATS_BITS	64	/* decoding failure positions */
+struct radio433_stats {
+	unsigned long edges;		/* GPIO interrupts */
+	unsigned long noise;		/* pulses shorter than noise time */
+	unsigned long frames;		/* timings handed to analyzer */
+	unsigned long rejected;		/* frames matching no device */
+	int types[RADIO433_DEVICES];	/* device types ... */
+	unsigned long decodes[RADIO433_DEVICES];	/* ... and their codes */
+	unsigned long failbit[RADIO433_STATS_BITS];	/* bit failed after sync */
+	int timingdepth, timingmax;	/* timing ring: frames waiting, peak */
+	unsigned long timingoverruns;	/* frames overwritten before analysis */
+	int codedepth, codemax;		/* code ring: codes waiting, peak */
+	unsigned long codeoverruns;	/* codes overwritten before reading */
+	int isrsched, anasched;		/* real-time profile of ISR and analyzer */
+					/* (1 applied, 0 pending, -errno failed) */
+};
+
+/* Get receiver statistics (counters are updated without locking, each */
+/* one by single thread, so values may be slightly inconsistent) */
+void Radio433_getStats(struct radio433_stats *st);
+
 #endif
@@ -0,0 +1,362 @@
+/*
+ * ***********************************************
+ *  This library contains radio433daemon message
+ *  encoding and decoding functions (text/binary)
+ * ***********************************************
+ */
+
+/*
+ * Text protocol is the default one. Binary records are
+ * recognized by magic value, so client stream buffer
+ * accepts both formats and recovers from garbage.
+ * Decoded fields extend both formats, flag in binary
+ * record tells its size.
+ * Multicast receiver uses sequence numbers to detect
+ * lost datagrams and drop repeated records.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "radio433_types.h"
+#include "radio433_msg.h"
+
+/* Little-endian helpers */
+static void putLE(unsigned char *p, unsigned long long v, int n)
+{
+	int i;
+
+	for(i = 0; i < n; i++, v >>= 8)
+		p[i] = v & 0xFF;
+}
+
+static unsigned long long getLE(const unsigned char *p, int n)
+{
+	unsigned long long v;
+
+	v = 0;
+	while (n--)
+		v = (v << 8) | p[n];
+	return v;
+}
+
+/* Encode binary message */
+int Radio433_packMsg(unsigned char *buf, const struct radio433_msg *m)
+{
+	putLE(buf, RADIO433_MSG_MAGIC, 2);
+	buf[2] = RADIO433_MSG_VERSION;
+	buf[3] = m->bits;
+	putLE(buf + 4, m->type, 2);
+	putLE(buf + 6, m->codetime, 2);
+	putLE(buf + 8, m->ts, 8);
+	putLE(buf + 16, m->seq, 8);
+	putLE(buf + 24, m->code, 8);
+	putLE(buf + 32, m->interval, 4);
+	buf[36] = m->repeats;
+	buf[37] = 0;
+	putLE(buf + 38, m->flags, 2);
+	if (!(m->flags & RADIO433_MSG_FLAG_DECODED))
+		return RADIO433_MSG_BINSIZE;
+	memset(buf + 40, 0, RADIO433_MSG_DECSIZE);
+	buf[40] = m->dec.sysid;
+	buf[41] = m->dec.devid;
+	buf[42] = m->dec.ch;
+	buf[43] = m->dec.button;
+	buf[44] = m->dec.batlow;
+	buf[45] = (signed char)m->dec.trend;
+	buf[46] = m->dec.humid;
+	putLE(buf + 48, (unsigned short)(short)(m->dec.temp * 10 +
+				(m->dec.temp < 0 ? -0.5 : 0.5)), 2);
+	return RADIO433_MSG_MAXSIZE;
+}
+
+/* Decode binary message */
+int Radio433_unpackMsg(const unsigned char *buf, struct radio433_msg *m)
+{
+	if (getLE(buf, 2) != RADIO433_MSG_MAGIC ||
+	    buf[2] != RADIO433_MSG_VERSION)
+		return -1;
+	m->bits = buf[3];
+	m->type = getLE(buf + 4, 2);
+	m->codetime = getLE(buf + 6, 2);
+	m->ts = getLE(buf + 8, 8);
+	m->seq = getLE(buf + 16, 8);
+	m->code = getLE(buf + 24, 8);
+	m->interval = getLE(buf + 32, 4);
+	m->repeats = buf[36];
+	m->flags = getLE(buf + 38, 2);
+	return 0;
+}
+
+/* Decode fields following record */
+void Radio433_unpackDec(const unsigned char *buf, struct radio433_msg *m)
+{
+	m->dec.sysid = buf[0];
+	m->dec.devid = buf[1];
+	m->dec.ch = buf[2];
+	m->dec.button = buf[3];
+	m->dec.batlow = buf[4];
+	m->dec.trend = (signed char)buf[5];
+	m->dec.humid = buf[6];
+	m->dec.temp = (short)getLE(buf + 8, 2) * 0.1;
+}
+
+/* Format text message */
+int Radio433_formatMsg(char *buf, const struct radio433_msg *m)
+{
+	int n;
+
+	n = snprintf(buf, RADIO433_MSG_TXTSIZE,
+		     "%s%llu.%03u;%d;%d;%d;0x%04X;%d;0x%016llX;",
+		     RADIO433_MSG_HDR, m->ts / 1000000,
+		     (unsigned int)(m->ts % 1000000) / 1000, m->codetime,
+		     m->repeats, m->interval, m->type, m->bits, m->code);
+	if (m->flags & RADIO433_MSG_FLAG_BADCODE)
+		n += snprintf(buf + n, RADIO433_MSG_TXTSIZE - n, "BAD;");
+	else if ((m->flags & RADIO433_MSG_FLAG_DECODED) &&
+		 (m->type & RADIO433_CLASS_POWER))
+		n += snprintf(buf + n, RADIO433_MSG_TXTSIZE - n, "PWR;%d;0x%02X;%d;",
+			      m->dec.sysid, m->dec.devid, m->dec.button);
+	else if (m->flags & RADIO433_MSG_FLAG_DECODED)
+		n += snprintf(buf + n, RADIO433_MSG_TXTSIZE - n,
+			      "THM;%d;%d;%d;%d;%d;%.1f;%d;", m->dec.sysid,
+			      m->dec.devid, m->dec.ch, m->dec.batlow,
+			      m->dec.trend, m->dec.temp, m->dec.humid);
+	n += snprintf(buf + n, RADIO433_MSG_TXTSIZE - n, "%s\n",
+		      RADIO433_MSG_END);
+	return n;
+}
+
+/* Parse text message */
+int Radio433_parseMsg(const char *buf, struct radio433_msg *m)
+{
+	unsigned long long tss;
+	unsigned int tsms, type;
+	int n;
+	const char *p;
+	struct radio433_dec *d;
+
+	if (strncmp(buf, RADIO433_MSG_HDR, strlen(RADIO433_MSG_HDR)))
+		return -1;
+	n = 0;
+	if (sscanf(buf + strlen(RADIO433_MSG_HDR),
+		   "%llu.%u;%d;%d;%d;0x%X;%d;0x%llX;%n", &tss, &tsms,
+		   &m->codetime, &m->repeats, &m->interval, &type, &m->bits,
+		   &m->code, &n) != 8 || !n)
+		return -1;
+	m->ts = tss * 1000000 + tsms * 1000;
+	m->type = type;
+	m->seq = 0;
+	m->flags = 0;
+
+	/* optional decoded fields */
+	p = buf + strlen(RADIO433_MSG_HDR) + n;
+	d = &m->dec;
+	if (!strncmp(p, "BAD;", 4))
+		m->flags |= RADIO433_MSG_FLAG_BADCODE;
+	else if (sscanf(p, "PWR;%d;0x%X;%d;", &d->sysid, &d->devid,
+			&d->button) == 3)
+		m->flags |= RADIO433_MSG_FLAG_DECODED;
+	else if (sscanf(p, "THM;%d;%d;%d;%d;%d;%lf;%d;", &d->sysid, &d->devid,
+			&d->ch, &d->batlow, &d->trend, &d->temp,
+			&d->humid) == 7)
+		m->flags |= RADIO433_MSG_FLAG_DECODED;
+	return 0;
+}
+
+/* Reset stream buffer */
+void Radio433_initMsgBuf(struct radio433_msgbuf *b)
+{
+	b->pos = 0;
+	b->len = 0;
+}
+
+/* Receive data into stream buffer */
+int Radio433_recvMsgBuf(int fd, struct radio433_msgbuf *b)
+{
+	int n;
+
+	if (b->pos) {
+		memmove(b->buf, b->buf + b->pos, b->len - b->pos);
+		b->len -= b->pos;
+		b->pos = 0;
+	}
+	if (b->len == RADIO433_MSGBUF_SIZE)
+		b->len = 0;	/* no message boundary found, discard */
+	do
+		n = recv(fd, b->buf + b->len, RADIO433_MSGBUF_SIZE - b->len, 0);
+	while (n == -1 && errno == EINTR);
+	if (n > 0)
+		b->len += n;
+	return n;
+}
+
+/* Get next message from stream buffer */
+int Radio433_nextMsg(struct radio433_msgbuf *b, struct radio433_msg *m)
+{
+	unsigned char *p, *e;
+	int n, hlen, elen;
+	char txt[RADIO433_MSG_TXTSIZE + 1];
+
+	hlen = strlen(RADIO433_MSG_HDR);
+	elen = strlen(RADIO433_MSG_END);
+	for(;;) {
+		p = b->buf + b->pos;
+		n = b->len - b->pos;
+		if (n <= 0) {
+			b->pos = 0;
+			b->len = 0;
+			return 0;
+		}
+		if (*p == RADIO433_MSG_HDR[0]) {
+			/* text message */
+			if (memcmp(p, RADIO433_MSG_HDR, n < hlen ? n : hlen)) {
+				b->pos++;
+				continue;
+			}
+			e = memmem(p, n, RADIO433_MSG_END, elen);
+			if (e == NULL) {
+				if (n < RADIO433_MSG_TXTSIZE)
+					return 0;
+				b->pos++;	/* too long, resync */
+				continue;
+			}
+			n = e - p + elen;
+			if (n > RADIO433_MSG_TXTSIZE) {
+				b->pos++;
+				continue;
+			}
+			b->pos += n;
+			memcpy(txt, p, n);
+			txt[n] = 0;
+			if (!Radio433_parseMsg(txt, m))
+				return 1;
+		} else if (*p == (RADIO433_MSG_MAGIC & 0xFF)) {
+			/* binary record */
+			if (n < RADIO433_MSG_BINSIZE) {
+				if ((n < 2 || p[1] == (RADIO433_MSG_MAGIC >> 8)) &&
+				    (n < 3 || p[2] == RADIO433_MSG_VERSION))
+					return 0;
+				b->pos++;
+				continue;
+			}
+			if (Radio433_unpackMsg(p, m)) {
+				b->pos++;
+				continue;
+			}
+			if (m->flags & RADIO433_MSG_FLAG_DECODED) {
+				if (n < RADIO433_MSG_MAXSIZE)
+					return 0;
+				Radio433_unpackDec(p + RADIO433_MSG_BINSIZE, m);
+				b->pos += RADIO433_MSG_MAXSIZE;
+				return 1;
+			}
+			b->pos += RADIO433_MSG_BINSIZE;
+			return 1;
+		} else
+			b->pos++;	/* separator or garbage */
+	}
+}
+
+/* Encode multicast datagram header */
+int Radio433_packMcastHdr(unsigned char *buf, unsigned int session, int count)
+{
+	putLE(buf, RADIO433_MCAST_MAGIC, 2);
+	buf[2] = RADIO433_MSG_VERSION;
+	buf[3] = count;
+	putLE(buf + 4, session, 4);
+	return RADIO433_MCAST_HDRSIZE;
+}
+
+/* Join multicast group */
+int Radio433_openMcast(struct radio433_mcast *mc, struct in_addr group,
+		       int port)
+{
+	int fd, ena;
+	struct sockaddr_in sin;
+	struct ip_mreq mreq;
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd == -1)
+		return -1;
+	ena = 1;
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr = group;
+	sin.sin_port = htons(port);
+	memset(&mreq, 0, sizeof(mreq));
+	mreq.imr_multiaddr = group;
+	mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &ena, sizeof(int)) == -1 ||
+	    bind(fd, (struct sockaddr *)&sin, sizeof(sin)) == -1 ||
+	    setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) == -1) {
+		close(fd);
+		return -1;
+	}
+	mc->fd = fd;
+	mc->synced = 0;
+	mc->lost = 0;
+	mc->recovered = 0;
+	mc->cnt = 0;
+	mc->idx = 0;
+	return fd;
+}
+
+/* Wait for next multicast message */
+int Radio433_recvMcast(struct radio433_mcast *mc, struct radio433_msg *m)
+{
+	int i, n, cnt;
+	unsigned int session;
+	struct radio433_msg r;
+	unsigned char buf[RADIO433_MCAST_HDRSIZE +
+			  RADIO433_MCAST_MAXREC * RADIO433_MSG_BINSIZE];
+
+	while (mc->idx >= mc->cnt) {
+		n = recv(mc->fd, buf, sizeof(buf), 0);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (n < RADIO433_MCAST_HDRSIZE ||
+		    getLE(buf, 2) != RADIO433_MCAST_MAGIC ||
+		    buf[2] != RADIO433_MSG_VERSION)
+			continue;
+		cnt = buf[3];
+		if (!cnt || cnt > RADIO433_MCAST_MAXREC ||
+		    n < RADIO433_MCAST_HDRSIZE + cnt * RADIO433_MSG_BINSIZE ||
+		    Radio433_unpackMsg(buf + RADIO433_MCAST_HDRSIZE, &r))
+			continue;
+		session = getLE(buf + 4, 4);
+		if (!mc->synced || mc->session != session) {
+			/* (re)start with newest message */
+			mc->synced = 1;
+			mc->session = session;
+			mc->next = r.seq;
+		}
+		mc->cnt = 0;
+		mc->idx = 0;
+		for(i = cnt - 1; i >= 0; i--) {	/* oldest first */
+			if (Radio433_unpackMsg(buf + RADIO433_MCAST_HDRSIZE +
+					       i * RADIO433_MSG_BINSIZE, &r))
+				continue;
+			if (r.seq < mc->next)
+				continue;	/* already delivered */
+			if (r.seq > mc->next)
+				mc->lost += r.seq - mc->next;
+			if (i)
+				mc->recovered++;	/* came only as repeat */
+			mc->msgs[mc->cnt++] = r;
+			mc->next = r.seq + 1;
+		}
+	}
+	*m = mc->msgs[mc->idx++];
+	return 1;
+}
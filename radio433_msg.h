@@ -0,0 +1,142 @@
+#ifndef _RADIO433_MSG_H_
+#define _RADIO433_MSG_H_
+
+#include <netinet/in.h>
+
+/* Radio433daemon network protocol (shared by server and clients) */
+
+/* Text messages (default), semicolon-separated one line:
+   <RX>ts.ms;codetime;repeats;interval;0xTYPE;bits;0xCODE;<ZZ>\n
+   Decoded fields are appended after code when requested (MODE DECODE):
+     PWR;system;0xDEVMASK;button;
+     THM;sysid;thmid;channel;batlow;trend;temp;humidity;
+     BAD;                            (code failed validation) */
+#define RADIO433_MSG_HDR	"<RX>"
+#define RADIO433_MSG_END	"<ZZ>"
+#define RADIO433_MSG_TXTSIZE	128	/* maximum text message size */
+
+/* Binary messages, enabled by sending RADIO433_CMD_BINARY line to server.
+   Fixed size little-endian records:
+     0  u16  magic ('R','X')
+     2  u8   version
+     3  u8   bits
+     4  u16  type
+     6  u16  codetime (ms)
+     8  u64  timestamp (us)
+    16  u64  sequence number
+    24  u64  code
+    32  u32  interval (ms)
+    36  u8   repeats
+    37  u8   reserved (0)
+    38  u16  flags
+   Record with RADIO433_MSG_FLAG_DECODED is followed by decoded fields:
+    40  u8   system id (power system, thermometer system)
+    41  u8   device (power device mask, thermometer id)
+    42  u8   channel (thermometer)
+    43  u8   button (power)
+    44  u8   battery low (thermometer)
+    45  s8   temperature trend
+    46  u8   humidity (%)
+    47  u8   reserved (0)
+    48  s16  temperature (0.1 C)
+    50  6    reserved (0)
+ */
+#define RADIO433_CMD_BINARY	"MODE BIN\n"
+#define RADIO433_CMD_DECODE	"MODE DECODE\n"
+#define RADIO433_MSG_MAGIC	0x5852
+#define RADIO433_MSG_VERSION	1
+#define RADIO433_MSG_BINSIZE	40
+#define RADIO433_MSG_DECSIZE	16
+#define RADIO433_MSG_MAXSIZE	(RADIO433_MSG_BINSIZE + RADIO433_MSG_DECSIZE)
+
+/* Message flags */
+#define RADIO433_MSG_FLAG_DECODED	0x0001	/* decoded fields are valid */
+#define RADIO433_MSG_FLAG_BADCODE	0x0002	/* code failed validation */
+
+/* Multicast datagrams: header followed by binary records, newest first,
+   older ones are repeated so receivers can recover lost datagrams.
+     0  u16  magic ('R','M')
+     2  u8   version
+     3  u8   number of records
+     4  u32  session (server start time, sequence numbers restart)
+ */
+#define RADIO433_MCAST_MAGIC	0x4D52
+#define RADIO433_MCAST_HDRSIZE	8
+#define RADIO433_MCAST_MAXREC	8	/* records per datagram */
+
+/* Stream reassembly buffer size */
+#define RADIO433_MSGBUF_SIZE	(RADIO433_MSG_TXTSIZE * 8)
+
+struct radio433_dec {		/* decoded fields (power or thermometer) */
+	int sysid, devid;
+	int ch, button;
+	int batlow, trend, humid;
+	double temp;
+};
+
+struct radio433_msg {
+	unsigned long long ts;		/* timestamp in us */
+	unsigned long long seq;		/* sequence number (binary only) */
+	unsigned long long code;
+	int type, bits;
+	int codetime, repeats;		/* ms, number of packets */
+	int interval;			/* ms */
+	int flags;
+	struct radio433_dec dec;	/* if RADIO433_MSG_FLAG_DECODED */
+};
+
+struct radio433_msgbuf {
+	int pos, len;
+	unsigned char buf[RADIO433_MSGBUF_SIZE];
+};
+
+struct radio433_mcast {
+	int fd;
+	int synced;
+	unsigned int session;
+	unsigned long long next;	/* next expected sequence number */
+	unsigned long lost;		/* messages lost */
+	unsigned long recovered;	/* messages recovered from repeats */
+	int cnt, idx;			/* messages pending delivery */
+	struct radio433_msg msgs[RADIO433_MCAST_MAXREC];
+};
+
+/* Encode binary message, returns RADIO433_MSG_BINSIZE or RADIO433_MSG_MAXSIZE */
+/* for decoded message (buf must be large enough) */
+int Radio433_packMsg(unsigned char *buf, const struct radio433_msg *m);
+
+/* Decode binary message (without decoded fields, see */
+/* Radio433_unpackDec()), returns -1 on bad magic or version */
+int Radio433_unpackMsg(const unsigned char *buf, struct radio433_msg *m);
+
+/* Decode fields following record with RADIO433_MSG_FLAG_DECODED */
+void Radio433_unpackDec(const unsigned char *buf, struct radio433_msg *m);
+
+/* Format text message (buf must hold RADIO433_MSG_TXTSIZE), returns length */
+int Radio433_formatMsg(char *buf, const struct radio433_msg *m);
+
+/* Parse text message starting with header, returns -1 if malformed */
+int Radio433_parseMsg(const char *buf, struct radio433_msg *m);
+
+/* Reset stream buffer (e.g. after reconnecting) */
+void Radio433_initMsgBuf(struct radio433_msgbuf *b);
+
+/* Receive data from server into stream buffer (recv() return value) */
+int Radio433_recvMsgBuf(int fd, struct radio433_msgbuf *b);
+
+/* Get next complete message from stream buffer, text or binary */
+/* (returns 1 if message is available, 0 if more data is needed) */
+int Radio433_nextMsg(struct radio433_msgbuf *b, struct radio433_msg *m);
+
+/* Encode multicast datagram header, returns RADIO433_MCAST_HDRSIZE */
+int Radio433_packMcastHdr(unsigned char *buf, unsigned int session, int count);
+
+/* Join multicast group, returns socket or -1 on error */
+int Radio433_openMcast(struct radio433_mcast *mc, struct in_addr group,
+		       int port);
+
+/* Wait for next multicast message in sequence order (duplicates removed) */
+/* (returns 1 if message is available, -1 on socket error) */
+int Radio433_recvMcast(struct radio433_mcast *mc, struct radio433_msg *m);
+
+#endif
@@ -0,0 +1,249 @@
+/*
+ * *********************************************
+ *  This library contains shared memory ring of
+ *  radio codes for same-host radio433daemon
+ *  clients (single writer, many readers)
+ * *********************************************
+ */
+
+/*
+ * Writer invalidates slot, stores binary record, then
+ * publishes slot and head sequence numbers and wakes
+ * readers waiting on futex. Readers map ring read-only,
+ * copy record and verify slot sequence did not change
+ * meanwhile; gaps in sequence numbers are overruns.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "radio433_shm.h"
+
+#define SHM_UMASK	(S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)
+
+/* Futex helpers (ring is shared between processes, no PRIVATE flag) */
+static int futexWait(volatile unsigned int *addr, unsigned int val,
+		     const struct timespec *ts)
+{
+	return syscall(SYS_futex, addr, FUTEX_WAIT, val, ts, NULL, 0);
+}
+
+static void futexWake(volatile unsigned int *addr)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/* Create ring */
+int Radio433_createShm(struct radio433_shm *sh, const char *name)
+{
+	int fd;
+	struct radio433_shmhdr *h;
+
+	/* readers of previous instance keep old ring until they notice */
+	shm_unlink(name);
+	fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, SHM_UMASK);
+	if (fd == -1)
+		return -1;
+	fchmod(fd, SHM_UMASK);	/* regardless of umask */
+	if (ftruncate(fd, sizeof(struct radio433_shmhdr)) == -1) {
+		close(fd);
+		shm_unlink(name);
+		return -1;
+	}
+	h = mmap(NULL, sizeof(struct radio433_shmhdr), PROT_READ | PROT_WRITE,
+		 MAP_SHARED, fd, 0);
+	if (h == MAP_FAILED) {
+		close(fd);
+		shm_unlink(name);
+		return -1;
+	}
+	/* ftruncate() zeroed all slots */
+	h->version = RADIO433_SHM_VERSION;
+	h->entries = RADIO433_SHM_ENTRIES;
+	h->active = 1;
+	__atomic_store_n(&h->magic, RADIO433_SHM_MAGIC, __ATOMIC_RELEASE);
+	sh->fd = fd;
+	sh->hdr = h;
+	strncpy(sh->name, name, sizeof(sh->name) - 1);
+	sh->name[sizeof(sh->name) - 1] = 0;
+	return 0;
+}
+
+/* Map ring handed over by previous server */
+int Radio433_adoptShm(struct radio433_shm *sh, int fd, const char *name)
+{
+	struct stat st;
+	struct radio433_shmhdr *h;
+
+	if (fstat(fd, &st) == -1)
+		return -1;
+	if (st.st_size < (off_t)sizeof(struct radio433_shmhdr)) {
+		errno = ENODATA;
+		return -1;
+	}
+	h = mmap(NULL, sizeof(struct radio433_shmhdr), PROT_READ | PROT_WRITE,
+		 MAP_SHARED, fd, 0);
+	if (h == MAP_FAILED)
+		return -1;
+	if (h->magic != RADIO433_SHM_MAGIC || h->version != RADIO433_SHM_VERSION ||
+	    h->entries != RADIO433_SHM_ENTRIES || !h->active) {
+		munmap(h, sizeof(struct radio433_shmhdr));
+		errno = EPROTO;
+		return -1;
+	}
+	sh->fd = fd;
+	sh->hdr = h;
+	strncpy(sh->name, name, sizeof(sh->name) - 1);
+	sh->name[sizeof(sh->name) - 1] = 0;
+	return 0;
+}
+
+/* Write message to ring */
+void Radio433_publishShm(struct radio433_shm *sh, const struct radio433_msg *m)
+{
+	struct radio433_shmhdr *h;
+	struct radio433_shmslot *s;
+	unsigned long long n;
+
+	h = sh->hdr;
+	n = h->head;
+	s = &h->slots[n % RADIO433_SHM_ENTRIES];
+	__atomic_store_n(&s->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	Radio433_packMsg(s->rec, m);
+	__atomic_store_n(&s->seq, n + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&h->head, n + 1, __ATOMIC_RELEASE);
+	__atomic_add_fetch(&h->futex, 1, __ATOMIC_RELEASE);
+	futexWake(&h->futex);
+}
+
+/* Mark ring inactive and remove it */
+void Radio433_destroyShm(struct radio433_shm *sh)
+{
+	if (sh->hdr == NULL)
+		return;
+	__atomic_store_n(&sh->hdr->active, 0, __ATOMIC_RELEASE);
+	__atomic_add_fetch(&sh->hdr->futex, 1, __ATOMIC_RELEASE);
+	futexWake(&sh->hdr->futex);
+	munmap(sh->hdr, sizeof(struct radio433_shmhdr));
+	close(sh->fd);
+	shm_unlink(sh->name);	/* may fail without privileges */
+	sh->hdr = NULL;
+}
+
+/* Map ring read-only */
+int Radio433_openShm(struct radio433_shm *sh, const char *name)
+{
+	int fd;
+	struct stat st;
+	struct radio433_shmhdr *h;
+
+	fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+	if (fd == -1)
+		return -1;
+	if (fstat(fd, &st) == -1 ||
+	    st.st_size < (off_t)sizeof(struct radio433_shmhdr)) {
+		close(fd);
+		errno = ENODATA;
+		return -1;
+	}
+	h = mmap(NULL, sizeof(struct radio433_shmhdr), PROT_READ, MAP_SHARED,
+		 fd, 0);
+	if (h == MAP_FAILED) {
+		close(fd);
+		return -1;
+	}
+	if (__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != RADIO433_SHM_MAGIC ||
+	    h->version != RADIO433_SHM_VERSION ||
+	    h->entries != RADIO433_SHM_ENTRIES || !h->active) {
+		munmap(h, sizeof(struct radio433_shmhdr));
+		close(fd);
+		errno = EPROTO;
+		return -1;
+	}
+	sh->fd = fd;
+	sh->hdr = h;
+	strncpy(sh->name, name, sizeof(sh->name) - 1);
+	sh->name[sizeof(sh->name) - 1] = 0;
+	sh->next = __atomic_load_n(&h->head, __ATOMIC_ACQUIRE);
+	sh->lost = 0;
+	return 0;
+}
+
+/* Check if ring was replaced by restarted server */
+static int shmReplaced(struct radio433_shm *sh)
+{
+	int fd, r;
+	struct stat st0, st1;
+
+	fd = shm_open(sh->name, O_RDONLY | O_CLOEXEC, 0);
+	if (fd == -1)
+		return 1;
+	r = fstat(fd, &st1) || fstat(sh->fd, &st0) || st0.st_ino != st1.st_ino;
+	close(fd);
+	return r;
+}
+
+/* Wait for next message */
+int Radio433_readShm(struct radio433_shm *sh, struct radio433_msg *m)
+{
+	struct radio433_shmhdr *h;
+	struct radio433_shmslot *s;
+	unsigned long long head, seq;
+	unsigned int f;
+	unsigned char rec[RADIO433_MSG_BINSIZE];
+	struct timespec ts;
+
+	h = sh->hdr;
+	for(;;) {
+		f = __atomic_load_n(&h->futex, __ATOMIC_ACQUIRE);
+		if (!__atomic_load_n(&h->active, __ATOMIC_ACQUIRE))
+			return -1;
+		head = __atomic_load_n(&h->head, __ATOMIC_ACQUIRE);
+		if (sh->next < head) {
+			if (head - sh->next > RADIO433_SHM_ENTRIES) {
+				/* reader too slow, writer wrapped around */
+				sh->lost += head - sh->next - RADIO433_SHM_ENTRIES;
+				sh->next = head - RADIO433_SHM_ENTRIES;
+			}
+			s = &h->slots[sh->next % RADIO433_SHM_ENTRIES];
+			seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+			memcpy(rec, s->rec, RADIO433_MSG_BINSIZE);
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			sh->next++;
+			if (seq == sh->next &&
+			    __atomic_load_n(&s->seq, __ATOMIC_RELAXED) == seq &&
+			    !Radio433_unpackMsg(rec, m))
+				return 1;
+			sh->lost++;	/* overwritten while reading */
+			continue;
+		}
+		ts.tv_sec = RADIO433_SHM_CHECK_SEC;
+		ts.tv_nsec = 0;
+		if (futexWait(&h->futex, f, &ts) == -1 && errno == ETIMEDOUT &&
+		    shmReplaced(sh))
+			return -1;
+	}
+}
+
+/* Unmap ring */
+void Radio433_closeShm(struct radio433_shm *sh)
+{
+	if (sh->hdr == NULL)
+		return;
+	munmap(sh->hdr, sizeof(struct radio433_shmhdr));
+	close(sh->fd);
+	sh->hdr = NULL;
+}
@@ -0,0 +1,60 @@
+#ifndef _RADIO433_SHM_H_
+#define _RADIO433_SHM_H_
+
+#include "radio433_msg.h"
+
+/* Shared memory code ring published by radio433daemon for local readers */
+
+#define RADIO433_SHM_MAGIC	0x33333452	/* "R433" */
+#define RADIO433_SHM_VERSION	1
+#define RADIO433_SHM_ENTRIES	256	/* ring size (power of 2) */
+#define RADIO433_SHM_CHECK_SEC	10	/* reader checks for server restart */
+
+/* Ring slot: seq is message number + 1 when record is valid, 0 while
+   it is being written (readers retry or count overrun) */
+struct radio433_shmslot {
+	volatile unsigned long long seq;
+	unsigned char rec[RADIO433_MSG_BINSIZE];	/* binary message */
+};
+
+struct radio433_shmhdr {
+	unsigned int magic, version;
+	unsigned int entries;		/* number of slots */
+	volatile unsigned int active;	/* cleared when server exits */
+	volatile unsigned int futex;	/* incremented for each message */
+	volatile unsigned long long head;	/* messages written so far */
+	struct radio433_shmslot slots[RADIO433_SHM_ENTRIES];
+};
+
+struct radio433_shm {
+	int fd;
+	struct radio433_shmhdr *hdr;
+	char name[64];
+	unsigned long long next;	/* reader: next message to read */
+	unsigned long lost;		/* reader: messages lost (overruns) */
+};
+
+/* Create ring (server), returns 0 on success */
+int Radio433_createShm(struct radio433_shm *sh, const char *name);
+
+/* Take over ring created by previous server instance (passed as fd), */
+/* readers keep their mapping (server), returns 0 on success */
+int Radio433_adoptShm(struct radio433_shm *sh, int fd, const char *name);
+
+/* Write message to ring and wake up readers (server) */
+void Radio433_publishShm(struct radio433_shm *sh, const struct radio433_msg *m);
+
+/* Mark ring inactive, unmap and remove it (server) */
+void Radio433_destroyShm(struct radio433_shm *sh);
+
+/* Map ring read-only, reading starts with next message (client) */
+int Radio433_openShm(struct radio433_shm *sh, const char *name);
+
+/* Wait for next message (client) */
+/* (returns 1 if message is available, -1 if server is gone, reopen ring) */
+int Radio433_readShm(struct radio433_shm *sh, struct radio433_msg *m);
+
+/* Unmap ring (client) */
+void Radio433_closeShm(struct radio433_shm *sh);
+
+#endif
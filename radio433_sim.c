@@ -0,0 +1,158 @@
+/*
+ * *********************************************
+ *  This library simulates GPIO access of
+ *  radio433_lib to test receiver and daemon
+ *  without radio hardware (wiringPi replacement)
+ * *********************************************
+ */
+
+/*
+ * Pins switched to OUTPUT mode are transmitters, any level
+ * change written to them is an edge on the air. Edge wakes
+ * interrupt thread started by wiringPiISR(), which calls
+ * handler once for all edges pending since its last call,
+ * same as wiringPi waiting for GPIO interrupt does. Handler
+ * timestamps edges itself, so its wakeup latency distorts
+ * received timings as on real hardware.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <string.h>
+#include <semaphore.h>
+#include <pthread.h>
+
+#include <wiringPi.h>
+
+#include "radio433_sim.h"
+
+#define SIM_GPIOS	64
+#define SIM_RESYNC_NS	2000000	/* later than this starts new pulse train */
+#define SIM_SPIN_NS	30000	/* busy wait for last part of pulse */
+
+static int simmode[SIM_GPIOS];
+static int simlevel;
+static void (*simhandler)(void);
+static pthread_t simisr;
+static sem_t simedge;
+static volatile unsigned long simedges, simmerged;
+
+/* Interrupt thread: one handler call per wakeup */
+static void *simIsrThread(void *arg)
+{
+	int n;
+
+	(void)arg;
+	for(;;) {
+		while (sem_wait(&simedge) && errno == EINTR)
+			;
+		for(n = 0; !sem_trywait(&simedge); n++)
+			;
+		simmerged += n;
+		simhandler();
+	}
+	return NULL;
+}
+
+int wiringPiSetupGpio(void)
+{
+	return 0;
+}
+
+int wiringPiSetup(void)
+{
+	return 0;
+}
+
+void pinMode(int pin, int mode)
+{
+	if (pin >= 0 && pin < SIM_GPIOS)
+		simmode[pin] = mode;
+}
+
+void digitalWrite(int pin, int value)
+{
+	if (pin < 0 || pin >= SIM_GPIOS || simmode[pin] != OUTPUT)
+		return;
+	value = value ? HIGH : LOW;
+	if (value == simlevel)
+		return;
+	simlevel = value;
+	if (simhandler != NULL) {
+		simedges++;
+		sem_post(&simedge);
+	}
+}
+
+int digitalRead(int pin)
+{
+	(void)pin;
+	return simlevel;
+}
+
+void delay(unsigned int ms)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (ms % 1000) * 1000000L;
+	while (nanosleep(&ts, &ts) && errno == EINTR)
+		;
+}
+
+/* Sleep until shortly before deadline following previous one, busy wait */
+/* rest, so that pulse train keeps exact length and leaves CPU to receiver */
+/* (caller thread should be real-time to wake up in time) */
+void delayMicroseconds(unsigned int us)
+{
+	static __thread struct timespec next;
+	struct timespec now, wake;
+	long d;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	d = (now.tv_sec - next.tv_sec) * 1000000000L + now.tv_nsec - next.tv_nsec;
+	if (now.tv_sec > next.tv_sec + 1 || d > SIM_RESYNC_NS)
+		next = now;	/* new pulse train */
+	next.tv_nsec += (long)us * 1000;
+	next.tv_sec += next.tv_nsec / 1000000000L;
+	next.tv_nsec %= 1000000000L;
+	wake = next;
+	wake.tv_nsec -= SIM_SPIN_NS;
+	if (wake.tv_nsec < 0) {
+		wake.tv_nsec += 1000000000L;
+		wake.tv_sec--;
+	}
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL) == EINTR)
+		;
+	do
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	while (now.tv_sec < next.tv_sec ||
+	       (now.tv_sec == next.tv_sec && now.tv_nsec < next.tv_nsec));
+}
+
+/* Single receiver supported, edge mode ignored (always both edges) */
+int wiringPiISR(int pin, int mode, void (*function)(void))
+{
+	(void)pin;
+	(void)mode;
+	if (simhandler != NULL)
+		return -1;
+	sem_init(&simedge, 0, 0);
+	simhandler = function;
+	if (pthread_create(&simisr, NULL, simIsrThread, NULL)) {
+		simhandler = NULL;
+		return -1;
+	}
+	pthread_detach(simisr);
+	return 0;
+}
+
+void Radio433_simStats(unsigned long *edges, unsigned long *merged)
+{
+	*edges = simedges;
+	*merged = simmerged;
+}
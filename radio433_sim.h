@@ -0,0 +1,18 @@
+#ifndef _RADIO433_SIM_H_
+#define _RADIO433_SIM_H_
+
+/* Simulated GPIO for radio433_lib without radio hardware: replaces the
+   wiringPi calls used by the library and radio433daemon (link
+   radio433_sim.o instead of -lwiringPi). Level changes written to any
+   output pin are looped back to interrupt handler of input pin, as if
+   transmitter and receiver shared the air, so codes sent with
+   Radio433_sendDeviceCode() or Radio433_pulseCode() are received by
+   the same process. Like in wiringPi, handler runs in its own thread
+   woken for each edge; edges arriving while it is late are merged into
+   one call, so scheduling delays show up as distorted timings. */
+
+/* Edges looped back to interrupt handler since start and edges merged */
+/* because handler thread was late */
+void Radio433_simStats(unsigned long *edges, unsigned long *merged);
+
+#endif
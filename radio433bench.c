@@ -0,0 +1,210 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/time.h>
+
+#include <wiringPi.h>
+
+#include "radio433_lib.h"
+#include "radio433_types.h"
+#include "radio433_sim.h"
+
+#define BENCH_TX_GPIO		17
+#define BENCH_RX_GPIO		27
+#define DEFAULT_TRANSMISSIONS	200
+#define DEFAULT_REPEATS		4
+#define DEFAULT_GAP_MS		50	/* pause between transmissions */
+#define TX_PRIORITY		99	/* transmitter stands in for hardware */
+#define RT_ANALYZER_OFFSET	5	/* analyzer below ISR, as in daemon */
+#define KEMOT_CODE_BASE		0x441450ULL
+#define HYUWS_CODE_BASE		0x4A0360000ULL
+#define SETTLE_MS		500	/* wait for last frames after sending */
+
+extern char *optarg;
+extern int optind, opterr, optopt;
+
+volatile int hogstop;
+volatile unsigned long correct, wrong;
+int ntx;
+
+/* Show help */
+void help(char *progname)
+{
+	printf("\nUsage:\n\t%s [-n transmissions] [-r repeats] [-g ms] [-l hogs] [-R p[:c]]\n\n", progname);
+	puts("Where:");
+	printf("\t-n count   - transmissions sent (optional, default %d)\n", DEFAULT_TRANSMISSIONS);
+	printf("\t-r repeats - frames in each transmission (optional, default %d)\n", DEFAULT_REPEATS);
+	printf("\t-g ms      - pause between transmissions (optional, default %d)\n", DEFAULT_GAP_MS);
+	puts("\t-l hogs    - threads keeping CPU busy meanwhile (optional, default 0)");
+	printf("\t-R p[:c]   - receive with SCHED_FIFO priority p (analyzer p-%d), pinned\n"
+	       "\t             to CPU c, as radio433daemon -R (optional)\n", RT_ANALYZER_OFFSET);
+	puts("\nReplays codes of both known devices through simulated GPIO into receiver");
+	puts("and reports how many frames were decoded (decode yield). Must be run as root");
+	puts("to let transmitter run real-time.\n");
+}
+
+/* Code sent in i-th transmission, types alternate */
+unsigned long long benchCode(int i, int *type)
+{
+	if (i & 1) {
+		*type = RADIO433_DEVICE_HYUWSSENZOR77TH;
+		return HYUWS_CODE_BASE + (i & 0xFFFF);
+	}
+	*type = RADIO433_DEVICE_KEMOTURZ1226;
+	return KEMOT_CODE_BASE + (i & 0x0F);
+}
+
+/* Burn CPU at normal priority */
+void *hogThread(void *arg)
+{
+	volatile unsigned long n;
+
+	(void)arg;
+	for(n = 0; !hogstop; n++)
+		;
+	return NULL;
+}
+
+/* Check received codes against the ones that may have been sent */
+void *consumerThread(void *arg)
+{
+	unsigned long long code;
+	int type, i, t;
+
+	(void)arg;
+	for(;;) {
+		code = Radio433_getCode(NULL, &type, NULL);
+		for(i = 0; i < ntx; i++)
+			if (benchCode(i, &t) == code && t == type)
+				break;
+		if (i < ntx)
+			correct++;
+		else
+			wrong++;
+	}
+	return NULL;
+}
+
+/* ********** */
+/* *  MAIN  * */
+/* ********** */
+
+int main(int argc, char *argv[])
+{
+	int opt, repeats, gap, nhogs, rtprio, rtcpu, i, type, r;
+	unsigned long decoded, frames, edges, merged, sendfail;
+	unsigned long long code;
+	struct sched_param sp;
+	struct radio433_stats st;
+	struct timespec ts;
+	pthread_t consumer, *hogs;
+
+	/* get parameters */
+	ntx = DEFAULT_TRANSMISSIONS;
+	repeats = DEFAULT_REPEATS;
+	gap = DEFAULT_GAP_MS;
+	nhogs = 0;
+	rtprio = 0;
+	rtcpu = -1;
+	while((opt = getopt(argc, argv, "hn:r:g:l:R:")) != -1) {
+		if (opt == 'n')
+			sscanf(optarg, "%d", &ntx);
+		else if (opt == 'r')
+			sscanf(optarg, "%d", &repeats);
+		else if (opt == 'g')
+			sscanf(optarg, "%d", &gap);
+		else if (opt == 'l')
+			sscanf(optarg, "%d", &nhogs);
+		else if (opt == 'R') {
+			if (sscanf(optarg, "%d:%d", &rtprio, &rtcpu) < 1 ||
+			    rtprio < 0 || rtprio >= TX_PRIORITY ||
+			    (rtprio && rtprio <= RT_ANALYZER_OFFSET)) {
+				fputs("Invalid real-time profile specification.\n", stderr);
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if (opt == '?' || opt == 'h') {
+			help(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (ntx < 1 || repeats < 1 || gap < 0 || nhogs < 0) {
+		help(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	/* receiver with optional real-time profile, checked after first edge */
+	wiringPiSetupGpio();
+	if (rtprio > 0 || rtcpu >= 0)
+		Radio433_setRealtime(rtprio, rtprio ? rtprio - RT_ANALYZER_OFFSET : 0,
+				     rtcpu);
+	if (Radio433_init(BENCH_TX_GPIO, BENCH_RX_GPIO)) {
+		fputs("Unable to initialize radio library.\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+	if (pthread_create(&consumer, NULL, consumerThread, NULL)) {
+		fputs("Unable to start consumer thread.\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+
+	/* load (threads inherit scheduling, so before going real-time) */
+	hogs = calloc(nhogs ? nhogs : 1, sizeof(pthread_t));
+	for(i = 0; i < nhogs; i++)
+		if (pthread_create(&hogs[i], NULL, hogThread, NULL)) {
+			fputs("Unable to start CPU hog thread.\n", stderr);
+			exit(EXIT_FAILURE);
+		}
+
+	/* transmitter */
+	sp.sched_priority = TX_PRIORITY;
+	r = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+	if (r)
+		fprintf(stderr, "Warning: transmitter not real-time (%s), timings will suffer.\n",
+			strerror(r));
+
+	/* replay */
+	sendfail = 0;
+	for(i = 0; i < ntx; i++) {
+		code = benchCode(i, &type);
+		if (Radio433_sendDeviceCode(code, type, repeats))
+			sendfail++;
+		ts.tv_sec = gap / 1000;
+		ts.tv_nsec = (gap % 1000) * 1000000L;
+		nanosleep(&ts, NULL);
+	}
+	ts.tv_sec = SETTLE_MS / 1000;
+	ts.tv_nsec = (SETTLE_MS % 1000) * 1000000L;
+	nanosleep(&ts, NULL);
+	hogstop = 1;
+	for(i = 0; i < nhogs; i++)
+		pthread_join(hogs[i], NULL);
+
+	/* report */
+	Radio433_getStats(&st);
+	Radio433_simStats(&edges, &merged);
+	decoded = 0;
+	for(i = 0; i < RADIO433_DEVICES; i++)
+		decoded += st.decodes[i];
+	frames = (unsigned long)(ntx - sendfail) * repeats;
+	printf("Transmissions %d x %d frames, %d CPU hog(s), receiver ", ntx,
+	       repeats, nhogs);
+	if (rtprio > 0 || rtcpu >= 0)
+		printf("real-time priority %d CPU %d (ISR %s, analyzer %s)\n",
+		       rtprio, rtcpu, st.isrsched > 0 ? "applied" : "failed",
+		       st.anasched > 0 ? "applied" : "failed");
+	else
+		puts("default scheduling");
+	printf("Frames sent %lu, decoded %lu, yield %.1f %%, codes correct %lu, wrong %lu\n",
+	       frames, decoded, frames ? 100.0 * decoded / frames : 0.0, correct, wrong);
+	printf("Edges %lu (%lu merged late), noise %lu, frames to analyzer %lu, rejected %lu, overruns %lu\n",
+	       edges, merged, st.noise, st.frames, st.rejected,
+	       st.timingoverruns + st.codeoverruns);
+	return 0;
+}
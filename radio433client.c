@@ -14,14 +14,11 @@
 
 #include "radio433_types.h"
 #include "radio433_dev.h"
+#include "radio433_msg.h"
 
 #define RADIO433_DEFAULT_HOST	"127.0.0.1"
 #define RADIO433_DEFAULT_PORT	5433
 #define RECONNECT_DELAY_SEC	10
-#define RADMSG_SIZE		128     /* radio daemon message size */
-#define RADBUF_SIZE		(RADMSG_SIZE * 8)
-#define MSG_HDR			"<RX>"
-#define MSG_EOT			"<ZZ>"
 
 extern char *optarg;
 extern int optind, opterr, optopt;
@@ -29,39 +26,111 @@ extern int optind, opterr, optopt;
 /* Show help */
 void help(char *progname)
 {
-	printf("\nUsage:\n\t%s [-w] [-P] [-T] [-R] [-r ipaddr] [-p tcpport]\n\n", progname);
+	printf("\nUsage:\n\t%s [-w] [-H] [-P] [-T] [-R] [-r ipaddr] [-p tcpport | -m group:port]\n\n", progname);
 	puts("Where:");
 	puts("\t-w         - wait for server when starting (optional)");
+	puts("\t-H         - show messages from server history first (optional)");
 	puts("\t-P,-T,-R   - select power (-P), weather (-T) or remote");
 	puts("\t             control (-R) messages (optional, default: all)");
 	puts("\t-r ipaddr  - IPv4 address of radio433daemon server (optional)");
 	puts("\t-p tcpport - TCP port of radio433daemon server (optional)");
+	puts("\t-m g:p     - receive from multicast group g port p instead of server (optional)");
 	printf("\nWhen no parameter is specified, client tries to connect to server %s on port %d.\n\n",
 	       RADIO433_DEFAULT_HOST, RADIO433_DEFAULT_PORT);
 }
 
+/* Show decoded message */
+void showMessage(struct radio433_msg *m, unsigned int filt)
+{
+	time_t tss;
+	unsigned int tsms;
+	struct tm *tl;
+	int tid;
+        char *stype[] = { "NUL", "PWR", "THM", "RMT" };
+	struct radio433_dec *d;
+	char trend[3] = { '_', '/', '\\' };
+
+	if (filt && !(m->type & filt))
+		return;
+	tss = m->ts / 1000000;
+	tsms = (m->ts / 1000) % 1000;
+	tl = localtime(&tss);
+	printf("%d-%02d-%02d %02d:%02d:%02d.%03u",
+	       1900 + tl->tm_year, tl->tm_mon + 1,
+	       tl->tm_mday, tl->tm_hour, tl->tm_min,
+	       tl->tm_sec, tsms);
+	if (m->type & RADIO433_CLASS_POWER)
+		tid = 1;
+	else if (m->type & RADIO433_CLASS_WEATHER)
+		tid = 2;
+	else if (m->type & RADIO433_CLASS_REMOTE)
+		tid = 3;
+	else
+		tid = 0;
+	printf("  %s%s len = %d , code = 0x%0*llX", filt ? "*" : "",
+	       stype[tid], m->bits, (m->bits + 3) >> 2, m->code);
+	/* server sends decoded fields, multicast needs local decoding */
+	d = &m->dec;
+	if (!Radio433_decodeMsg(m))
+		puts("");
+	else if (m->type == RADIO433_DEVICE_KEMOTURZ1226)
+		printf(" , %d : %s%s%s%s%s : %s\n", d->sysid,
+		       d->devid & POWER433_DEVICE_A ? "A" : "",
+		       d->devid & POWER433_DEVICE_B ? "B" : "",
+		       d->devid & POWER433_DEVICE_C ? "C" : "",
+		       d->devid & POWER433_DEVICE_D ? "D" : "",
+		       d->devid & POWER433_DEVICE_E ? "E" : "",
+		       d->button ? "ON" : "OFF");
+	else
+		printf(" , %1d , T: %+.1lf C %c , H: %d %% %c\n",
+		       d->ch, d->temp, d->trend < 0 ? '!' : trend[d->trend],
+		       d->humid, d->batlow ? 'b' : ' ');
+}
+
+/* Receive messages from multicast group (never returns) */
+void mcastLoop(struct in_addr group, int port, unsigned int filt)
+{
+	struct radio433_mcast mc;
+	struct radio433_msg m;
+	unsigned long lost;
+
+	if (Radio433_openMcast(&mc, group, port) == -1) {
+		fprintf(stderr, "Unable to join multicast group: %s\n",
+			strerror (errno));
+		exit(EXIT_FAILURE);
+	}
+	printf("Joined multicast group %s port %d. Awaiting messages...\n",
+	       inet_ntoa(group), port);
+	lost = 0;
+	for(;;) {
+		if (Radio433_recvMcast(&mc, &m) < 0) {
+			fprintf(stderr, "Error receiving multicast data: %s\n",
+				strerror (errno));
+			exit(EXIT_FAILURE);
+		}
+		if (mc.lost != lost) {
+			fprintf(stderr, "%lu message(s) lost\n", mc.lost - lost);
+			lost = mc.lost;
+		}
+		showMessage(&m, filt);
+	}
+}
+
 /* ********** */
 /* *  MAIN  * */
 /* ********** */
 
 int main(int argc, char *argv[])
 {
-	time_t tss;
-	unsigned int tsms, filt;
-	struct tm *tl;
-	unsigned long long code;
-	int opt, tid, type, bits;
-        char *stype[] = { "NUL", "PWR", "THM", "RMT" };
-	int sysid, devid, btn;
-	int ch, batlow, tdir, humid;
-	double temp;
-	char trend[3] = { '_', '/', '\\' };
+	unsigned int filt;
+	int opt;
 	int port, clfd, msglen;
 	struct sockaddr_in clntsin;
-	char buf[RADBUF_SIZE + 1];
-	char *msgptr, *msgend;
-	int waitflag;
-	int codelen, repeats, interval;
+	struct radio433_msgbuf mb;
+	struct radio433_msg m;
+	char cmd[64], mcaddr[INET_ADDRSTRLEN];
+	int cmdlen, waitflag, histflag, mcport;
+	struct in_addr mcgroup;
 
 	/* get parameters */
 	memset((char *)&clntsin, 0, sizeof(clntsin));
@@ -69,8 +138,10 @@ int main(int argc, char *argv[])
 	inet_aton(RADIO433_DEFAULT_HOST, &clntsin.sin_addr);
 	port = RADIO433_DEFAULT_PORT;
 	waitflag = 0;
+	histflag = 0;
+	mcport = 0;
 	filt = 0;
-	while((opt = getopt(argc, argv, "hwPTRr:p:")) != -1) {
+	while((opt = getopt(argc, argv, "hwHPTRr:p:m:")) != -1) {
 		if (opt == 'r') {
 			if (!inet_aton(optarg, &clntsin.sin_addr)) {
 				fputs("Invalid IPv4 address specification.\n", stderr);
@@ -78,9 +149,19 @@ int main(int argc, char *argv[])
 			}
 		}
 		else if (opt == 'p')
-			sscanf(optarg, "%d", port);
+			sscanf(optarg, "%d", &port);
+		else if (opt == 'm') {
+			if (sscanf(optarg, "%15[0-9.]:%d", mcaddr, &mcport) != 2 ||
+			    !inet_aton(mcaddr, &mcgroup) ||
+			    !IN_MULTICAST(ntohl(mcgroup.s_addr))) {
+				fputs("Invalid multicast group specification.\n", stderr);
+				exit(EXIT_FAILURE);
+			}
+		}
 		else if (opt == 'w')
 			waitflag = 1;
+		else if (opt == 'H')
+			histflag = 1;
 		else if (opt == 'P')
 			filt |= RADIO433_CLASS_POWER;
 		else if (opt == 'T')
@@ -94,6 +175,10 @@ int main(int argc, char *argv[])
 	}
 	clntsin.sin_port = htons(port);
 
+	/* multicast receiver needs no connection */
+	if (mcport)
+		mcastLoop(mcgroup, mcport, filt);
+
 	/* connect to server */
 	for(;;) {
 		clfd = socket(AF_INET, SOCK_STREAM, 0);
@@ -119,11 +204,19 @@ int main(int argc, char *argv[])
 	printf("Connected to server %s port %d. Awaiting messages...\n",
 	       inet_ntoa(clntsin.sin_addr), port);
 
+	/* request decoded binary records, let server filter classes and */
+	/* replay (older servers ignore commands, send text and all classes) */
+	cmdlen = sprintf(cmd, "%s%s", RADIO433_CMD_BINARY, RADIO433_CMD_DECODE);
+	if (filt)
+		cmdlen += sprintf(cmd + cmdlen, "SUB CLASS 0x%04X\n", filt);
+	if (histflag)
+		cmdlen += sprintf(cmd + cmdlen, "REPLAY SEQ 0\n");
+	send(clfd, cmd, cmdlen, MSG_NOSIGNAL);
+	Radio433_initMsgBuf(&mb);
+
 	/* function loop - never ends, send signal to exit */
 	for(;;) {
-		do
-			msglen = recv(clfd, buf, RADBUF_SIZE, 0);
-		while (msglen == -1 && errno == EINTR);
+		msglen = Radio433_recvMsgBuf(clfd, &mb);
 		if (msglen < 0) {
                 	fprintf(stderr, "Error receiving data from server: %s\n",
                         	strerror (errno));
@@ -132,57 +225,7 @@ int main(int argc, char *argv[])
 			fputs("Server has closed connection.\n", stderr);
 			exit(EXIT_FAILURE);
 		}
-		buf[msglen] = 0;
-		msgptr = buf;
-		do {
-			msgptr = strstr(msgptr, MSG_HDR);
-			if (msgptr == NULL)
-				break;
-			msgend = strstr(msgptr, MSG_EOT);
-			if (msgend == NULL)
-				break;
-			if (sscanf(msgptr + 4, "%lu.%u;%d;%d;%d;0x%X;%d;0x%llX;",
-			    &tss, &tsms, &codelen, &repeats, &interval, &type,
-			    &bits, &code) == 8)
-				if (!filt || (type & filt)) {
-					tl = localtime(&tss);
-					printf("%d-%02d-%02d %02d:%02d:%02d.%03u",
-					       1900 + tl->tm_year, tl->tm_mon + 1,
-					       tl->tm_mday, tl->tm_hour, tl->tm_min,
-					       tl->tm_sec, tsms);
-					if (type & RADIO433_CLASS_POWER)
-						tid = 1;
-					else if (type & RADIO433_CLASS_WEATHER)
-						tid = 2;
-					else if (type & RADIO433_CLASS_REMOTE)
-						tid = 3;
-					else
-						tid = 0;
-					printf("  %s%s len = %d , code = 0x%0*llX", filt ? "*" : "",
-					       stype[tid], bits, (bits + 3) >> 2, code);
-					if (type == RADIO433_DEVICE_KEMOTURZ1226) {
-						if (Radio433_pwrGetCommand(code, &sysid, &devid, &btn))
-							printf(" , %d : %s%s%s%s%s : %s\n", sysid,
-							       devid & POWER433_DEVICE_A ? "A" : "",
-							       devid & POWER433_DEVICE_B ? "B" : "",
-							       devid & POWER433_DEVICE_C ? "C" : "",
-							       devid & POWER433_DEVICE_D ? "D" : "",
-							       devid & POWER433_DEVICE_E ? "E" : "",
-							       btn ? "ON" : "OFF");
-						else
-							puts("");
-					} else if (type == RADIO433_DEVICE_HYUWSSENZOR77TH) {
-						if (Radio433_thmGetData(code, &sysid, &devid, &ch,
-									&batlow, &tdir, &temp, &humid))
-							printf(" , %1d , T: %+.1lf C %c , H: %d %% %c\n",
-							       ch, temp, tdir < 0 ? '!' : trend[tdir],
-							       humid, batlow ? 'b' : ' ');
-						else
-							puts("");
-					} else
-						puts("");
-				}
-			msgptr = msgend + 5;
-		} while (msgptr < buf + msglen);
+		while (Radio433_nextMsg(&mb, &m))
+			showMessage(&m, filt);
 	}	/* main loop ends here */
 }
@@ -11,6 +11,10 @@
 #include <sys/time.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/un.h>
 #include <sched.h>
 #include <semaphore.h>
 #include <pthread.h>
@@ -18,6 +22,7 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <fcntl.h>
 #include <linux/limits.h>  /* for NGROUPS_MAX */
 #include <pwd.h>	/* for getpwnam_r() */
@@ -30,6 +35,10 @@
 
 #include "radio433_lib.h"
 #include "radio433_dev.h"
+#include "radio433_msg.h"
+#include "daemonlog_lib.h"
+#include "radio433_shm.h"
+#include "radio433_jnl.h"
 
 extern char *optarg;
 extern int optind, opterr, optopt;
@@ -47,6 +56,35 @@ extern int optind, opterr, optopt;
    Example:
    <RX>1490084244.768;40;3;0;0x0101;32;0x0000000000441454;<ZZ>
    <RX>1490084239.165;128;4;33000;0x0201;36;0x00000004A03608F9;<ZZ>
+
+   Client may switch its connection to fixed size binary records
+   (see radio433_msg.h) by sending "MODE BIN" command line.
+
+   With "MODE DECODE" server appends decoded fields of known devices
+   (power commands, thermometer readings) to each message, or marks code
+   as bad when it fails validation ("MODE RAW" switches back). Codes are
+   decoded once when published, results are cached per code value.
+
+   Client may also limit messages it receives with subscription commands:
+   SUB CLASS mask, SUB TYPE type, SUB CODE type code (exact match)
+   and SUB ALL (remove filters). Matching any subscription is enough.
+
+   Recent messages are kept in history ring and client may request them
+   with REPLAY SEQ seqnum or REPLAY TIME microseconds (since Epoch) before
+   live delivery continues.
+
+   Optionally each message is also published once as UDP multicast
+   datagram with binary records (see radio433_msg.h), followed by
+   copies of previous ones so receivers can recover single losses.
+
+   Local clients may read binary records straight from shared memory
+   ring (see radio433_shm.h) without any socket or syscall per message.
+
+   Published binary records may be appended to journal on disk (see
+   radio433_jnl.h) by separate thread, radio433replay serves them later.
+
+   On SIGUSR2 server restarts and new instance takes over clients
+   without closing their connections (see handoff messages below).
  */
 
 
@@ -54,25 +92,78 @@ extern int optind, opterr, optopt;
 /* *  Constants  * */
 /* *************** */
 
-#define BANNER			"Radio433Daemon v0.98.2 server"
+#define BANNER			"Radio433Daemon v0.99.0 server"
 #define MAX_USERNAME		32
 #define MAX_NGROUPS		(NGROUPS_MAX >> 10)	/* reasonable maximum */
 #define GPIO_PINS		28	/* number of Pi GPIO pins */
 #define LED_BLINK_MS		100	/* minimal LED blinking time in ms */
 #define SERVER_ADDR		"0.0.0.0" /* default server address */
 #define SERVER_PORT		5433	/* default server TCP port */
-#define MAX_MSG_SIZE		128	/* maximum message size in bytes */
-#define MAX_CLIENTS		64	/* client limit */
-#define MSG_HDR			"<RX>"
-#define MSG_END			"<ZZ>"
+#define MAX_MSG_SIZE		RADIO433_MSG_TXTSIZE	/* maximum message size in bytes */
+#define MAX_CMD_SIZE		64	/* maximum client command line */
+#define MAX_SUB_TYPES		8	/* device types subscribed by client */
+#define SUB_CODE_SLOTS		128	/* code hash size (power of 2) */
+#define MAX_SUB_CODES		(SUB_CODE_SLOTS >> 1)	/* codes per client */
+#define MAX_CLIENTS		256	/* client limit */
+#define CLIENT_QUEUE_LEN	64	/* per-client output queue (messages) */
+#define HISTORY_LEN		256	/* default history size (> CLIENT_QUEUE_LEN) */
+#define MAX_HISTORY_LEN		65536	/* history size limit */
+#define MCAST_TTL		1	/* multicast datagrams stay in local network */
+#define MAX_EPOLL_EVENTS	32	/* events handled per epoll_wait() call */
+#define METRICS_ADDR		"127.0.0.1" /* default metrics address */
+#define MAX_METRICS_CONNS	4	/* concurrent metrics requests */
+#define METRICS_REQ_SIZE	512	/* request bytes kept (first line only) */
+#define LATENCY_BUCKETS		10	/* publish latency histogram */
+#define DECODE_CACHE_SLOTS	256	/* decoded codes cache (power of 2) */
+#define MAX_TX_CONNS		8	/* concurrent transmit connections */
+#define TX_QUEUE_LEN		32	/* transmit requests waiting (power of 2) */
+#define TX_MAX_REPEATS		100	/* packets in one transmission */
+#define TX_RAW_REPEATS		10	/* default packets for raw codes */
+#define TX_SOCKET_UMASK		(S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP)
+#define HANDOFF_TX_WAIT_MS	5000	/* restart waits for transmit queue */
+#define JOURNAL_QUEUE_LEN	1024	/* records waiting for journal writer */
+#define JOURNAL_SEGMENT_MB	4	/* default journal segment size */
+#define JOURNAL_SEGMENTS	32	/* default journal segments kept */
+#define HANDOFF_JNL_WAIT_MS	2000	/* restart waits for journal writer */
+#define MAX_RX_TYPES		8	/* device types and classes received */
+#define FLOOD_SLOTS		256	/* rate limited codes (power of 2) */
+#define FLOOD_WAYS		4	/* buckets per hash set */
+#define FLOOD_BURST		10	/* default codes passed at once */
+#define FLOOD_SCALE		60000000ULL	/* tokens per code (us per minute) */
+#define FLOOD_REPORT_SEC	60	/* suppressed codes summary period */
+#define EPOLL_TAG_SERVER	0	/* epoll data: listening socket */
+#define EPOLL_TAG_CODES		1	/* epoll data: code pipe */
+#define EPOLL_TAG_METRICS	2	/* epoll data: metrics listening socket */
+#define EPOLL_TAG_RESTART	3	/* epoll data: restart request pipe */
+#define EPOLL_TAG_HANDOFF	4	/* epoll data: socket to new instance */
+#define EPOLL_TAG_TXSERVER	5	/* epoll data: transmit listening socket */
+#define EPOLL_TAG_TXDONE	6	/* epoll data: transmit results pipe */
+#define EPOLL_TAG_HTTP		7	/* epoll data: first metrics connection */
+#define EPOLL_TAG_TXCONN	(EPOLL_TAG_HTTP + MAX_METRICS_CONNS)	/* first transmit connection */
+#define EPOLL_TAG_CLIENT	(EPOLL_TAG_TXCONN + MAX_TX_CONNS)	/* first client slot */
 #define FILE_UMASK		(S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)
 #define PID_DIR			"/var/run/"
-#define LOG_DEBUG		"debug"
-#define LOG_INFO		"info"
-#define LOG_NOTICE		"notice"
-#define LOG_WARN		"warn"
-#define LOG_ERROR		"error"
 #define SYSFS_GPIO_UNEXPORT	"/sys/class/gpio/unexport"
+#define SYSFS_CPU_ISOLATED	"/sys/devices/system/cpu/isolated"
+#define PROC_RT_RUNTIME		"/proc/sys/kernel/sched_rt_runtime_us"
+#define HANDOFF_VERSION		2	/* state transfer protocol */
+#define HANDOFF_TIMEOUT_SEC	5	/* new instance waits for state */
+#define HANDOFF_DEDUP_US	50000	/* same code seen by both instances */
+#define HANDOFF_RING_CHUNK	64	/* history entries per message */
+#define HANDOFF_READY		1	/* message kinds */
+#define HANDOFF_STATE		2
+#define HANDOFF_RING		3
+#define HANDOFF_CLIENT		4
+#define HANDOFF_END		5
+#define HANDOFF_FD_SERVER	1	/* descriptors attached to state */
+#define HANDOFF_FD_METRICS	2
+#define HANDOFF_FD_SHM		4
+#define HANDOFF_FD_TX		8
+#define RT_ANALYZER_OFFSET	5	/* analyzer runs below ISR priority */
+#define RT_STACK_PREFAULT	(64 * 1024)	/* main stack touched at start */
+#ifndef MCL_ONFAULT
+#define MCL_ONFAULT		4	/* older libc headers */
+#endif
 
 /* ********************** */
 /* *  Global variables  * */
@@ -82,15 +173,224 @@ volatile int debugflag, clntrun;
 sem_t blinksem;		/* signal LED that it should blink */
 pthread_t blinkthread;
 int gpio, ledgpio, ledact;
-sem_t clientsem;	/* to synchronize access to client fd array */
-pthread_t clntaddthread;
+pthread_t srvthread;	/* network server thread */
 int srvsock;		/* server socket */
-int clntfd[MAX_CLIENTS];
-sem_t logsem;		/* log file semaphore */
+int epfd;		/* server epoll instance */
+int codepipe[2];	/* codes passed from receiver to server thread */
+int mcsock;		/* multicast socket (optional) */
+struct sockaddr_in mcsin;	/* multicast group and port */
+int mcrepeat;		/* previous messages repeated in each datagram */
+unsigned int mcsession;	/* multicast session ID (start time) */
+unsigned long mcerrors;	/* multicast send errors */
+struct radio433_shm shm;	/* shared memory ring (optional) */
+int mtsock;		/* metrics HTTP socket (optional) */
+int rtprio, rtcpu;	/* real-time profile: ISR priority, CPU (optional) */
+int nrxtypes, rxtypes[MAX_RX_TYPES];	/* received devices (optional) */
+int txgpio;		/* transmitter GPIO pin (optional) */
+int txsock;		/* transmit control socket */
+char txpath[sizeof(((struct sockaddr_un *)0)->sun_path)];
+pthread_t txthread;	/* transmitter thread */
+sem_t txsem;		/* requests waiting in transmit queue */
+int txdone[2];		/* transmit results passed to server thread */
+volatile unsigned int txwi, txri;	/* transmit queue write and read idx */
+struct radio433_jnl journal;	/* journal of published codes (optional) */
+char jnldir[PATH_MAX + 1];
+int jnlsize, jnlsegs;	/* segment size (MB), segments kept */
+int jnlrun;		/* journal writer thread is running */
+pthread_t jnlthread;	/* journal writer thread */
+sem_t jnlsem;		/* records waiting in journal queue */
+unsigned char jnlqueue[JOURNAL_QUEUE_LEN][RADIO433_MSG_BINSIZE];
+volatile unsigned int jnlwi, jnlri;	/* journal queue write and read idx */
+unsigned long jnlerrors;	/* journal write errors (writer thread) */
+int floodrate, floodburst;	/* per-code limit: codes per minute, burst */
+unsigned long long floodreport;	/* next suppressed codes summary (us) */
+int restartpipe[2];	/* SIGUSR2 handler wakes server thread */
+int hosock;		/* restart: socket to new instance */
+pid_t hopid;		/* restart: PID of new instance */
+int handofffd;		/* socket to previous instance until takeover */
+unsigned long long handoffts;	/* newest code published by previous instance */
+unsigned long long handoffseq;	/* first code published by this instance */
+char exepath[PATH_MAX + 1];	/* executable and arguments for restart */
+char **srvargv;
+int srvargc;
+volatile unsigned long pipeerrors;	/* codes lost between threads */
 pid_t procpid;
 volatile int logfd;
 char progname[PATH_MAX + 1], logfname[PATH_MAX + 1], pidfname[PATH_MAX + 1];
 
+struct radiocode {		/* code as received from radio library */
+	struct timeval ts;
+	int type, bits;
+	int codelen, repeats, interval;
+	unsigned long long code;
+};
+
+struct codeentry {		/* formatted message in publish ring */
+	unsigned long long seq;
+	unsigned long long ts;		/* timestamp in us */
+	unsigned long long code;
+	int type;
+	int len;
+	char msg[MAX_MSG_SIZE];
+	unsigned char bin[RADIO433_MSG_BINSIZE];
+	int dlen, dbinlen;		/* with decoded fields */
+	char dmsg[MAX_MSG_SIZE];
+	unsigned char dbin[RADIO433_MSG_MAXSIZE];
+} *codering;		/* publish ring, also history for replay */
+int histlen;		/* number of entries in publish ring */
+int histage;		/* maximum age of replayed messages in seconds */
+unsigned long long codeseq;	/* sequence number of next published message */
+
+struct subcode {			/* subscribed code (hash slot) */
+	unsigned long long code;
+	int type;
+	int used;
+};
+
+/* Clients do not own any buffer: each one keeps a cursor (sequence number)
+ * into the publish ring, so its output queue is the ring range between
+ * cursor and codeseq. Queue is bounded to CLIENT_QUEUE_LEN messages and
+ * oldest messages are dropped (and counted) when client falls behind.
+ * Replay moves cursor back into history, skipping messages that were
+ * already delivered live, so there is no gap or duplicate at the seam. */
+struct cliententry {
+	int fd;
+	struct in_addr addr;
+	unsigned long long seq;	/* next message to send */
+	int off;		/* bytes of current message already sent */
+	int replay;		/* 0 - live, 1 - pending, 2 - replaying, -1 - done */
+	unsigned long long first;	/* first live message (seq at connect) */
+	unsigned long long rstart;	/* first replayed message */
+	unsigned long long rskip;	/* end of messages sent live before replay */
+	int binary;		/* binary mode requested */
+	int msgbin;		/* current message sent as binary record */
+	int decode;		/* decoded fields requested */
+	int msgdec;		/* current message sent with decoded fields */
+	int cmdlen;		/* bytes in command buffer */
+	char cmd[MAX_CMD_SIZE];
+	int subs;		/* subscription filter active */
+	unsigned int classmask;	/* subscribed classes */
+	int ntypes, types[MAX_SUB_TYPES];	/* subscribed device types */
+	int ncodes;
+	struct subcode *codes;	/* subscribed codes, SUB_CODE_SLOTS hash */
+	int pollout;		/* EPOLLOUT armed (socket buffer full) */
+	unsigned long drops;	/* messages dropped due to slow reading */
+	unsigned long long bytes;	/* bytes sent */
+} clients[MAX_CLIENTS];
+
+/* Server statistics (updated by server thread only) */
+const unsigned int latbounds[LATENCY_BUCKETS] = {	/* in us */
+	1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000, 1000000
+};
+struct serverstats {
+	unsigned long accepted;		/* clients connected so far */
+	unsigned long long gonebytes;	/* bytes sent to disconnected clients */
+	unsigned long gonedrops;	/* and messages dropped */
+	unsigned long latency[LATENCY_BUCKETS + 1];	/* edge to publish */
+	unsigned long long latsum;	/* in us */
+	struct timespec edgets;		/* edge rate: previous sample */
+	unsigned long edges;
+	double edgerate;
+	unsigned long txok;		/* transmissions done */
+	unsigned long txfailed;
+	unsigned long dechits;		/* decode cache */
+	unsigned long decmisses;
+	unsigned long jnldrops;		/* journal queue full */
+	unsigned long long jnlrecords;	/* journaled by previous instances */
+	unsigned long floodsupp;	/* codes over rate limit */
+} srvstats;
+
+struct deccache {		/* decoded code (direct-mapped cache slot) */
+	unsigned long long code;
+	int type;		/* 0 - empty */
+	int flags;		/* RADIO433_MSG_FLAG_DECODED or _BADCODE */
+	struct radio433_dec dec;
+} deccache[DECODE_CACHE_SLOTS];
+
+/* Token bucket per (type, code), set-associative table: a new code evicts
+ * bucket seen least recently in its set. Bucket refills floodrate tokens
+ * per minute up to floodburst, each published code takes one. */
+struct floodbucket {
+	unsigned long long code;
+	int type;		/* 0 - empty */
+	unsigned long long tokens;	/* FLOOD_SCALE per code */
+	unsigned long long last;	/* previous code seen (us) */
+	unsigned long suppressed;	/* since previous summary */
+} floodtab[FLOOD_SLOTS];
+
+/* Transmit requests are queued by server thread and drained by single
+ * transmitter thread, result goes back through pipe to connection that
+ * sent the request (unless it was closed and slot reused meanwhile). */
+struct txrequest {
+	int conn;		/* transmit connection slot */
+	unsigned int gen;	/* and its generation */
+	int type;		/* device type or 0 for raw code */
+	int coding, bits, repeats;
+	unsigned long long code;
+} txqueue[TX_QUEUE_LEN];
+
+struct txresult {
+	int conn;
+	unsigned int gen;
+	int result;		/* radio library return code */
+};
+
+struct txconn {			/* connection to transmit control socket */
+	int fd;
+	unsigned int gen;
+	pid_t pid;		/* peer credentials */
+	uid_t uid;
+	int cmdlen;
+	char cmd[MAX_CMD_SIZE];
+} txconns[MAX_TX_CONNS];
+
+struct metricsconn {		/* HTTP connection to metrics endpoint */
+	int fd;
+	time_t since;
+	int reqlen;
+	char req[METRICS_REQ_SIZE];
+	char *out;		/* response (malloc'ed) */
+	size_t outlen, outpos;
+} mconns[MAX_METRICS_CONNS];
+
+/* Restart handoff messages (SOCK_SEQPACKET, one per datagram). New
+ * instance initializes receiver, then sends READY. Previous instance
+ * publishes codes still in pipe and sends STATE (with listening socket,
+ * metrics socket and shared memory ring attached), history RING chunks
+ * and one CLIENT per connection (with its socket attached), then END and
+ * exits. Both instances receive during handoff, codes published by
+ * previous instance are dropped by new one. Ring and clients are skipped
+ * if structure layout differs between versions, restart is refused if
+ * statistics layout in STATE differs. */
+struct handoffready {
+	int kind, version;
+	int clientsize, entrysize;	/* layout check */
+	int statssize;			/* state message carries stats */
+};
+
+struct handoffstate {
+	int kind, version;
+	int fds;			/* HANDOFF_FD_* attached, in this order */
+	char shmname[sizeof(shm.name)];
+	char txpath[sizeof(txpath)];
+	unsigned long long codeseq;
+	unsigned long long lastts;	/* newest published code */
+	unsigned int mcsession;
+	unsigned long mcerrors, pipeerrors;
+	struct serverstats stats;
+};
+
+struct handoffring {
+	int kind, count;
+	struct codeentry e[HANDOFF_RING_CHUNK];
+};
+
+struct handoffclient {
+	int kind, hascodes;
+	struct cliententry c;
+	struct subcode codes[SUB_CODE_SLOTS];
+};
+
 /* *************** */
 /* *  Functions  * */
 /* *************** */
@@ -98,7 +398,7 @@ char progname[PATH_MAX + 1], logfname[PATH_MAX + 1], pidfname[PATH_MAX + 1];
 /* Show help */
 void help(void)
 {
-	printf("Usage:\n\t%s -g gpio [-V] [-u user] [-d | -l logfile] [-P pidfile] [-L gpio:act] [-h ipaddr] [-p tcpport]\n\n", progname);
+	printf("Usage:\n\t%s -g gpio [-V] [-u user] [-d | -l logfile] [-P pidfile] [-L gpio:act] [-h ipaddr] [-p tcpport] [-H entries] [-A seconds] [-m group:port[:repeat]] [-S shmname] [-M [ipaddr:]port] [-R prio[:cpu]] [-t gpio [-T path]] [-J dir[:size[:count]]] [-F rate[:burst]] [-D type[,type...]]\n\n", progname);
 	puts("Where:");
 	puts("\t-g gpio     - GPIO pin with external RF receiver data (mandatory)");
 	puts("\t-u user     - name of the user to switch to (optional)");
@@ -108,9 +408,30 @@ void help(void)
 	puts("\t-L g:a      - LED to signal packet receiving (optional, g is BCM GPIO number and a is 0/1 for active low/high)");
 	printf("\t-h ipaddr   - IPv4 address to listen on (optional, default %s)\n", SERVER_ADDR);
 	printf("\t-p tcpport  - TCP port to listen on (optional, default is %d)\n", SERVER_PORT);
+	printf("\t-H entries  - number of messages kept in history (optional, default is %d)\n", HISTORY_LEN);
+	puts("\t-A seconds  - maximum age of replayed messages (optional, default is no limit)");
+	printf("\t-m g:p[:r]  - publish to UDP multicast group g port p, repeating r previous\n"
+	       "\t              messages in each datagram (optional, r is 0-%d, default 0)\n",
+	       RADIO433_MCAST_MAXREC - 1);
+	puts("\t-S shmname - publish to POSIX shared memory ring for local clients (optional, e.g. /radio433)");
+	printf("\t-M a:p      - serve Prometheus metrics over HTTP on address a (default %s) port p (optional)\n",
+	       METRICS_ADDR);
+	printf("\t-R p[:c]    - receive with SCHED_FIFO priority p (analyzer p-%d), pinned to CPU c\n"
+	       "\t              (optional, p 0 keeps default scheduling, memory is locked)\n",
+	       RT_ANALYZER_OFFSET);
+	puts("\t-t gpio     - GPIO pin with RF transmitter, enables transmit socket (optional)");
+	printf("\t-T path     - transmit control socket (optional, default is %s%s.sock)\n",
+	       PID_DIR, progname);
+	printf("\t-J d[:s[:c]] - append published codes to journal in directory d, segments of\n"
+	       "\t              s MB, c newest kept (optional, default %d MB, %d segments, 0 - all)\n",
+	       JOURNAL_SEGMENT_MB, JOURNAL_SEGMENTS);
+	printf("\t-F r[:b]    - pass each code at most r times per minute, b at once (optional,\n"
+	       "\t              default burst %d)\n", FLOOD_BURST);
+	puts("\t-D t[,t...] - receive only listed device types or classes (number or PWR, THM,\n"
+	     "\t              RMT), frames of other devices are rejected early (optional)");
 	puts("\t-V          - show version and exit");
 	puts("\nRecognized devices - Hyundai WS Senzor 77TH, Kemot Remote Power URZ1226 compatible");
-	puts("\nSignal actions: SIGHUP (log file truncate and reopen)\n");
+	puts("\nSignal actions: SIGHUP (log file truncate and reopen), SIGUSR2 (restart keeping clients)\n");
 }
 
 /* show version */
@@ -123,28 +444,6 @@ void verShow(void)
 #endif
 }
 
-/* Log line header */
-void logprintf(int fd, const char *level, const char *fmt, ...)
-{
-        struct timeval ts;
-        struct tm *tl;
-	va_list ap;
-
-	if (fd < 0)
-		return;
-	sem_wait(&logsem);
-	gettimeofday(&ts, NULL);
-	tl = localtime(&ts.tv_sec);
-	dprintf(fd, "%d-%02d-%02d %02d:%02d:%02d.%03u %s[%d] %s: ",
-		1900 + tl->tm_year, tl->tm_mon + 1, tl->tm_mday,
-		tl->tm_hour, tl->tm_min, tl->tm_sec, ts.tv_usec / 1000,
-		progname, procpid, level);
-	va_start(ap, fmt);
-	vdprintf(fd, fmt, ap);
-	va_end(ap);
-	sem_post(&logsem);
-}
-
 /* change ownership of log and pid files */
 void chownFiles(uid_t uid, gid_t gid)
 {
@@ -152,6 +451,8 @@ void chownFiles(uid_t uid, gid_t gid)
 		fchown(logfd, uid, gid);
 	if (pidfname[0])
 		chown(pidfname, uid, gid);
+	if (txsock >= 0)
+		chown(txpath, uid, gid);
 }
 
 /* drop super-user privileges */
@@ -200,6 +501,109 @@ int changeSched(void)
 	return 0;
 }
 
+/* Check if CPU is in kernel list (e.g. "1,3-5") */
+int cpuInList(const char *list, int cpu)
+{
+	int a, b, n;
+
+	while (*list) {
+		n = sscanf(list, "%d-%d", &a, &b);
+		if (n < 1)
+			break;
+		if (n == 1)
+			b = a;
+		if (cpu >= a && cpu <= b)
+			return 1;
+		list = strchr(list, ',');
+		if (list == NULL)
+			break;
+		list++;
+	}
+	return 0;
+}
+
+/* Read first line of system file, returns 0 on success */
+int readSysFile(const char *fname, char *buf, int size)
+{
+	FILE *f;
+
+	f = fopen(fname, "r");
+	if (f == NULL)
+		return -1;
+	if (fgets(buf, size, f) == NULL)
+		buf[0] = 0;
+	fclose(f);
+	buf[strcspn(buf, "\n")] = 0;
+	return 0;
+}
+
+/* Prepare process for real-time receiving: report system settings */
+/* that weaken the profile, allow threads to switch after privileges */
+/* are dropped, lock memory and fault in main stack */
+void setupRealtime(void)
+{
+	struct rlimit rl;
+	char buf[256];
+	volatile char stack[RT_STACK_PREFAULT];
+	int i, anaprio;
+
+	if (rtcpu >= 0) {
+		if (readSysFile(SYSFS_CPU_ISOLATED, buf, sizeof(buf)) ||
+		    !cpuInList(buf, rtcpu))
+			logprintf(logfd, LOG_WARN,
+				  "CPU %d is not isolated (isolcpus=), receive threads share it with other tasks\n",
+				  rtcpu);
+	}
+	if (rtprio > 0) {
+		if (!readSysFile(PROC_RT_RUNTIME, buf, sizeof(buf)) &&
+		    strcmp(buf, "-1"))
+			logprintf(logfd, LOG_NOTICE,
+				  "real-time throttling active (sched_rt_runtime_us=%s)\n",
+				  buf);
+		rl.rlim_cur = rl.rlim_max = rtprio;
+		if (setrlimit(RLIMIT_RTPRIO, &rl))
+			logprintf(logfd, LOG_WARN, "unable to raise RLIMIT_RTPRIO: %s\n",
+				  strerror(errno));
+	}
+	rl.rlim_cur = rl.rlim_max = RLIM_INFINITY;
+	if (setrlimit(RLIMIT_MEMLOCK, &rl))
+		logprintf(logfd, LOG_WARN, "unable to raise RLIMIT_MEMLOCK: %s\n",
+			  strerror(errno));
+	/* lock pages as they are touched, so thread stacks are not */
+	/* locked whole; real-time threads fault their stacks in */
+	if (mlockall(MCL_CURRENT | MCL_FUTURE | MCL_ONFAULT) &&
+	    (errno != EINVAL || mlockall(MCL_CURRENT | MCL_FUTURE)))
+		logprintf(logfd, LOG_WARN, "unable to lock memory: %s\n",
+			  strerror(errno));
+	for(i = 0; i < RT_STACK_PREFAULT; i += 256)
+		stack[i] = stack[i];
+	if (rtprio > RT_ANALYZER_OFFSET)
+		anaprio = rtprio - RT_ANALYZER_OFFSET;
+	else
+		anaprio = rtprio > 0;
+	Radio433_setRealtime(rtprio, anaprio, rtcpu);
+	logprintf(logfd, LOG_NOTICE, "real-time profile: ISR priority %d, analyzer priority %d, CPU %d\n",
+		  rtprio, anaprio, rtcpu);
+}
+
+/* Report state of real-time profile (ISR switches on first edge) */
+void reportRealtime(void)
+{
+	struct radio433_stats st;
+
+	Radio433_getStats(&st);
+	if (st.isrsched < 0)
+		logprintf(logfd, LOG_WARN, "real-time profile not applied to ISR thread: %s\n",
+			  strerror(-st.isrsched));
+	else if (st.isrsched > 0)
+		logprintf(logfd, LOG_NOTICE, "real-time profile applied to ISR thread\n");
+	if (st.anasched < 0)
+		logprintf(logfd, LOG_WARN, "real-time profile not applied to analyzer thread: %s\n",
+			  strerror(-st.anasched));
+	else if (st.anasched > 0)
+		logprintf(logfd, LOG_NOTICE, "real-time profile applied to analyzer thread\n");
+}
+
 #ifdef HAS_CPUFREQ
 /* verify if cpufreq governor prefers 'fixed' frequencies */
 /* (gpio timings require stable system clock) */
@@ -270,22 +674,100 @@ int unexportSysfsGPIO(int oipg)
 	return ws < 0 ? -1 : 0;
 }
 
+/* Journal writer thread, appends queued records in batches */
+void *journalThread(void *arg)
+{
+	unsigned int ri, n;
+	sigset_t blkset;
+
+	sigfillset(&blkset);
+	pthread_sigmask(SIG_BLOCK, &blkset, NULL);
+
+	for(;;) {
+		sem_wait(&jnlsem);
+		ri = jnlri;
+		n = __atomic_load_n(&jnlwi, __ATOMIC_ACQUIRE) - ri;
+		if (!n)
+			continue;	/* taken with previous batch */
+		if (n > JOURNAL_QUEUE_LEN - ri % JOURNAL_QUEUE_LEN)
+			n = JOURNAL_QUEUE_LEN - ri % JOURNAL_QUEUE_LEN;
+		if (Radio433_writeJournal(&journal, jnlqueue[ri % JOURNAL_QUEUE_LEN], n) &&
+		    !jnlerrors++)
+			logprintf(logfd, LOG_WARN, "unable to write journal: %s\n",
+				  strerror(errno));
+		__atomic_store_n(&jnlri, ri + n, __ATOMIC_RELEASE);
+	}
+}
+
+/* Wait until journal queue is written (restart) */
+void drainJournal(void)
+{
+	int i;
+
+	for(i = 0; i < HANDOFF_JNL_WAIT_MS / 10 &&
+	    __atomic_load_n(&jnlri, __ATOMIC_ACQUIRE) != jnlwi; i++)
+		usleep(10000);
+	/* writer is idle, new instance continues counting */
+	srvstats.jnlrecords += journal.records;
+	journal.records = 0;
+}
+
+/* Log codes suppressed since previous summary */
+void floodSummary(unsigned long long now)
+{
+	struct floodbucket *b;
+
+	for(b = floodtab; b < floodtab + FLOOD_SLOTS; b++)
+		if (b->suppressed) {
+			logprintf(logfd, LOG_WARN, "code 0x%llX (type 0x%04X) suppressed %lu times (rate limit)\n",
+				  b->code, b->type, b->suppressed);
+			b->suppressed = 0;
+		}
+	floodreport = now + FLOOD_REPORT_SEC * 1000000ULL;
+}
+
+/* Log summary when due, returns milliseconds until next one */
+/* (epoll_wait() timeout, summaries come even when no codes arrive) */
+int floodTimeout(void)
+{
+	struct timeval tv;
+	unsigned long long now;
+
+	if (!floodrate)
+		return -1;
+	gettimeofday(&tv, NULL);
+	now = tv.tv_sec * 1000000ULL + tv.tv_usec;
+	if (now >= floodreport)
+		floodSummary(now);
+	return (floodreport - now + 999) / 1000;
+}
+
 /* Process shutdown */
 void endProcess(int status)
 {
 	int i;
 
-	unlink(pidfname);
+	/* before takeover, files and GPIO belong to previous instance */
+	if (handofffd < 0) {
+		unlink(pidfname);
 
-	/* unexport gpios */
-	unexportSysfsGPIO(gpio);
+		/* unexport gpios */
+		unexportSysfsGPIO(gpio);
+	}
 
 	/* terminate threads regardless of semaphores */
 	if (clntrun) {
-		pthread_cancel(clntaddthread);
+		pthread_cancel(srvthread);
 		for(i = 0; i < MAX_CLIENTS; i++)
-			if (clntfd[i] >= 0)
-				close(clntfd[i]);
+			if (clients[i].fd >= 0)
+				close(clients[i].fd);
+	}
+	if (floodrate)
+		floodSummary(0);	/* server thread is gone */
+	if (jnlrun) {
+		drainJournal();		/* codes already published */
+		pthread_cancel(jnlthread);
+		Radio433_closeJournal(&journal);
 	}
 	if (ledgpio >= 0) {
 		pthread_cancel(blinkthread);
@@ -293,113 +775,1920 @@ void endProcess(int status)
 	}
 	if (srvsock >= 0)
 		close(srvsock);
+	if (mcsock >= 0)
+		close(mcsock);
+	if (mtsock >= 0)
+		close(mtsock);
+	if (txsock >= 0) {
+		close(txsock);
+		if (handofffd < 0)
+			unlink(txpath);
+	}
+	Radio433_destroyShm(&shm);
 	if (logfd >= 0) {
 		logprintf(logfd, LOG_NOTICE, "server shut down with code %d\n",
 			  status);
-		close(logfd);
+		DaemonLog_close();
+	}
+	exit(status);
+}
+
+/* Intercept TERM and INT signals */
+void signalQuit(int sig)
+{
+	logprintf(logfd, LOG_NOTICE, "signal %d received\n", sig);
+	endProcess(0);
+}
+
+/* SIGHUP - reopen log file, useful for logrotate (done by log writer) */
+void signalReopenLog(int sig)
+{
+	DaemonLog_reopen();
+}
+
+/* SIGUSR2 - restart, new instance takes over clients (done by server) */
+void signalRestart(int sig)
+{
+	write(restartpipe[1], "R", 1);
+}
+
+/* Find free slot in client table, return -1 if table full */
+int findFreeClient(void)
+{
+	int i;
+
+	i=0;
+	while(i < MAX_CLIENTS)
+       		if (clients[i].fd == -1)
+               		break;
+		else
+			i++;
+	if (i == MAX_CLIENTS)
+			i = -1;
+	return i;
+}
+
+/* Remove client from server */
+void removeClient(struct cliententry *c)
+{
+	logprintf(logfd, LOG_INFO,
+		  "client [%d] disconnected (%llu bytes sent, %lu messages dropped)\n",
+		  c->fd, c->bytes, c->drops);
+	srvstats.gonebytes += c->bytes;
+	srvstats.gonedrops += c->drops;
+	epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	c->fd = -1;
+	free(c->codes);
+	c->codes = NULL;
+}
+
+/* Accept all pending connections (listening socket is non-blocking) */
+void acceptClients(void)
+{
+	int i, clfd;
+	socklen_t clen;
+	struct sockaddr_in clin;
+	struct epoll_event ev;
+	struct cliententry *c;
+
+	for(;;) {
+		clen = sizeof(struct sockaddr_in);
+		clfd = accept4(srvsock, (struct sockaddr *)&clin, &clen,
+			       SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (clfd == -1) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				logprintf(logfd, LOG_WARN, "unable to accept client: %s\n",
+					  strerror(errno));
+			return;
+		}
+		i = findFreeClient();
+		if (i < 0) {
+			logprintf(logfd, LOG_WARN, "client limit reached\n");
+			close(clfd);
+			continue;
+		}
+		c = &clients[i];
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN | EPOLLRDHUP;
+		ev.data.u32 = EPOLL_TAG_CLIENT + i;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, clfd, &ev) == -1) {
+			logprintf(logfd, LOG_WARN, "unable to register client [%d]: %s\n",
+				  clfd, strerror(errno));
+			close(clfd);
+			continue;
+		}
+		c->fd = clfd;
+		c->addr = clin.sin_addr;
+		c->seq = codeseq;	/* only new codes are delivered */
+		c->first = codeseq;
+		c->replay = 0;
+		c->rskip = codeseq;
+		c->off = 0;
+		c->binary = 0;
+		c->msgbin = 0;
+		c->decode = 0;
+		c->msgdec = 0;
+		c->cmdlen = 0;
+		c->subs = 0;
+		c->classmask = 0;
+		c->ntypes = 0;
+		c->ncodes = 0;
+		c->pollout = 0;
+		c->drops = 0;
+		c->bytes = 0;
+		srvstats.accepted++;
+		logprintf(logfd, LOG_INFO,
+			  "client %s [%d] connected successfully\n",
+			  inet_ntoa(clin.sin_addr), clfd);
+	}
+}
+
+/* Arm or disarm EPOLLOUT for client */
+void setClientPollOut(struct cliententry *c, int on)
+{
+	struct epoll_event ev;
+
+	if (c->pollout == on)
+		return;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLRDHUP | (on ? EPOLLOUT : 0);
+	ev.data.u32 = EPOLL_TAG_CLIENT + (c - clients);
+	if (!epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev))
+		c->pollout = on;
+}
+
+/* Hash slot for subscribed code */
+unsigned int subCodeHash(int type, unsigned long long code)
+{
+	code ^= (unsigned long long)type << 48;
+	return (code * 0x9E3779B97F4A7C15ULL) >> 57;	/* 7 bits */
+}
+
+/* Find code in client hash: matching slot or free one to insert */
+struct subcode *findSubCode(struct cliententry *c, int type,
+			    unsigned long long code)
+{
+	unsigned int h;
+	struct subcode *sc;
+
+	h = subCodeHash(type, code);
+	for(;;) {
+		sc = &c->codes[h];
+		if (!sc->used || (sc->type == type && sc->code == code))
+			return sc;
+		h = (h + 1) & (SUB_CODE_SLOTS - 1);
+	}
+}
+
+/* Check if message matches client subscriptions */
+int clientMatch(struct cliententry *c, struct codeentry *e)
+{
+	int i;
+
+	if (!c->subs || (e->type & c->classmask))
+		return 1;
+	for(i = 0; i < c->ntypes; i++)
+		if (c->types[i] == e->type)
+			return 1;
+	return c->ncodes && findSubCode(c, e->type, e->code)->used;
+}
+
+/* Apply drop-oldest policy to client queue */
+/* (message partially sent is never dropped) */
+void trimClientQueue(struct cliententry *c)
+{
+	unsigned long long skip;
+
+	if (c->off || c->replay > 0 || codeseq - c->seq <= CLIENT_QUEUE_LEN)
+		return;
+	skip = codeseq - c->seq - CLIENT_QUEUE_LEN;
+	while (skip--) {
+		if (clientMatch(c, &codering[c->seq % histlen])) {
+			if (!c->drops)	/* total is reported on disconnect */
+				logprintf(logfd, LOG_WARN,
+					  "client [%d] too slow, dropping oldest messages\n",
+					  c->fd);
+			c->drops++;
+		}
+		c->seq++;
+	}
+}
+
+/* Send as much of client queue as socket accepts without blocking */
+/* (return -1 if client has been removed) */
+int flushClient(struct cliententry *c)
+{
+	int n, len;
+	struct codeentry *e;
+	void *msg;
+
+	while (c->seq < codeseq || c->replay == 1) {
+		if (!c->off && c->replay > 0) {
+			if (c->replay == 1) {	/* start replay between messages */
+				c->seq = c->rstart;
+				c->replay = 2;
+			}
+			if (c->seq >= c->first) {	/* replay complete */
+				c->seq = c->rskip;
+				c->replay = -1;
+				logprintf(logfd, LOG_INFO, "client [%d] replay complete\n",
+					  c->fd);
+				continue;
+			}
+		}
+		trimClientQueue(c);
+		e = &codering[c->seq % histlen];
+		if (e->seq != c->seq) {
+			/* partially sent message overwritten in ring */
+			c->seq++;
+			c->drops++;
+			c->off = 0;
+			continue;
+		}
+		if (!c->off) {
+			if (!clientMatch(c, e)) {
+				c->seq++;
+				continue;
+			}
+			c->msgbin = c->binary;	/* mode changes between messages */
+			c->msgdec = c->decode;
+		}
+		if (c->msgbin && c->msgdec) {
+			msg = e->dbin;
+			len = e->dbinlen;
+		} else if (c->msgbin) {
+			msg = e->bin;
+			len = RADIO433_MSG_BINSIZE;
+		} else if (c->msgdec) {
+			msg = e->dmsg;
+			len = e->dlen;
+		} else {
+			msg = e->msg;
+			len = e->len;
+		}
+		n = send(c->fd, (char *)msg + c->off, len - c->off,
+			 MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				setClientPollOut(c, 1);
+				return 0;
+			}
+			removeClient(c);
+			return -1;
+		}
+		c->bytes += n;
+		c->off += n;
+		if (c->off == len) {
+			if (debugflag)
+				logprintf(logfd, LOG_DEBUG,
+					  "message sent to client [%d], %d bytes\n",
+					  c->fd, len);
+			c->seq++;
+			c->off = 0;
+		}
+	}
+	setClientPollOut(c, 0);
+	return 0;
+}
+
+/* Find first history message not older than ts (in us) */
+unsigned long long findHistoryTime(unsigned long long ts)
+{
+	unsigned long long seq;
+
+	seq = codeseq;
+	while (seq > 0 && codeseq - seq < histlen &&
+	       codering[(seq - 1) % histlen].ts >= ts)
+		seq--;
+	return seq;
+}
+
+/* Schedule replay of history messages, return -1 if request is invalid */
+int clientReplay(struct cliententry *c, char *arg)
+{
+	unsigned long long v, start;
+	struct timeval now;
+
+	if (c->replay)
+		return -1;	/* one replay per connection */
+	if (sscanf(arg, "SEQ %llu", &v) == 1)
+		start = v;
+	else if (sscanf(arg, "TIME %llu", &v) == 1)
+		start = findHistoryTime(v);
+	else
+		return -1;
+	/* limit to messages still in history */
+	if (codeseq > histlen && start < codeseq - histlen)
+		start = codeseq - histlen;
+	if (histage) {
+		gettimeofday(&now, NULL);
+		v = findHistoryTime((now.tv_sec - histage) * 1000000ULL +
+				    now.tv_usec);
+		if (v > start)
+			start = v;
+	}
+	/* messages already sent live (including partial one) are skipped */
+	c->rskip = c->seq + (c->off ? 1 : 0);
+	if (start >= c->first) {
+		c->replay = -1;	/* nothing to replay */
+		return 0;
+	}
+	c->rstart = start;
+	c->replay = 1;	/* flushClient() starts it between messages */
+	logprintf(logfd, LOG_INFO, "client [%d] requested replay of %llu messages\n",
+		  c->fd, c->first - start);
+	return 0;
+}
+
+/* Add subscription, return -1 if limit is reached */
+int clientSubscribe(struct cliententry *c, char *arg)
+{
+	int i, type;
+	unsigned long long code;
+	struct subcode *sc;
+
+	if (sscanf(arg, "CLASS %i", &type) == 1)
+		c->classmask |= type;
+	else if (sscanf(arg, "TYPE %i", &type) == 1) {
+		for(i = 0; i < c->ntypes; i++)
+			if (c->types[i] == type)
+				break;
+		if (i == c->ntypes) {
+			if (c->ntypes == MAX_SUB_TYPES)
+				return -1;
+			c->types[c->ntypes++] = type;
+		}
+	} else if (sscanf(arg, "CODE %i %lli", &type, &code) == 2) {
+		if (c->codes == NULL) {
+			c->codes = calloc(SUB_CODE_SLOTS, sizeof(struct subcode));
+			if (c->codes == NULL)
+				return -1;
+		}
+		sc = findSubCode(c, type, code);
+		if (!sc->used) {
+			if (c->ncodes == MAX_SUB_CODES)
+				return -1;
+			sc->type = type;
+			sc->code = code;
+			sc->used = 1;
+			c->ncodes++;
+		}
+	} else if (!strcmp(arg, "ALL")) {
+		c->subs = 0;
+		c->classmask = 0;
+		c->ntypes = 0;
+		c->ncodes = 0;
+		free(c->codes);
+		c->codes = NULL;
+		return 0;
+	} else
+		return -1;
+	c->subs = 1;
+	return 0;
+}
+
+/* Execute client command line */
+void clientCommand(struct cliententry *c, char *line)
+{
+	if (!strcmp(line, "MODE BIN") || !strcmp(line, "MODE TEXT")) {
+		c->binary = line[5] == 'B';
+		logprintf(logfd, LOG_INFO, "client [%d] switched to %s mode\n",
+			  c->fd, c->binary ? "binary" : "text");
+	} else if (!strcmp(line, "MODE DECODE") || !strcmp(line, "MODE RAW")) {
+		c->decode = line[5] == 'D';
+		logprintf(logfd, LOG_INFO, "client [%d] %s decoded fields\n",
+			  c->fd, c->decode ? "requested" : "dropped");
+	} else if (!strncmp(line, "SUB ", 4)) {
+		if (clientSubscribe(c, line + 4))
+			logprintf(logfd, LOG_WARN,
+				  "invalid subscription from client [%d]: %s\n",
+				  c->fd, line);
+		else if (debugflag)
+			logprintf(logfd, LOG_DEBUG, "client [%d] subscription: %s\n",
+				  c->fd, line + 4);
+	} else if (!strncmp(line, "REPLAY ", 7)) {
+		if (clientReplay(c, line + 7))
+			logprintf(logfd, LOG_WARN,
+				  "invalid replay request from client [%d]: %s\n",
+				  c->fd, line);
+	} else
+		logprintf(logfd, LOG_WARN, "unknown command from client [%d]\n",
+			  c->fd);
+}
+
+/* Read commands sent by client and detect closed connection */
+/* (return -1 if client has been removed) */
+int readClient(struct cliententry *c)
+{
+	int i, n;
+	char *eol;
+
+	for(;;) {
+		if (c->cmdlen == MAX_CMD_SIZE)
+			c->cmdlen = 0;	/* line too long, discard */
+		n = recv(c->fd, c->cmd + c->cmdlen, MAX_CMD_SIZE - c->cmdlen,
+			 MSG_DONTWAIT);
+		if (n > 0) {
+			c->cmdlen += n;
+			while ((eol = memchr(c->cmd, '\n', c->cmdlen)) != NULL) {
+				*eol = 0;
+				i = eol - c->cmd;
+				if (i && eol[-1] == '\r')
+					eol[-1] = 0;
+				clientCommand(c, c->cmd);
+				c->cmdlen -= i + 1;
+				memmove(c->cmd, eol + 1, c->cmdlen);
+			}
+			continue;
+		}
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return 0;
+		removeClient(c);
+		return -1;
+	}
+}
+
+/* Decode known device code into message fields, validity is checked */
+/* here for all clients (repeated codes are served from cache) */
+void decodeCode(struct radio433_msg *m)
+{
+	unsigned long long h;
+	struct deccache *dc;
+
+	if (m->type != RADIO433_DEVICE_KEMOTURZ1226 &&
+	    m->type != RADIO433_DEVICE_HYUWSSENZOR77TH)
+		return;
+	h = (m->code ^ (unsigned long long)m->type << 48) * 0x9E3779B97F4A7C15ULL;
+	dc = &deccache[h >> 56 & (DECODE_CACHE_SLOTS - 1)];
+	if (dc->type == m->type && dc->code == m->code) {
+		srvstats.dechits++;
+		m->flags |= dc->flags;
+		m->dec = dc->dec;
+		return;
+	}
+	srvstats.decmisses++;
+	Radio433_decodeMsg(m);
+	dc->type = m->type;
+	dc->code = m->code;
+	dc->flags = m->flags & (RADIO433_MSG_FLAG_DECODED | RADIO433_MSG_FLAG_BADCODE);
+	dc->dec = m->dec;
+}
+
+/* Put new code into publish ring */
+void publishCode(struct radiocode *rc)
+{
+	struct codeentry *e;
+	struct radio433_msg m;
+	struct timeval now;
+	long long lat;
+	int i;
+
+	m.ts = rc->ts.tv_sec * 1000000ULL + rc->ts.tv_usec;
+	m.seq = codeseq;
+	m.code = rc->code;
+	m.type = rc->type;
+	m.bits = rc->bits;
+	m.codetime = rc->codelen;
+	m.repeats = rc->repeats;
+	m.interval = rc->interval;
+	m.flags = 0;
+	e = &codering[codeseq % histlen];
+	e->seq = codeseq;
+	e->ts = m.ts;
+	e->code = rc->code;
+	e->type = rc->type;
+	e->len = Radio433_formatMsg(e->msg, &m);
+	Radio433_packMsg(e->bin, &m);
+	if (shm.hdr != NULL)
+		Radio433_publishShm(&shm, &m);
+	/* variant for clients in decode mode */
+	decodeCode(&m);
+	e->dlen = Radio433_formatMsg(e->dmsg, &m);
+	e->dbinlen = Radio433_packMsg(e->dbin, &m);
+	if (jnlrun) {
+		if (jnlwi - __atomic_load_n(&jnlri, __ATOMIC_ACQUIRE) < JOURNAL_QUEUE_LEN) {
+			memcpy(jnlqueue[jnlwi % JOURNAL_QUEUE_LEN], e->bin,
+			       RADIO433_MSG_BINSIZE);
+			__atomic_store_n(&jnlwi, jnlwi + 1, __ATOMIC_RELEASE);
+			sem_post(&jnlsem);
+		} else {
+			if (!srvstats.jnldrops)
+				logprintf(logfd, LOG_WARN, "journal writer too slow, dropping records\n");
+			srvstats.jnldrops++;
+		}
+	}
+	gettimeofday(&now, NULL);
+	lat = (now.tv_sec - rc->ts.tv_sec) * 1000000LL +
+	      now.tv_usec - rc->ts.tv_usec;
+	if (lat < 0)
+		lat = 0;
+	for(i = 0; i < LATENCY_BUCKETS && lat > latbounds[i]; i++)
+		;
+	srvstats.latency[i]++;
+	srvstats.latsum += lat;
+	if (debugflag)
+		logprintf(logfd, LOG_DEBUG, "sending message (%d bytes): %s",
+			  e->len, e->msg);
+	codeseq++;
+}
+
+/* Send newest message (with previous ones) to multicast group */
+void publishMcast(void)
+{
+	int i, len;
+	unsigned char dgram[RADIO433_MCAST_HDRSIZE +
+			    RADIO433_MCAST_MAXREC * RADIO433_MSG_BINSIZE];
+
+	len = RADIO433_MCAST_HDRSIZE;
+	for(i = 0; i <= mcrepeat && i < codeseq; i++) {
+		memcpy(dgram + len, codering[(codeseq - 1 - i) % histlen].bin,
+		       RADIO433_MSG_BINSIZE);
+		len += RADIO433_MSG_BINSIZE;
+	}
+	Radio433_packMcastHdr(dgram, mcsession, i);
+	if (sendto(mcsock, dgram, len, MSG_DONTWAIT, (struct sockaddr *)&mcsin,
+		   sizeof(mcsin)) == -1) {
+		if (!mcerrors)
+			logprintf(logfd, LOG_WARN, "unable to send multicast datagram: %s\n",
+				  strerror(errno));
+		mcerrors++;
+	}
+}
+
+/* Check if code was already published by previous instance */
+/* (both receive while new one takes over) */
+int handoffDuplicate(struct radiocode *rc)
+{
+	unsigned long long ts, seq;
+	struct codeentry *e;
+
+	ts = rc->ts.tv_sec * 1000000ULL + rc->ts.tv_usec;
+	if (ts > handoffts + HANDOFF_DEDUP_US) {
+		handoffts = 0;	/* past handoff, stop checking */
+		return 0;
+	}
+	if (ts + HANDOFF_DEDUP_US <= handoffts)
+		return 1;
+	for(seq = handoffseq; seq > 0 && handoffseq - seq < histlen; seq--) {
+		e = &codering[(seq - 1) % histlen];
+		if (e->seq != seq - 1 || e->ts + HANDOFF_DEDUP_US < ts)
+			break;
+		if (e->type == rc->type && e->code == rc->code &&
+		    e->ts <= ts + HANDOFF_DEDUP_US)
+			return 1;
+	}
+	return 0;
+}
+
+/* Check code against its token bucket, returns 1 if over limit */
+int floodSuppress(struct radiocode *rc)
+{
+	unsigned long long h, ts, max;
+	struct floodbucket *set, *b;
+	int i;
+
+	ts = rc->ts.tv_sec * 1000000ULL + rc->ts.tv_usec;
+	max = floodburst * FLOOD_SCALE;
+	h = (rc->code ^ (unsigned long long)rc->type << 48) * 0x9E3779B97F4A7C15ULL;
+	set = &floodtab[h >> 56 & (FLOOD_SLOTS - FLOOD_WAYS)];
+	b = set;
+	for(i = 0; i < FLOOD_WAYS; i++) {
+		if (set[i].type == rc->type && set[i].code == rc->code) {
+			b = &set[i];
+			break;
+		}
+		if (set[i].last < b->last)	/* empty ones first */
+			b = &set[i];
+	}
+	if (i == FLOOD_WAYS) {
+		if (b->suppressed)
+			logprintf(logfd, LOG_WARN, "code 0x%llX (type 0x%04X) suppressed %lu times (rate limit)\n",
+				  b->code, b->type, b->suppressed);
+		b->code = rc->code;
+		b->type = rc->type;
+		b->tokens = max;
+		b->last = ts;
+		b->suppressed = 0;
+	}
+	if (ts > b->last) {
+		if (ts - b->last >= (max - b->tokens) / floodrate)
+			b->tokens = max;	/* also avoids overflow */
+		else
+			b->tokens += (ts - b->last) * floodrate;
+		b->last = ts;
+	}
+	if (b->tokens >= FLOOD_SCALE) {
+		b->tokens -= FLOOD_SCALE;
+		return 0;
+	}
+	b->suppressed++;
+	srvstats.floodsupp++;
+	return 1;
+}
+
+/* Read codes from receiver, publish them and update all clients */
+void updateClients(void)
+{
+	int i, n;
+	struct radiocode rc;
+
+	n = 0;
+	while (read(codepipe[0], &rc, sizeof(rc)) == sizeof(rc)) {
+		if (handoffts && handoffDuplicate(&rc))
+			continue;
+		if (floodrate && floodSuppress(&rc))
+			continue;
+		publishCode(&rc);
+		if (mcsock >= 0)
+			publishMcast();
+		n++;
+	}
+	if (!n)
+		return;
+	for(i = 0; i < MAX_CLIENTS; i++)
+		if (clients[i].fd >= 0) {
+			if (clients[i].pollout)
+				trimClientQueue(&clients[i]);	/* wait for EPOLLOUT */
+			else
+				flushClient(&clients[i]);
+		}
+}
+
+/* Close metrics connection */
+void closeMetrics(struct metricsconn *mc)
+{
+	epoll_ctl(epfd, EPOLL_CTL_DEL, mc->fd, NULL);
+	close(mc->fd);
+	mc->fd = -1;
+	free(mc->out);
+	mc->out = NULL;
+}
+
+/* Accept metrics connections, oldest one is dropped when table is full */
+void acceptMetrics(void)
+{
+	int i, j, fd;
+	struct epoll_event ev;
+	struct metricsconn *mc;
+
+	for(;;) {
+		fd = accept4(mtsock, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd == -1) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			return;
+		}
+		j = 0;
+		for(i = 0; i < MAX_METRICS_CONNS; i++) {
+			if (mconns[i].fd == -1)
+				break;
+			if (mconns[i].since < mconns[j].since)
+				j = i;
+		}
+		if (i == MAX_METRICS_CONNS) {
+			closeMetrics(&mconns[j]);
+			i = j;
+		}
+		mc = &mconns[i];
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN | EPOLLRDHUP;
+		ev.data.u32 = EPOLL_TAG_HTTP + i;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+			close(fd);
+			continue;
+		}
+		mc->fd = fd;
+		mc->since = time(NULL);
+		mc->reqlen = 0;
+		mc->outlen = 0;
+		mc->outpos = 0;
+	}
+}
+
+/* Write Prometheus text exposition of all counters */
+void writeMetrics(FILE *f)
+{
+	struct radio433_stats st;
+	struct timespec now;
+	struct cliententry *c;
+	unsigned long long bytes;
+	unsigned long drops, cum;
+	double dt;
+	int i, n;
+
+	Radio433_getStats(&st);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	dt = now.tv_sec - srvstats.edgets.tv_sec +
+	     (now.tv_nsec - srvstats.edgets.tv_nsec) / 1e9;
+	if (dt >= 1.0) {	/* average since previous scrape */
+		if (srvstats.edgets.tv_sec)
+			srvstats.edgerate = (st.edges - srvstats.edges) / dt;
+		srvstats.edgets = now;
+		srvstats.edges = st.edges;
+	}
+
+	fputs("# HELP radio433_edges_total GPIO edges seen by receiver.\n"
+	      "# TYPE radio433_edges_total counter\n", f);
+	fprintf(f, "radio433_edges_total %lu\n", st.edges);
+	fputs("# HELP radio433_edges_per_second GPIO edge rate since previous scrape.\n"
+	      "# TYPE radio433_edges_per_second gauge\n", f);
+	fprintf(f, "radio433_edges_per_second %.1f\n", srvstats.edgerate);
+	fputs("# HELP radio433_noise_pulses_total Pulses rejected as noise inside frame.\n"
+	      "# TYPE radio433_noise_pulses_total counter\n", f);
+	fprintf(f, "radio433_noise_pulses_total %lu\n", st.noise);
+	fputs("# HELP radio433_frames_total Frames handed to analyzer.\n"
+	      "# TYPE radio433_frames_total counter\n", f);
+	fprintf(f, "radio433_frames_total %lu\n", st.frames);
+	fputs("# HELP radio433_frames_rejected_total Frames not matching any device.\n"
+	      "# TYPE radio433_frames_rejected_total counter\n", f);
+	fprintf(f, "radio433_frames_rejected_total %lu\n", st.rejected);
+	fputs("# HELP radio433_decodes_total Codes decoded per device type.\n"
+	      "# TYPE radio433_decodes_total counter\n", f);
+	for(i = 0; i < RADIO433_DEVICES; i++)
+		fprintf(f, "radio433_decodes_total{type=\"0x%04X\"} %lu\n",
+			st.types[i], st.decodes[i]);
+	fputs("# HELP radio433_decode_failures_total Decoding failures after valid sync by bit position.\n"
+	      "# TYPE radio433_decode_failures_total counter\n", f);
+	for(i = 0; i < RADIO433_STATS_BITS; i++)
+		if (st.failbit[i])
+			fprintf(f, "radio433_decode_failures_total{bit=\"%d\"} %lu\n",
+				i, st.failbit[i]);
+	fputs("# HELP radio433_ring_depth Entries waiting in receiver ring.\n"
+	      "# TYPE radio433_ring_depth gauge\n", f);
+	fprintf(f, "radio433_ring_depth{ring=\"timing\"} %d\n", st.timingdepth);
+	fprintf(f, "radio433_ring_depth{ring=\"code\"} %d\n", st.codedepth);
+	fputs("# HELP radio433_ring_depth_max Receiver ring high-water mark.\n"
+	      "# TYPE radio433_ring_depth_max gauge\n", f);
+	fprintf(f, "radio433_ring_depth_max{ring=\"timing\"} %d\n", st.timingmax);
+	fprintf(f, "radio433_ring_depth_max{ring=\"code\"} %d\n", st.codemax);
+	fputs("# HELP radio433_ring_overruns_total Entries overwritten before processing.\n"
+	      "# TYPE radio433_ring_overruns_total counter\n", f);
+	fprintf(f, "radio433_ring_overruns_total{ring=\"timing\"} %lu\n",
+		st.timingoverruns);
+	fprintf(f, "radio433_ring_overruns_total{ring=\"code\"} %lu\n",
+		st.codeoverruns);
+	fprintf(f, "radio433_ring_overruns_total{ring=\"pipe\"} %lu\n",
+		pipeerrors);
+	if (rtprio > 0 || rtcpu >= 0) {
+		fputs("# HELP radio433_realtime_profile Real-time profile state (1 applied, 0 pending, -errno failed).\n"
+		      "# TYPE radio433_realtime_profile gauge\n", f);
+		fprintf(f, "radio433_realtime_profile{thread=\"isr\"} %d\n", st.isrsched);
+		fprintf(f, "radio433_realtime_profile{thread=\"analyzer\"} %d\n", st.anasched);
+	}
+	fputs("# HELP radio433_published_total Messages published to clients.\n"
+	      "# TYPE radio433_published_total counter\n", f);
+	fprintf(f, "radio433_published_total %llu\n", codeseq);
+	fputs("# HELP radio433_publish_latency_seconds Time from first edge of frame to publishing.\n"
+	      "# TYPE radio433_publish_latency_seconds histogram\n", f);
+	cum = 0;
+	for(i = 0; i < LATENCY_BUCKETS; i++) {
+		cum += srvstats.latency[i];
+		fprintf(f, "radio433_publish_latency_seconds_bucket{le=\"%g\"} %lu\n",
+			latbounds[i] / 1e6, cum);
+	}
+	cum += srvstats.latency[LATENCY_BUCKETS];
+	fprintf(f, "radio433_publish_latency_seconds_bucket{le=\"+Inf\"} %lu\n", cum);
+	fprintf(f, "radio433_publish_latency_seconds_sum %.6f\n",
+		srvstats.latsum / 1e6);
+	fprintf(f, "radio433_publish_latency_seconds_count %lu\n", cum);
+	fputs("# HELP radio433_decode_cache_total Decode cache lookups for known devices.\n"
+	      "# TYPE radio433_decode_cache_total counter\n", f);
+	fprintf(f, "radio433_decode_cache_total{result=\"hit\"} %lu\n",
+		srvstats.dechits);
+	fprintf(f, "radio433_decode_cache_total{result=\"miss\"} %lu\n",
+		srvstats.decmisses);
+	if (jnlrun) {
+		fputs("# HELP radio433_journal_records_total Records appended to journal.\n"
+		      "# TYPE radio433_journal_records_total counter\n", f);
+		fprintf(f, "radio433_journal_records_total %llu\n",
+			srvstats.jnlrecords + journal.records);
+		fputs("# HELP radio433_journal_dropped_total Records not journaled (queue full).\n"
+		      "# TYPE radio433_journal_dropped_total counter\n", f);
+		fprintf(f, "radio433_journal_dropped_total %lu\n", srvstats.jnldrops);
+		fputs("# HELP radio433_journal_errors_total Journal write errors.\n"
+		      "# TYPE radio433_journal_errors_total counter\n", f);
+		fprintf(f, "radio433_journal_errors_total %lu\n", jnlerrors);
+	}
+	if (floodrate) {
+		for(i = 0, n = 0; i < FLOOD_SLOTS; i++)
+			if (floodtab[i].suppressed)
+				n++;
+		fputs("# HELP radio433_rate_limited_total Codes suppressed by per-code rate limit.\n"
+		      "# TYPE radio433_rate_limited_total counter\n", f);
+		fprintf(f, "radio433_rate_limited_total %lu\n", srvstats.floodsupp);
+		fputs("# HELP radio433_rate_limited_codes Codes suppressed since previous summary.\n"
+		      "# TYPE radio433_rate_limited_codes gauge\n", f);
+		fprintf(f, "radio433_rate_limited_codes %d\n", n);
+	}
+	if (txsock >= 0) {
+		fputs("# HELP radio433_transmitted_total Transmit requests completed.\n"
+		      "# TYPE radio433_transmitted_total counter\n", f);
+		fprintf(f, "radio433_transmitted_total{result=\"ok\"} %lu\n",
+			srvstats.txok);
+		fprintf(f, "radio433_transmitted_total{result=\"failed\"} %lu\n",
+			srvstats.txfailed);
+		fputs("# HELP radio433_transmit_queue Transmit requests waiting.\n"
+		      "# TYPE radio433_transmit_queue gauge\n", f);
+		fprintf(f, "radio433_transmit_queue %u\n",
+			txwi - __atomic_load_n(&txri, __ATOMIC_ACQUIRE));
+	}
+	if (mcsock >= 0) {
+		fputs("# HELP radio433_multicast_errors_total Multicast datagrams not sent.\n"
+		      "# TYPE radio433_multicast_errors_total counter\n", f);
+		fprintf(f, "radio433_multicast_errors_total %lu\n", mcerrors);
+	}
+
+	n = 0;
+	bytes = srvstats.gonebytes;
+	drops = srvstats.gonedrops;
+	for(i = 0; i < MAX_CLIENTS; i++)
+		if (clients[i].fd >= 0) {
+			n++;
+			bytes += clients[i].bytes;
+			drops += clients[i].drops;
+		}
+	fputs("# HELP radio433_clients Connected clients.\n"
+	      "# TYPE radio433_clients gauge\n", f);
+	fprintf(f, "radio433_clients %d\n", n);
+	fputs("# HELP radio433_clients_accepted_total Client connections accepted.\n"
+	      "# TYPE radio433_clients_accepted_total counter\n", f);
+	fprintf(f, "radio433_clients_accepted_total %lu\n", srvstats.accepted);
+	fputs("# HELP radio433_sent_bytes_total Bytes sent to all clients.\n"
+	      "# TYPE radio433_sent_bytes_total counter\n", f);
+	fprintf(f, "radio433_sent_bytes_total %llu\n", bytes);
+	fputs("# HELP radio433_dropped_total Messages dropped for slow clients.\n"
+	      "# TYPE radio433_dropped_total counter\n", f);
+	fprintf(f, "radio433_dropped_total %lu\n", drops);
+	fputs("# HELP radio433_client_sent_bytes Bytes sent to connected client.\n"
+	      "# TYPE radio433_client_sent_bytes gauge\n", f);
+	for(i = 0; i < MAX_CLIENTS; i++) {
+		c = &clients[i];
+		if (c->fd >= 0)
+			fprintf(f, "radio433_client_sent_bytes{client=\"%d\",addr=\"%s\"} %llu\n",
+				c->fd, inet_ntoa(c->addr), c->bytes);
+	}
+	fputs("# HELP radio433_client_dropped Messages dropped for connected client.\n"
+	      "# TYPE radio433_client_dropped gauge\n", f);
+	for(i = 0; i < MAX_CLIENTS; i++) {
+		c = &clients[i];
+		if (c->fd >= 0)
+			fprintf(f, "radio433_client_dropped{client=\"%d\",addr=\"%s\"} %lu\n",
+				c->fd, inet_ntoa(c->addr), c->drops);
+	}
+	fputs("# HELP radio433_client_queue Messages queued for connected client.\n"
+	      "# TYPE radio433_client_queue gauge\n", f);
+	for(i = 0; i < MAX_CLIENTS; i++) {
+		c = &clients[i];
+		if (c->fd >= 0)
+			fprintf(f, "radio433_client_queue{client=\"%d\",addr=\"%s\"} %llu\n",
+				c->fd, inet_ntoa(c->addr), codeseq - c->seq);
+	}
+}
+
+/* Prepare HTTP response for request line */
+void buildMetricsResponse(struct metricsconn *mc)
+{
+	FILE *f;
+	char *body;
+	size_t blen;
+	int ok;
+
+	ok = !strncmp(mc->req, "GET /metrics ", 13) || !strncmp(mc->req, "GET / ", 6);
+	body = NULL;
+	blen = 0;
+	f = open_memstream(&body, &blen);
+	if (f == NULL) {
+		mc->out = NULL;
+		return;
+	}
+	if (ok)
+		writeMetrics(f);
+	else
+		fputs("Not found\n", f);
+	fclose(f);
+	mc->out = NULL;
+	mc->outlen = 0;
+	f = open_memstream(&mc->out, &mc->outlen);
+	if (f != NULL) {
+		fprintf(f, "HTTP/1.0 %s\r\n"
+			"Content-Type: text/plain; version=0.0.4\r\n"
+			"Content-Length: %zu\r\n"
+			"Connection: close\r\n\r\n",
+			ok ? "200 OK" : "404 Not Found", blen);
+		fwrite(body, 1, blen, f);
+		fclose(f);
+	}
+	free(body);
+}
+
+/* Handle metrics connection event */
+void serveMetrics(struct metricsconn *mc, unsigned int events)
+{
+	struct epoll_event ev;
+	char *eol;
+	int n;
+
+	if (mc->fd < 0)
+		return;
+	if (events & (EPOLLERR | EPOLLHUP)) {
+		closeMetrics(mc);
+		return;
+	}
+	if (mc->out == NULL) {
+		/* collect request line, headers are ignored */
+		n = recv(mc->fd, mc->req + mc->reqlen,
+			 METRICS_REQ_SIZE - 1 - mc->reqlen, MSG_DONTWAIT);
+		if (n == -1 && (errno == EAGAIN || errno == EINTR))
+			return;
+		if (n <= 0) {
+			closeMetrics(mc);
+			return;
+		}
+		mc->reqlen += n;
+		mc->req[mc->reqlen] = 0;
+		eol = strchr(mc->req, '\n');
+		if (eol == NULL && mc->reqlen < METRICS_REQ_SIZE - 1)
+			return;
+		buildMetricsResponse(mc);
+		if (mc->out == NULL) {
+			closeMetrics(mc);
+			return;
+		}
+		shutdown(mc->fd, SHUT_RD);
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLOUT;
+		ev.data.u32 = EPOLL_TAG_HTTP + (mc - mconns);
+		epoll_ctl(epfd, EPOLL_CTL_MOD, mc->fd, &ev);
+	}
+	while (mc->outpos < mc->outlen) {
+		n = send(mc->fd, mc->out + mc->outpos, mc->outlen - mc->outpos,
+			 MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return;		/* wait for EPOLLOUT */
+			break;
+		}
+		mc->outpos += n;
+	}
+	closeMetrics(mc);
+}
+
+/* Transmitter thread, sends queued codes one by one */
+void *transmitThread(void *arg)
+{
+	struct txrequest *rq;
+	struct txresult res;
+	sigset_t blkset;
+
+	sigfillset(&blkset);
+	pthread_sigmask(SIG_BLOCK, &blkset, NULL);
+
+	for(;;) {
+		sem_wait(&txsem);
+		rq = &txqueue[txri % TX_QUEUE_LEN];
+		res.conn = rq->conn;
+		res.gen = rq->gen;
+		if (rq->type)
+			res.result = Radio433_sendDeviceCode(rq->code, rq->type,
+							     rq->repeats);
+		else
+			res.result = Radio433_sendRawCode(rq->code, rq->coding,
+							  rq->bits, rq->repeats);
+		write(txdone[1], &res, sizeof(res));
+		/* slot can be reused by server thread from now on */
+		__atomic_store_n(&txri, txri + 1, __ATOMIC_RELEASE);
+	}
+}
+
+/* Close transmit connection */
+void closeTransmit(struct txconn *tc)
+{
+	epoll_ctl(epfd, EPOLL_CTL_DEL, tc->fd, NULL);
+	close(tc->fd);
+	tc->fd = -1;
+}
+
+/* Send reply line to transmit connection */
+void replyTransmit(struct txconn *tc, const char *reply)
+{
+	if (send(tc->fd, reply, strlen(reply), MSG_NOSIGNAL | MSG_DONTWAIT) == -1) {
+		logprintf(logfd, LOG_WARN, "transmit client PID %d not reading replies, closing\n",
+			  (int)tc->pid);
+		closeTransmit(tc);
+	}
+}
+
+/* Accept connections to transmit socket, identify peers */
+void acceptTransmit(void)
+{
+	int i, fd;
+	struct ucred cr;
+	socklen_t len;
+	struct epoll_event ev;
+	struct txconn *tc;
+
+	for(;;) {
+		fd = accept4(txsock, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd == -1) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				logprintf(logfd, LOG_WARN, "unable to accept transmit client: %s\n",
+					  strerror(errno));
+			return;
+		}
+		/* socket file permissions decide who may connect, */
+		/* kernel-provided credentials identify requests in log */
+		len = sizeof(cr);
+		if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cr, &len) == -1) {
+			close(fd);
+			continue;
+		}
+		for(i = 0; i < MAX_TX_CONNS; i++)
+			if (txconns[i].fd < 0)
+				break;
+		if (i == MAX_TX_CONNS) {
+			logprintf(logfd, LOG_WARN, "transmit client limit reached\n");
+			close(fd);
+			continue;
+		}
+		tc = &txconns[i];
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN | EPOLLRDHUP;
+		ev.data.u32 = EPOLL_TAG_TXCONN + i;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+			close(fd);
+			continue;
+		}
+		tc->fd = fd;
+		tc->gen++;
+		tc->pid = cr.pid;
+		tc->uid = cr.uid;
+		tc->cmdlen = 0;
+		logprintf(logfd, LOG_INFO, "transmit client PID %d UID %d connected\n",
+			  (int)cr.pid, (int)cr.uid);
+	}
+}
+
+/* Queue transmit request: TX TYPE type code [repeats] or */
+/* TX RAW coding bits code [repeats] */
+void transmitCommand(struct txconn *tc, char *line)
+{
+	struct txrequest *rq;
+	int n, type, coding, bits, repeats;
+	unsigned long long code;
+
+	repeats = 0;
+	type = 0;
+	coding = 0;
+	bits = 0;
+	if (sscanf(line, "TX TYPE %i %lli %i", &type, &code, &repeats) >= 2 &&
+	    type > 0)
+		;
+	else if ((n = sscanf(line, "TX RAW %i %i %lli %i", &coding, &bits, &code,
+			     &repeats)) >= 3 && bits > 0 && bits <= 64) {
+		type = 0;
+		if (n == 3)
+			repeats = TX_RAW_REPEATS;
+	} else {
+		logprintf(logfd, LOG_WARN, "invalid transmit request from PID %d\n",
+			  (int)tc->pid);
+		replyTransmit(tc, "ERR syntax\n");
+		return;
+	}
+	if (repeats < 0 || repeats > TX_MAX_REPEATS) {
+		replyTransmit(tc, "ERR repeats\n");
+		return;
+	}
+	if (txwi - __atomic_load_n(&txri, __ATOMIC_ACQUIRE) >= TX_QUEUE_LEN) {
+		logprintf(logfd, LOG_WARN, "transmit queue full, request from PID %d rejected\n",
+			  (int)tc->pid);
+		replyTransmit(tc, "ERR busy\n");
+		return;
+	}
+	rq = &txqueue[txwi % TX_QUEUE_LEN];
+	rq->conn = tc - txconns;
+	rq->gen = tc->gen;
+	rq->type = type;
+	rq->coding = coding;
+	rq->bits = bits;
+	rq->repeats = repeats;
+	rq->code = code;
+	txwi++;
+	sem_post(&txsem);
+	logprintf(logfd, LOG_INFO, "transmit request from PID %d UID %d: %s\n",
+		  (int)tc->pid, (int)tc->uid, line + 3);
+}
+
+/* Handle transmit connection event */
+void serveTransmit(struct txconn *tc, unsigned int events)
+{
+	int i, n;
+	char *eol;
+
+	if (tc->fd < 0)
+		return;
+	if (events & (EPOLLERR | EPOLLHUP)) {
+		closeTransmit(tc);
+		return;
+	}
+	for(;;) {
+		if (tc->cmdlen == MAX_CMD_SIZE)
+			tc->cmdlen = 0;	/* line too long, discard */
+		n = recv(tc->fd, tc->cmd + tc->cmdlen, MAX_CMD_SIZE - tc->cmdlen,
+			 MSG_DONTWAIT);
+		if (n > 0) {
+			tc->cmdlen += n;
+			while (tc->fd >= 0 &&
+			       (eol = memchr(tc->cmd, '\n', tc->cmdlen)) != NULL) {
+				*eol = 0;
+				i = eol - tc->cmd;
+				if (i && eol[-1] == '\r')
+					eol[-1] = 0;
+				transmitCommand(tc, tc->cmd);
+				tc->cmdlen -= i + 1;
+				memmove(tc->cmd, eol + 1, tc->cmdlen);
+			}
+			if (tc->fd < 0)
+				return;
+			continue;
+		}
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return;
+		/* peer closed: requests already queued are still sent */
+		closeTransmit(tc);
+		return;
+	}
+}
+
+/* Pass transmit results to connections that sent requests */
+void transmitDone(void)
+{
+	struct txresult res;
+	struct txconn *tc;
+	char reply[32];
+
+	while (read(txdone[0], &res, sizeof(res)) == sizeof(res)) {
+		if (res.result) {
+			srvstats.txfailed++;
+			logprintf(logfd, LOG_WARN, "transmission failed with code %d\n",
+				  res.result);
+		} else
+			srvstats.txok++;
+		tc = &txconns[res.conn];
+		if (tc->fd < 0 || tc->gen != res.gen)
+			continue;
+		if (res.result)
+			snprintf(reply, sizeof(reply), "ERR failed %d\n", res.result);
+		else
+			strcpy(reply, "OK\n");
+		replyTransmit(tc, reply);
+	}
+}
+
+/* Wait until transmit queue is empty (restart) */
+void drainTransmit(void)
+{
+	int i;
+
+	for(i = 0; i < HANDOFF_TX_WAIT_MS / 10 &&
+	    __atomic_load_n(&txri, __ATOMIC_ACQUIRE) != txwi; i++)
+		usleep(10000);
+	transmitDone();
+}
+
+/* Send handoff message with descriptors attached */
+int sendHandoff(int sock, const void *buf, size_t len, const int *fds, int nfds)
+{
+	struct msghdr mh;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	union {
+		char buf[CMSG_SPACE(4 * sizeof(int))];
+		struct cmsghdr align;
+	} cm;
+
+	memset(&mh, 0, sizeof(mh));
+	iov.iov_base = (void *)buf;
+	iov.iov_len = len;
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	if (nfds) {
+		mh.msg_control = cm.buf;
+		mh.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+		cmsg = CMSG_FIRSTHDR(&mh);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+		memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+	}
+	if (sendmsg(sock, &mh, MSG_NOSIGNAL) != len)
+		return -1;
+	return 0;
+}
+
+/* Receive handoff message, returns its size (0 if peer is gone) */
+/* and descriptors attached (up to 4) */
+int recvHandoff(int sock, void *buf, size_t len, int *fds, int *nfds)
+{
+	struct msghdr mh;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	union {
+		char buf[CMSG_SPACE(4 * sizeof(int))];
+		struct cmsghdr align;
+	} cm;
+	int n;
+
+	memset(&mh, 0, sizeof(mh));
+	iov.iov_base = buf;
+	iov.iov_len = len;
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	mh.msg_control = cm.buf;
+	mh.msg_controllen = sizeof(cm.buf);
+	do
+		n = recvmsg(sock, &mh, MSG_CMSG_CLOEXEC);
+	while (n == -1 && errno == EINTR);
+	if (nfds != NULL)
+		*nfds = 0;
+	for(cmsg = CMSG_FIRSTHDR(&mh); cmsg != NULL; cmsg = CMSG_NXTHDR(&mh, cmsg))
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+		    nfds != NULL) {
+			*nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			memcpy(fds, CMSG_DATA(cmsg), *nfds * sizeof(int));
+		}
+	if (n > 0 && (mh.msg_flags & MSG_TRUNC)) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+	return n;
+}
+
+/* Start new instance of server connected with handoff socket */
+void startRestart(void)
+{
+	int i, n, sv[2];
+	char buf[16], fdarg[16], **argv;
+	sigset_t set;
+	struct epoll_event ev;
+
+	while (read(restartpipe[0], buf, sizeof(buf)) > 0)
+		;
+	if (hosock >= 0) {
+		logprintf(logfd, LOG_WARN, "restart already in progress\n");
+		return;
+	}
+	argv = malloc((srvargc + 3) * sizeof(char *));
+	if (argv == NULL ||
+	    socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1) {
+		logprintf(logfd, LOG_ERROR, "unable to prepare restart: %s\n",
+			  strerror(errno));
+		free(argv);
+		return;
+	}
+	/* same arguments except handoff descriptor of this instance */
+	n = 0;
+	for(i = 0; i < srvargc; i++) {
+		if (!strcmp(srvargv[i], "-I")) {
+			i++;
+			continue;
+		}
+		if (!strncmp(srvargv[i], "-I", 2))
+			continue;
+		argv[n++] = srvargv[i];
+	}
+	argv[0] = exepath;
+	snprintf(fdarg, sizeof(fdarg), "%d", sv[1]);
+	argv[n++] = "-I";
+	argv[n++] = fdarg;
+	argv[n] = NULL;
+	hopid = fork();
+	if (!hopid) {
+		/* server thread blocks all signals, mask survives exec */
+		sigemptyset(&set);
+		pthread_sigmask(SIG_SETMASK, &set, NULL);
+		fcntl(sv[1], F_SETFD, 0);
+		if (strchr(exepath, '/') != NULL)
+			execv(exepath, argv);
+		else
+			execvp(exepath, argv);
+		_exit(127);
+	}
+	free(argv);
+	close(sv[1]);
+	if (hopid == -1) {
+		logprintf(logfd, LOG_ERROR, "unable to start new instance: %s\n",
+			  strerror(errno));
+		close(sv[0]);
+		return;
+	}
+	hosock = sv[0];
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u32 = EPOLL_TAG_HANDOFF;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, hosock, &ev);
+	logprintf(logfd, LOG_NOTICE, "restarting, new instance has PID %d\n",
+		  hopid);
+}
+
+/* Give up restart, this instance keeps running */
+void abortRestart(const char *reason)
+{
+	logprintf(logfd, LOG_WARN, "restart failed (%s), server continues\n",
+		  reason);
+	epoll_ctl(epfd, EPOLL_CTL_DEL, hosock, NULL);
+	close(hosock);		/* new instance exits on EOF */
+	hosock = -1;
+	waitpid(hopid, NULL, 0);
+	hopid = 0;
+}
+
+/* Send server state to new instance (returns 0 on success) */
+int handOver(int layout)
+{
+	struct handoffstate st;
+	struct handoffclient hc;
+	struct handoffring hr;
+	unsigned long long seq;
+	int i, fds[4], nfds;
+
+	memset(&st, 0, sizeof(st));
+	st.kind = HANDOFF_STATE;
+	st.version = HANDOFF_VERSION;
+	nfds = 0;
+	fds[nfds++] = srvsock;
+	st.fds = HANDOFF_FD_SERVER;
+	if (mtsock >= 0) {
+		fds[nfds++] = mtsock;
+		st.fds |= HANDOFF_FD_METRICS;
+	}
+	if (shm.hdr != NULL) {
+		fds[nfds++] = shm.fd;
+		st.fds |= HANDOFF_FD_SHM;
+		strcpy(st.shmname, shm.name);
+	}
+	if (txsock >= 0) {
+		fds[nfds++] = txsock;
+		st.fds |= HANDOFF_FD_TX;
+		strcpy(st.txpath, txpath);
+	}
+	st.codeseq = codeseq;
+	if (codeseq)
+		st.lastts = codering[(codeseq - 1) % histlen].ts;
+	st.mcsession = mcsession;
+	st.mcerrors = mcerrors;
+	st.pipeerrors = pipeerrors;
+	st.stats = srvstats;
+	if (sendHandoff(hosock, &st, sizeof(st), fds, nfds))
+		return -1;
+	if (layout) {
+		/* history, oldest first */
+		hr.kind = HANDOFF_RING;
+		hr.count = 0;
+		seq = codeseq > histlen ? codeseq - histlen : 0;
+		for(; seq < codeseq; seq++) {
+			hr.e[hr.count++] = codering[seq % histlen];
+			if (hr.count == HANDOFF_RING_CHUNK || seq + 1 == codeseq) {
+				if (sendHandoff(hosock, &hr,
+						offsetof(struct handoffring, e[hr.count]),
+						NULL, 0))
+					return -1;
+				hr.count = 0;
+			}
+		}
+		/* clients keep cursors, command buffers and subscriptions */
+		hc.kind = HANDOFF_CLIENT;
+		for(i = 0; i < MAX_CLIENTS; i++) {
+			if (clients[i].fd < 0)
+				continue;
+			hc.c = clients[i];
+			hc.hascodes = clients[i].codes != NULL;
+			if (hc.hascodes)
+				memcpy(hc.codes, clients[i].codes, sizeof(hc.codes));
+			if (sendHandoff(hosock, &hc, hc.hascodes ? sizeof(hc) :
+					offsetof(struct handoffclient, codes),
+					&clients[i].fd, 1))
+				return -1;
+		}
+	}
+	i = HANDOFF_END;
+	return sendHandoff(hosock, &i, sizeof(i), NULL, 0);
+}
+
+/* Handle message from new instance */
+void handleHandoff(void)
+{
+	struct handoffready rd;
+	int i, n, layout;
+
+	n = recvHandoff(hosock, &rd, sizeof(rd), NULL, NULL);
+	if (n == -1 && errno == EAGAIN)
+		return;
+	if (n != sizeof(rd) || rd.kind != HANDOFF_READY) {
+		abortRestart("new instance exited");
+		return;
+	}
+	if (rd.version != HANDOFF_VERSION) {
+		abortRestart("incompatible handoff version");
+		return;
+	}
+	if (rd.statssize != sizeof(struct serverstats)) {
+		abortRestart("incompatible server statistics layout");
+		return;
+	}
+	layout = rd.clientsize == sizeof(struct cliententry) &&
+		 rd.entrysize == sizeof(struct codeentry);
+	if (!layout)
+		logprintf(logfd, LOG_WARN, "client state layout differs, clients will reconnect\n");
+	/* publish everything receiver has passed so far, finish queued */
+	/* transmissions (GPIO is shared with new instance) and journal */
+	updateClients();
+	if (txsock >= 0)
+		drainTransmit();
+	if (jnlrun)
+		drainJournal();
+	if (floodrate)
+		floodSummary(0);	/* buckets are not handed over */
+	if (handOver(layout)) {
+		abortRestart(strerror(errno));
+		return;
+	}
+	for(i = n = 0; i < MAX_CLIENTS; i++)
+		if (clients[i].fd >= 0)
+			n++;
+	logprintf(logfd, LOG_NOTICE, "server handed over to PID %d (%d clients)\n",
+		  hopid, layout ? n : 0);
+	/* sockets, shared memory ring, PID file and GPIO stay with new */
+	/* instance, only close own descriptors */
+	DaemonLog_close();
+	exit(EXIT_SUCCESS);
+}
+
+/* Use listening socket of previous instance if address did not change */
+int adoptListenSocket(int fd, struct sockaddr_in *sin)
+{
+	struct sockaddr_in cur;
+	socklen_t len;
+
+	len = sizeof(cur);
+	if (getsockname(fd, (struct sockaddr *)&cur, &len) == -1 ||
+	    cur.sin_addr.s_addr != sin->sin_addr.s_addr ||
+	    cur.sin_port != sin->sin_port) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* Take over state of previous instance, returns 0 on success */
+/* (listening sockets are adopted only if configuration matches) */
+int takeOver(struct sockaddr_in *srvsin, struct sockaddr_in *mtsin,
+	     const char *shmname)
+{
+	struct handoffready rd;
+	struct handoffstate st;
+	union {
+		int kind;
+		struct handoffring hr;
+		struct handoffclient hc;
+	} m;
+	struct timeval tv;
+	struct cliententry *c;
+	int i, n, nfds, fds[4], sfd, mfd, hfd, tfd;
+
+	tv.tv_sec = HANDOFF_TIMEOUT_SEC;
+	tv.tv_usec = 0;
+	setsockopt(handofffd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	rd.kind = HANDOFF_READY;
+	rd.version = HANDOFF_VERSION;
+	rd.clientsize = sizeof(struct cliententry);
+	rd.entrysize = sizeof(struct codeentry);
+	rd.statssize = sizeof(struct serverstats);
+	if (sendHandoff(handofffd, &rd, sizeof(rd), NULL, 0))
+		return -1;
+	n = recvHandoff(handofffd, &st, sizeof(st), fds, &nfds);
+	if (n != sizeof(st) || st.kind != HANDOFF_STATE ||
+	    st.version != HANDOFF_VERSION) {
+		for(i = 0; n > 0 && i < nfds; i++)
+			close(fds[i]);
+		if (n >= 0)
+			errno = n ? EPROTO : ECONNRESET;
+		return -1;
+	}
+	i = 0;
+	sfd = st.fds & HANDOFF_FD_SERVER && i < nfds ? fds[i++] : -1;
+	mfd = st.fds & HANDOFF_FD_METRICS && i < nfds ? fds[i++] : -1;
+	hfd = st.fds & HANDOFF_FD_SHM && i < nfds ? fds[i++] : -1;
+	tfd = st.fds & HANDOFF_FD_TX && i < nfds ? fds[i++] : -1;
+	codeseq = st.codeseq;
+	handoffseq = st.codeseq;
+	handoffts = st.lastts;
+	mcsession = st.mcsession;
+	mcerrors = st.mcerrors;
+	pipeerrors = st.pipeerrors;
+	srvstats = st.stats;
+	srvstats.edges = 0;	/* receiver counters start again */
+	memset(&srvstats.edgets, 0, sizeof(srvstats.edgets));
+	for(;;) {
+		n = recvHandoff(handofffd, &m, sizeof(m), fds, &nfds);
+		if (n >= (int)sizeof(int) && m.kind == HANDOFF_END)
+			break;
+		if (n >= (int)offsetof(struct handoffring, e) &&
+		    m.kind == HANDOFF_RING) {
+			for(i = 0; i < m.hr.count; i++)
+				if (codeseq - m.hr.e[i].seq <= histlen)
+					codering[m.hr.e[i].seq % histlen] = m.hr.e[i];
+			continue;
+		}
+		if (n >= (int)offsetof(struct handoffclient, codes) &&
+		    m.kind == HANDOFF_CLIENT && nfds == 1) {
+			i = findFreeClient();
+			if (i < 0) {
+				close(fds[0]);
+				continue;
+			}
+			c = &clients[i];
+			*c = m.hc.c;
+			c->fd = fds[0];
+			c->codes = NULL;
+			c->pollout = 0;
+			if (m.hc.hascodes) {
+				c->codes = malloc(sizeof(m.hc.codes));
+				if (c->codes != NULL)
+					memcpy(c->codes, m.hc.codes, sizeof(m.hc.codes));
+				else
+					c->ncodes = 0;
+			}
+			continue;
+		}
+		/* previous instance failed, it keeps running */
+		if (n >= 0)
+			errno = n ? EPROTO : ECONNRESET;
+		for(i = 0; n > 0 && i < nfds; i++)
+			close(fds[i]);
+		for(i = 0; i < MAX_CLIENTS; i++)
+			if (clients[i].fd >= 0) {
+				close(clients[i].fd);
+				clients[i].fd = -1;
+				free(clients[i].codes);
+				clients[i].codes = NULL;
+			}
+		if (sfd >= 0)
+			close(sfd);
+		if (mfd >= 0)
+			close(mfd);
+		if (hfd >= 0)
+			close(hfd);
+		if (tfd >= 0)
+			close(tfd);
+		return -1;
+	}
+	close(handofffd);
+	handofffd = -1;
+	/* previous instance is gone, adopt or drop its endpoints */
+	if (sfd >= 0)
+		srvsock = adoptListenSocket(sfd, srvsin);
+	if (mfd >= 0 && mtsin->sin_port)
+		mtsock = adoptListenSocket(mfd, mtsin);
+	else if (mfd >= 0)
+		close(mfd);
+	if (hfd >= 0) {
+		if (Radio433_adoptShm(&shm, hfd, st.shmname))
+			close(hfd);
+		else if (strcmp(shmname, st.shmname))
+			Radio433_destroyShm(&shm);	/* ring removed or renamed */
+	}
+	if (tfd >= 0) {
+		if (txgpio >= 0 && !strcmp(txpath, st.txpath))
+			txsock = tfd;
+		else {
+			close(tfd);
+			unlink(st.txpath);	/* transmit socket removed or moved */
+		}
+	}
+	return 0;
+}
+
+/* Network server thread */
+/* (accept clients and deliver codes, single epoll loop) */
+void *serverThread(void *arg)
+{
+	int i, n;
+	unsigned int tag;
+	struct epoll_event evs[MAX_EPOLL_EVENTS];
+	struct cliententry *c;
+	sigset_t blkset;
+
+	sigfillset(&blkset);
+	pthread_sigmask(SIG_BLOCK, &blkset, NULL);
+
+	for(;;) {
+		n = epoll_wait(epfd, evs, MAX_EPOLL_EVENTS, floodTimeout());
+		if (n == -1) {
+			if (errno != EINTR)
+				logprintf(logfd, LOG_ERROR, "epoll_wait() failed: %s\n",
+					  strerror(errno));
+			continue;
+		}
+		for(i = 0; i < n; i++) {
+			tag = evs[i].data.u32;
+			if (tag == EPOLL_TAG_SERVER)
+				acceptClients();
+			else if (tag == EPOLL_TAG_CODES)
+				updateClients();
+			else if (tag == EPOLL_TAG_METRICS)
+				acceptMetrics();
+			else if (tag == EPOLL_TAG_RESTART)
+				startRestart();
+			else if (tag == EPOLL_TAG_HANDOFF)
+				handleHandoff();
+			else if (tag == EPOLL_TAG_TXSERVER)
+				acceptTransmit();
+			else if (tag == EPOLL_TAG_TXDONE)
+				transmitDone();
+			else if (tag < EPOLL_TAG_TXCONN)
+				serveMetrics(&mconns[tag - EPOLL_TAG_HTTP],
+					     evs[i].events);
+			else if (tag < EPOLL_TAG_CLIENT)
+				serveTransmit(&txconns[tag - EPOLL_TAG_TXCONN],
+					      evs[i].events);
+			else {
+				c = &clients[tag - EPOLL_TAG_CLIENT];
+				if (c->fd < 0)
+					continue;	/* removed earlier in this batch */
+				if (evs[i].events & (EPOLLERR | EPOLLHUP)) {
+					removeClient(c);
+					continue;
+				}
+				if (evs[i].events & (EPOLLIN | EPOLLRDHUP))
+					if (readClient(c))
+						continue;
+				if ((evs[i].events & EPOLLOUT) || c->replay > 0)
+					flushClient(c);
+			}
+		}
 	}
-	exit(status);
 }
 
-/* Intercept TERM and INT signals */
-void signalQuit(int sig)
+/* Parse multicast group:port[:repeat] argument, returns 0 if invalid */
+int parseMcastAddr(const char *arg, struct sockaddr_in *sin, int *repeat)
 {
-	logprintf(logfd, LOG_NOTICE, "signal %d received\n", sig);
-	endProcess(0);
+	char addr[INET_ADDRSTRLEN];
+	int port;
+
+	if (sscanf(arg, "%15[0-9.]:%d:%d", addr, &port, repeat) < 2)
+		return 0;
+	if (!inet_aton(addr, &sin->sin_addr) ||
+	    !IN_MULTICAST(ntohl(sin->sin_addr.s_addr)) ||
+	    port <= 0 || port > 65535)
+		return 0;
+	sin->sin_port = htons(port);
+	return 1;
 }
 
-/* SIGHUP - reopen log file, useful for logrotate */
-void signalReopenLog(int sig)
+/* Parse comma-separated device types or classes (number or PWR, THM, */
+/* RMT), returns number of entries or 0 if invalid */
+int parseDevices(char *arg)
 {
-	if (!debugflag && logfd >= 0) {
-		logprintf(logfd, LOG_NOTICE, "signal %d received\n", sig);
-		logprintf(logfd, LOG_NOTICE, "closing log file\n");
-		fsync(logfd);	/* never hurts */
-		close(logfd);
-		logfd = open(logfname, O_CREAT | O_TRUNC | O_SYNC | O_WRONLY, FILE_UMASK);
-		if (logfd == -1)
-			endProcess(EXIT_FAILURE);
-		logprintf(logfd, LOG_NOTICE, "log file flushed after receiving signal %d\n", sig);
+	char *t, *end;
+	int n;
+
+	n = 0;
+	for(t = strtok(arg, ","); t != NULL; t = strtok(NULL, ",")) {
+		if (n == MAX_RX_TYPES)
+			return 0;
+		if (!strcasecmp(t, "PWR"))
+			rxtypes[n] = RADIO433_CLASS_POWER;
+		else if (!strcasecmp(t, "THM"))
+			rxtypes[n] = RADIO433_CLASS_WEATHER;
+		else if (!strcasecmp(t, "RMT"))
+			rxtypes[n] = RADIO433_CLASS_REMOTE;
+		else {
+			rxtypes[n] = strtol(t, &end, 0);
+			if (*end || rxtypes[n] <= 0)
+				return 0;
+		}
+		n++;
 	}
+	return n;
 }
 
-/* Format message */
-int formatMessage(char *buf, struct timeval *ts, int type, int bits,
-		  int codelen, int repeats, int interval,
-		  unsigned long long code)
+/* Parse metrics [ipaddr:]port argument, returns 0 if invalid */
+int parseMetricsAddr(const char *arg, struct sockaddr_in *sin)
 {
-	memset(buf, 0, MAX_MSG_SIZE);
-	sprintf(buf, "%s%lu.%03u;%d;%d;%d;0x%04X;%d;0x%016llX;%s\n", MSG_HDR,
-		ts->tv_sec, ts->tv_usec / 1000, codelen, repeats, interval,
-		type, bits, code, MSG_END);
-	return strlen(buf);
+	char addr[INET_ADDRSTRLEN];
+	int port;
+
+	if (strchr(arg, ':') == NULL) {
+		strcpy(addr, METRICS_ADDR);
+		if (sscanf(arg, "%d", &port) != 1)
+			return 0;
+	} else if (sscanf(arg, "%15[0-9.]:%d", addr, &port) != 2)
+		return 0;
+	if (!inet_aton(addr, &sin->sin_addr) || port <= 0 || port > 65535)
+		return 0;
+	sin->sin_port = htons(port);
+	return 1;
 }
 
-/* Find free slot in client descriptor table, return -1 if table full */
-int findFreeFd(void)
+/* Create multicast socket, use listening address as outgoing interface */
+int openMcastSocket(struct in_addr *ifaddr)
 {
-	int i;
+	int fd;
+	unsigned char ttl;
 
-	i=0;
-	while(i < MAX_CLIENTS)
-       		if (clntfd[i] == -1)
-               		break;
-		else
-			i++;
-	if (i == MAX_CLIENTS)
-			i = -1;
-	return i;
+	fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd == -1)
+		return -1;
+	ttl = MCAST_TTL;
+	if (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) == -1 ||
+	    (ifaddr->s_addr != htonl(INADDR_ANY) &&
+	     setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, ifaddr,
+			sizeof(*ifaddr)) == -1)) {
+		close(fd);
+		return -1;
+	}
+	return fd;
 }
 
-/* Client add thread */
-/* (accept clients) */
-void *clientAddThread(void *arg)
+/* Write PID file */
+void writePidFile(void)
 {
-	int i, clfd, clen;
-	struct sockaddr_in clin;
-	sigset_t blkset;
+	int pidfd;
 
-	sigfillset(&blkset);
-	pthread_sigmask(SIG_BLOCK, &blkset, NULL);
+	pidfd = open(pidfname, O_CREAT | O_TRUNC | O_WRONLY, FILE_UMASK);
+	if (pidfd < 0) {
+		if (!debugflag)
+			logprintf(logfd, LOG_ERROR, "unable to create PID file %s: %s\n",
+				  pidfname, strerror(errno));
+		else
+			dprintf(STDERR_FILENO, "Unable to create PID file %s: %s\n",
+				pidfname, strerror(errno));
+		endProcess(EXIT_FAILURE);
+	}
+	dprintf(pidfd, "%d\n", procpid);
+	close(pidfd);
+}
 
-	for(;;) {
-		clen = sizeof(struct sockaddr_in);
-		clfd = accept(srvsock, (struct sockaddr *)&clin, &clen);
-		sem_wait(&clientsem);
-		i = findFreeFd();
-		if (i >= 0)
-			clntfd[i] = clfd;
-		sem_post(&clientsem);
-		if (i < 0)
-			logprintf(logfd, LOG_WARN, "client limit reached\n");
+/* Create listening socket for clients */
+void openServerSocket(struct sockaddr_in *srvsin)
+{
+	int ena;
+
+	srvsock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (srvsock == -1) {
+		if (!debugflag)
+			logprintf(logfd, LOG_ERROR, "unable to create server socket: %s\n",
+				  strerror(errno));
+		else
+			dprintf(STDERR_FILENO, "Unable to create server socket: %s\n",
+				strerror(errno));
+		endProcess(EXIT_FAILURE);
+	}
+	ena = 1;
+	if (setsockopt(srvsock, SOL_SOCKET, SO_REUSEADDR, &ena, sizeof(int)) == -1) {
+		if (!debugflag)
+			logprintf(logfd, LOG_ERROR, "unable to set flags for server socket: %s\n",
+				  strerror(errno));
+		else
+			dprintf(STDERR_FILENO, "Unable to set flags for server socket: %s\n",
+				strerror(errno));
+		endProcess(EXIT_FAILURE);
+	}
+	if (setsockopt(srvsock, SOL_SOCKET, SO_REUSEPORT, &ena, sizeof(int)) == -1) {
+		if (!debugflag)
+			logprintf(logfd, LOG_ERROR, "unable to set flags for server socket: %s\n",
+				  strerror(errno));
+		else
+			dprintf(STDERR_FILENO, "Unable to set flags for server socket: %s\n",
+				strerror(errno));
+		endProcess(EXIT_FAILURE);
+	}
+	if (bind(srvsock, (struct sockaddr *)srvsin, sizeof(*srvsin)) == -1) {
+		if (!debugflag)
+			logprintf(logfd, LOG_ERROR, "unable to bind to server socket: %s\n",
+				  strerror(errno));
+		else
+			dprintf(STDERR_FILENO, "Unable to bind to server socket: %s\n",
+				strerror(errno));
+		endProcess(EXIT_FAILURE);
+	}
+	if (listen(srvsock, (MAX_CLIENTS >> 2)) == -1) {
+		if (!debugflag)
+			logprintf(logfd, LOG_ERROR, "unable to listen to server socket: %s\n",
+				  strerror(errno));
 		else
-			logprintf(logfd, LOG_INFO,
-				  "client %s [%d] connected successfully\n",
-				  inet_ntoa(clin.sin_addr), clfd);
+			dprintf(STDERR_FILENO, "Unable to listen to server socket: %s\n",
+				strerror(errno));
+		endProcess(EXIT_FAILURE);
 	}
 }
 
-/* Send code to all clients */
-/* (also detect stale sockets and remove them from array) */
-int updateClients(const char *buf, size_t len)
+/* Setup client, multicast and metrics sockets and shared memory ring */
+/* (endpoints handed over by previous instance are kept) */
+void openEndpoints(struct sockaddr_in *srvsin, struct sockaddr_in *mtsin,
+		   const char *shmname, int mcflag)
 {
-	int i;
+	int ena;
+	struct sockaddr_un sun;
 
-	for(i = 0; i < MAX_CLIENTS; i++)
-		if (clntfd[i] >= 0) {
-			if (debugflag)
-				logprintf(logfd, LOG_DEBUG,
-					  "sending message to client [%d], %d bytes\n",
-					  clntfd[i], len);
-			sem_wait(&clientsem);
-			if (send(clntfd[i], buf, len, MSG_NOSIGNAL) == -1) {
-				logprintf(logfd, LOG_INFO,
-					  "client [%d] disconnected\n", clntfd[i]);
-				close(clntfd[i]);
-				clntfd[i] = -1;
-			}
-			sem_post(&clientsem);
+	if (srvsock < 0)
+		openServerSocket(srvsin);
+	logprintf(logfd, LOG_NOTICE, "accepting client TCP connections on %s port %d\n",
+		  inet_ntoa(srvsin->sin_addr), ntohs(srvsin->sin_port));
+
+	/* setup multicast publishing (optional) */
+	if (mcflag) {
+		mcsock = openMcastSocket(&srvsin->sin_addr);
+		if (mcsock == -1) {
+			if (!debugflag)
+				logprintf(logfd, LOG_ERROR, "unable to create multicast socket: %s\n",
+					  strerror(errno));
+			else
+				dprintf(STDERR_FILENO, "Unable to create multicast socket: %s\n",
+					strerror(errno));
+			endProcess(EXIT_FAILURE);
+		}
+		if (!mcsession)		/* kept on restart */
+			mcsession = time(NULL);
+		logprintf(logfd, LOG_NOTICE,
+			  "publishing to multicast group %s port %d (repeat %d)\n",
+			  inet_ntoa(mcsin.sin_addr), ntohs(mcsin.sin_port),
+			  mcrepeat);
+	}
+
+	/* setup metrics endpoint (optional) */
+	if (mtsin->sin_port && mtsock < 0) {
+		mtsock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		ena = 1;
+		if (mtsock == -1 ||
+		    setsockopt(mtsock, SOL_SOCKET, SO_REUSEADDR, &ena, sizeof(int)) == -1 ||
+		    bind(mtsock, (struct sockaddr *)mtsin, sizeof(*mtsin)) == -1 ||
+		    listen(mtsock, MAX_METRICS_CONNS) == -1) {
+			if (!debugflag)
+				logprintf(logfd, LOG_ERROR, "unable to setup metrics socket: %s\n",
+					  strerror(errno));
+			else
+				dprintf(STDERR_FILENO, "Unable to setup metrics socket: %s\n",
+					strerror(errno));
+			endProcess(EXIT_FAILURE);
+		}
+	}
+	if (mtsock >= 0)
+		logprintf(logfd, LOG_NOTICE, "serving metrics on %s port %d\n",
+			  inet_ntoa(mtsin->sin_addr), ntohs(mtsin->sin_port));
+
+	/* setup shared memory ring (optional, before dropping privileges) */
+	if (shmname[0] && shm.hdr == NULL) {
+		if (Radio433_createShm(&shm, shmname)) {
+			if (!debugflag)
+				logprintf(logfd, LOG_ERROR, "unable to create shared memory ring %s: %s\n",
+					  shmname, strerror(errno));
+			else
+				dprintf(STDERR_FILENO, "Unable to create shared memory ring %s: %s\n",
+					shmname, strerror(errno));
+			endProcess(EXIT_FAILURE);
+		}
+	}
+	if (shm.hdr != NULL)
+		logprintf(logfd, LOG_NOTICE, "publishing to shared memory ring %s (%d entries)\n",
+			  shmname, RADIO433_SHM_ENTRIES);
+
+	/* setup transmit control socket (optional, before dropping privileges) */
+	if (txgpio >= 0 && txsock < 0) {
+		memset(&sun, 0, sizeof(sun));
+		sun.sun_family = AF_UNIX;
+		strcpy(sun.sun_path, txpath);
+		unlink(txpath);
+		txsock = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (txsock == -1 ||
+		    bind(txsock, (struct sockaddr *)&sun, sizeof(sun)) == -1 ||
+		    chmod(txpath, TX_SOCKET_UMASK) == -1 ||
+		    listen(txsock, MAX_TX_CONNS) == -1) {
+			if (!debugflag)
+				logprintf(logfd, LOG_ERROR, "unable to setup transmit socket %s: %s\n",
+					  txpath, strerror(errno));
+			else
+				dprintf(STDERR_FILENO, "Unable to setup transmit socket %s: %s\n",
+					txpath, strerror(errno));
+			endProcess(EXIT_FAILURE);
 		}
+	}
+	if (txsock >= 0)
+		logprintf(logfd, LOG_NOTICE, "accepting transmit requests on %s (GPIO %d)\n",
+			  txpath, txgpio);
 }
 
 /* Daemonize process */
@@ -442,23 +2731,30 @@ int daemonize(void)
 
 int main(int argc, char *argv[])
 {
-	struct timeval ts;
-	unsigned long long code;
-	int type, bits, opt;
+	struct radiocode rc;
+	int opt;
 	uid_t uid;
 	gid_t gid;
 	int srvport;
 	int pidfd;
-	struct sockaddr_in srvsin;
-	int i, len, ena;
-	int codelen, repeats, interval;
-	char buf[MAX_MSG_SIZE + 1];
+	struct sockaddr_in srvsin, mtsin;
+	int i, n, mcflag, rtreport;
+	struct epoll_event ev;
 	char username[MAX_USERNAME + 1];
+	char shmname[sizeof(shm.name)];
 	struct sigaction sa;
+	struct stat st;
+	char *p;
 
 	/* get process name */
 	strncpy(progname, basename(argv[0]), PATH_MAX);
 
+	/* remember how to start again (working directory changes) */
+	srvargc = argc;
+	srvargv = argv;
+	if (strchr(argv[0], '/') == NULL || realpath(argv[0], exepath) == NULL)
+		strncpy(exepath, argv[0], PATH_MAX);
+
 	/* show help */
 	if (argc < 2) {
 		help();
@@ -478,7 +2774,42 @@ int main(int argc, char *argv[])
 	debugflag = 0;
 	logfd = -1;
 	srvsock = -1;
+	epfd = -1;
 	clntrun = 0;
+	histlen = HISTORY_LEN;
+	histage = 0;
+	mcsock = -1;
+	mcflag = 0;
+	shmname[0] = 0;
+	mtsock = -1;
+	rtprio = 0;
+	rtcpu = -1;
+	nrxtypes = 0;
+	restartpipe[0] = -1;
+	restartpipe[1] = -1;
+	txgpio = -1;
+	txsock = -1;
+	txdone[0] = -1;
+	txdone[1] = -1;
+	jnldir[0] = 0;
+	jnlsize = JOURNAL_SEGMENT_MB;
+	jnlsegs = JOURNAL_SEGMENTS;
+	jnlrun = 0;
+	floodrate = 0;
+	floodburst = FLOOD_BURST;
+	snprintf(txpath, sizeof(txpath), "%s%.*s.sock", PID_DIR,
+		 (int)(sizeof(txpath) - sizeof(PID_DIR) - 5), progname);
+	hosock = -1;
+	hopid = 0;
+	handofffd = -1;
+	handoffts = 0;
+	mcsession = 0;
+	memset((char *)&mtsin, 0, sizeof(mtsin));
+	mtsin.sin_family = AF_INET;
+	mcrepeat = 0;
+	mcerrors = 0;
+	memset((char *)&mcsin, 0, sizeof(mcsin));
+	mcsin.sin_family = AF_INET;
 	memset(username, 0, MAX_USERNAME + 1);
 	memset((char *)&srvsin, 0, sizeof(srvsin));
 	srvsin.sin_family = AF_INET;
@@ -489,7 +2820,7 @@ int main(int argc, char *argv[])
 	strcpy(pidfname, PID_DIR);
 	strcat(pidfname, progname);
 	strcat(pidfname, ".pid");
-	while((opt = getopt(argc, argv, "g:u:dl:P:L:h:p:V")) != -1) {
+	while((opt = getopt(argc, argv, "g:u:dl:P:L:h:p:H:A:m:S:M:R:I:t:T:J:F:D:V")) != -1) {
 		if (opt == 'g')
 			sscanf(optarg, "%d", &gpio);
 		else if (opt == 'u')
@@ -510,6 +2841,74 @@ int main(int argc, char *argv[])
 		}
 		else if (opt == 'p')
 			sscanf(optarg, "%d", &srvport);
+		else if (opt == 'H')
+			sscanf(optarg, "%d", &histlen);
+		else if (opt == 'A')
+			sscanf(optarg, "%d", &histage);
+		else if (opt == 'm') {
+			if (!parseMcastAddr(optarg, &mcsin, &mcrepeat) ||
+			    mcrepeat < 0 || mcrepeat >= RADIO433_MCAST_MAXREC) {
+				dprintf(STDERR_FILENO, "Invalid multicast group specification.\n");
+				exit(EXIT_FAILURE);
+			}
+			mcflag = 1;
+		}
+		else if (opt == 'S') {
+			if (optarg[0] != '/' || strchr(optarg + 1, '/') != NULL ||
+			    strlen(optarg) >= sizeof(shmname)) {
+				dprintf(STDERR_FILENO, "Invalid shared memory name (must be /name).\n");
+				exit(EXIT_FAILURE);
+			}
+			strcpy(shmname, optarg);
+		}
+		else if (opt == 'M') {
+			if (!parseMetricsAddr(optarg, &mtsin)) {
+				dprintf(STDERR_FILENO, "Invalid metrics address specification.\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if (opt == 'I')
+			sscanf(optarg, "%d", &handofffd);
+		else if (opt == 't')
+			sscanf(optarg, "%d", &txgpio);
+		else if (opt == 'T') {
+			if (optarg[0] != '/' || strlen(optarg) >= sizeof(txpath)) {
+				dprintf(STDERR_FILENO, "Invalid transmit socket path (must be absolute).\n");
+				exit(EXIT_FAILURE);
+			}
+			strcpy(txpath, optarg);
+		}
+		else if (opt == 'J') {
+			strncpy(jnldir, optarg, PATH_MAX);
+			if ((p = strchr(jnldir, ':')) != NULL) {
+				*p = 0;
+				sscanf(p + 1, "%d:%d", &jnlsize, &jnlsegs);
+			}
+			if (jnldir[0] != '/') {
+				dprintf(STDERR_FILENO, "Invalid journal directory (must be absolute).\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if (opt == 'D') {
+			nrxtypes = parseDevices(optarg);
+			if (!nrxtypes) {
+				dprintf(STDERR_FILENO, "Invalid device list.\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if (opt == 'F') {
+			if (sscanf(optarg, "%d:%d", &floodrate, &floodburst) < 1 ||
+			    floodrate < 1 || floodburst < 1) {
+				dprintf(STDERR_FILENO, "Invalid rate limit specification.\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if (opt == 'R') {
+			if (sscanf(optarg, "%d:%d", &rtprio, &rtcpu) < 1) {
+				dprintf(STDERR_FILENO, "Invalid real-time specification.\n");
+				exit(EXIT_FAILURE);
+			}
+		}
 		else if (opt == 'V') {
 			verShow();
 			exit(EXIT_SUCCESS);
@@ -520,21 +2919,62 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	/* restarted by instance that dropped privileges, real UID is root */
+	if (handofffd >= 0 && geteuid() && !getuid()) {
+		if (seteuid(0) || setegid(0)) {
+			dprintf(STDERR_FILENO, "Unable to regain super-user privileges.\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
 	if (getuid()) {
 		dprintf(STDERR_FILENO, "Must be run by root.\n");
 		exit(EXIT_FAILURE);
 	}
 
+	if (handofffd != -1 && (fstat(handofffd, &st) == -1 || !S_ISSOCK(st.st_mode))) {
+		dprintf(STDERR_FILENO, "Invalid handoff descriptor (internal option).\n");
+		exit(EXIT_FAILURE);
+	}
+
 	if (gpio < 0 || gpio > GPIO_PINS) {
 		dprintf(STDERR_FILENO, "Invalid RX GPIO pin.\n");
 		exit(EXIT_FAILURE);
 	}
 
+	if (txgpio > GPIO_PINS || (txgpio >= 0 && txgpio == gpio)) {
+		dprintf(STDERR_FILENO, "Invalid TX GPIO pin.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (jnlsize < 1 || jnlsize > 1024 || jnlsegs < 0) {
+		dprintf(STDERR_FILENO, "Invalid journal specification (segment size 1-1024 MB).\n");
+		exit(EXIT_FAILURE);
+	}
+
 	if (ledgpio > GPIO_PINS || ledact < 0 || ledact > 1) {
 		dprintf(STDERR_FILENO, "Invalid LED specification.\n");
 		exit(EXIT_FAILURE);
 	}
 
+	if (histlen <= CLIENT_QUEUE_LEN || histlen > MAX_HISTORY_LEN ||
+	    histage < 0) {
+		dprintf(STDERR_FILENO, "Invalid history specification (size must be %d-%d).\n",
+			CLIENT_QUEUE_LEN + 1, MAX_HISTORY_LEN);
+		exit(EXIT_FAILURE);
+	}
+
+	if (rtprio < 0 || (rtprio > 0 &&
+	    (rtprio < sched_get_priority_min(SCHED_FIFO) ||
+	     rtprio > sched_get_priority_max(SCHED_FIFO))) ||
+	    rtcpu < -1 || rtcpu >= sysconf(_SC_NPROCESSORS_ONLN)) {
+		dprintf(STDERR_FILENO, "Invalid real-time specification (priority %d-%d, CPU 0-%ld).\n",
+			sched_get_priority_min(SCHED_FIFO),
+			sched_get_priority_max(SCHED_FIFO),
+			sysconf(_SC_NPROCESSORS_ONLN) - 1);
+		exit(EXIT_FAILURE);
+	}
+
 	if (debugflag && logfname[0]) {
 		dprintf(STDERR_FILENO, "Flags -d and -l are mutually exclusive.\n");
 		exit(EXIT_FAILURE);
@@ -543,20 +2983,12 @@ int main(int argc, char *argv[])
 	srvsin.sin_port = htons(srvport);
 
 	/* initialize log */
-	if (debugflag)
-		logfd = STDOUT_FILENO;
-	else {
-		if (logfname[0]) {
-			logfd = open(logfname, O_CREAT | O_APPEND | O_SYNC | O_WRONLY, FILE_UMASK);
-			if (logfd == -1) {
-				dprintf(STDERR_FILENO, "Unable to open log file '%s': %s\n",
-					logfname, strerror(errno));
-				exit(EXIT_FAILURE);
-			}
-		} else
-			logfd = -1;
+	logfd = DaemonLog_open(progname, logfname, debugflag);
+	if (logfd == -2) {
+		dprintf(STDERR_FILENO, "Unable to open log file '%s': %s\n",
+			logfname, strerror(errno));
+		exit(EXIT_FAILURE);
 	}
-	sem_init(&logsem, 0, 1);
 
 	/* put banner in log */
 #ifdef BUILDSTAMP
@@ -567,8 +2999,8 @@ int main(int argc, char *argv[])
 		  RADIO433_DEVICES);
 #endif
 
-	/* check if pid file exists */
-	pidfd = open(pidfname, O_PATH, FILE_UMASK);
+	/* check if pid file exists (on restart it belongs to previous instance) */
+	pidfd = handofffd < 0 ? open(pidfname, O_PATH, FILE_UMASK) : -1;
 	if (pidfd >= 0) {
 		/* pid file exists */
 		close(pidfd);
@@ -577,18 +3009,18 @@ int main(int argc, char *argv[])
 		if (!debugflag)
 			logprintf(logfd, LOG_ERROR, "unable to create PID file %s: %s\n",
 				  pidfname, strerror(errno));
-		close(logfd);
+		DaemonLog_close();
 		exit(EXIT_FAILURE);
 	}
 
-	/* setup process */
-	if (!debugflag)
+	/* setup process (new instance on restart is already detached) */
+	if (!debugflag && handofffd < 0)
 		if (daemonize()) {
 			dprintf(STDERR_FILENO, "Unable to fork to background: %s\n",
 				strerror(errno));
 			logprintf(logfd, LOG_ERROR, "unable to fork to background: %s\n",
 				  strerror(errno));
-			close(logfd);
+			DaemonLog_close();
 			exit(EXIT_FAILURE);
 		} else {
 			procpid = getpid();
@@ -596,19 +3028,14 @@ int main(int argc, char *argv[])
 				  procpid);
 		}
 
-	/* populate pid file (new PID after daemonize()) */
-	pidfd = open(pidfname, O_CREAT | O_WRONLY, FILE_UMASK);
-	if (pidfd < 0) {
-		if (!debugflag)
-			logprintf(logfd, LOG_ERROR, "unable to create PID file %s: %s\n",
-				  pidfname, strerror(errno));
-		else
-			dprintf(STDERR_FILENO, "Unable to create PID file %s: %s\n",
-				pidfname, strerror(errno));
-		endProcess(EXIT_FAILURE);
-	}
-	dprintf(pidfd, "%d\n", procpid);
-	close(pidfd);
+	/* start log writer (threads do not survive fork) */
+	if (DaemonLog_start())
+		logprintf(logfd, LOG_WARN, "unable to start log writer thread\n");
+
+	/* populate pid file (new PID after daemonize(), after takeover */
+	/* on restart) */
+	if (handofffd < 0)
+		writePidFile();
 
 	/* signal handler */
 	memset(&sa, 0, sizeof(sa));
@@ -619,60 +3046,51 @@ int main(int argc, char *argv[])
 	sigaction(SIGINT, &sa, NULL);
 	sa.sa_handler = &signalReopenLog;
 	sigaction(SIGHUP, &sa, NULL);
-
-	/* setup server */
-	srvsock = socket(AF_INET, SOCK_STREAM, 0);
-	if (srvsock == -1) {
-		if (!debugflag)
-			logprintf(logfd, LOG_ERROR, "unable to create server socket: %s\n",
-				  strerror(errno));
-		else
-			dprintf(STDERR_FILENO, "Unable to create server socket: %s\n",
-				strerror(errno));
-		endProcess(EXIT_FAILURE);
-	}
-	ena = 1;
-	if (setsockopt(srvsock, SOL_SOCKET, SO_REUSEADDR, &ena, sizeof(int)) == -1) {
+	if (pipe2(restartpipe, O_CLOEXEC | O_NONBLOCK) == -1) {
 		if (!debugflag)
-			logprintf(logfd, LOG_ERROR, "unable to set flags for server socket: %s\n",
+			logprintf(logfd, LOG_ERROR, "unable to create restart pipe: %s\n",
 				  strerror(errno));
 		else
-			dprintf(STDERR_FILENO, "Unable to set flags for server socket: %s\n",
+			dprintf(STDERR_FILENO, "Unable to create restart pipe: %s\n",
 				strerror(errno));
 		endProcess(EXIT_FAILURE);
 	}
-	if (setsockopt(srvsock, SOL_SOCKET, SO_REUSEPORT, &ena, sizeof(int)) == -1) {
-		if (!debugflag)
-			logprintf(logfd, LOG_ERROR, "unable to set flags for server socket: %s\n",
-				  strerror(errno));
-		else
-			dprintf(STDERR_FILENO, "Unable to set flags for server socket: %s\n",
-				strerror(errno));
-		endProcess(EXIT_FAILURE);
+	sa.sa_handler = &signalRestart;
+	sigaction(SIGUSR2, &sa, NULL);
+
+	/* setup endpoints (new instance adopts them after takeover) */
+	if (handofffd < 0)
+		openEndpoints(&srvsin, &mtsin, shmname, mcflag);
+
+	/* client table and history (filled by takeover on restart) */
+	for(i = 0; i < MAX_CLIENTS; i++) {
+		clients[i].fd = -1;
+		clients[i].codes = NULL;
 	}
-	if (bind(srvsock, (struct sockaddr *)&srvsin, sizeof(srvsin)) == -1) {
-		if (!debugflag)
-			logprintf(logfd, LOG_ERROR, "unable to bind to server socket: %s\n",
-				  strerror(errno));
-		else
-			dprintf(STDERR_FILENO, "Unable to bind to server socket: %s\n",
-				strerror(errno));
-		endProcess(EXIT_FAILURE);
+	for(i = 0; i < MAX_METRICS_CONNS; i++) {
+		mconns[i].fd = -1;
+		mconns[i].out = NULL;
 	}
-	if (listen(srvsock, (MAX_CLIENTS >> 4)) == -1) {
+	for(i = 0; i < MAX_TX_CONNS; i++)
+		txconns[i].fd = -1;
+	codeseq = 0;
+	codering = calloc(histlen, sizeof(struct codeentry));
+	if (codering == NULL) {
 		if (!debugflag)
-			logprintf(logfd, LOG_ERROR, "unable to listen to server socket: %s\n",
+			logprintf(logfd, LOG_ERROR, "unable to allocate history buffer: %s\n",
 				  strerror(errno));
 		else
-			dprintf(STDERR_FILENO, "Unable to listen to server socket: %s\n",
+			dprintf(STDERR_FILENO, "Unable to allocate history buffer: %s\n",
 				strerror(errno));
 		endProcess(EXIT_FAILURE);
 	}
-	logprintf(logfd, LOG_NOTICE, "accepting client TCP connections on %s port %d\n",
-		  inet_ntoa(srvsin.sin_addr), srvport);
+	logprintf(logfd, LOG_NOTICE, "keeping up to %d messages in history\n",
+		  histlen);
 
-	/* change scheduling priority */
-	if (changeSched()) {
+	/* change scheduling priority (batch unless receiving in real-time) */
+	if (rtprio > 0 || rtcpu >= 0)
+		setupRealtime();
+	else if (changeSched()) {
 		if (!debugflag)
 			logprintf(logfd, LOG_ERROR, "unable to change process scheduling priority: %s\n",
 				  strerror(errno));
@@ -685,8 +3103,15 @@ int main(int argc, char *argv[])
 	/* initialize WiringPi library - use BCM GPIO numbers - must be root */
 	wiringPiSetupGpio();
 
-	/* no transmission, only read (uses GPIO ISR, must be root) */
-	if (Radio433_init(-1, gpio)) {
+	/* read and optionally transmit (uses GPIO ISR, must be root) */
+	if (nrxtypes && Radio433_setDevices(rxtypes, nrxtypes) <= 0) {
+		if (!debugflag)
+			logprintf(logfd, LOG_ERROR, "no known device selected for receiving\n");
+		else
+			dprintf(STDERR_FILENO, "No known device selected for receiving.\n");
+		endProcess(EXIT_FAILURE);
+	}
+	if (Radio433_init(txgpio, gpio)) {
 		if (!debugflag)
 			logprintf(logfd, LOG_ERROR, "unable to initialize radio input\n");
 		else
@@ -694,6 +3119,22 @@ int main(int argc, char *argv[])
 		endProcess(EXIT_FAILURE);
 	}
 
+	/* restart: receiver is running, take over from previous instance */
+	if (handofffd >= 0) {
+		if (takeOver(&srvsin, &mtsin, shmname)) {
+			logprintf(logfd, LOG_ERROR, "unable to take over from previous instance: %s\n",
+				  strerror(errno));
+			endProcess(EXIT_FAILURE);
+		}
+		for(i = n = 0; i < MAX_CLIENTS; i++)
+			if (clients[i].fd >= 0)
+				n++;
+		logprintf(logfd, LOG_NOTICE, "took over %d clients and %llu messages from previous instance\n",
+			  n, codeseq);
+		openEndpoints(&srvsin, &mtsin, shmname, mcflag);
+		writePidFile();
+	}
+
 	/* drop privileges */
 	if (username[0]) {
 		if (dropRootPriv(username, &uid, &gid)) {
@@ -708,7 +3149,7 @@ int main(int argc, char *argv[])
 		else
 			logprintf(logfd, LOG_NOTICE,
 				  "dropping super-user privileges, running as UID=%ld GID=%ld\n",
-				  uid, gid);
+				  (long)uid, (long)gid);
 	}
 
 	/* activate LED */
@@ -723,15 +3164,98 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	/* start network listener */
+	/* start journal writer (directory must be writable after */
+	/* dropping privileges, segments are created later) */
+	if (jnldir[0]) {
+		if (Radio433_openJournal(&journal, jnldir,
+					 jnlsize * (1048576ULL / RADIO433_MSG_BINSIZE),
+					 jnlsegs)) {
+			if (!debugflag)
+				logprintf(logfd, LOG_ERROR, "unable to use journal directory %s: %s\n",
+					  jnldir, strerror(errno));
+			else
+				dprintf(STDERR_FILENO, "Unable to use journal directory %s: %s\n",
+					jnldir, strerror(errno));
+			endProcess(EXIT_FAILURE);
+		}
+		sem_init(&jnlsem, 0, 0);
+		if (pthread_create(&jnlthread, NULL, journalThread, NULL)) {
+			if (!debugflag)
+				logprintf(logfd, LOG_ERROR, "cannot start journal writer thread\n");
+			else
+				dprintf(STDERR_FILENO, "Cannot start journal writer thread.\n");
+			endProcess(EXIT_FAILURE);
+		}
+		jnlrun = 1;
+		logprintf(logfd, LOG_NOTICE, "appending codes to journal in %s (%d MB segments, %d kept)\n",
+			  jnldir, jnlsize, jnlsegs);
+	}
+
+	/* start network server */
+	if (pipe2(codepipe, O_CLOEXEC) == -1 ||
+	    fcntl(codepipe[0], F_SETFL, O_NONBLOCK) == -1) {
+		if (!debugflag)
+			logprintf(logfd, LOG_ERROR, "unable to create code pipe: %s\n",
+				  strerror(errno));
+		else
+			dprintf(STDERR_FILENO, "Unable to create code pipe: %s\n",
+				strerror(errno));
+		endProcess(EXIT_FAILURE);
+	}
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd == -1) {
+		if (!debugflag)
+			logprintf(logfd, LOG_ERROR, "unable to create epoll instance: %s\n",
+				  strerror(errno));
+		else
+			dprintf(STDERR_FILENO, "Unable to create epoll instance: %s\n",
+				strerror(errno));
+		endProcess(EXIT_FAILURE);
+	}
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u32 = EPOLL_TAG_SERVER;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, srvsock, &ev);
+	ev.data.u32 = EPOLL_TAG_CODES;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, codepipe[0], &ev);
+	if (mtsock >= 0) {
+		ev.data.u32 = EPOLL_TAG_METRICS;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, mtsock, &ev);
+	}
+	ev.data.u32 = EPOLL_TAG_RESTART;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, restartpipe[0], &ev);
+	if (txsock >= 0) {
+		/* transmissions are slow, keep them out of server thread */
+		sem_init(&txsem, 0, 0);
+		if (pipe2(txdone, O_CLOEXEC) == -1 ||
+		    fcntl(txdone[0], F_SETFL, O_NONBLOCK) == -1 ||
+		    pthread_create(&txthread, NULL, transmitThread, NULL)) {
+			if (!debugflag)
+				logprintf(logfd, LOG_ERROR, "cannot start transmitter thread\n");
+			else
+				dprintf(STDERR_FILENO, "Cannot start transmitter thread.\n");
+			endProcess(EXIT_FAILURE);
+		}
+		ev.data.u32 = EPOLL_TAG_TXSERVER;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, txsock, &ev);
+		ev.data.u32 = EPOLL_TAG_TXDONE;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, txdone[0], &ev);
+	}
+	/* clients taken over on restart continue with their queues */
 	for(i = 0; i < MAX_CLIENTS; i++)
-		clntfd[i] = -1;
-	sem_init(&clientsem, 0, 1);
-	if (pthread_create(&clntaddthread, NULL, clientAddThread, NULL)) {
+		if (clients[i].fd >= 0) {
+			ev.events = EPOLLIN | EPOLLRDHUP | EPOLLOUT;
+			ev.data.u32 = EPOLL_TAG_CLIENT + i;
+			if (epoll_ctl(epfd, EPOLL_CTL_ADD, clients[i].fd, &ev) == -1)
+				removeClient(&clients[i]);
+			else
+				clients[i].pollout = 1;
+		}
+	if (pthread_create(&srvthread, NULL, serverThread, NULL)) {
 		if (!debugflag)
-			logprintf(logfd, LOG_ERROR, "cannot start network listener thread\n");
+			logprintf(logfd, LOG_ERROR, "cannot start network server thread\n");
 		else
-			dprintf(STDERR_FILENO, "Cannot start network listener thread.\n");
+			dprintf(STDERR_FILENO, "Cannot start network server thread.\n");
 		endProcess(EXIT_FAILURE);
 	}
 	clntrun = 1;
@@ -749,17 +3273,24 @@ int main(int argc, char *argv[])
 		  gpio);
 
 	/* function loop - never ends, send signal to exit */
+	rtreport = rtprio > 0 || rtcpu >= 0;
 	for(;;) {
 		/* codes are buffered, so this loop can be more relaxed */
-		code = Radio433_getCodeExt(&ts, &type, &bits, &codelen,
-					   &repeats, &interval);
+		rc.code = Radio433_getCodeExt(&rc.ts, &rc.type, &rc.bits,
+					      &rc.codelen, &rc.repeats,
+					      &rc.interval);
 		logprintf(logfd, LOG_INFO, "radio transmission received\n");
+		if (rtreport) {
+			reportRealtime();
+			rtreport = 0;
+		}
 		if (ledgpio >= 0)
 			blinkLED();
-		len = formatMessage(buf, &ts, type, bits, codelen,
-				    repeats, interval, code);
-		if (debugflag)
-			logprintf(logfd, LOG_DEBUG, "sending message (%d bytes): %s", len, buf);
-		updateClients(buf, len);
+		/* hand over to server thread, never blocks on clients */
+		if (write(codepipe[1], &rc, sizeof(rc)) != sizeof(rc)) {
+			logprintf(logfd, LOG_WARN, "unable to pass code to server thread: %s\n",
+				  strerror(errno));
+			pipeerrors++;
+		}
 	}
 }
@@ -0,0 +1,402 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "radio433_types.h"
+#include "radio433_msg.h"
+
+#define RADIO433_DEFAULT_HOST	"127.0.0.1"
+#define RADIO433_DEFAULT_PORT	5433
+#define DEFAULT_CLIENTS		128
+#define DEFAULT_DURATION_SEC	30
+#define DEFAULT_TX_RATE		4	/* codes per second */
+#define SLOW_RCVBUF		1024	/* receive buffer of slow clients */
+#define SLOW_READ_MS		2000	/* slow clients read this often */
+#define SEQ_RING		4096	/* first arrival of recent codes */
+#define TX_CODE_BASE		0x441450ULL	/* Kemot URZ1226 system 0 */
+
+extern char *optarg;
+extern int optind, opterr, optopt;
+
+struct loadclient {
+	int fd;
+	int slow;
+	unsigned long long next;	/* next expected sequence number */
+	unsigned long received, lost;
+	struct radio433_msgbuf mb;
+};
+
+struct firstseen {
+	unsigned long long seq;
+	unsigned long long us;
+};
+
+struct loadclient *clients;
+struct firstseen seqring[SEQ_RING];
+unsigned int *agelat, *spreadlat;	/* latency samples in us */
+size_t nlat, latsize;
+unsigned long disconnects, slowdisconnects;
+
+/* Show help */
+void help(char *progname)
+{
+	printf("\nUsage:\n\t%s [-r ipaddr] [-p tcpport] [-n clients] [-s slow] [-d seconds]\n"
+	       "\t\t[-T path] [-x rate]\n\n", progname);
+	puts("Where:");
+	puts("\t-r ipaddr  - IPv4 address of radio433daemon server (optional)");
+	puts("\t-p tcpport - TCP port of radio433daemon server (optional)");
+	printf("\t-n clients - number of connected clients (optional, default %d)\n", DEFAULT_CLIENTS);
+	printf("\t-s slow    - how many of them read only every %d ms with small receive\n"
+	       "\t             buffer (optional, default 0)\n", SLOW_READ_MS);
+	printf("\t-d seconds - test duration (optional, default %d)\n", DEFAULT_DURATION_SEC);
+	puts("\t-T path    - transmit control socket of server, codes are sent through");
+	puts("\t             it to generate traffic (optional, default only listen)");
+	printf("\t-x rate    - codes transmitted per second (optional, default %d)\n", DEFAULT_TX_RATE);
+	puts("\nReports latency from code reception by server to client (age) and between");
+	puts("first and each other client receiving the same code (spread), fast clients only.\n");
+}
+
+/* Current wall clock time in us (same base as message timestamps) */
+unsigned long long nowUs(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000000ULL + tv.tv_usec;
+}
+
+/* Monotonic time in ms for test scheduling */
+long long monotonicMs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/* Store latency sample pair */
+void addLatency(unsigned long long age, unsigned long long spread)
+{
+	unsigned int *a, *s;
+
+	if (nlat == latsize) {
+		latsize = latsize ? latsize * 2 : 65536;
+		a = realloc(agelat, latsize * sizeof(*agelat));
+		s = realloc(spreadlat, latsize * sizeof(*spreadlat));
+		if (a == NULL || s == NULL) {
+			fputs("Out of memory for latency samples.\n", stderr);
+			exit(EXIT_FAILURE);
+		}
+		agelat = a;
+		spreadlat = s;
+	}
+	agelat[nlat] = age > 0xFFFFFFFFULL ? 0xFFFFFFFFU : age;
+	spreadlat[nlat] = spread > 0xFFFFFFFFULL ? 0xFFFFFFFFU : spread;
+	nlat++;
+}
+
+/* Account message received by client */
+void clientMessage(struct loadclient *c, struct radio433_msg *m,
+		   unsigned long long now)
+{
+	struct firstseen *f;
+
+	c->received++;
+	if (c->next && m->seq > c->next)
+		c->lost += m->seq - c->next;
+	c->next = m->seq + 1;
+	if (c->slow)
+		return;
+	f = &seqring[m->seq % SEQ_RING];
+	if (f->seq != m->seq || !f->us) {
+		f->seq = m->seq;
+		f->us = now;
+	}
+	addLatency(now > m->ts ? now - m->ts : 0, now - f->us);
+}
+
+/* Read what is waiting on client socket, returns 0 if closed */
+int clientRead(struct loadclient *c)
+{
+	struct radio433_msg m;
+	unsigned long long now;
+	int n;
+
+	for(;;) {
+		n = Radio433_recvMsgBuf(c->fd, &c->mb);
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return 1;
+		if (n <= 0)
+			return 0;
+		now = nowUs();
+		while (Radio433_nextMsg(&c->mb, &m))
+			clientMessage(c, &m, now);
+		if (c->slow)
+			return 1;	/* one buffer per read period */
+	}
+}
+
+/* Connect client to server and request binary records */
+int clientConnect(struct loadclient *c, struct sockaddr_in *sin, int slow)
+{
+	int rcvbuf;
+
+	c->fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (c->fd == -1)
+		return -1;
+	c->slow = slow;
+	if (slow) {
+		rcvbuf = SLOW_RCVBUF;
+		setsockopt(c->fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+	}
+	if (connect(c->fd, (struct sockaddr *)sin, sizeof(*sin)) == -1) {
+		close(c->fd);
+		c->fd = -1;
+		return -1;
+	}
+	send(c->fd, RADIO433_CMD_BINARY, strlen(RADIO433_CMD_BINARY), MSG_NOSIGNAL);
+	fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL) | O_NONBLOCK);
+	Radio433_initMsgBuf(&c->mb);
+	return 0;
+}
+
+/* Connect to transmit control socket */
+int txConnect(const char *path)
+{
+	struct sockaddr_un sun;
+	int fd;
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1)
+		return -1;
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	strncpy(sun.sun_path, path, sizeof(sun.sun_path) - 1);
+	if (connect(fd, (struct sockaddr *)&sun, sizeof(sun)) == -1) {
+		close(fd);
+		return -1;
+	}
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	return fd;
+}
+
+/* Count transmit results (OK or ERR lines) */
+void txReplies(int fd, unsigned long *ok, unsigned long *err)
+{
+	static char buf[128];
+	static int len;
+	char *p, *e;
+	int n;
+
+	while ((n = recv(fd, buf + len, sizeof(buf) - 1 - len, 0)) > 0) {
+		len += n;
+		buf[len] = '\0';
+		p = buf;
+		while ((e = strchr(p, '\n')) != NULL) {
+			if (!strncmp(p, "OK", 2))
+				(*ok)++;
+			else
+				(*err)++;
+			p = e + 1;
+		}
+		len -= p - buf;
+		memmove(buf, p, len);
+		if (len == sizeof(buf) - 1)
+			len = 0;
+	}
+}
+
+int cmpUint(const void *a, const void *b)
+{
+	unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Show percentiles of latency samples (sorted in place) */
+void showPercentiles(const char *name, unsigned int *v, size_t n)
+{
+	if (!n) {
+		printf("%-7s no samples\n", name);
+		return;
+	}
+	qsort(v, n, sizeof(*v), cmpUint);
+	printf("%-7s p50 %8.3f  p90 %8.3f  p99 %8.3f  max %8.3f ms\n", name,
+	       v[n / 2] / 1000.0, v[n * 90 / 100] / 1000.0,
+	       v[n * 99 / 100] / 1000.0, v[n - 1] / 1000.0);
+}
+
+/* ********** */
+/* *  MAIN  * */
+/* ********** */
+
+int main(int argc, char *argv[])
+{
+	int opt, port, nclients, nslow, duration, txrate;
+	int i, n, epfd, txfd, timeout;
+	char *txpath, line[64];
+	struct sockaddr_in clntsin;
+	struct epoll_event ev, evs[64];
+	struct loadclient *c;
+	long long start, now, nexttx, nextslow;
+	unsigned long txsent, txok, txerr, received, lost, slowreceived, slowlost;
+
+	/* get parameters */
+	memset((char *)&clntsin, 0, sizeof(clntsin));
+	clntsin.sin_family = AF_INET;
+	inet_aton(RADIO433_DEFAULT_HOST, &clntsin.sin_addr);
+	port = RADIO433_DEFAULT_PORT;
+	nclients = DEFAULT_CLIENTS;
+	nslow = 0;
+	duration = DEFAULT_DURATION_SEC;
+	txrate = DEFAULT_TX_RATE;
+	txpath = NULL;
+	while((opt = getopt(argc, argv, "hr:p:n:s:d:T:x:")) != -1) {
+		if (opt == 'r') {
+			if (!inet_aton(optarg, &clntsin.sin_addr)) {
+				fputs("Invalid IPv4 address specification.\n", stderr);
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if (opt == 'p')
+			sscanf(optarg, "%d", &port);
+		else if (opt == 'n')
+			sscanf(optarg, "%d", &nclients);
+		else if (opt == 's')
+			sscanf(optarg, "%d", &nslow);
+		else if (opt == 'd')
+			sscanf(optarg, "%d", &duration);
+		else if (opt == 'T')
+			txpath = optarg;
+		else if (opt == 'x')
+			sscanf(optarg, "%d", &txrate);
+		else if (opt == '?' || opt == 'h') {
+			help(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (nclients < 1 || nslow < 0 || nslow > nclients || duration < 1 ||
+	    txrate < 1 || txrate > 1000) {
+		help(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	clntsin.sin_port = htons(port);
+
+	/* connect clients, slow ones first */
+	clients = calloc(nclients, sizeof(*clients));
+	epfd = epoll_create1(0);
+	if (clients == NULL || epfd == -1) {
+		fprintf(stderr, "Unable to set up clients: %s\n", strerror (errno));
+		exit(EXIT_FAILURE);
+	}
+	for(i = 0; i < nclients; i++) {
+		c = &clients[i];
+		if (clientConnect(c, &clntsin, i < nslow) == -1) {
+			fprintf(stderr, "Unable to connect client %d to server: %s\n",
+				i, strerror (errno));
+			exit(EXIT_FAILURE);
+		}
+		if (!c->slow) {
+			ev.events = EPOLLIN;
+			ev.data.ptr = c;
+			epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev);
+		}
+	}
+	txfd = -1;
+	if (txpath != NULL) {
+		txfd = txConnect(txpath);
+		if (txfd == -1) {
+			fprintf(stderr, "Unable to connect to transmit socket %s: %s\n",
+				txpath, strerror (errno));
+			exit(EXIT_FAILURE);
+		}
+		ev.events = EPOLLIN;
+		ev.data.ptr = NULL;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, txfd, &ev);
+	}
+	printf("Connected %d clients (%d slow) to server %s port %d, running %d s...\n",
+	       nclients, nslow, inet_ntoa(clntsin.sin_addr), port, duration);
+	fflush(stdout);
+
+	/* test loop */
+	txsent = 0;
+	txok = 0;
+	txerr = 0;
+	start = monotonicMs();
+	nexttx = start;
+	nextslow = start + SLOW_READ_MS;
+	while ((now = monotonicMs()) < start + duration * 1000LL) {
+		if (txfd != -1 && now >= nexttx) {
+			/* vary code so that server does not merge repeats */
+			n = sprintf(line, "TX TYPE %d 0x%llX\n", RADIO433_DEVICE_KEMOTURZ1226,
+				    TX_CODE_BASE + (txsent & 0x0F));
+			if (send(txfd, line, n, MSG_NOSIGNAL) == n)
+				txsent++;
+			nexttx += 1000 / txrate;
+		}
+		if (now >= nextslow) {
+			for(i = 0; i < nslow; i++)
+				if (clients[i].fd != -1 && !clientRead(&clients[i])) {
+					close(clients[i].fd);
+					clients[i].fd = -1;
+					slowdisconnects++;
+				}
+			nextslow += SLOW_READ_MS;
+		}
+		timeout = (txfd != -1 && nexttx < nextslow ? nexttx : nextslow) - now;
+		n = epoll_wait(epfd, evs, 64, timeout < 0 ? 0 : timeout);
+		for(i = 0; i < n; i++) {
+			c = evs[i].data.ptr;
+			if (c == NULL) {
+				txReplies(txfd, &txok, &txerr);
+				continue;
+			}
+			if (!clientRead(c)) {
+				epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+				close(c->fd);
+				c->fd = -1;
+				disconnects++;
+			}
+		}
+	}
+
+	/* report */
+	received = 0;
+	lost = 0;
+	slowreceived = 0;
+	slowlost = 0;
+	for(i = 0; i < nclients; i++) {
+		if (clients[i].slow) {
+			slowreceived += clients[i].received;
+			slowlost += clients[i].lost;
+		} else {
+			received += clients[i].received;
+			lost += clients[i].lost;
+		}
+	}
+	if (txfd != -1) {
+		/* results of requests still queued at the end are not counted */
+		printf("Transmit requests: %lu sent (%.1f/s), %lu OK, %lu failed\n",
+		       txsent, (double)txsent / duration, txok, txerr);
+	}
+	printf("Fast clients: %lu messages received, %lu lost, %lu disconnected\n",
+	       received, lost, disconnects);
+	if (nslow)
+		printf("Slow clients: %lu messages received, %lu lost, %lu disconnected\n",
+		       slowreceived, slowlost, slowdisconnects);
+	showPercentiles("age", agelat, nlat);
+	showPercentiles("spread", spreadlat, nlat);
+	return 0;
+}
@@ -0,0 +1,460 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <string.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "radio433_types.h"
+#include "radio433_dev.h"
+#include "radio433_msg.h"
+#include "radio433_jnl.h"
+
+#define BANNER			"radio433replay v0.99.0"
+#define REPLAY_DEFAULT_HOST	"127.0.0.1"
+#define REPLAY_DEFAULT_PORT	5435
+#define MAX_CLIENTS		16	/* concurrent replays */
+#define MAX_CMD_SIZE		64	/* client command line */
+#define MAX_SUB_TYPES		8	/* as in radio433daemon */
+#define MAX_SUB_CODES		64
+#define CMD_WAIT_MS		200	/* commands expected after connecting */
+#define CMD_MAX_WAIT_MS		1000
+#define OUTBUF_SIZE		65536	/* messages sent at once at full speed */
+#define MAX_SPEED_CHECK		256	/* messages between command checks */
+
+extern char *optarg;
+extern int optind, opterr, optopt;
+
+/*
+ Serves journal written by radio433daemon -J to clients with the same
+ protocol as the server: text or binary messages, decoded fields and
+ subscriptions. Every connection gets its own replay of configured time
+ range, paced by original timestamps (speed 1), N times faster or
+ without delays (speed 0). REPLAY TIME / SEQ requests sent by client
+ narrow the range (backfill), unless timestamps are rebased to present.
+ */
+
+struct replayclient {
+	int fd;
+	struct sockaddr_in addr;
+	int binary, decode;
+	int subs;
+	unsigned int classmask;
+	int ntypes, types[MAX_SUB_TYPES];
+	int ncodes;
+	struct { int type; unsigned long long code; } codes[MAX_SUB_CODES];
+	unsigned long long start;	/* first record time (us) */
+	unsigned long long minseq;	/* REPLAY SEQ */
+	int cmdlen;
+	char cmd[MAX_CMD_SIZE];
+	int outlen;
+	char out[OUTBUF_SIZE];
+};
+
+/* Replay configuration (read-only after start) */
+char jnldir[PATH_MAX + 1];
+unsigned long long tsfrom, tsto;	/* range in us */
+double speed;		/* 0 - no delays */
+int rebase;		/* shift timestamps to present */
+int nclients;		/* active replays */
+
+/* Show help */
+void help(char *progname)
+{
+	printf("\nUsage:\n\t%s -J dir [-V] [-h ipaddr] [-p tcpport] [-f from] [-t to] [-s speed] [-N] [-1]\n\n", progname);
+	puts("Where:");
+	puts("\t-J dir     - radio433daemon journal directory (mandatory)");
+	puts("\t-V         - show version and exit");
+	printf("\t-h ipaddr  - IPv4 address to listen on (optional, default %s)\n", REPLAY_DEFAULT_HOST);
+	printf("\t-p tcpport - TCP port to listen on (optional, default is %d)\n", REPLAY_DEFAULT_PORT);
+	puts("\t-f from    - start of replayed range (optional, default is beginning of journal)");
+	puts("\t-t to      - end of replayed range (optional, default is end of journal)");
+	puts("\t-s speed   - replay speed, 1 is real time, 0 is maximum (optional, default 1)");
+	puts("\t-N         - rebase timestamps to replay start, ignore client replay requests (optional)");
+	puts("\t-1         - exit after first client replay is complete (optional)");
+	puts("\nTime is given as 'YYYY-mm-dd HH:MM[:SS]' (local), seconds since Epoch or -seconds ago.\n");
+}
+
+/* show version */
+void verShow(void)
+{
+#ifdef BUILDSTAMP
+	printf("%s build %s\n", BANNER, BUILDSTAMP);
+#else
+	printf("%s\n", BANNER);
+#endif
+}
+
+/* Current time in us */
+unsigned long long nowUs(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000000ULL + tv.tv_usec;
+}
+
+/* Parse time argument into us since Epoch, returns 0 if invalid */
+unsigned long long parseTime(const char *arg)
+{
+	struct tm tm;
+	char *end;
+	double v;
+
+	memset(&tm, 0, sizeof(tm));
+	end = strptime(arg, "%Y-%m-%d %H:%M", &tm);
+	if (end == NULL)
+		end = strptime(arg, "%Y-%m-%dT%H:%M", &tm);
+	if (end != NULL) {
+		if (*end == ':')
+			end = strptime(end + 1, "%S", &tm);
+		if (end == NULL || *end)
+			return 0;
+		tm.tm_isdst = -1;
+		return mktime(&tm) * 1000000ULL;
+	}
+	v = strtod(arg, &end);
+	if (*end || end == arg)
+		return 0;
+	if (v < 0)
+		return nowUs() + (long long)(v * 1e6);
+	return v * 1e6;
+}
+
+/* Check if message matches client subscriptions */
+int clientMatch(struct replayclient *c, struct radio433_msg *m)
+{
+	int i;
+
+	if (!c->subs || (m->type & c->classmask))
+		return 1;
+	for(i = 0; i < c->ntypes; i++)
+		if (c->types[i] == m->type)
+			return 1;
+	for(i = 0; i < c->ncodes; i++)
+		if (c->codes[i].type == m->type && c->codes[i].code == m->code)
+			return 1;
+	return 0;
+}
+
+/* Execute client command line (server commands, see radio433daemon) */
+void clientCommand(struct replayclient *c, char *line)
+{
+	int type;
+	unsigned long long v;
+
+	if (!strcmp(line, "MODE BIN") || !strcmp(line, "MODE TEXT"))
+		c->binary = line[5] == 'B';
+	else if (!strcmp(line, "MODE DECODE") || !strcmp(line, "MODE RAW"))
+		c->decode = line[5] == 'D';
+	else if (!strcmp(line, "SUB ALL")) {
+		c->subs = 0;
+		c->classmask = 0;
+		c->ntypes = 0;
+		c->ncodes = 0;
+	} else if (sscanf(line, "SUB CLASS %i", &type) == 1) {
+		c->classmask |= type;
+		c->subs = 1;
+	} else if (sscanf(line, "SUB TYPE %i", &type) == 1) {
+		if (c->ntypes < MAX_SUB_TYPES)
+			c->types[c->ntypes++] = type;
+		c->subs = 1;
+	} else if (sscanf(line, "SUB CODE %i %lli", &type, &v) == 2) {
+		if (c->ncodes < MAX_SUB_CODES) {
+			c->codes[c->ncodes].type = type;
+			c->codes[c->ncodes++].code = v;
+		}
+		c->subs = 1;
+	} else if (rebase)
+		return;		/* replay position is given by range */
+	else if (sscanf(line, "REPLAY TIME %llu", &v) == 1) {
+		if (v > c->start)
+			c->start = v;
+	} else if (sscanf(line, "REPLAY SEQ %llu", &v) == 1)
+		c->minseq = v;
+}
+
+/* Read available commands, wait up to timeout ms for them */
+/* (returns 1 if anything was read, -1 if client closed connection) */
+int readCommands(struct replayclient *c, int timeout)
+{
+	struct pollfd pfd;
+	char *eol;
+	int i, n, got;
+
+	pfd.fd = c->fd;
+	pfd.events = POLLIN;
+	got = 0;
+	for(;;) {
+		n = poll(&pfd, 1, timeout);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return n ? n : got;
+		if (c->cmdlen == MAX_CMD_SIZE)
+			c->cmdlen = 0;	/* line too long, discard */
+		n = recv(c->fd, c->cmd + c->cmdlen, MAX_CMD_SIZE - c->cmdlen,
+			 MSG_DONTWAIT);
+		if (n == -1 && (errno == EINTR || errno == EAGAIN))
+			continue;
+		if (n <= 0)
+			return -1;
+		c->cmdlen += n;
+		got = 1;
+		while ((eol = memchr(c->cmd, '\n', c->cmdlen)) != NULL) {
+			*eol = 0;
+			i = eol - c->cmd;
+			if (i && eol[-1] == '\r')
+				eol[-1] = 0;
+			clientCommand(c, c->cmd);
+			c->cmdlen -= i + 1;
+			memmove(c->cmd, eol + 1, c->cmdlen);
+		}
+		timeout = 0;	/* take rest without waiting */
+	}
+}
+
+/* Send buffered messages, returns -1 if client is gone */
+int flushClient(struct replayclient *c)
+{
+	int n, off;
+
+	for(off = 0; off < c->outlen; off += n) {
+		n = send(c->fd, c->out + off, c->outlen - off, MSG_NOSIGNAL);
+		if (n == -1 && errno == EINTR) {
+			n = 0;
+			continue;
+		}
+		if (n <= 0)
+			return -1;
+	}
+	c->outlen = 0;
+	return 0;
+}
+
+/* Wait until message time (us since replay start), commands are */
+/* accepted meanwhile, returns -1 if client is gone */
+int waitClient(struct replayclient *c, unsigned long long t0,
+	       unsigned long long offset)
+{
+	long long left;
+
+	if (flushClient(c))
+		return -1;
+	for(;;) {
+		left = t0 + offset - nowUs();
+		if (left <= 0)
+			return 0;
+		if (readCommands(c, (left + 999) / 1000) < 0)
+			return -1;
+	}
+}
+
+/* Replay journal range to one client */
+void *clientThread(void *arg)
+{
+	struct replayclient *c;
+	struct radio433_jnl j;
+	struct radio433_msg m;
+	unsigned long long t0, first, sent, n;
+	int waited;
+
+	c = arg;
+	sent = 0;
+	pthread_detach(pthread_self());
+
+	/* clients send mode, subscriptions and replay position first, */
+	/* replay starts when they stop */
+	for(waited = 0; waited < CMD_MAX_WAIT_MS; waited += CMD_WAIT_MS)
+		if (readCommands(c, CMD_WAIT_MS) <= 0)
+			break;
+
+	if (Radio433_openJournalReader(&j, jnldir) < 0 ||
+	    Radio433_seekJournal(&j, c->start)) {
+		fprintf(stderr, "Unable to read journal %s: %s\n", jnldir,
+			strerror(errno));
+		goto done;
+	}
+	t0 = nowUs();
+	first = 0;
+	n = 0;
+	while (Radio433_readJournal(&j, &m) > 0) {
+		if (tsto && m.ts > tsto)
+			break;
+		if (!first)
+			first = m.ts;
+		if (m.seq < c->minseq || !clientMatch(c, &m))
+			continue;
+		if (speed > 0) {
+			if (m.ts > first &&
+			    waitClient(c, t0, (m.ts - first) / speed))
+				break;
+		} else if (!(++n % MAX_SPEED_CHECK) && readCommands(c, 0) < 0)
+			break;
+		if (rebase)
+			m.ts = t0 + (m.ts - first);
+		if (c->decode)
+			Radio433_decodeMsg(&m);
+		else
+			m.flags = 0;
+		if (c->outlen + RADIO433_MSG_TXTSIZE > OUTBUF_SIZE &&
+		    flushClient(c))
+			break;
+		if (c->binary)
+			c->outlen += Radio433_packMsg((unsigned char *)c->out + c->outlen, &m);
+		else
+			c->outlen += Radio433_formatMsg(c->out + c->outlen, &m);
+		sent++;
+	}
+	flushClient(c);
+	printf("Client %s: %llu messages replayed in %.3f s.\n",
+	       inet_ntoa(c->addr.sin_addr), sent, (nowUs() - t0) / 1e6);
+	Radio433_closeJournalReader(&j);
+
+done:
+	close(c->fd);
+	free(c);
+	__atomic_sub_fetch(&nclients, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+/* ********** */
+/* *  MAIN  * */
+/* ********** */
+
+int main(int argc, char *argv[])
+{
+	int opt, port, srvfd, fd, ena, once;
+	struct sockaddr_in srvsin, clsin;
+	socklen_t sl;
+	struct replayclient *c;
+	struct radio433_jnl j;
+	pthread_t th;
+
+	/* show help */
+	if (argc < 2) {
+		help(argv[0]);
+		exit(0);
+	}
+
+	/* get parameters */
+	setlinebuf(stdout);	/* progress is usually logged to file */
+	memset((char *)&srvsin, 0, sizeof(srvsin));
+	srvsin.sin_family = AF_INET;
+	inet_aton(REPLAY_DEFAULT_HOST, &srvsin.sin_addr);
+	port = REPLAY_DEFAULT_PORT;
+	jnldir[0] = 0;
+	tsfrom = 0;
+	tsto = 0;
+	speed = 1;
+	rebase = 0;
+	once = 0;
+	while((opt = getopt(argc, argv, "J:h:p:f:t:s:N1V")) != -1) {
+		if (opt == 'J')
+			strncpy(jnldir, optarg, PATH_MAX);
+		else if (opt == 'h') {
+			if (!inet_aton(optarg, &srvsin.sin_addr)) {
+				fprintf(stderr, "Invalid IPv4 address specification.\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if (opt == 'p')
+			sscanf(optarg, "%d", &port);
+		else if (opt == 'f' || opt == 't') {
+			if (!(opt == 'f' ? (tsfrom = parseTime(optarg)) :
+					   (tsto = parseTime(optarg)))) {
+				fprintf(stderr, "Invalid time specification: %s\n", optarg);
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if (opt == 's')
+			sscanf(optarg, "%lf", &speed);
+		else if (opt == 'N')
+			rebase = 1;
+		else if (opt == '1')
+			once = 1;
+		else if (opt == 'V') {
+			verShow();
+			exit(EXIT_SUCCESS);
+		}
+		else {
+			help(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (!jnldir[0]) {
+		fprintf(stderr, "Journal directory is mandatory.\n");
+		exit(EXIT_FAILURE);
+	}
+	if (port <= 0 || port > 65535 || speed < 0 ||
+	    (tsto && tsto < tsfrom)) {
+		fprintf(stderr, "Invalid port, speed or time range.\n");
+		exit(EXIT_FAILURE);
+	}
+	if (Radio433_openJournalReader(&j, jnldir) <= 0) {
+		fprintf(stderr, "No journal segments found in %s.\n", jnldir);
+		exit(EXIT_FAILURE);
+	}
+	printf("Journal %s has %d segment%s.\n", jnldir, j.nsegs,
+	       j.nsegs > 1 ? "s" : "");
+	Radio433_closeJournalReader(&j);
+
+	/* listen for clients */
+	srvsin.sin_port = htons(port);
+	srvfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	ena = 1;
+	if (srvfd == -1 ||
+	    setsockopt(srvfd, SOL_SOCKET, SO_REUSEADDR, &ena, sizeof(int)) == -1 ||
+	    bind(srvfd, (struct sockaddr *)&srvsin, sizeof(srvsin)) == -1 ||
+	    listen(srvfd, MAX_CLIENTS) == -1) {
+		fprintf(stderr, "Unable to listen on %s port %d: %s\n",
+			inet_ntoa(srvsin.sin_addr), port, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	printf("Replaying at %s speed to clients on %s port %d...\n",
+	       speed > 0 ? "given" : "maximum", inet_ntoa(srvsin.sin_addr),
+	       port);
+
+	for(;;) {
+		sl = sizeof(clsin);
+		fd = accept4(srvfd, (struct sockaddr *)&clsin, &sl, SOCK_CLOEXEC);
+		if (fd == -1) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			fprintf(stderr, "Unable to accept client: %s\n",
+				strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		if (__atomic_load_n(&nclients, __ATOMIC_ACQUIRE) >= MAX_CLIENTS ||
+		    (c = calloc(1, sizeof(struct replayclient))) == NULL) {
+			close(fd);
+			continue;
+		}
+		c->fd = fd;
+		c->addr = clsin;
+		c->start = tsfrom;
+		printf("Client %s connected.\n", inet_ntoa(clsin.sin_addr));
+		__atomic_add_fetch(&nclients, 1, __ATOMIC_RELEASE);
+		if (once) {
+			clientThread(c);	/* detaches itself, harmless */
+			break;
+		}
+		if (pthread_create(&th, NULL, clientThread, c)) {
+			close(fd);
+			free(c);
+			__atomic_sub_fetch(&nclients, 1, __ATOMIC_RELEASE);
+		}
+	}
+
+	close(srvfd);
+	return 0;
+}
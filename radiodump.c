@@ -11,6 +11,7 @@
 #include <sys/time.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <sched.h>
 #include <semaphore.h>
 #include <pthread.h>
@@ -36,6 +37,10 @@ extern int optind, opterr, optopt;
 #define RING_BUFFER_ENTRIES	1024
 #define FILE_UMASK		(S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)
 #define SYSFS_GPIO_UNEXPORT	"/sys/class/gpio/unexport"
+#define SYSFS_CPU_ISOLATED	"/sys/devices/system/cpu/isolated"
+#ifndef MCL_ONFAULT
+#define MCL_ONFAULT		4	/* older libc headers */
+#endif
 #define TUSDIFF(sec_e, usec_e, sec_s, usec_s)	(((sec_e) - (sec_s)) * 1000000UL + (usec_e) - (usec_s))
 
 /* ********************** */
@@ -52,6 +57,8 @@ static struct timeval tvprev;
 static unsigned long *tbuf;	/* timing ring buffer */
 static sem_t semtrdy;		/* buffer access semaphore */
 static sem_t semisrdown;	/* unblocked if ISR is shut down and ready for exit */
+static int rtprio, rtcpu;	/* real-time profile of ISR thread */
+static volatile int rtstate;	/* 1 applied, 0 pending, -errno failed */
 
 /* *************** */
 /* *  Functions  * */
@@ -60,7 +67,7 @@ static sem_t semisrdown;	/* unblocked if ISR is shut down and ready for exit */
 /* Show help */
 void help(void)
 {
-	printf("Usage:\n\t%s -g gpio [-C|-N|-V] [-o outfile] [-b buffersize] [-s syncmin[,syncmax]] [-e noisetime] [-t timelimit] [-c packets]\n\n", progname);
+	printf("Usage:\n\t%s -g gpio [-C|-N|-V] [-o outfile] [-b buffersize] [-s syncmin[,syncmax]] [-e noisetime] [-t timelimit] [-c packets] [-R prio[:cpu]]\n\n", progname);
 	puts("Where:");
 	puts("\t-g gpio       - GPIO pin with external RF receiver data (mandatory)");
 	puts("\t-C            - generate CSV-friendly output (optional, format \"time,0,1,duration\")");
@@ -72,6 +79,7 @@ void help(void)
 	puts("\t-e noisetime  - treat signal as noise and ignore (in microseconds, optional, default is record all)");
 	puts("\t-t timelimit  - capture duration (in seconds, optional, default is indefinite)");
 	puts("\t-c packets    - number of packets to capture (optional, default is indefinite, valid only with -s)");
+	puts("\t-R p[:c]      - capture with SCHED_FIFO priority p pinned to CPU c (optional, p 0 keeps default scheduling)");
 	puts("\t-V            - show version and exit\n");
 }
 
@@ -96,6 +104,60 @@ int changeSched(void)
 	return 0;
 }
 
+/* check if CPU is in isolated list (e.g. "1,3-5") */
+int checkCpuIsolated(int cpu)
+{
+	FILE *f;
+	char buf[256], *p;
+	int a, b, n;
+
+	f = fopen(SYSFS_CPU_ISOLATED, "r");
+	if (f == NULL)
+		return 0;
+	if (fgets(buf, sizeof(buf), f) == NULL)
+		buf[0] = 0;
+	fclose(f);
+	p = buf;
+	while (*p) {
+		n = sscanf(p, "%d-%d", &a, &b);
+		if (n < 1)
+			break;
+		if (n == 1)
+			b = a;
+		if (cpu >= a && cpu <= b)
+			return 1;
+		p = strchr(p, ',');
+		if (p == NULL)
+			break;
+		p++;
+	}
+	return 0;
+}
+
+/* switch ISR thread to SCHED_FIFO and pin it to CPU */
+/* (returns 1 on success or -errno) */
+int setThreadRealtime(void)
+{
+	struct sched_param sp;
+	cpu_set_t cs;
+	int r;
+
+	if (rtcpu >= 0) {
+		CPU_ZERO(&cs);
+		CPU_SET(rtcpu, &cs);
+		r = pthread_setaffinity_np(pthread_self(), sizeof(cs), &cs);
+		if (r)
+			return -r;
+	}
+	if (rtprio > 0) {
+		sp.sched_priority = rtprio;
+		r = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+		if (r)
+			return -r;
+	}
+	return 1;
+}
+
 #ifdef HAS_CPUFREQ
 /* verify if cpufreq governor prefers 'fixed' frequencies */
 /* (gpio timings require stable system clock) */
@@ -159,6 +221,9 @@ static void handleGpioInt(void)
 
 	if (!tvprev.tv_sec) {
 		/* first pass, initialize timestamp and exit */
+		/* (wiringPi created this thread, so switch it now) */
+		if (rtprio > 0 || rtcpu >= 0)
+			rtstate = setThreadRealtime();
 		gettimeofday(&tvprev, NULL);
 		return;
 	}
@@ -236,7 +301,9 @@ int main(int argc, char *argv[])
 	pktlim = 0;
 	csvflag = 0;
 	numflag = 0;
-	while((opt = getopt(argc, argv, "g:o:b:s:e:t:c:CNV")) != -1) {
+	rtprio = 0;
+	rtcpu = -1;
+	while((opt = getopt(argc, argv, "g:o:b:s:e:t:c:R:CNV")) != -1) {
 		if (opt == 'g')
 			sscanf(optarg, "%d", &gpio);
 		else if (opt == 'o')
@@ -251,6 +318,8 @@ int main(int argc, char *argv[])
 			sscanf(optarg, "%d", &timlim);
 		else if (opt == 'c')
 			sscanf(optarg, "%d", &pktlim);
+		else if (opt == 'R')
+			sscanf(optarg, "%d:%d", &rtprio, &rtcpu);
 		else if (opt == 'C')
 			csvflag = 1;
 		else if (opt == 'N')
@@ -291,6 +360,21 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
+	if (rtprio < 0 || (rtprio > 0 &&
+	    (rtprio < sched_get_priority_min(SCHED_FIFO) ||
+	     rtprio > sched_get_priority_max(SCHED_FIFO))) ||
+	    rtcpu < -1 || rtcpu >= sysconf(_SC_NPROCESSORS_ONLN)) {
+		dprintf(STDERR_FILENO, "Error: invalid real-time specification (priority %d-%d, CPU 0-%ld).\n",
+			sched_get_priority_min(SCHED_FIFO),
+			sched_get_priority_max(SCHED_FIFO),
+			sysconf(_SC_NPROCESSORS_ONLN) - 1);
+		exit(EXIT_FAILURE);
+	}
+
+	if (rtcpu >= 0 && !checkCpuIsolated(rtcpu))
+		dprintf(STDERR_FILENO, "Warning: CPU %d is not isolated, capture shares it with other tasks.\n",
+			rtcpu);
+
 	if (csvflag && numflag) {
 		dprintf(STDERR_FILENO, "Warning: numbering disabled in CSV mode (-C overrides -N).\n");
 		numflag = 0;
@@ -305,8 +389,13 @@ int main(int argc, char *argv[])
 		dprintf(STDERR_FILENO, "Warning: current CPUfreq governor is not optimal for radio code timing.\n");
 #endif
 
-	/* try to change scheduling priority */
-	if (changeSched())
+	/* try to change scheduling priority (batch unless capturing in real-time) */
+	if (rtprio > 0 || rtcpu >= 0) {
+		if (mlockall(MCL_CURRENT | MCL_FUTURE | MCL_ONFAULT) &&
+		    (errno != EINVAL || mlockall(MCL_CURRENT | MCL_FUTURE)))
+			dprintf(STDERR_FILENO, "Warning: unable to lock memory: %s\n",
+				strerror(errno));
+	} else if (changeSched())
 		dprintf(STDERR_FILENO, "Warning: unable to change process scheduling priority.\n");
 
 	/* init buffer */
@@ -427,6 +516,10 @@ int main(int argc, char *argv[])
 		numtnoise, 100.0 * numtnoise / (numttotal + numtnoise));
 	dprintf(ofd, "# Packets (sync pulses): %lu\n", numpkts);
 	dprintf(ofd, "# Capture duration: %lu second(s)\n", td / 1000000UL);
+	if (rtstate < 0)
+		dprintf(ofd, "# Real-time profile: failed (%s)\n", strerror(-rtstate));
+	else if (rtstate > 0)
+		dprintf(ofd, "# Real-time profile: priority %d, CPU %d\n", rtprio, rtcpu);
 
 	/* the end */
 	free(tbuf);
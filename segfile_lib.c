@@ -0,0 +1,246 @@
+/*
+ * **********************************************
+ *  This library contains segment file handling
+ *  shared by radio433 journal and sensor store
+ *  (naming, rotation, pruning and time index)
+ * **********************************************
+ */
+
+/*
+ * Segment name carries timestamp of its first record in
+ * fixed width hexadecimal, so alphabetical order is time
+ * order and segment of given time is found without
+ * opening any file. New segment is created exclusively,
+ * with timestamp bumped when name is taken, and oldest
+ * segments above limit are removed with their indexes.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "segfile_lib.h"
+
+#define SEGFILE_UMASK	(S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)
+#define SEGFILE_TSLEN	16	/* hexadecimal timestamp in name */
+
+/* Little-endian helpers */
+void SegFile_putLE(unsigned char *p, unsigned long long v, int n)
+{
+	int i;
+
+	for(i = 0; i < n; i++, v >>= 8)
+		p[i] = v & 0xFF;
+}
+
+unsigned long long SegFile_getLE(const unsigned char *p, int n)
+{
+	unsigned long long v;
+
+	v = 0;
+	while (n--)
+		v = (v << 8) | p[n];
+	return v;
+}
+
+/* Write whole buffer */
+int SegFile_writeAll(int fd, const unsigned char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len) {
+		n = write(fd, buf, len);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/* Length of segment name */
+static size_t nameLen(const struct segfile_fmt *f)
+{
+	return strlen(f->prefix) + SEGFILE_TSLEN + strlen(f->suffix);
+}
+
+/* Check directory name length */
+int SegFile_checkDir(const struct segfile_fmt *f, const char *dir, size_t size)
+{
+	if (strlen(dir) + nameLen(f) + 2 > size) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	return 0;
+}
+
+/* Segment name of this kind */
+static int isSegment(const struct segfile_fmt *f, const char *name)
+{
+	size_t l;
+
+	l = strlen(name);
+	return l == nameLen(f) &&
+	       !strncmp(name, f->prefix, strlen(f->prefix)) &&
+	       !strcmp(name + l - strlen(f->suffix), f->suffix);
+}
+
+/* Path of segment or its index */
+void SegFile_path(char *path, const struct segfile_fmt *f, const char *dir,
+		  const char *name, const char *suffix)
+{
+	snprintf(path, PATH_MAX, "%s/%.*s%s", dir,
+		 (int)(strlen(f->prefix) + SEGFILE_TSLEN), name, suffix);
+}
+
+/* Timestamp of first record from segment name */
+unsigned long long SegFile_time(const struct segfile_fmt *f, const char *name)
+{
+	unsigned long long ts;
+
+	if (name == NULL || sscanf(name + strlen(f->prefix), "%16llX", &ts) != 1)
+		return 0;
+	return ts;
+}
+
+/* List segments */
+int SegFile_list(const struct segfile_fmt *f, const char *dir, char ***names)
+{
+	struct dirent **nl;
+	char **segs;
+	int i, j, n;
+
+	n = scandir(dir, &nl, NULL, alphasort);
+	if (n < 0)
+		return -1;
+	segs = malloc((n ? n : 1) * sizeof(char *));
+	for(i = j = 0; i < n; i++) {
+		if (segs != NULL && isSegment(f, nl[i]->d_name))
+			segs[j++] = strdup(nl[i]->d_name);
+		free(nl[i]);
+	}
+	free(nl);
+	if (segs == NULL)
+		return -1;
+	*names = segs;
+	return j;
+}
+
+/* Free segment names */
+void SegFile_freeList(char **names, int n)
+{
+	int i;
+
+	for(i = 0; i < n; i++)
+		free(names[i]);
+	free(names);
+}
+
+/* Remove oldest segments above limit */
+static void pruneSegments(const struct segfile_fmt *f, const char *dir, int keep)
+{
+	char path[PATH_MAX], **segs;
+	int i, n;
+
+	n = SegFile_list(f, dir, &segs);
+	if (n < 0)
+		return;
+	for(i = 0; i < n - keep; i++) {
+		SegFile_path(path, f, dir, segs[i], f->suffix);
+		unlink(path);
+		SegFile_path(path, f, dir, segs[i], SEGFILE_INDEX);
+		unlink(path);
+	}
+	SegFile_freeList(segs, n);
+}
+
+/* Create segment starting with record timestamp */
+int SegFile_create(const struct segfile_fmt *f, const char *dir,
+		   unsigned long long ts, int keep, int *fd, int *idxfd)
+{
+	char name[NAME_MAX + 1], path[PATH_MAX];
+	unsigned char hdr[SEGFILE_HDRSIZE];
+	int i;
+
+	*idxfd = -1;
+	for(i = 0; i < 16; i++, ts++) {	/* names are unique */
+		snprintf(name, sizeof(name), "%s%016llX%s", f->prefix, ts,
+			 f->suffix);
+		SegFile_path(path, f, dir, name, f->suffix);
+		*fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_APPEND | O_CLOEXEC,
+			   SEGFILE_UMASK);
+		if (*fd >= 0 || errno != EEXIST)
+			break;
+	}
+	if (*fd < 0)
+		return -1;
+	SegFile_path(path, f, dir, name, SEGFILE_INDEX);
+	*idxfd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC,
+		      SEGFILE_UMASK);
+	SegFile_putLE(hdr, f->magic, 4);
+	hdr[4] = f->version;
+	hdr[5] = f->recsize;
+	SegFile_putLE(hdr + 6, 0, 2);
+	SegFile_putLE(hdr + 8, ts, 8);
+	if (*idxfd < 0 || SegFile_writeAll(*fd, hdr, sizeof(hdr))) {
+		close(*fd);
+		if (*idxfd >= 0)
+			close(*idxfd);
+		*fd = -1;
+		*idxfd = -1;
+		return -1;
+	}
+	if (keep)
+		pruneSegments(f, dir, keep);
+	return 0;
+}
+
+/* Check segment header */
+int SegFile_checkHeader(const struct segfile_fmt *f, const unsigned char *hdr)
+{
+	return SegFile_getLE(hdr, 4) != f->magic || hdr[4] != f->version ||
+	       hdr[5] != f->recsize ? -1 : 0;
+}
+
+/* Append index entry */
+void SegFile_indexAdd(int idxfd, unsigned long long ts, unsigned long long rec)
+{
+	unsigned char ie[SEGFILE_IDXSIZE];
+
+	SegFile_putLE(ie, ts, 8);
+	SegFile_putLE(ie + 8, rec, 8);
+	SegFile_writeAll(idxfd, ie, sizeof(ie));
+}
+
+/* Find record by index */
+unsigned long long SegFile_indexFind(const struct segfile_fmt *f,
+				     const char *dir, const char *name,
+				     unsigned long long ts)
+{
+	char path[PATH_MAX];
+	unsigned char ie[SEGFILE_IDXSIZE];
+	unsigned long long rec;
+	int fd;
+
+	rec = 0;
+	SegFile_path(path, f, dir, name, SEGFILE_INDEX);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd >= 0) {
+		while (read(fd, ie, sizeof(ie)) == sizeof(ie) &&
+		       SegFile_getLE(ie, 8) < ts)
+			rec = SegFile_getLE(ie + 8, 8);
+		close(fd);
+	}
+	return rec;
+}
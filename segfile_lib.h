@@ -0,0 +1,76 @@
+#ifndef _SEGFILE_LIB_H_
+#define _SEGFILE_LIB_H_
+
+#include <stddef.h>
+
+/* Segment files of append-only record logs (radio433 journal, sensor
+   store), record format and timestamp unit are up to their users */
+
+/* Directory holds segments named by timestamp of their first record, so
+   sorted names are in time order:
+     PREFIXTTTTTTTTTTTTTTTTSUFFIX   16-byte header followed by records
+     PREFIXTTTTTTTTTTTTTTTT.idx     sparse time index: (timestamp, record
+                                    number) pair of u64 every few records
+   Segment header:
+     0  u32  magic
+     4  u8   version
+     5  u8   record size
+     6  u16  reserved (0)
+     8  u64  timestamp of first record
+   All numbers are little-endian. */
+
+#define SEGFILE_HDRSIZE		16
+#define SEGFILE_INDEX		".idx"
+#define SEGFILE_IDXSIZE		16	/* index entry */
+
+struct segfile_fmt {		/* segments of one kind */
+	const char *prefix;		/* name before timestamp */
+	const char *suffix;		/* name after timestamp */
+	unsigned int magic;
+	int version, recsize;
+};
+
+/* Store and load little-endian number of n bytes */
+void SegFile_putLE(unsigned char *p, unsigned long long v, int n);
+unsigned long long SegFile_getLE(const unsigned char *p, int n);
+
+/* Write whole buffer, returns 0 on success */
+int SegFile_writeAll(int fd, const unsigned char *buf, size_t len);
+
+/* Check that paths of segments in directory fit into buffer of size */
+/* bytes, returns 0 if they do (errno is ENAMETOOLONG otherwise) */
+int SegFile_checkDir(const struct segfile_fmt *f, const char *dir, size_t size);
+
+/* Path of segment (suffix f->suffix) or its index (SEGFILE_INDEX), */
+/* path buffer is PATH_MAX bytes */
+void SegFile_path(char *path, const struct segfile_fmt *f, const char *dir,
+		  const char *name, const char *suffix);
+
+/* Timestamp of first record from segment name, 0 if invalid */
+unsigned long long SegFile_time(const struct segfile_fmt *f, const char *name);
+
+/* Sorted segment names in directory (free with SegFile_freeList()), */
+/* returns number of segments or -1 on error */
+int SegFile_list(const struct segfile_fmt *f, const char *dir, char ***names);
+
+/* Free segment names */
+void SegFile_freeList(char **names, int n);
+
+/* Create segment starting with record timestamp ts and its index, */
+/* oldest segments above keep are removed (0 keeps all), returns 0 on */
+/* success */
+int SegFile_create(const struct segfile_fmt *f, const char *dir,
+		   unsigned long long ts, int keep, int *fd, int *idxfd);
+
+/* Check segment header, returns 0 if segment is of this kind */
+int SegFile_checkHeader(const struct segfile_fmt *f, const unsigned char *hdr);
+
+/* Append index entry (index is a hint, errors are ignored) */
+void SegFile_indexAdd(int idxfd, unsigned long long ts, unsigned long long rec);
+
+/* Number of last indexed record with timestamp older than ts, 0 if none */
+unsigned long long SegFile_indexFind(const struct segfile_fmt *f,
+				     const char *dir, const char *name,
+				     unsigned long long ts);
+
+#endif
@@ -44,17 +44,26 @@
  *          that may serve as a marker that sensor info is complete
  *
  *  Execution flow:
- *  + main thread accepts clients, immediately sends info and closes socket
+ *  + main thread serves all clients with single epoll loop and non-blocking
+ *    sockets: sends info and closes socket, answers queries
  *  + optional client_thread listens to radio server and updates sensor list
  *  + optional i2c_thread reads from I2C sensors and updates sensor list
+ *    (conversions of all sensors run in parallel, list is locked only to
+ *    store samples, not during I2C conversion)
+ *  + optional subscription thread pushes changes to subscribers
+ *  + optional store thread appends queued samples to store on disk in
+ *    batches (see sensorstore_lib.h), latest values are read back from
+ *    its tail on startup
  *
- *  Sensor list utilizes lazy timing and housekeeping, it means that obsolete
- *  entries are removed only during access (updates and sending to clients)
+ *  Sensor list is indexed by sensor identity (hash), free slots are kept
+ *  on stack and expiry times in min-heap, so updates do not scan the list;
+ *  main thread removes obsolete entries when their expiry is due
  */
 
 #define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <time.h>
 #include <errno.h>
@@ -69,9 +78,14 @@
 #include <semaphore.h>
 #include <pthread.h>
 #include <signal.h>
+#include <poll.h>
+#include <fnmatch.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <stdarg.h>
+#include <limits.h>
 #include <linux/limits.h>
 #include <fcntl.h>
 #include <linux/limits.h>  /* for NGROUPS_MAX */
@@ -83,10 +97,14 @@
 #include <wiringPiI2C.h>
 
 #include "radio433_dev.h"
+#include "radio433_msg.h"
+#include "daemonlog_lib.h"
+#include "radio433_shm.h"
 #include "htu21d_lib.h"
 #include "bmp180_lib.h"
 #include "bh1750_lib.h"
 #include "bme280_lib.h"
+#include "sensorstore_lib.h"
 
 /* *************** */
 /* *  Constants  * */
@@ -99,31 +117,60 @@
 #define SERVER_PORT		5444
 #define SERVER_ADDR		"0.0.0.0"
 #define RPI3I2C_BUS		1
-#define RADMSG_SIZE		128	/* radio daemon message size */
-#define RADBUF_SIZE		(RADMSG_SIZE * 8)
-#define BUFFER_SIZE		4096	/* output buffer size */
-#define MAX_CLNT_QUEUE		16	/* client backlog limit */
+#define MAX_CLNT_QUEUE		64	/* client backlog limit */
+#define MAX_SUBSCRIBERS		16	/* subscription clients limit */
+#define PUSH_INTERVAL_MS	500	/* default minimum push interval */
+#define SUB_OUT_LIMIT		(8 << 20)	/* pending output of subscriber */
+#define SUB_OUT_KEEP		(64 << 10)	/* larger buffer freed when sent */
+#define SUB_CMD_SIZE		64
+#define MAX_CLIENT_CONNS	64	/* client and query connections limit */
+#define CLIENT_OUT_KEEP		(64 << 10)	/* larger response buffer freed */
+#define MAX_QUERY_PATTERNS	16	/* patterns per query */
+#define QUERY_REQ_SIZE		2048	/* query request limit */
+#define MAX_EPOLL_EVENTS	32	/* events handled per epoll_wait() call */
+#define EPOLL_TAG_SERVER	0	/* epoll data: listening socket */
+#define EPOLL_TAG_QUERY		1	/* epoll data: query listening socket */
+#define EPOLL_TAG_EXPIRY	2	/* epoll data: sensor expiry changed */
+#define EPOLL_TAG_CLIENT	3	/* epoll data: first client connection */
+#define HOUSEKEEPING_MS		1000	/* pending signal actions check */
+#define EXPIRY_RETRY_MS		100	/* recheck of I2C entry being read */
 #define RECONNECT_DELAY_SEC	15
+#define REPLAY_WINDOW_SEC	120	/* radio history requested on connect */
 #define MAX_SENSORS		256
+#define SENSOR_HASH_BITS	9	/* sensor index has 2^bits buckets */
+#define HISTORY_MEM_KB		2048	/* default history memory budget */
+#define HIST_VALUES		3	/* values with history per sensor */
+#define HIST_RAW		256	/* raw samples kept per value */
+#define HIST_LEVELS		3	/* rollup resolutions (see histlevels) */
+#define HIST_BUCKETS		(1440 + 168 + 366)	/* rollup buckets per value */
+#define STORE_QUEUE_LEN		4096	/* samples waiting for store writer */
+#define STORE_FLUSH_SEC		30	/* store writer batch interval */
+#define STORE_SEGMENT_MB	4	/* default store segment size */
+#define STORE_SEGMENTS		64	/* default store segments kept */
+#define STORE_RESTORE_SEC	86400	/* oldest sample read on startup */
+#define STORE_RESTORE_RECS	131072	/* records read on startup at most */
+#define STORE_RESTORE_HASH	2048	/* restore lookup slots (> values) */
+#define STORE_QUERY_HASH	2048	/* history query lookup slots (> values) */
+#define HIST_RAW_SPAN_SEC	86400	/* default range of raw history query */
 #define SENSOR_LABEL		16
 #define BUS_LABEL		8
 #define UNIT_LABEL		4
 #define SENSOR_ENTRY_TTL	4	/* failed communication limit */
-#define RADMSG_HDR		"<RX>"
-#define RADMSG_EOT		"<ZZ>"
 #define TXTMSG_HDR		"BEGIN"
 #define TXTMSG_EOT		"END"
+#define TXTMSG_SNAP		"SNAPSHOT"
+#define TXTMSG_UPD		"UPDATE"
+#define TXTMSG_DEL		"DELETE"
+#define TXTCMD_RESYNC		"RESYNC"
+#define TXTCMD_HISTORY		"HISTORY"
+#define TXTMSG_ERR		"ERROR"
 #define FILE_UMASK		(S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)
 #define PID_DIR			"/var/run/"
-#define LOG_DEBUG		"debug"
-#define LOG_INFO		"info"
-#define LOG_NOTICE		"notice"
-#define LOG_WARN		"warn"
-#define LOG_ERROR		"error"
 
 #define TSDIFF(s0, m0, s1, m1)	(((s0) - (s1)) * 1000 + (m0) - (m1))
 #define MIN(x, y)		((x) < (y) ? (x) : (y))
 #define MAX(x, y)		((x) > (y) ? (x) : (y))
+#define RADIO_KEY(ch, s, d)	(((ch) << 16) | ((s) << 8) | (d))
 
 /* Labels */
 #define SL_HYUWSSENZOR77TH	"hyuws77th"
@@ -144,41 +191,115 @@
 #define ST_I2C_BH1750		3
 #define ST_I2C_BME280		4
 
+/* Sensor section consumers (sensdirty bits) */
+#define SD_RESPONSE		1	/* cached client response */
+#define SD_PUSH			2	/* subscription updates */
+
+/* Sensor attribute value kinds */
+#define AV_TIMESTAMP		0	/* entry timestamp */
+#define AV_INTERVAL		1	/* entry interval */
+#define AV_INDEX		2	/* entry index */
+#define AV_HEX64		3	/* unsigned long long, hex */
+#define AV_INT			4	/* int */
+#define AV_FLOAT		5	/* double */
+#define AV_SFLOAT		6	/* double, always signed */
+#define AV_UNIT			7	/* char[UNIT_LABEL] */
+#define AV_TREND		8	/* int, trend character index */
+
 /* ********************** */
 /* *  Global variables  * */
 /* ********************** */
 
 const char *busname[] = { "(null)", "radio", "i2c" };
 const char trend[3] = { '_', '/', '\\' };
+const char *i2cvalfmt[] = { "", "h=%.1lf, t=%.1lf", "p=%.1lf, t=%.1lf",
+			    "l=%.1lf", "t=%.1lf, p=%.1lf, h=%.1lf" };
+const char *i2clabel[] = { "", SL_HTU21D, SL_BMP180, SL_BH1750, SL_BME280 };
 extern char *optarg;
 extern int optind, opterr, optopt;
-volatile int debugflag, i2cdelay, netclrun, i2ctrun;
+volatile int debugflag, i2cdelay, netclrun, i2ctrun, subtrun;
 volatile int mrstflag, rdelflag;
-pthread_t netcltthread, i2cthread;
+pthread_t netcltthread, i2cthread, subthread;
 pid_t procpid;
 char progname[PATH_MAX + 1], logfname[PATH_MAX + 1], pidfname[PATH_MAX + 1];
-volatile int logfd, srvfd, radfd; /* files and sockets */
+volatile int logfd, srvfd, radfd, subfd, qryfd; /* files and sockets */
+int epfd;			/* server epoll instance */
+int expfd;			/* eventfd waking main loop on earlier expiry */
+int pushint;			/* minimum subscription push interval (ms) */
 sem_t sensem;		/* semaphore for sensor list updates */
-sem_t logsem;		/* log file semaphore */
+volatile int i2cbusy;	/* I2C measurements running without semaphore */
+int i2cint[ST_I2C_BME280 + 1];	/* sampling interval of each I2C type (s) */
 struct sockaddr_in radsin;
-
-struct radmsg {
-	time_t tsec;
-	unsigned int tmsec;
-	int codelen, repeats, interval;
-	int type, bits;
-	unsigned long long code;
-};
+unsigned long long radlastts;	/* last radio message timestamp in us */
+struct in_addr radmcgroup;	/* radio multicast group (optional) */
+int radmcport;
+char radshmname[64];		/* radio shared memory ring (optional) */
 
 struct sensorentry {
 	time_t tsec;
 	unsigned int tmsec;
 	int interval;			/* interval between readings in ms */
 	int bus, type;
+	int key;			/* identity on bus (I2C address or */
+					/* RADIO_KEY()), unique with type */
 	char label[SENSOR_LABEL];
 	void *data;			/* pointer to model-specific struct */
 } senstbl[MAX_SENSORS];
 
+/* Sensor table index (all of it is guarded by sensor table lock) */
+int senshash[1 << SENSOR_HASH_BITS];	/* buckets, -1 terminated chains */
+int senshnext[MAX_SENSORS];		/* next entry in bucket */
+int sensbus[SB_I2C + 1];		/* entries on bus, -1 terminated lists */
+int sensbnext[MAX_SENSORS], sensbprev[MAX_SENSORS];
+int sensfree[MAX_SENSORS], sensnfree;	/* free slots (stack) */
+int sensheap[MAX_SENSORS], sensnheap;	/* entries by expiry (min-heap) */
+int senshpos[MAX_SENSORS];		/* position in heap, -1 if none */
+long long sensexp[MAX_SENSORS];		/* expiry time (ms since Epoch) */
+
+struct textbuf {		/* growable text buffer */
+	char *data;
+	size_t len, size;
+};
+
+struct subscriber {		/* subscription client */
+	int fd;
+	char cmd[SUB_CMD_SIZE];		/* incomplete command line */
+	int cmdlen;
+	struct textbuf out;		/* output waiting for POLLOUT */
+	size_t outpos;
+};
+
+struct querypat {		/* path pattern split at bus and device */
+	char bus[BUS_LABEL];
+	char dev[SENSOR_LABEL + 32];
+	char attr[64];			/* empty - all attributes */
+};
+
+struct snapshot {		/* formatted client message, shared */
+	struct textbuf buf;
+	int refs;			/* connections still sending it */
+};
+
+struct clientconn {		/* client connection */
+	int fd;
+	time_t since;
+	int query;			/* query connection (reads requests) */
+	int http, keep;			/* HTTP request, keep-alive */
+	int reqlen;
+	char req[QUERY_REQ_SIZE];
+	struct textbuf out;		/* response being sent */
+	struct snapshot *snap;		/* or message being sent */
+	size_t outpos;
+	int pollout;			/* EPOLLOUT armed (socket buffer full) */
+	unsigned int gen;		/* connection in slot (epoll data) */
+} clconns[MAX_CLIENT_CONNS];
+unsigned int clgen;			/* last connection generation */
+
+struct snapshot *respsnap;		/* current client message */
+struct textbuf senssect[MAX_SENSORS];	/* formatted sensor sections */
+char sensdirty[MAX_SENSORS];		/* section needs formatting (SD_*) */
+unsigned long senstblver, respver;	/* sensor table and response versions */
+
 struct fvalentry {
 	double cur, min, max;
 	char unit[UNIT_LABEL];
@@ -227,6 +348,150 @@ struct databme280 {
 	struct fvalentry press, temp, humid;
 };
 
+struct i2csample {		/* I2C sensor schedule and measurement */
+	int idx, type, fd;		/* type 0 - removed from schedule */
+	int period;			/* sampling period (ms) */
+	long long due;			/* next measurement start (ms) */
+	int step;			/* next action (see i2cSensorStep()) */
+	long long deadline;		/* next step time (ms), -1 if idle */
+	int raw;			/* BMP180 uncompensated temperature */
+	int valid, ready;
+	struct timeval ts;
+	double v[3];			/* as stored by i2cSensorStore() */
+};
+
+struct histpoint {		/* raw sample */
+	long long ts;			/* ms since Epoch */
+	double v;
+};
+
+struct histbucket {		/* rollup of samples in time slot */
+	int slot;			/* timestamp / resolution */
+	unsigned int count;		/* 0 - empty */
+	float min, max;
+	double sum;
+};
+
+struct histseries {		/* history of single sensor value */
+	struct histseries *next;	/* free list */
+	int rawhead, rawlen;		/* raw ring */
+	struct histpoint raw[HIST_RAW];
+	struct histbucket roll[HIST_BUCKETS];	/* rings of all levels */
+};
+
+struct histlevel {		/* rollup resolution */
+	const char *name;
+	int res;			/* bucket length (s) */
+	int cap, off;			/* ring size and position in roll[] */
+};
+
+struct histquery {		/* history request */
+	int level;			/* -1 - raw samples */
+	long long from, to;		/* time range (ms since Epoch) */
+};
+
+struct histcopy {		/* requested history of sensor value, copied */
+				/* under sensor table lock for formatting */
+	char path[SENSOR_LABEL + 128];	/* "/bus/device/value" */
+	int kind;			/* AV_* */
+	unsigned char id[SENSORSTORE_RECSIZE];	/* identity of store records */
+	long long storeto;		/* store read up to (ms), -1 - not read */
+	int shead, stail;		/* samples read from store (histhits) */
+	size_t first, count;		/* samples or buckets in histsamples */
+};
+
+struct storehit {		/* sample read from store for history query */
+	long long ts;			/* ms since Epoch */
+	double v;
+	int next;			/* next sample of value, -1 - last */
+};
+
+struct attrentry {		/* sensor attribute, in message order */
+	const char *name;
+	int kind;			/* AV_* */
+	size_t off;			/* offset in model-specific struct */
+	int hist;			/* current value kept in history */
+};
+
+#define ATTR_HEAD		{ "timestamp", AV_TIMESTAMP, 0 }, \
+				{ "interval", AV_INTERVAL, 0 }
+#define ATTR_TAIL		{ "index", AV_INDEX, 0 }, { NULL, 0, 0 }
+#define ATTR_VAL(t, f, n, k)	{ n "/min", k, offsetof(t, f.min) }, \
+				{ n "/cur", k, offsetof(t, f.cur), 1 }, \
+				{ n "/max", k, offsetof(t, f.max) }, \
+				{ n "/unit", AV_UNIT, offsetof(t, f.unit) }
+
+const struct attrentry attrhyuws77th[] = {
+	ATTR_HEAD,
+	{ "code", AV_HEX64, offsetof(struct datahyuws77th, radio.code) },
+	{ "signal/cur", AV_INT, offsetof(struct datahyuws77th, radio.sigcur) },
+	{ "signal/max", AV_INT, offsetof(struct datahyuws77th, radio.sigmax) },
+	{ "batlow", AV_INT, offsetof(struct datahyuws77th, batlow) },
+	ATTR_VAL(struct datahyuws77th, temp, "temp", AV_SFLOAT),
+	{ "temp/trend", AV_TREND, offsetof(struct datahyuws77th, trend) },
+	ATTR_VAL(struct datahyuws77th, humid, "humid", AV_INT),
+	ATTR_TAIL
+};
+
+const struct attrentry attrhtu21d[] = {
+	ATTR_HEAD,
+	ATTR_VAL(struct datahtu21d, humid, "humid", AV_FLOAT),
+	ATTR_VAL(struct datahtu21d, temp, "temp", AV_SFLOAT),
+	ATTR_TAIL
+};
+
+const struct attrentry attrbmp180[] = {
+	ATTR_HEAD,
+	ATTR_VAL(struct databmp180, press, "press", AV_FLOAT),
+	ATTR_VAL(struct databmp180, temp, "temp", AV_SFLOAT),
+	ATTR_TAIL
+};
+
+const struct attrentry attrbh1750[] = {
+	ATTR_HEAD,
+	ATTR_VAL(struct databh1750, light, "light", AV_FLOAT),
+	ATTR_TAIL
+};
+
+const struct attrentry attrbme280[] = {
+	ATTR_HEAD,
+	ATTR_VAL(struct databme280, press, "press", AV_FLOAT),
+	ATTR_VAL(struct databme280, temp, "temp", AV_SFLOAT),
+	ATTR_VAL(struct databme280, humid, "humid", AV_FLOAT),
+	ATTR_TAIL
+};
+
+const struct attrentry *i2cattrs[] = { NULL, attrhtu21d, attrbmp180,
+				       attrbh1750, attrbme280 };
+
+const struct histlevel histlevels[HIST_LEVELS] = {
+	{ "1m", 60, 1440, 0 },		/* 1 day */
+	{ "1h", 3600, 168, 1440 },	/* 1 week */
+	{ "1d", 86400, 366, 1608 }	/* 1 year */
+};
+
+struct histseries *histpool, *histfree;	/* series memory, free list */
+struct histseries *senshist[MAX_SENSORS][HIST_VALUES]; /* NULL - none */
+int histkb;				/* history memory budget (kB) */
+int histfull;				/* out of series (warned once) */
+struct histcopy *histcopies;		/* history query: values to format */
+char *histsamples;			/* history query: samples or buckets */
+struct storehit *histhits;		/* history query: store samples */
+size_t histcopysize, histsamplesize, histhitsize;	/* (bytes) */
+
+struct sensorstore store;		/* sample store (optional) */
+char storedir[PATH_MAX + 1];
+int storesize, storesegs;		/* segment size (MB), segments kept */
+int storerun, storestop;		/* writer thread running, asked to stop */
+pthread_t storethread;			/* store writer thread */
+sem_t storesem;				/* store queue half full or stop */
+unsigned char storequeue[STORE_QUEUE_LEN][SENSORSTORE_RECSIZE];
+volatile unsigned int storewi, storeri;	/* store queue write and read idx */
+unsigned long storedrops;		/* store queue full */
+unsigned long storeerrors;		/* store write errors (writer thread) */
+struct sensorstore_rec storelast[MAX_SENSORS * HIST_VALUES]; /* latest */
+int nstorelast;				/* values of sensors not in table */
+
 /* *************** */
 /* *  Functions  * */
 /* *************** */
@@ -234,17 +499,26 @@ struct databme280 {
 /* Show help */
 void help(void)
 {
-	printf("Usage:\n\t%s [-V] [-i i2cint] [-u username] [-d | -l logfile] [-P pidfile] [-r radioip [-t radioport]] [-h address] [-p tcpport]\n\n", progname);
+	printf("Usage:\n\t%s [-V] [-i i2cint [-I type=int,...]] [-u username] [-d | -l logfile] [-P pidfile] [-r radioip [-t radioport] | -m group:port | -s shmname] [-h address] [-p tcpport] [-S subport [-c pushint]] [-q qport [-H histkb]] [-J dir[:size[:count]]]\n\n", progname);
 	puts("Where:");
 	puts("\t-i i2cint     - read I2C sensors with specified interval in seconds (optional, default is skip)");
+	puts("\t-I type=int   - interval in seconds for I2C sensor type (e.g. bh1750=2,bmp180=60), overrides -i (optional)");
 	puts("\t-u username   - name of the user to switch to (optional, valid only if run by root)");
 	puts("\t-d            - debug mode, stay foreground and show activity (optional)");
 	puts("\t-l logfile    - path to log file (optional, default is none)");
 	printf("\t-P pidfile    - path to PID file (optional, default is %s%s.pid)\n", PID_DIR, progname);
 	printf("\t-r radioip    - IPv4 address of radio server (optional)\n");
 	printf("\t-t radioport  - TCP port of radio server (optional, default is %d)\n", RADIO_PORT);
+	puts("\t-m g:p        - receive radio messages from multicast group g port p (optional)");
+	puts("\t-s shmname    - read radio messages from local shared memory ring (optional)");
 	printf("\t-h address    - IPv4 address to listen on (optional, default %s)\n", SERVER_ADDR);
 	printf("\t-p tcpport    - TCP port to listen on (optional, default is %d)\n", SERVER_PORT);
+	puts("\t-S subport    - TCP port for subscribers that get pushed updates (optional)");
+	printf("\t-c pushint    - minimum interval between pushed updates in ms (optional, default is %d)\n", PUSH_INTERVAL_MS);
+	puts("\t-q qport      - TCP port for path queries, text or HTTP/JSON (optional)");
+	printf("\t-H histkb     - memory for value history in kB, 0 disables it (optional, default is %d)\n", HISTORY_MEM_KB);
+	printf("\t-J dir:s:n    - append samples to store in directory, segments of s MB, n kept (optional, default %d:%d)\n",
+	       STORE_SEGMENT_MB, STORE_SEGMENTS);
 	puts("\t-V            - show version and exit");
 	puts("\nSupported source devices:");
 	puts("\thyuws77th (radio) - temperature/humidity 433.92 MHz radio sensor Hyundai WS Senzor 77TH");
@@ -267,35 +541,16 @@ void verShow(void)
 #endif
 }
 
-/* Log line header */
-void logprintf(int fd, const char *level, const char *fmt, ...)
-{
-        struct timeval ts;
-        struct tm *tl;
-	va_list ap;
-
-	if (fd < 0)
-		return;
-	sem_wait(&logsem);
-	gettimeofday(&ts, NULL);
-	tl = localtime(&ts.tv_sec);
-	dprintf(fd, "%d-%02d-%02d %02d:%02d:%02d.%03u %s[%d] %s: ",
-		1900 + tl->tm_year, tl->tm_mon + 1, tl->tm_mday,
-		tl->tm_hour, tl->tm_min, tl->tm_sec, ts.tv_usec / 1000,
-		progname, procpid, level);
-	va_start(ap, fmt);
-	vdprintf(fd, fmt, ap);
-	va_end(ap);
-	sem_post(&logsem);
-}
-
 /* Connect/reconnect to radio daemon */
 /* (this function loops indefinitely until connection is created
  *  and end process when no sockets are available)
  */
 int connectRadioSrv(struct sockaddr_in *s)
 {
-	int fd;
+	int fd, n;
+	char cmd[128];
+	struct timeval ts;
+	unsigned long long since;
 
 	for(;;) {
 		fd = socket(AF_INET, SOCK_STREAM, 0);
@@ -315,6 +570,17 @@ int connectRadioSrv(struct sockaddr_in *s)
 			logprintf(logfd, LOG_NOTICE,
 				  "connected successfully to radio server %s port %d\n",
 				  inet_ntoa(s->sin_addr), ntohs(s->sin_port));
+			/* request decoded binary records of weather sensors */
+			/* only, replay recent messages missed while disconnected */
+			/* (older servers ignore it and send all as text) */
+			gettimeofday(&ts, NULL);
+			since = (ts.tv_sec - REPLAY_WINDOW_SEC) * 1000000ULL;
+			if (radlastts >= since)
+				since = radlastts + 1;
+			n = sprintf(cmd, "%s%sSUB TYPE 0x%04X\nREPLAY TIME %llu\n",
+				    RADIO433_CMD_BINARY, RADIO433_CMD_DECODE,
+				    RADIO433_DEVICE_HYUWSSENZOR77TH, since);
+			send(fd, cmd, n, MSG_NOSIGNAL);
 			break;
 		}
 	}
@@ -364,6 +630,8 @@ void endProcess(int status)
 	unlink(pidfname);
 	if (netclrun)
 		pthread_cancel(netcltthread);
+	if (subtrun)
+		pthread_cancel(subthread);
 	if (i2ctrun) {
 		pthread_cancel(i2cthread);
 		/* we do not use semaphore here, as both threads
@@ -394,14 +662,25 @@ void endProcess(int status)
 			}
 		}
 	}
+	if (storerun) {
+		/* sample producers are stopped, write what is queued */
+		__atomic_store_n(&storestop, 1, __ATOMIC_RELEASE);
+		sem_post(&storesem);
+		pthread_join(storethread, NULL);
+		SensorStore_close(&store);
+	}
 	if (srvfd >= 0)
 		close(srvfd);
+	if (subfd >= 0)
+		close(subfd);
+	if (qryfd >= 0)
+		close(qryfd);
 	if (radfd >= 0)
 		close(radfd);
 	if (logfd >= 0) {
 		logprintf(logfd, LOG_NOTICE, "server shut down with code %d\n",
 			  status);
-		close(logfd);
+		DaemonLog_close();
 	}
 	exit(status);
 }
@@ -413,26 +692,17 @@ void signalQuit(int sig)
 	endProcess(0);
 }
 
-/* SIGHUP - reopen log file, useful for logrotate */
+/* SIGHUP - reopen log file, useful for logrotate (done by log writer) */
 void signalReopenLog(int sig)
 {
-	if (!debugflag && logfd >= 0) {
-		logprintf(logfd, LOG_NOTICE, "signal %d received\n", sig);
-		logprintf(logfd, LOG_NOTICE, "closing log file\n");
-		fsync(logfd);	/* never hurts */
-		close(logfd);
-		logfd = open(logfname, O_CREAT | O_TRUNC | O_SYNC | O_WRONLY, FILE_UMASK);
-		if (logfd == -1)
-			endProcess(EXIT_FAILURE);
-		logprintf(logfd, LOG_NOTICE, "log file flushed after receiving signal %d\n", sig);
-	}
+	DaemonLog_reopen();
 }
 
 /* SIGUSR1 - signal to reset min and max values before client transmission */
 void signalRstMinMax(int sig)
 {
 	logprintf(logfd, LOG_NOTICE, "signal %d received\n", sig);
-	logprintf(logfd, LOG_NOTICE, "min and max values will be reset with next read\n", sig);
+	logprintf(logfd, LOG_NOTICE, "min and max values will be reset with next read\n");
 	mrstflag = 1;
 }
 
@@ -440,7 +710,7 @@ void signalRstMinMax(int sig)
 void signalDelRadio(int sig)
 {
 	logprintf(logfd, LOG_NOTICE, "signal %d received\n", sig);
-	logprintf(logfd, LOG_NOTICE, "all radio sensors will be deleted with next read\n", sig);
+	logprintf(logfd, LOG_NOTICE, "all radio sensors will be deleted with next read\n");
 	rdelflag = 1;
 }
 
@@ -488,294 +758,1297 @@ int changeSched(void)
 	return 0;
 }
 
-/* Format network message */
-int formatMessage(char *buf, size_t len)
+/* Append formatted text to growable buffer, returns 0 on success */
+int textPrintf(struct textbuf *b, const char *fmt, ...)
 {
-	int i;
-	char dbuf[SENSOR_LABEL + BUS_LABEL + 32];
-	char *bufptr;
-	struct sensorentry *s;
-	struct radioentry *r;
-	struct i2centry *c;
-	struct datahyuws77th *dhs;
-	struct datahtu21d *dht2;
-	struct databmp180 *dbm1;
-	struct databh1750 *dbh1;
-	struct databme280 *dbm2;
+	va_list ap;
+	int n;
+	size_t size;
+	char *p;
 
-        memset(buf, 0, len);
-	bufptr = buf;
-	sem_wait(&sensem);
-#ifdef BUILDSTAMP
-	bufptr += sprintf(bufptr, "#INFO: %s build %s\n", BANNER, BUILDSTAMP);
-#else
-	bufptr += sprintf(bufptr, "#INFO: %s\n", BANNER);
-#endif
-	bufptr += sprintf(bufptr, "#%s\n", TXTMSG_HDR);
-	for(i = 0; i < MAX_SENSORS; i++) {
-		s = &senstbl[i];
-		if (s->bus == SB_RADIO) {
-			r = (struct radioentry *)(s->data); /* radio begins every struct here */
-			sprintf(dbuf, "/%s/%s@%d,%02X:%02X", busname[SB_RADIO],
-				s->label, r->ch, r->sysid, r->devid);
-			bufptr += sprintf(bufptr, "%s/timestamp=%lu.%03u\n",
-					  dbuf, s->tsec, s->tmsec);
-			bufptr += sprintf(bufptr, "%s/interval=%d\n", dbuf, s->interval);
-			bufptr += sprintf(bufptr, "%s/code=0x%016llX\n", dbuf, r->code);
-			bufptr += sprintf(bufptr, "%s/signal/cur=%d\n", dbuf, r->sigcur);
-			bufptr += sprintf(bufptr, "%s/signal/max=%d\n", dbuf, r->sigmax);
-			if (s->type == RADIO433_DEVICE_HYUWSSENZOR77TH) {
-				dhs = (struct datahyuws77th *)(s->data);
-				bufptr += sprintf(bufptr, "%s/batlow=%d\n", dbuf, dhs->batlow);
-				bufptr += sprintf(bufptr, "%s/temp/min=%+.1lf\n", dbuf, dhs->temp.min);
-				bufptr += sprintf(bufptr, "%s/temp/cur=%+.1lf\n", dbuf, dhs->temp.cur);
-				bufptr += sprintf(bufptr, "%s/temp/max=%+.1lf\n", dbuf, dhs->temp.max);
-				bufptr += sprintf(bufptr, "%s/temp/unit=%s\n", dbuf, dhs->temp.unit);
-				bufptr += sprintf(bufptr, "%s/temp/trend=%c\n", dbuf, trend[dhs->trend]);
-				bufptr += sprintf(bufptr, "%s/humid/min=%d\n", dbuf, dhs->humid.min);
-				bufptr += sprintf(bufptr, "%s/humid/cur=%d\n", dbuf, dhs->humid.cur);
-				bufptr += sprintf(bufptr, "%s/humid/max=%d\n", dbuf, dhs->humid.max);
-				bufptr += sprintf(bufptr, "%s/humid/unit=%s\n", dbuf, dhs->humid.unit);
-				bufptr += sprintf(bufptr, "%s/index=%d\n", dbuf, i);
-			} else
-				continue;
-		} else if (s->bus == SB_I2C) {
-			c = (struct i2centry *)(s->data); /* i2c info begins every struct here */
-			sprintf(dbuf, "/%s/%s@%d,%02X", busname[SB_I2C],
-				s->label, c->bus, c->id);
-			bufptr += sprintf(bufptr, "%s/timestamp=%lu.%03u\n",
-					  dbuf, s->tsec, s->tmsec);
-			bufptr += sprintf(bufptr, "%s/interval=%d\n", dbuf, s->interval);
-			if (s->type == ST_I2C_HTU21D) {
-				dht2 = (struct datahtu21d *)(s->data);
-				bufptr += sprintf(bufptr, "%s/humid/min=%.1lf\n", dbuf, dht2->humid.min);
-				bufptr += sprintf(bufptr, "%s/humid/cur=%.1lf\n", dbuf, dht2->humid.cur);
-				bufptr += sprintf(bufptr, "%s/humid/max=%.1lf\n", dbuf, dht2->humid.max);
-				bufptr += sprintf(bufptr, "%s/humid/unit=%s\n", dbuf, dht2->humid.unit);
-				bufptr += sprintf(bufptr, "%s/temp/min=%+.1lf\n", dbuf, dht2->temp.min);
-				bufptr += sprintf(bufptr, "%s/temp/cur=%+.1lf\n", dbuf, dht2->temp.cur);
-				bufptr += sprintf(bufptr, "%s/temp/max=%+.1lf\n", dbuf, dht2->temp.max);
-				bufptr += sprintf(bufptr, "%s/temp/unit=%s\n", dbuf, dht2->temp.unit);
-			} else if (s->type == ST_I2C_BMP180) {
-				dbm1 = (struct databmp180 *)(s->data);
-				bufptr += sprintf(bufptr, "%s/press/min=%.1lf\n", dbuf, dbm1->press.min);
-				bufptr += sprintf(bufptr, "%s/press/cur=%.1lf\n", dbuf, dbm1->press.cur);
-				bufptr += sprintf(bufptr, "%s/press/max=%.1lf\n", dbuf, dbm1->press.max);
-				bufptr += sprintf(bufptr, "%s/press/unit=%s\n", dbuf, dbm1->press.unit);
-				bufptr += sprintf(bufptr, "%s/temp/min=%+.1lf\n", dbuf, dbm1->temp.min);
-				bufptr += sprintf(bufptr, "%s/temp/cur=%+.1lf\n", dbuf, dbm1->temp.cur);
-				bufptr += sprintf(bufptr, "%s/temp/max=%+.1lf\n", dbuf, dbm1->temp.max);
-				bufptr += sprintf(bufptr, "%s/temp/unit=%s\n", dbuf, dbm1->temp.unit);
-			} else if (s->type == ST_I2C_BH1750) {
-				dbh1 = (struct databh1750 *)(s->data);
-				bufptr += sprintf(bufptr, "%s/light/min=%.1lf\n", dbuf, dbh1->light.min);
-				bufptr += sprintf(bufptr, "%s/light/cur=%.1lf\n", dbuf, dbh1->light.cur);
-				bufptr += sprintf(bufptr, "%s/light/max=%.1lf\n", dbuf, dbh1->light.max);
-				bufptr += sprintf(bufptr, "%s/light/unit=%s\n", dbuf, dbh1->light.unit);
-			} else if (s->type == ST_I2C_BME280) {
-				dbm2 = (struct databme280 *)(s->data);
-				bufptr += sprintf(bufptr, "%s/press/min=%.1lf\n", dbuf, dbm2->press.min);
-				bufptr += sprintf(bufptr, "%s/press/cur=%.1lf\n", dbuf, dbm2->press.cur);
-				bufptr += sprintf(bufptr, "%s/press/max=%.1lf\n", dbuf, dbm2->press.max);
-				bufptr += sprintf(bufptr, "%s/press/unit=%s\n", dbuf, dbm2->press.unit);
-				bufptr += sprintf(bufptr, "%s/temp/min=%+.1lf\n", dbuf, dbm2->temp.min);
-				bufptr += sprintf(bufptr, "%s/temp/cur=%+.1lf\n", dbuf, dbm2->temp.cur);
-				bufptr += sprintf(bufptr, "%s/temp/max=%+.1lf\n", dbuf, dbm2->temp.max);
-				bufptr += sprintf(bufptr, "%s/temp/unit=%s\n", dbuf, dbm2->temp.unit);
-				bufptr += sprintf(bufptr, "%s/humid/min=%.1lf\n", dbuf, dbm2->humid.min);
-				bufptr += sprintf(bufptr, "%s/humid/cur=%.1lf\n", dbuf, dbm2->humid.cur);
-				bufptr += sprintf(bufptr, "%s/humid/max=%.1lf\n", dbuf, dbm2->humid.max);
-				bufptr += sprintf(bufptr, "%s/humid/unit=%s\n", dbuf, dbm2->humid.unit);
-			}
-			bufptr += sprintf(bufptr, "%s/index=%d\n", dbuf, i);
-		} else
-			continue;
+	for(;;) {
+		va_start(ap, fmt);
+		n = vsnprintf(b->data + b->len, b->size - b->len, fmt, ap);
+		va_end(ap);
+		if (n < 0)
+			return -1;
+		if (b->len + n < b->size) {
+			b->len += n;
+			return 0;
+		}
+		size = MAX(b->size * 2, b->len + n + 1);
+		p = realloc(b->data, size);
+		if (p == NULL) {
+			if (b->size)
+				b->data[b->len] = '\0';
+			return -1;
+		}
+		b->data = p;
+		b->size = size;
 	}
-	bufptr += sprintf(bufptr, "#%s\n", TXTMSG_EOT);
-	sem_post(&sensem);
-        return strlen(buf);
 }
 
-/* Find free slot in sensor table */
-int findFreeSlot(void)
+/* Mark sensor section for formatting (sensor table lock held) */
+void sensorEntryChanged(int i)
 {
-	int i;
-
-	for(i = 0; i < MAX_SENSORS; i++)
-		if (!senstbl[i].type)
-			break;
+	sensdirty[i] = SD_RESPONSE | SD_PUSH;
+	senstblver++;
+}
 
-	return i < MAX_SENSORS ? i : -1;
+/* Attribute table of sensor, NULL if there is nothing to report */
+const struct attrentry *sensorAttrs(const struct sensorentry *s)
+{
+	if (s->bus == SB_RADIO && s->type == RADIO433_DEVICE_HYUWSSENZOR77TH)
+		return attrhyuws77th;
+	if (s->bus == SB_I2C && s->type > ST_I2C_NULL && s->type <= ST_I2C_BME280)
+		return i2cattrs[s->type];
+	return NULL;
 }
 
-/* Remove sensor entry by index */
-void sensorEntryDelete(int i)
+/* Device part of sensor path ("name@address") */
+void sensorDevice(char *buf, const struct sensorentry *s)
 {
-	struct sensorentry *s;
+	struct radioentry *r;
 	struct i2centry *c;
 
-	if (i < 0 || i >= MAX_SENSORS)
-		return;
+	if (s->bus == SB_RADIO) {
+		r = (struct radioentry *)(s->data); /* radio begins every struct here */
+		sprintf(buf, "%s@%d,%02X:%02X", s->label, r->ch, r->sysid,
+			r->devid);
+	} else {
+		c = (struct i2centry *)(s->data); /* i2c info begins every struct here */
+		sprintf(buf, "%s@%d,%02X", s->label, c->bus, c->id);
+	}
+}
+
+/* Format attribute value (json: as JSON value) */
+void formatAttr(struct textbuf *b, int i, const struct attrentry *a, int json)
+{
+	struct sensorentry *s;
+	char *v;
 
 	s = &senstbl[i];
-	if (s->data) {
-		if (s->bus == SB_I2C) {
-			c = (struct i2centry *)(s->data);
-			if (c->fd >= 0)
-				close(c->fd);
-		}
-		free(s->data);
+	v = (char *)(s->data) + a->off;
+	switch (a->kind) {
+	case AV_TIMESTAMP:
+		textPrintf(b, "%lu.%03u", s->tsec, s->tmsec);
+		break;
+	case AV_INTERVAL:
+		textPrintf(b, "%d", s->interval);
+		break;
+	case AV_INDEX:
+		textPrintf(b, "%d", i);
+		break;
+	case AV_HEX64:
+		textPrintf(b, json ? "\"0x%016llX\"" : "0x%016llX",
+			   *(unsigned long long *)v);
+		break;
+	case AV_INT:
+		textPrintf(b, "%d", *(int *)v);
+		break;
+	case AV_FLOAT:
+		textPrintf(b, "%.1lf", *(double *)v);
+		break;
+	case AV_SFLOAT:
+		textPrintf(b, json ? "%.1lf" : "%+.1lf", *(double *)v);
+		break;
+	case AV_UNIT:
+		textPrintf(b, json ? "\"%s\"" : "%s", v);
+		break;
+	case AV_TREND:
+		if (json)
+			textPrintf(b, trend[*(int *)v] == '\\' ? "\"\\%c\"" : "\"%c\"",
+				   trend[*(int *)v]);
+		else
+			textPrintf(b, "%c", trend[*(int *)v]);
+		break;
 	}
-	memset(s, 0, sizeof(struct sensorentry));
 }
 
-/* Remove all radio sensors from table */
-void sensorRadioRemoveAll(void)
+/* Format network message section of single sensor */
+void formatSensor(int i, struct textbuf *b)
 {
-        int i;
-        struct sensorentry *s;
+	char dbuf[SENSOR_LABEL + 32];
+	struct sensorentry *s;
+	const struct attrentry *a;
 
-        sem_wait(&sensem);
-        for(i = 0; i < MAX_SENSORS; i++) {
-                s = &senstbl[i];
-                if (s->bus == SB_RADIO)
-                                sensorEntryDelete(i);
-        }
-        sem_post(&sensem);
+	b->len = 0;
+	s = &senstbl[i];
+	a = sensorAttrs(s);
+	if (a == NULL)
+		return;
+	sensorDevice(dbuf, s);
+	for(; a->name != NULL; a++) {
+		textPrintf(b, "/%s/%s/%s=", busname[s->bus], dbuf, a->name);
+		formatAttr(b, i, a, 0);
+		textPrintf(b, "\n");
+	}
 }
 
-/* Remove stale sensors from table */
-/* entry is expired if time difference is more
- * than SENSOR_ENTRY_TTL intervals */
-void sensorTableClean(void)
+/* Format network message, response is kept until sensor table changes */
+/* and then only sections of changed sensors are formatted again; message */
+/* still being sent is left to its clients and new one is built, returns */
+/* NULL if out of memory (main thread only) */
+struct snapshot *formatMessage(void)
 {
-	int i, l;
-	struct timeval t;
-	struct sensorentry *s;
+	int i;
+	struct snapshot *sn;
+	struct textbuf *buf;
 
-	gettimeofday(&t, NULL);
 	sem_wait(&sensem);
-	for(i = 0; i < MAX_SENSORS; i++) {
-		s = &senstbl[i];
-		if (s->type) {
-			l = TSDIFF(t.tv_sec, t.tv_usec / 1000, s->tsec, s->tmsec);
-			if (l > SENSOR_ENTRY_TTL * s->interval) {
-				logprintf(logfd, LOG_NOTICE,
-					  "removing sensor \"%s\" [%d] due to timeout (%lu ms)\n",
-					  s->label, i, l);
-				sensorEntryDelete(i);
-			}
+	if (respsnap != NULL && respsnap->buf.len && respver == senstblver) {
+		sem_post(&sensem);
+		return respsnap;
+	}
+	sn = respsnap;
+	if (sn == NULL || sn->refs) {
+		sn = calloc(1, sizeof(struct snapshot));
+		if (sn == NULL) {
+			sem_post(&sensem);
+			return NULL;
 		}
 	}
+	for(i = 0; i < MAX_SENSORS; i++)
+		if (sensdirty[i] & SD_RESPONSE) {
+			formatSensor(i, &senssect[i]);
+			sensdirty[i] &= ~SD_RESPONSE;
+		}
+	respver = senstblver;
 	sem_post(&sensem);
+	respsnap = sn;		/* old one is freed by its last client */
+
+	/* sections are changed only here */
+	buf = &sn->buf;
+	buf->len = 0;
+#ifdef BUILDSTAMP
+	textPrintf(buf, "#INFO: %s build %s\n", BANNER, BUILDSTAMP);
+#else
+	textPrintf(buf, "#INFO: %s\n", BANNER);
+#endif
+	textPrintf(buf, "#%s\n", TXTMSG_HDR);
+	for(i = 0; i < MAX_SENSORS; i++)
+		if (senssect[i].len)
+			textPrintf(buf, "%s", senssect[i].data);
+	textPrintf(buf, "#%s\n", TXTMSG_EOT);
+	return sn;
 }
 
-/* Reset min/max for all active sensors */
-void sensorResetMinMax(void)
+/* Drop reference of client to message, replaced message is freed */
+/* with its last reference */
+void snapshotRelease(struct clientconn *cc)
 {
-        int i;
-        struct sensorentry *s;
-        struct datahyuws77th *dhs;
-	struct datahtu21d *dht2;
-	struct databmp180 *dbm1;
-	struct databh1750 *dbh1;
-	struct databme280 *dbm2;
+	struct snapshot *sn;
 
-	sem_wait(&sensem);
+	sn = cc->snap;
+	if (sn == NULL)
+		return;
+	cc->snap = NULL;
+	if (--sn->refs || sn == respsnap)
+		return;
+	free(sn->buf.data);
+	free(sn);
+}
+
+/* Split path pattern ("/bus/device/attribute", trailing parts */
+/* may be omitted), returns 0 on success */
+int parsePattern(const char *p, struct querypat *q)
+{
+	int n;
+
+	memset(q, 0, sizeof(struct querypat));
+	if (*p++ != '/')
+		return -1;
+	n = strcspn(p, "/");
+	if (!n || n >= sizeof(q->bus))
+		return -1;
+	memcpy(q->bus, p, n);
+	p += n;
+	strcpy(q->dev, "*");
+	if (*p++ != '/')
+		return 0;
+	n = strcspn(p, "/");
+	if (n >= sizeof(q->dev))
+		return -1;
+	memcpy(q->dev, p, n);
+	q->dev[n] = '\0';
+	p += n;
+	if (*p++ != '/')
+		return 0;
+	if (strlen(p) >= sizeof(q->attr))
+		return -1;
+	strcpy(q->attr, p);
+	return 0;
+}
+
+/* Empty sensor table and its index */
+void sensorTableInit(void)
+{
+	int i;
+
+	memset(senstbl, 0, MAX_SENSORS * sizeof(struct sensorentry));
+	for(i = 0; i < (1 << SENSOR_HASH_BITS); i++)
+		senshash[i] = -1;
+	for(i = 0; i <= SB_I2C; i++)
+		sensbus[i] = -1;
 	for(i = 0; i < MAX_SENSORS; i++) {
-		s = &senstbl[i];
-		if (s->type == RADIO433_DEVICE_HYUWSSENZOR77TH) {
-			dhs = (struct datahyuws77th *)(s->data);
-			dhs->temp.min = dhs->temp.cur;
-			dhs->temp.max = dhs->temp.cur;
-			dhs->humid.min = dhs->humid.cur;
-			dhs->humid.max = dhs->humid.cur;
-		} else if (s->bus == SB_I2C) {
-			if (s->type == ST_I2C_HTU21D) {
-				dht2 = (struct datahtu21d *)(s->data);
-				dht2->humid.min = dht2->humid.cur;
-				dht2->humid.max = dht2->humid.cur;
-				dht2->temp.min = dht2->temp.cur;
-				dht2->temp.max = dht2->temp.cur;
-			} else if (s->type == ST_I2C_BMP180) {
-				dbm1 = (struct databmp180 *)(s->data);
-				dbm1->press.min = dbm1->press.cur;
-				dbm1->press.max = dbm1->press.cur;
-				dbm1->temp.min = dbm1->temp.cur;
-				dbm1->temp.max = dbm1->temp.cur;
-			} else if (s->type == ST_I2C_BH1750) {
-				dbh1 = (struct databh1750 *)(s->data);
-				dbh1->light.min = dbh1->light.cur;
-				dbh1->light.max = dbh1->light.cur;
-			} else if (s->type == ST_I2C_BME280) {
-				dbm2 = (struct databme280 *)(s->data);
-				dbm2->press.min = dbm2->press.cur;
-				dbm2->press.max = dbm2->press.cur;
-				dbm2->temp.min = dbm2->temp.cur;
-				dbm2->temp.max = dbm2->temp.cur;
-				dbm2->humid.min = dbm2->humid.cur;
-				dbm2->humid.max = dbm2->humid.cur;
-			}
-		}
-        }
-        sem_post(&sensem);
+		sensfree[i] = MAX_SENSORS - 1 - i;	/* lowest slot first */
+		senshpos[i] = -1;
+	}
+	sensnfree = MAX_SENSORS;
+	sensnheap = 0;
 }
 
-/* Update remote sensor in table */
-void sensorRadioUpdate(struct radmsg *rm)
+/* Index bucket of sensor identity */
+int sensorHash(int bus, int type, int key)
+{
+	unsigned int h;
+
+	h = ((bus * 31 + type) * 65599 + key) * 2654435761U;
+	return h >> (32 - SENSOR_HASH_BITS);
+}
+
+/* Find sensor entry by identity, returns index or -1 */
+/* (sensor table lock held) */
+int sensorFind(int bus, int type, int key)
 {
 	int i;
 	struct sensorentry *s;
-	struct radioentry *r;
-	struct datahyuws77th *dhs;
-	int sysid, devid, ch, batlow, tdir, humid;
-	double temp;
-	int codestatus; /* 0-new, 1-update ts + data, 2-update only ts */
 
-	if (rm->type != RADIO433_DEVICE_HYUWSSENZOR77TH)
-		return;
+	for(i = senshash[sensorHash(bus, type, key)]; i >= 0; i = senshnext[i]) {
+		s = &senstbl[i];
+		if (s->bus == bus && s->type == type && s->key == key)
+			return i;
+	}
+	return -1;
+}
 
-	if (!Radio433_thmGetData(rm->code, &sysid, &devid, &ch,
-				 &batlow, &tdir, &temp, &humid))
-		return;
+/* Take free slot for new sensor and index it, returns index or -1 */
+/* if table is full (sensor table lock held) */
+int sensorEntryNew(int bus, int type, int key)
+{
+	int i, h;
+	struct sensorentry *s;
 
-	/* first check if signal is part of multi-signal transmission */
-	sem_wait(&sensem);
-	codestatus = 0;
-	for(i = 0; i < MAX_SENSORS; i++) {
-		s = &senstbl[i];
-		if (s->bus == SB_RADIO && s->type == rm->type) {
-			r = (struct radioentry *)(s->data); /* radio begins every struct */
-			if (r->code == rm->code)
-				codestatus = 2;
-			else if (r->ch == ch && r->sysid == sysid && r->devid == devid)
-				codestatus = 1;
-			if (codestatus > 0) {
-				if (TSDIFF(rm->tsec, rm->tmsec, s->tsec, s->tmsec) <=
-				    (r->sigmax - r->sigcur + 1) * rm->codelen) {
-					if (r->sigcur < r->sigmax)
-						r->sigcur++;
-					else {
-						sem_post(&sensem);
-						return;
-					}
-				} else
-					r->sigcur = 1;
-				break;
-			}
-		}
+	if (!sensnfree)
+		return -1;
+	i = sensfree[--sensnfree];
+	s = &senstbl[i];
+	s->bus = bus;
+	s->type = type;
+	s->key = key;
+	h = sensorHash(bus, type, key);
+	senshnext[i] = senshash[h];
+	senshash[h] = i;
+	sensbprev[i] = -1;
+	sensbnext[i] = sensbus[bus];
+	if (sensbus[bus] >= 0)
+		sensbprev[sensbus[bus]] = i;
+	sensbus[bus] = i;
+	return i;
+}
+
+/* Sensor type of device label on bus, returns 0 if unknown */
+int sensorLabelType(int bus, const char *label, int len)
+{
+	int t;
+
+	if (bus == SB_RADIO) {
+		if (len == strlen(SL_HYUWSSENZOR77TH) &&
+		    !strncmp(label, SL_HYUWSSENZOR77TH, len))
+			return RADIO433_DEVICE_HYUWSSENZOR77TH;
+	} else if (bus == SB_I2C) {
+		for(t = ST_I2C_HTU21D; t <= ST_I2C_BME280; t++)
+			if (len == strlen(i2clabel[t]) &&
+			    !strncmp(label, i2clabel[t], len))
+				return t;
 	}
+	return 0;
+}
 
-	if (!codestatus) {
-		i = findFreeSlot();
-		if (i < 0) {
-			sem_post(&sensem);
+/* Pattern has fnmatch() special characters */
+int hasWildcard(const char *p, int len)
+{
+	for(; len > 0 && *p; p++, len--)
+		if (strchr("*?[\\", *p) != NULL)
+			return 1;
+	return 0;
+}
+
+int cmpInt(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+/* Collect entries that may match bus and device of any pattern into */
+/* cand in table order, returns their count (sensor table lock held) */
+/* (literal device names are looked up in index, literal label limits */
+/* walk over bus entries to its type, wildcards are matched later) */
+int queryCandidates(const struct querypat *q, int n, int *cand)
+{
+	int k, bus, type, key, i, nc, l, ch, a, d;
+	char mark[MAX_SENSORS];
+	const char *at;
+
+	memset(mark, 0, sizeof(mark));
+	nc = 0;
+	for(k = 0; k < n; k++)
+		for(bus = SB_RADIO; bus <= SB_I2C; bus++) {
+			if (hasWildcard(q[k].bus, sizeof(q[k].bus)) ?
+			    fnmatch(q[k].bus, busname[bus], 0) :
+			    strcmp(q[k].bus, busname[bus]))
+				continue;
+			at = strchr(q[k].dev, '@');
+			l = at != NULL ? at - q[k].dev : strlen(q[k].dev);
+			type = 0;
+			if (!hasWildcard(q[k].dev, l)) {
+				type = sensorLabelType(bus, q[k].dev, l);
+				if (!type)
+					continue;	/* no such device */
+			}
+			if (type && !hasWildcard(q[k].dev, sizeof(q[k].dev))) {
+				/* exact name, device checked when matched */
+				if (at == NULL)
+					continue;
+				if (bus == SB_RADIO ?
+				    sscanf(at, "@%d,%x:%x", &ch, &a, &d) != 3 :
+				    sscanf(at, "@%d,%x", &ch, &a) != 2)
+					continue;
+				key = bus == SB_RADIO ? RADIO_KEY(ch, a, d) : a;
+				i = sensorFind(bus, type, key);
+				if (i >= 0 && !mark[i]) {
+					mark[i] = 1;
+					cand[nc++] = i;
+				}
+				continue;
+			}
+			for(i = sensbus[bus]; i >= 0; i = sensbnext[i])
+				if ((!type || senstbl[i].type == type) && !mark[i]) {
+					mark[i] = 1;
+					cand[nc++] = i;
+				}
+		}
+	qsort(cand, nc, sizeof(int), cmpInt);
+	return nc;
+}
+
+/* Check device name against pattern (fnmatch() only for wildcards) */
+int deviceMatch(const struct querypat *q, const struct sensorentry *s,
+		const char *dev)
+{
+	if (hasWildcard(q->bus, sizeof(q->bus)) ?
+	    fnmatch(q->bus, busname[s->bus], 0) : strcmp(q->bus, busname[s->bus]))
+		return 0;
+	return hasWildcard(q->dev, sizeof(q->dev)) ?
+	       !fnmatch(q->dev, dev, 0) : !strcmp(q->dev, dev);
+}
+
+/* Append sensor attributes matching any pattern (json: as JSON members) */
+/* (entries are found through sensor index, only matching values are */
+/* formatted) */
+void querySensors(struct textbuf *b, const struct querypat *q, int n, int json)
+{
+	int i, j, k, nc, nm, first;
+	int match[MAX_QUERY_PATTERNS], cand[MAX_SENSORS];
+	char dbuf[SENSOR_LABEL + 32];
+	struct sensorentry *s;
+	const struct attrentry *a;
+
+	first = 1;
+	sem_wait(&sensem);
+	nc = queryCandidates(q, n, cand);
+	for(j = 0; j < nc; j++) {
+		i = cand[j];
+		s = &senstbl[i];
+		a = sensorAttrs(s);
+		if (a == NULL)
+			continue;
+		sensorDevice(dbuf, s);
+		for(k = nm = 0; k < n; k++) {
+			match[k] = deviceMatch(&q[k], s, dbuf);
+			nm += match[k];
+		}
+		if (!nm)
+			continue;
+		for(; a->name != NULL; a++) {
+			for(k = 0; k < n; k++)
+				if (match[k] && (!q[k].attr[0] ||
+				    !fnmatch(q[k].attr, a->name, FNM_PATHNAME)))
+					break;
+			if (k == n)
+				continue;
+			if (json) {
+				textPrintf(b, "%s\"/%s/%s/%s\":", first ? "" : ",",
+					   busname[s->bus], dbuf, a->name);
+				formatAttr(b, i, a, 1);
+			} else {
+				textPrintf(b, "/%s/%s/%s=", busname[s->bus], dbuf,
+					   a->name);
+				formatAttr(b, i, a, 0);
+				textPrintf(b, "\n");
+			}
+			first = 0;
+		}
+	}
+	sem_post(&sensem);
+}
+
+/* Attributes of current sensor values that have history, returns their */
+/* count (value name is attribute name without "/cur") */
+int sensorValues(const struct sensorentry *s, const struct attrentry **va)
+{
+	int n;
+	const struct attrentry *a;
+
+	a = sensorAttrs(s);
+	if (a == NULL)
+		return 0;
+	for(n = 0; a->name != NULL && n < HIST_VALUES; a++)
+		if (a->hist)
+			va[n++] = a;
+	return n;
+}
+
+/* Numeric value of sensor attribute */
+double attrValue(const struct sensorentry *s, const struct attrentry *a)
+{
+	char *v;
+
+	v = (char *)(s->data) + a->off;
+	return a->kind == AV_INT ? *(int *)v : *(double *)v;
+}
+
+/* Set numeric value of sensor attribute */
+void attrSetValue(struct sensorentry *s, const struct attrentry *a, double v)
+{
+	char *p;
+
+	p = (char *)(s->data) + a->off;
+	if (a->kind == AV_INT)
+		*(int *)p = v < 0.0 ? v - 0.5 : v + 0.5;
+	else
+		*(double *)p = v;
+}
+
+/* Prepare series pool of history memory budget, returns 0 on success */
+int historyInit(void)
+{
+	int i, n;
+
+	n = MIN((long)histkb * 1024 / sizeof(struct histseries),
+		MAX_SENSORS * HIST_VALUES);
+	histfree = NULL;
+	if (!n)
+		return 0;
+	histpool = malloc(n * sizeof(struct histseries));
+	if (histpool == NULL)
+		return -1;
+	for(i = n - 1; i >= 0; i--) {
+		histpool[i].next = histfree;
+		histfree = &histpool[i];
+	}
+	return 0;
+}
+
+/* Return series of sensor to pool (sensor table lock held) */
+void historyRelease(int i)
+{
+	int k;
+
+	for(k = 0; k < HIST_VALUES; k++)
+		if (senshist[i][k] != NULL) {
+			senshist[i][k]->next = histfree;
+			histfree = senshist[i][k];
+			senshist[i][k] = NULL;
+			histfull = 0;
+		}
+}
+
+/* Add sample to raw ring and to rollup bucket of each level */
+/* (sample older than bucket in its place is not rolled up) */
+void historyAdd(struct histseries *h, long long ts, double v)
+{
+	int k, slot;
+	struct histbucket *b;
+	const struct histlevel *l;
+
+	h->raw[h->rawhead] = (struct histpoint){ ts, v };
+	h->rawhead = (h->rawhead + 1) % HIST_RAW;
+	if (h->rawlen < HIST_RAW)
+		h->rawlen++;
+	for(k = 0; k < HIST_LEVELS; k++) {
+		l = &histlevels[k];
+		slot = ts / 1000 / l->res;
+		b = &h->roll[l->off + slot % l->cap];
+		if (b->count && b->slot > slot)
+			continue;
+		if (!b->count || b->slot != slot) {
+			b->slot = slot;
+			b->count = 0;
+			b->min = v;
+			b->max = v;
+			b->sum = 0.0;
+		}
+		b->count++;
+		b->min = MIN(b->min, v);
+		b->max = MAX(b->max, v);
+		b->sum += v;
+	}
+}
+
+/* Series of sensor value, taken from pool if sensor has none yet, */
+/* returns NULL if pool is empty (sensor table lock held) */
+struct histseries *historySeries(int i, int k)
+{
+	struct histseries *h;
+
+	h = senshist[i][k];
+	if (h != NULL)
+		return h;
+	if (histfree == NULL) {
+		if (histpool != NULL && !histfull)
+			logprintf(logfd, LOG_WARN,
+				  "history memory full, values of sensor \"%s\" [%d] are not recorded\n",
+				  senstbl[i].label, i);
+		histfull = 1;
+		return NULL;
+	}
+	h = histfree;
+	histfree = h->next;
+	memset(h, 0, sizeof(struct histseries));
+	senshist[i][k] = h;
+	return h;
+}
+
+/* Queue sample of sensor value for store writer, sample is dropped if */
+/* writer falls behind (sensor table lock held) */
+void storeQueue(int i, int k, const struct attrentry *a, long long ts)
+{
+	struct sensorstore_rec r;
+	struct sensorentry *s;
+	unsigned int n;
+
+	n = storewi - __atomic_load_n(&storeri, __ATOMIC_ACQUIRE);
+	if (n >= STORE_QUEUE_LEN) {
+		if (!storedrops++)
+			logprintf(logfd, LOG_WARN,
+				  "store queue full, samples are dropped\n");
+		return;
+	}
+	s = &senstbl[i];
+	r.ts = ts;
+	r.bus = s->bus;
+	r.val = k;
+	r.type = s->type;
+	r.key = s->key;
+	r.cur = attrValue(s, a);
+	r.min = attrValue(s, a - 1);	/* ATTR_VAL order: min, cur, max */
+	r.max = attrValue(s, a + 1);
+	SensorStore_packRec(storequeue[storewi % STORE_QUEUE_LEN], &r);
+	__atomic_store_n(&storewi, storewi + 1, __ATOMIC_RELEASE);
+	if (n + 1 == STORE_QUEUE_LEN / 2)
+		sem_post(&storesem);
+}
+
+/* Record current values of sensor in history and store */
+/* (sensor table lock held) */
+void historyRecord(int i)
+{
+	int k, n;
+	long long ts;
+	struct sensorentry *s;
+	struct histseries *h;
+	const struct attrentry *va[HIST_VALUES];
+
+	s = &senstbl[i];
+	n = sensorValues(s, va);
+	ts = s->tsec * 1000LL + s->tmsec;
+	for(k = 0; k < n; k++) {
+		if (storerun)
+			storeQueue(i, k, va[k], ts);
+		h = historySeries(i, k);
+		if (h != NULL)
+			historyAdd(h, ts, attrValue(s, va[k]));
+	}
+}
+
+/* Format history value (json: as JSON value) */
+void formatHistValue(struct textbuf *b, int kind, double v, int json)
+{
+	textPrintf(b, kind == AV_SFLOAT && !json ? "%+.1lf" : "%.1lf", v);
+}
+
+/* Append raw sample of sensor value (json: as JSON array), path is */
+/* "/bus/device/value" */
+void formatHistPoint(struct textbuf *b, const char *path, int kind,
+		     long long ts, double v, int json, int first)
+{
+	if (json)
+		textPrintf(b, "%s[%lld.%03lld,", first ? "" : ",",
+			   ts / 1000, ts % 1000);
+	else
+		textPrintf(b, "%s/%lld.%03lld=", path, ts / 1000, ts % 1000);
+	formatHistValue(b, kind, v, json);
+	textPrintf(b, json ? "]" : "\n");
+}
+
+/* Grow history query buffer to need bytes, returns new buffer or NULL */
+/* if out of memory (old one is kept) */
+void *histGrow(void *p, size_t *size, size_t need)
+{
+	size_t s;
+
+	if (need <= *size)
+		return p;
+	s = MAX(*size * 2, need);
+	p = realloc(p, s);
+	if (p != NULL)
+		*size = s;
+	return p;
+}
+
+/* Lookup slot of store record identity (bytes 8-15 of packed record) */
+int storeIdHash(const unsigned char *p)
+{
+	return (sensorHash(p[8], p[10] | p[11] << 8, p[12] | p[13] << 8 |
+			   p[14] << 16 | (unsigned int)p[15] << 24) * HIST_VALUES +
+		p[9]) % STORE_QUERY_HASH;
+}
+
+/* Read raw samples of first nc copied values from store in single pass */
+/* over segments in time range, samples of each value are chained to it */
+/* in store order (stops early if out of memory) */
+void queryStore(struct sensorstore *rd, int nc, unsigned long long from)
+{
+	short slot[STORE_QUERY_HASH];
+	int g, h, j, nh;
+	unsigned long long m, nr, to;
+	void *q;
+	struct sensorstore_rec r;
+	struct histcopy *hc;
+	const unsigned char *p;
+
+	memset(slot, 0xff, sizeof(slot));
+	to = 0;
+	for(j = 0; j < nc; j++) {
+		hc = &histcopies[j];
+		hc->shead = hc->stail = -1;
+		if (hc->storeto < 0)
+			continue;
+		for(h = storeIdHash(hc->id); slot[h] >= 0;
+		    h = (h + 1) % STORE_QUERY_HASH)
+			;
+		slot[h] = j;
+		to = MAX(to, (unsigned long long)hc->storeto);
+	}
+	nh = 0;
+	for(g = SensorStore_findSegment(rd, from); g < rd->nsegs &&
+	    SensorStore_segmentTime(rd, g) <= to; g++) {
+		if (SensorStore_map(rd, g) <= 0)
+			continue;
+		nr = rd->nrecs;
+		for(m = SensorStore_seek(rd, from); m < nr; m++) {
+			p = rd->recs + m * SENSORSTORE_RECSIZE;
+			/* identity lookup before checksum */
+			for(h = storeIdHash(p); slot[h] >= 0;
+			    h = (h + 1) % STORE_QUERY_HASH)
+				if (!memcmp(p + 8, histcopies[slot[h]].id + 8, 8))
+					break;
+			if (slot[h] < 0 || SensorStore_unpackRec(p, &r))
+				continue;
+			hc = &histcopies[slot[h]];
+			if (r.ts < from || r.ts > (unsigned long long)hc->storeto)
+				continue;
+			q = histGrow(histhits, &histhitsize,
+				     (nh + 1) * sizeof(struct storehit));
+			if (q == NULL)
+				return;
+			histhits = q;
+			histhits[nh] = (struct storehit){ r.ts, r.cur, -1 };
+			if (hc->stail >= 0)
+				histhits[hc->stail].next = nh;
+			else
+				hc->shead = nh;
+			hc->stail = nh++;
+		}
+	}
+}
+
+/* Append history of sensor values matching any pattern in requested time */
+/* range and resolution (json: as JSON members with arrays of samples), */
+/* rollups are read from their rings, raw samples older than memory ring */
+/* are read from store (values are found through sensor index and their */
+/* samples in range copied under sensor table lock, store is read in one */
+/* pass for all values and formatted after lock is released) */
+void queryHistory(struct textbuf *b, const struct querypat *q, int n,
+		  const struct histquery *hq, int json)
+{
+	int i, j, k, m, v, nv, one, rs, oom, nc, nm;
+	int match[MAX_QUERY_PATTERNS], cand[MAX_SENSORS];
+	size_t ns, len;
+	long long end, slot, from, to;
+	void *p;
+	char dbuf[SENSOR_LABEL + 32], vname[64];
+	struct sensorentry *s;
+	struct sensorstore_rec id;
+	struct histseries *h;
+	struct histpoint *r, *rc;
+	struct histbucket *c, *cc;
+	struct histcopy *hc;
+	struct sensorstore rd;
+	const struct histlevel *l;
+	const struct attrentry *va[HIST_VALUES];
+
+	l = hq->level >= 0 ? &histlevels[hq->level] : NULL;
+	len = l != NULL ? sizeof(struct histbucket) : sizeof(struct histpoint);
+	rs = 0;
+	if (l == NULL && storerun) {
+		rs = SensorStore_openReader(&rd, storedir);
+		if (!rs)
+			SensorStore_closeReader(&rd);
+		rs = rs > 0;
+	}
+	nc = ns = 0;
+	oom = 0;
+	sem_wait(&sensem);
+	nm = queryCandidates(q, n, cand);
+	for(j = 0; j < nm && !oom; j++) {
+		i = cand[j];
+		s = &senstbl[i];
+		nv = sensorValues(s, va);
+		if (!nv)
+			continue;
+		sensorDevice(dbuf, s);
+		for(k = 0; k < n; k++)
+			match[k] = deviceMatch(&q[k], s, dbuf);
+		for(v = 0; v < nv && !oom; v++) {
+			h = senshist[i][v];
+			if (h == NULL && !rs)
+				continue;
+			snprintf(vname, sizeof(vname), "%.*s",
+				 (int)strlen(va[v]->name) - 4, va[v]->name);
+			for(k = 0; k < n; k++)
+				if (match[k] && (!q[k].attr[0] ||
+				    !fnmatch(q[k].attr, vname, FNM_PATHNAME)))
+					break;
+			if (k == n)
+				continue;
+			/* room for whole ring, response is truncated if none */
+			p = histGrow(histcopies, &histcopysize,
+				     (nc + 1) * sizeof(struct histcopy));
+			if (p != NULL)
+				histcopies = p;
+			if (p != NULL) {
+				p = histGrow(histsamples, &histsamplesize,
+					     ns + (l != NULL ? l->cap : HIST_RAW) * len);
+				if (p != NULL)
+					histsamples = p;
+			}
+			if (p == NULL) {
+				oom = 1;
+				continue;
+			}
+			hc = &histcopies[nc++];
+			snprintf(hc->path, sizeof(hc->path), "/%s/%s/%s",
+				 busname[s->bus], dbuf, vname);
+			hc->kind = va[v]->kind;
+			memset(&id, 0, sizeof(id));
+			id.bus = s->bus;
+			id.val = v;
+			id.type = s->type;
+			id.key = s->key;
+			SensorStore_packRec(hc->id, &id);
+			hc->storeto = -1;
+			hc->shead = hc->stail = -1;
+			hc->first = ns / len;
+			hc->count = 0;
+			if (l == NULL) {
+				end = hq->to;
+				if (h != NULL && h->rawlen)
+					end = MIN(end, h->raw[(h->rawhead - h->rawlen + HIST_RAW) % HIST_RAW].ts - 1);
+				if (rs && end >= 0 && hq->from <= end)
+					hc->storeto = end;
+				rc = (struct histpoint *)histsamples + hc->first;
+				for(m = 0; h != NULL && m < h->rawlen; m++) {
+					r = &h->raw[(h->rawhead - h->rawlen + m + HIST_RAW) % HIST_RAW];
+					if (r->ts >= hq->from && r->ts <= hq->to)
+						rc[hc->count++] = *r;
+				}
+			} else {
+				cc = (struct histbucket *)histsamples + hc->first;
+				to = hq->to / 1000 / l->res;
+				from = MAX(hq->from / 1000 / l->res, to - l->cap + 1);
+				for(slot = from; slot <= to; slot++) {
+					c = &h->roll[l->off + slot % l->cap];
+					if (c->count && c->slot == slot)
+						cc[hc->count++] = *c;
+				}
+			}
+			ns += hc->count * len;
+		}
+	}
+	sem_post(&sensem);
+	if (rs) {
+		queryStore(&rd, nc, MAX(hq->from, 0));
+		SensorStore_closeReader(&rd);
+	}
+
+	for(j = 0; j < nc; j++) {
+		hc = &histcopies[j];
+		if (json)
+			textPrintf(b, "%s\"%s\":[", j ? "," : "", hc->path);
+		one = 1;
+		for(m = hc->shead; m >= 0; m = histhits[m].next) {
+			formatHistPoint(b, hc->path, hc->kind, histhits[m].ts,
+					histhits[m].v, json, one);
+			one = 0;
+		}
+		for(m = 0; m < (int)hc->count; m++) {
+			if (l == NULL) {
+				r = (struct histpoint *)histsamples + hc->first + m;
+				formatHistPoint(b, hc->path, hc->kind, r->ts, r->v,
+						json, one);
+				one = 0;
+				continue;
+			}
+			c = (struct histbucket *)histsamples + hc->first + m;
+			if (json)
+				textPrintf(b, "%s[%lld,", one ? "" : ",",
+					   (long long)c->slot * l->res);
+			else
+				textPrintf(b, "%s/%lld=", hc->path,
+					   (long long)c->slot * l->res);
+			formatHistValue(b, hc->kind, c->min, json);
+			textPrintf(b, ",");
+			formatHistValue(b, hc->kind, c->sum / c->count, json);
+			textPrintf(b, ",");
+			formatHistValue(b, hc->kind, c->max, json);
+			textPrintf(b, json ? ",%u]" : ",%u\n", c->count);
+			one = 0;
+		}
+		if (json)
+			textPrintf(b, "]");
+	}
+	/* do not hold memory of large query */
+	if (histsamplesize > CLIENT_OUT_KEEP) {
+		free(histsamples);
+		histsamples = NULL;
+		histsamplesize = 0;
+	}
+	if (histcopysize > CLIENT_OUT_KEEP) {
+		free(histcopies);
+		histcopies = NULL;
+		histcopysize = 0;
+	}
+	if (histhitsize > CLIENT_OUT_KEEP) {
+		free(histhits);
+		histhits = NULL;
+		histhitsize = 0;
+	}
+}
+
+/* Parse history request parameters ("res=raw|1m|1h|1d from=time to=time" */
+/* separated by any of delim characters, time is seconds since Epoch or */
+/* negative number of seconds before now, clamped to Epoch..now, default */
+/* range ends now and spans rollup ring or HIST_RAW_SPAN_SEC of raw */
+/* samples), returns 0 on success */
+int parseHistory(char *p, const char *delim, struct histquery *hq)
+{
+	char *t, *sp;
+	long long v, now;
+	int k, from;
+
+	now = time(NULL) * 1000LL;
+	hq->level = -1;
+	hq->to = now;
+	from = 0;
+	for(t = strtok_r(p, delim, &sp); t != NULL; t = strtok_r(NULL, delim, &sp)) {
+		if (!strncmp(t, "res=", 4)) {
+			for(k = 0; k < HIST_LEVELS; k++)
+				if (!strcmp(t + 4, histlevels[k].name))
+					break;
+			if (k == HIST_LEVELS && strcmp(t + 4, "raw"))
+				return -1;
+			hq->level = k < HIST_LEVELS ? k : -1;
+		} else if (!strncmp(t, "from=", 5) || !strncmp(t, "to=", 3)) {
+			if (sscanf(strchr(t, '=') + 1, "%lld", &v) != 1 ||
+			    v > LLONG_MAX / 1000 || v < -(LLONG_MAX / 1000))
+				return -1;
+			v = v < 0 ? now + v * 1000 : v * 1000;
+			v = MIN(MAX(v, 0), now);
+			if (t[0] == 'f') {
+				hq->from = v;
+				from = 1;
+			} else
+				hq->to = v;
+		} else
+			return -1;
+	}
+	if (!from)
+		hq->from = hq->to - (hq->level >= 0 ?
+			   histlevels[hq->level].res * 1000LL *
+			   histlevels[hq->level].cap : HIST_RAW_SPAN_SEC * 1000LL);
+	hq->from = MAX(hq->from, 0);
+	return hq->from <= hq->to ? 0 : -1;
+}
+
+/* Find latest known value of sensor not in table, returns index in */
+/* storelast or -1 */
+int storeLastFind(int bus, int type, int key, int val)
+{
+	int j;
+	struct sensorstore_rec *r;
+
+	for(j = 0; j < nstorelast; j++) {
+		r = &storelast[j];
+		if (r->bus == bus && r->type == type &&
+		    r->key == (unsigned int)key && r->val == val)
+			return j;
+	}
+	return -1;
+}
+
+/* Keep values of sensor leaving table, so they are restored if it comes */
+/* back, oldest value is forgotten if there is no room */
+/* (sensor table lock held) */
+void storeRemember(int i)
+{
+	int j, k, m, n;
+	struct sensorentry *s;
+	struct sensorstore_rec *r;
+	const struct attrentry *va[HIST_VALUES];
+
+	if (!storerun)
+		return;
+	s = &senstbl[i];
+	n = sensorValues(s, va);
+	for(k = 0; k < n; k++) {
+		j = storeLastFind(s->bus, s->type, s->key, k);
+		if (j < 0 && nstorelast < MAX_SENSORS * HIST_VALUES)
+			j = nstorelast++;
+		else if (j < 0)
+			for(j = 0, m = 1; m < nstorelast; m++)
+				if (storelast[m].ts < storelast[j].ts)
+					j = m;
+		r = &storelast[j];
+		r->ts = s->tsec * 1000LL + s->tmsec;
+		r->bus = s->bus;
+		r->val = k;
+		r->type = s->type;
+		r->key = s->key;
+		r->cur = attrValue(s, va[k]);
+		r->min = attrValue(s, va[k] - 1);
+		r->max = attrValue(s, va[k] + 1);
+	}
+}
+
+/* Apply latest known values to new sensor: min/max are widened and */
+/* value is put in history before the first read (sensor table lock held) */
+void storeRestoreSensor(int i)
+{
+	int j, k, n;
+	long long ts;
+	struct sensorentry *s;
+	struct sensorstore_rec *r;
+	struct histseries *h;
+	const struct attrentry *va[HIST_VALUES];
+
+	s = &senstbl[i];
+	n = sensorValues(s, va);
+	ts = s->tsec * 1000LL + s->tmsec;
+	for(k = 0; k < n; k++) {
+		j = storeLastFind(s->bus, s->type, s->key, k);
+		if (j < 0)
+			continue;
+		r = &storelast[j];
+		if (r->min < attrValue(s, va[k] - 1))
+			attrSetValue(s, va[k] - 1, r->min);
+		if (r->max > attrValue(s, va[k] + 1))
+			attrSetValue(s, va[k] + 1, r->max);
+		if (r->ts >= ts)
+			continue;
+		h = historySeries(i, k);
+		if (h != NULL && !h->rawlen)
+			historyAdd(h, r->ts, r->cur);
+	}
+}
+
+/* Swap two entries of expiry heap */
+void expirySwap(int a, int b)
+{
+	int i;
+
+	i = sensheap[a];
+	sensheap[a] = sensheap[b];
+	sensheap[b] = i;
+	senshpos[sensheap[a]] = a;
+	senshpos[sensheap[b]] = b;
+}
+
+/* Move heap entry up or down to its place */
+void expiryFix(int p)
+{
+	int c;
+
+	while (p > 0 && sensexp[sensheap[p]] < sensexp[sensheap[(p - 1) / 2]]) {
+		expirySwap(p, (p - 1) / 2);
+		p = (p - 1) / 2;
+	}
+	for(;;) {
+		c = 2 * p + 1;
+		if (c >= sensnheap)
+			break;
+		if (c + 1 < sensnheap &&
+		    sensexp[sensheap[c + 1]] < sensexp[sensheap[c]])
+			c++;
+		if (sensexp[sensheap[c]] >= sensexp[sensheap[p]])
+			break;
+		expirySwap(p, c);
+		p = c;
+	}
+}
+
+/* Set expiry of sensor entry from its timestamp and interval, main */
+/* loop is woken up when earliest expiry moves closer (sensor table */
+/* lock held) */
+void sensorExpiryUpdate(int i)
+{
+	struct sensorentry *s;
+	long long first;
+
+	s = &senstbl[i];
+	first = sensnheap ? sensexp[sensheap[0]] : -1;
+	sensexp[i] = s->tsec * 1000LL + s->tmsec +
+		     SENSOR_ENTRY_TTL * (long long)s->interval;
+	if (senshpos[i] < 0) {
+		senshpos[i] = sensnheap;
+		sensheap[sensnheap++] = i;
+	}
+	expiryFix(senshpos[i]);
+	if (first < 0 || sensexp[sensheap[0]] < first)
+		eventfd_write(expfd, 1);
+}
+
+/* Remove sensor entry by index */
+void sensorEntryDelete(int i)
+{
+	int *p, h;
+	struct sensorentry *s;
+	struct i2centry *c;
+
+	if (i < 0 || i >= MAX_SENSORS || !senstbl[i].type)
+		return;
+
+	s = &senstbl[i];
+	for(p = &senshash[sensorHash(s->bus, s->type, s->key)]; *p != i;
+	    p = &senshnext[*p])
+		;
+	*p = senshnext[i];
+	if (sensbprev[i] >= 0)
+		sensbnext[sensbprev[i]] = sensbnext[i];
+	else
+		sensbus[s->bus] = sensbnext[i];
+	if (sensbnext[i] >= 0)
+		sensbprev[sensbnext[i]] = sensbprev[i];
+	if (senshpos[i] >= 0) {
+		h = senshpos[i];
+		expirySwap(h, --sensnheap);
+		senshpos[i] = -1;
+		if (h < sensnheap)
+			expiryFix(h);
+	}
+	sensfree[sensnfree++] = i;
+	storeRemember(i);
+	historyRelease(i);
+	if (s->data) {
+		if (s->bus == SB_I2C) {
+			c = (struct i2centry *)(s->data);
+			if (c->fd >= 0)
+				close(c->fd);
+		}
+		free(s->data);
+	}
+	memset(s, 0, sizeof(struct sensorentry));
+	sensorEntryChanged(i);
+}
+
+/* Remove all radio sensors from table */
+void sensorRadioRemoveAll(void)
+{
+        int i;
+        struct sensorentry *s;
+
+        sem_wait(&sensem);
+        for(i = 0; i < MAX_SENSORS; i++) {
+                s = &senstbl[i];
+                if (s->bus == SB_RADIO)
+                                sensorEntryDelete(i);
+        }
+        sem_post(&sensem);
+}
+
+/* Remove stale sensors from table, returns ms to next expiry or -1 */
+/* if table is empty */
+/* entry is expired if time difference is more
+ * than SENSOR_ENTRY_TTL intervals, only entries from top of
+ * expiry heap are visited */
+long long sensorTableClean(void)
+{
+	int i, l;
+	long long now, w;
+	struct timeval t;
+	struct sensorentry *s;
+
+	gettimeofday(&t, NULL);
+	now = t.tv_sec * 1000LL + t.tv_usec / 1000;
+	sem_wait(&sensem);
+	while (sensnheap && sensexp[sensheap[0]] < now) {
+		i = sensheap[0];
+		s = &senstbl[i];
+		/* I2C entries being read are checked a bit later */
+		if (i2cbusy && s->bus == SB_I2C) {
+			sensexp[i] = now + EXPIRY_RETRY_MS;
+			expiryFix(0);
+			continue;
+		}
+		l = TSDIFF(t.tv_sec, t.tv_usec / 1000, s->tsec, s->tmsec);
+		logprintf(logfd, LOG_NOTICE,
+			  "removing sensor \"%s\" [%d] due to timeout (%d ms)\n",
+			  s->label, i, l);
+		sensorEntryDelete(i);
+	}
+	w = sensnheap ? sensexp[sensheap[0]] - now + 1 : -1;
+	sem_post(&sensem);
+	return w;
+}
+
+/* Reset min/max for all active sensors */
+void sensorResetMinMax(void)
+{
+        int i;
+        struct sensorentry *s;
+        struct datahyuws77th *dhs;
+	struct datahtu21d *dht2;
+	struct databmp180 *dbm1;
+	struct databh1750 *dbh1;
+	struct databme280 *dbm2;
+
+	sem_wait(&sensem);
+	for(i = 0; i < MAX_SENSORS; i++) {
+		s = &senstbl[i];
+		if (s->type == RADIO433_DEVICE_HYUWSSENZOR77TH) {
+			dhs = (struct datahyuws77th *)(s->data);
+			dhs->temp.min = dhs->temp.cur;
+			dhs->temp.max = dhs->temp.cur;
+			dhs->humid.min = dhs->humid.cur;
+			dhs->humid.max = dhs->humid.cur;
+		} else if (s->bus == SB_I2C) {
+			if (s->type == ST_I2C_HTU21D) {
+				dht2 = (struct datahtu21d *)(s->data);
+				dht2->humid.min = dht2->humid.cur;
+				dht2->humid.max = dht2->humid.cur;
+				dht2->temp.min = dht2->temp.cur;
+				dht2->temp.max = dht2->temp.cur;
+			} else if (s->type == ST_I2C_BMP180) {
+				dbm1 = (struct databmp180 *)(s->data);
+				dbm1->press.min = dbm1->press.cur;
+				dbm1->press.max = dbm1->press.cur;
+				dbm1->temp.min = dbm1->temp.cur;
+				dbm1->temp.max = dbm1->temp.cur;
+			} else if (s->type == ST_I2C_BH1750) {
+				dbh1 = (struct databh1750 *)(s->data);
+				dbh1->light.min = dbh1->light.cur;
+				dbh1->light.max = dbh1->light.cur;
+			} else if (s->type == ST_I2C_BME280) {
+				dbm2 = (struct databme280 *)(s->data);
+				dbm2->press.min = dbm2->press.cur;
+				dbm2->press.max = dbm2->press.cur;
+				dbm2->temp.min = dbm2->temp.cur;
+				dbm2->temp.max = dbm2->temp.cur;
+				dbm2->humid.min = dbm2->humid.cur;
+				dbm2->humid.max = dbm2->humid.cur;
+			}
+		}
+		if (s->type)
+			sensorEntryChanged(i);
+        }
+	for(i = 0; i < nstorelast; i++) {
+		storelast[i].min = storelast[i].cur;
+		storelast[i].max = storelast[i].cur;
+	}
+        sem_post(&sensem);
+}
+
+/* Process pending signal actions */
+void sensorHousekeeping(void)
+{
+	if (rdelflag) {
+		sensorRadioRemoveAll();
+		rdelflag = 0;
+	}
+	if (mrstflag) {
+		sensorResetMinMax();
+		mrstflag = 0;
+	}
+}
+
+/* Update remote sensor in table */
+void sensorRadioUpdate(struct radio433_msg *rm)
+{
+	int i;
+	time_t tsec;
+	unsigned int tmsec;
+	struct sensorentry *s;
+	struct radioentry *r;
+	struct datahyuws77th *dhs;
+	int sysid, devid, ch, batlow, tdir, humid;
+	double temp;
+	int codestatus; /* 0-new, 1-update ts + data, 2-update only ts */
+
+	if (rm->type != RADIO433_DEVICE_HYUWSSENZOR77TH)
+		return;
+
+	/* decoded and validated by server (shared memory and multicast */
+	/* records are decoded here) */
+	if (!Radio433_decodeMsg(rm))
+		return;
+	sysid = rm->dec.sysid;
+	devid = rm->dec.devid;
+	ch = rm->dec.ch;
+	batlow = rm->dec.batlow;
+	tdir = rm->dec.trend;
+	temp = rm->dec.temp;
+	humid = rm->dec.humid;
+	tsec = rm->ts / 1000000;
+	tmsec = (rm->ts / 1000) % 1000;
+
+	/* first check if signal is part of multi-signal transmission */
+	sem_wait(&sensem);
+	codestatus = 0;
+	i = sensorFind(SB_RADIO, rm->type, RADIO_KEY(ch, sysid, devid));
+	if (i >= 0) {
+		s = &senstbl[i];
+		r = (struct radioentry *)(s->data); /* radio begins every struct */
+		codestatus = r->code == rm->code ? 2 : 1;
+		if (TSDIFF(tsec, tmsec, s->tsec, s->tmsec) <=
+		    (r->sigmax - r->sigcur + 1) * rm->codetime) {
+			if (r->sigcur < r->sigmax)
+				r->sigcur++;
+			else {
+				sem_post(&sensem);
+				return;
+			}
+		} else
+			r->sigcur = 1;
+	}
+
+	if (!codestatus) {
+		i = sensorEntryNew(SB_RADIO, rm->type, RADIO_KEY(ch, sysid, devid));
+		if (i < 0) {
+			sem_post(&sensem);
 			return;
 		}
 		s = &senstbl[i];
 		s->interval = rm->interval;
-		s->bus = SB_RADIO;
-		s->type = rm->type;
 		if (rm->type == RADIO433_DEVICE_HYUWSSENZOR77TH) {
 			strncpy(s->label, SL_HYUWSSENZOR77TH, SENSOR_LABEL);
 			s->data = malloc(sizeof(struct datahyuws77th));
@@ -802,8 +2075,11 @@ void sensorRadioUpdate(struct radmsg *rm)
 			dhs = (struct datahyuws77th *)(s->data);
 	}
 
-	s->tsec = rm->tsec;
-	s->tmsec = rm->tmsec;
+	s->tsec = tsec;
+	s->tmsec = tmsec;
+	sensorExpiryUpdate(i);
+	if (!codestatus)
+		storeRestoreSensor(i);
 
 	if (codestatus < 2) {
 		dhs->radio.code = rm->code;
@@ -815,160 +2091,1011 @@ void sensorRadioUpdate(struct radmsg *rm)
 		dhs->humid.max = MAX(humid, dhs->humid.max);
 		dhs->trend = tdir;
 		dhs->batlow = batlow;
+		historyRecord(i);
+	}
+	sensorEntryChanged(i);
+	sem_post(&sensem);
+}
+
+/* ************* */
+/* *  Threads  * */
+/* ************* */
+
+/* Radio daemon client thread */
+void *radioDaemonThread(void *arg)
+{
+	struct radio433_msgbuf mb;
+	int n, msglen;
+	sigset_t blkset;
+	struct radio433_msg rm;
+
+	sigfillset(&blkset);
+	pthread_sigmask(SIG_BLOCK, &blkset, NULL);
+
+	Radio433_initMsgBuf(&mb);
+
+	/* function loop - never ends, send signal to exit */
+	for(;;) {
+		msglen = Radio433_recvMsgBuf(radfd, &mb);
+		if (msglen <= 0) {
+			close(radfd);
+			radfd = connectRadioSrv(&radsin);
+			Radio433_initMsgBuf(&mb);
+			continue;
+		}
+		n = 0;
+		while (Radio433_nextMsg(&mb, &rm)) {
+			sensorRadioUpdate(&rm);
+			radlastts = rm.ts;
+			n++;
+		}
+		if (n)
+			logprintf(logfd, LOG_INFO, "received update packet from server\n");
+	}	/* thread main loop ends here */
+}
+
+/* Radio multicast receiver thread */
+void *radioMcastThread(void *arg)
+{
+	struct radio433_mcast mc;
+	struct radio433_msg rm;
+	unsigned long lost;
+	sigset_t blkset;
+
+	sigfillset(&blkset);
+	pthread_sigmask(SIG_BLOCK, &blkset, NULL);
+
+	while (Radio433_openMcast(&mc, radmcgroup, radmcport) == -1) {
+		logprintf(logfd, LOG_WARN,
+			  "unable to join radio multicast group %s port %d: %s\n",
+			  inet_ntoa(radmcgroup), radmcport, strerror(errno));
+		logprintf(logfd, LOG_WARN, "retrying in %d seconds...\n",
+			  RECONNECT_DELAY_SEC);
+		sleep(RECONNECT_DELAY_SEC);
+	}
+	radfd = mc.fd;
+	logprintf(logfd, LOG_NOTICE, "joined radio multicast group %s port %d\n",
+		  inet_ntoa(radmcgroup), radmcport);
+
+	/* function loop - never ends, send signal to exit */
+	lost = 0;
+	while (Radio433_recvMcast(&mc, &rm) > 0) {
+		if (mc.lost != lost) {
+			logprintf(logfd, LOG_WARN, "%lu radio message(s) lost\n",
+				  mc.lost - lost);
+			lost = mc.lost;
+		}
+		sensorRadioUpdate(&rm);
+		radlastts = rm.ts;
+	}
+	logprintf(logfd, LOG_ERROR, "radio multicast receive failed: %s\n",
+		  strerror(errno));
+	return NULL;
+}
+
+/* Radio shared memory ring reader thread */
+void *radioShmThread(void *arg)
+{
+	struct radio433_shm sh;
+	struct radio433_msg rm;
+	unsigned long lost;
+	sigset_t blkset;
+
+	sigfillset(&blkset);
+	pthread_sigmask(SIG_BLOCK, &blkset, NULL);
+
+	/* function loop - never ends, send signal to exit */
+	for(;;) {
+		while (Radio433_openShm(&sh, radshmname) == -1) {
+			logprintf(logfd, LOG_WARN,
+				  "unable to open radio shared memory ring %s: %s\n",
+				  radshmname, strerror(errno));
+			logprintf(logfd, LOG_WARN, "retrying in %d seconds...\n",
+				  RECONNECT_DELAY_SEC);
+			sleep(RECONNECT_DELAY_SEC);
+		}
+		logprintf(logfd, LOG_NOTICE, "reading radio shared memory ring %s\n",
+			  radshmname);
+		lost = 0;
+		while (Radio433_readShm(&sh, &rm) > 0) {
+			if (sh.lost != lost) {
+				logprintf(logfd, LOG_WARN, "%lu radio message(s) lost\n",
+					  sh.lost - lost);
+				lost = sh.lost;
+			}
+			sensorRadioUpdate(&rm);
+			radlastts = rm.ts;
+		}
+		Radio433_closeShm(&sh);
+		logprintf(logfd, LOG_WARN, "radio server closed shared memory ring, reopening\n");
+	}
+}
+
+/* Advance I2C sensor measurement by one step: conversions are started */
+/* here and collected on next call, returns ms to wait before next step */
+/* or 0 when sample is complete (called without sensor table lock) */
+int i2cSensorStep(struct i2csample *p)
+{
+	switch (p->type * 4 + p->step++) {
+	case ST_I2C_HTU21D * 4:
+		return HTU21D_startTemperature(p->fd);
+	case ST_I2C_HTU21D * 4 + 1:
+		p->v[1] = HTU21D_readTemperature(p->fd);
+		return HTU21D_startHumidity(p->fd);
+	case ST_I2C_HTU21D * 4 + 2:
+		p->v[0] = HTU21D_readHumidity(p->fd);
+		p->valid = p->v[0] >= 0.0 && p->v[0] <= 100.0 &&
+			   p->v[1] >= -40.0 && p->v[1] <= 125.0;
+		return 0;
+	case ST_I2C_BMP180 * 4:
+		return BMP180_startTemperature(p->fd);
+	case ST_I2C_BMP180 * 4 + 1:
+		p->raw = BMP180_readRawTemperature(p->fd);
+		return BMP180_startPressure(p->fd, BMP180_OSS_MODE_UHR);
+	case ST_I2C_BMP180 * 4 + 2:
+		p->v[0] = BMP180_readPressureFP(p->fd, p->raw, &p->v[1]);
+		p->valid = p->v[0] >= 300.0 && p->v[0] <= 1100.0 &&
+			   p->v[1] >= -40.0 && p->v[1] <= 85.0;
+		return 0;
+	case ST_I2C_BH1750 * 4:		/* continuous mode */
+		p->v[0] = BH1750_readLx(p->fd);
+		p->valid = p->v[0] >= 0.0;
+		return 0;
+	case ST_I2C_BME280 * 4:
+		return BME280_startForced(p->fd);
+	case ST_I2C_BME280 * 4 + 1:
+		p->valid = !BME280_getSensorData(p->fd, &p->v[0], &p->v[1],
+						 &p->v[2]);
+		return 0;
+	}
+	return 0;
+}
+
+/* Store I2C sensor sample in table (sensor table lock held) */
+void i2cSensorStore(struct sensorentry *s, const double *v, struct timeval *ts)
+{
+	struct datahtu21d *dht2;
+	struct databmp180 *dbm1;
+	struct databh1750 *dbh1;
+	struct databme280 *dbm2;
+
+	sensorEntryChanged(s - senstbl);
+	s->tsec = ts->tv_sec;
+	s->tmsec = ts->tv_usec / 1000;
+	sensorExpiryUpdate(s - senstbl);
+	if (s->type == ST_I2C_HTU21D) {
+		dht2 = (struct datahtu21d *)(s->data);
+		dht2->humid.cur = v[0];
+		dht2->humid.min = MIN(v[0], dht2->humid.min);
+		dht2->humid.max = MAX(v[0], dht2->humid.max);
+		dht2->temp.cur = v[1];
+		dht2->temp.min = MIN(v[1], dht2->temp.min);
+		dht2->temp.max = MAX(v[1], dht2->temp.max);
+	} else if (s->type == ST_I2C_BMP180) {
+		dbm1 = (struct databmp180 *)(s->data);
+		dbm1->press.cur = v[0];
+		dbm1->press.min = MIN(v[0], dbm1->press.min);
+		dbm1->press.max = MAX(v[0], dbm1->press.max);
+		dbm1->temp.cur = v[1];
+		dbm1->temp.min = MIN(v[1], dbm1->temp.min);
+		dbm1->temp.max = MAX(v[1], dbm1->temp.max);
+	} else if (s->type == ST_I2C_BH1750) {
+		dbh1 = (struct databh1750 *)(s->data);
+		dbh1->light.cur = v[0];
+		dbh1->light.min = MIN(v[0], dbh1->light.min);
+		dbh1->light.max = MAX(v[0], dbh1->light.max);
+	} else if (s->type == ST_I2C_BME280) {
+		dbm2 = (struct databme280 *)(s->data);
+		dbm2->temp.cur = v[0];
+		dbm2->temp.min = MIN(v[0], dbm2->temp.min);
+		dbm2->temp.max = MAX(v[0], dbm2->temp.max);
+		dbm2->press.cur = v[1];
+		dbm2->press.min = MIN(v[1], dbm2->press.min);
+		dbm2->press.max = MAX(v[1], dbm2->press.max);
+		dbm2->humid.cur = v[2];
+		dbm2->humid.min = MIN(v[2], dbm2->humid.min);
+		dbm2->humid.max = MAX(v[2], dbm2->humid.max);
+	}
+	historyRecord(s - senstbl);
+}
+
+/* Monotonic time in ms */
+long long monotonicMs(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000LL + t.tv_nsec / 1000000;
+}
+
+/* Read latest values of sensors from tail of store, segments are scanned */
+/* backwards up to STORE_RESTORE_SEC old or STORE_RESTORE_RECS records, */
+/* returns number of values or -1 on error */
+int storeRestore(void)
+{
+	short slot[STORE_RESTORE_HASH];
+	int g, h, n, done;
+	long long m, cnt;
+	unsigned long long from;
+	struct sensorstore rd;
+	struct sensorstore_rec r, *e;
+
+	n = SensorStore_openReader(&rd, storedir);
+	if (n < 0)
+		return -1;
+	memset(slot, 0xff, sizeof(slot));
+	from = time(NULL) * 1000ULL - STORE_RESTORE_SEC * 1000ULL;
+	cnt = 0;
+	done = 0;
+	for(g = n - 1; g >= 0 && !done; g--) {
+		m = SensorStore_map(&rd, g);
+		while (--m >= 0 && !done) {
+			done = ++cnt >= STORE_RESTORE_RECS;
+			if (SensorStore_unpackRec(rd.recs + m * SENSORSTORE_RECSIZE, &r) ||
+			    r.val >= HIST_VALUES)
+				continue;
+			if (r.ts < from) {
+				done = 1;
+				break;
+			}
+			/* newest record of value wins */
+			h = (sensorHash(r.bus, r.type, r.key) * HIST_VALUES + r.val) %
+			    STORE_RESTORE_HASH;
+			for(; slot[h] >= 0; h = (h + 1) % STORE_RESTORE_HASH) {
+				e = &storelast[slot[h]];
+				if (e->bus == r.bus && e->type == r.type &&
+				    e->key == r.key && e->val == r.val)
+					break;
+			}
+			if (slot[h] >= 0)
+				continue;
+			slot[h] = nstorelast;
+			storelast[nstorelast++] = r;
+			done = nstorelast == MAX_SENSORS * HIST_VALUES;
+		}
+	}
+	SensorStore_closeReader(&rd);
+	return nstorelast;
+}
+
+/* Store writer thread, appends queued samples in large batches and */
+/* flushes each batch to disk once */
+void *storeThread(void *arg)
+{
+	unsigned int ri, n, c;
+	int stop;
+	struct timespec ts;
+	sigset_t blkset;
+
+	sigfillset(&blkset);
+	pthread_sigmask(SIG_BLOCK, &blkset, NULL);
+
+	do {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += STORE_FLUSH_SEC;
+		while (sem_timedwait(&storesem, &ts) == -1 && errno == EINTR)
+			;
+		stop = __atomic_load_n(&storestop, __ATOMIC_ACQUIRE);
+		ri = storeri;
+		n = __atomic_load_n(&storewi, __ATOMIC_ACQUIRE) - ri;
+		if (!n)
+			continue;
+		while (n) {
+			c = MIN(n, STORE_QUEUE_LEN - ri % STORE_QUEUE_LEN);
+			if (SensorStore_write(&store, storequeue[ri % STORE_QUEUE_LEN], c) &&
+			    !storeerrors++)
+				logprintf(logfd, LOG_WARN, "unable to write store: %s\n",
+					  strerror(errno));
+			ri += c;
+			n -= c;
+			__atomic_store_n(&storeri, ri, __ATOMIC_RELEASE);
+		}
+		if (SensorStore_sync(&store) && !storeerrors++)
+			logprintf(logfd, LOG_WARN, "unable to flush store: %s\n",
+				  strerror(errno));
+	} while (!stop);
+	return NULL;
+}
+
+/* I2C sensor reading thread */
+/* (each sensor is sampled with its own period at absolute deadlines, */
+/* so late wakeups and conversion time do not shift its schedule; */
+/* conversions of sensors that are due together run in parallel and */
+/* table lock is held only to start measurements and store samples) */
+void *i2cSensorThread(void *arg)
+{
+	sigset_t blkset;
+	int i, n, w, start, done;
+	long long now, next;
+	struct timespec t;
+        struct sensorentry *s;
+	struct i2csample smp[MAX_SENSORS], *p;
+	char vbuf[64];
+
+	sigfillset(&blkset);
+	pthread_sigmask(SIG_BLOCK, &blkset, NULL);
+
+	now = monotonicMs();
+	sem_wait(&sensem);
+	for(i = n = 0; i < MAX_SENSORS; i++) {
+		s = &senstbl[i];
+		if (s->bus != SB_I2C)
+			continue;
+		p = &smp[n++];
+		memset(p, 0, sizeof(struct i2csample));
+		p->idx = i;
+		p->type = s->type;
+		p->period = s->interval;
+		p->due = now;
+		p->deadline = -1;
 	}
 	sem_post(&sensem);
+
+	for(;;) {
+		/* start due measurements, entry may have expired meanwhile */
+		now = monotonicMs();
+		for(i = start = 0; i < n; i++)
+			if (smp[i].type && smp[i].deadline < 0 &&
+			    smp[i].due <= now)
+				start++;
+		if (start) {
+			sem_wait(&sensem);
+			for(i = 0; i < n; i++) {
+				p = &smp[i];
+				if (!p->type || p->deadline >= 0 || p->due > now)
+					continue;
+				s = &senstbl[p->idx];
+				if (s->bus != SB_I2C || s->type != p->type) {
+					logprintf(logfd, LOG_NOTICE,
+						  "%s sensor [%d] removed from schedule\n",
+						  i2clabel[p->type], p->idx);
+					p->type = ST_I2C_NULL;
+					continue;
+				}
+				p->fd = ((struct i2centry *)(s->data))->fd;
+				p->step = 0;
+				p->deadline = now;
+				p->valid = 0;
+				memset(p->v, 0, sizeof(p->v));
+				gettimeofday(&p->ts, NULL);
+				i2cbusy++;	/* entry stays until stored */
+			}
+			sem_post(&sensem);
+		}
+
+		/* advance running ones, next start is one period later */
+		/* (missed periods are skipped, phase is kept) */
+		for(i = done = 0; i < n; i++) {
+			p = &smp[i];
+			if (!p->type || p->deadline < 0 || p->deadline > now)
+				continue;
+			w = i2cSensorStep(p);
+			if (w) {
+				p->deadline = now + w;
+				continue;
+			}
+			p->deadline = -1;
+			p->ready = 1;
+			p->due += p->period;
+			if (p->due <= now)
+				p->due += ((now - p->due) / p->period + 1) * p->period;
+			done++;
+		}
+
+		if (done) {
+			sem_wait(&sensem);
+			for(i = 0; i < n; i++) {
+				p = &smp[i];
+				s = &senstbl[p->idx];
+				if (p->ready && p->valid && s->type == p->type)
+					i2cSensorStore(s, p->v, &p->ts);
+			}
+			i2cbusy -= done;
+			sem_post(&sensem);
+			for(i = 0; i < n; i++) {
+				p = &smp[i];
+				if (!p->ready)
+					continue;
+				p->ready = 0;
+				if (!debugflag || !p->valid)
+					continue;
+				snprintf(vbuf, sizeof(vbuf), i2cvalfmt[p->type],
+					 p->v[0], p->v[1], p->v[2]);
+				logprintf(logfd, LOG_DEBUG,
+					  "sensor \"%s\" [%d] read complete (%s)\n",
+					  i2clabel[p->type], p->idx, vbuf);
+			}
+		}
+
+		/* sleep until earliest step or start */
+		next = now + 60000;
+		for(i = 0; i < n; i++) {
+			p = &smp[i];
+			if (!p->type)
+				continue;
+			next = MIN(next, p->deadline >= 0 ? p->deadline : p->due);
+		}
+		t.tv_sec = next / 1000;
+		t.tv_nsec = (next % 1000) * 1000000;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) == EINTR)
+			;
+	}
+}
+
+/* Append lines of new sensor section that differ from old one, */
+/* sensor that disappeared from slot is reported as deleted */
+void sectionDelta(struct textbuf *d, const struct textbuf *o,
+		  const struct textbuf *n)
+{
+	int ol, nl, l;
+	char *op, *np, *oe, *ne, *p;
+
+	/* sections start with "/bus/device/timestamp=" */
+	ol = o->len ? strstr(o->data, "/timestamp=") - o->data : 0;
+	nl = n->len ? strstr(n->data, "/timestamp=") - n->data : 0;
+	op = o->data;
+	oe = o->data + o->len;
+	if (ol && (ol != nl || strncmp(o->data, n->data, ol))) {
+		textPrintf(d, "#%s %.*s\n", TXTMSG_DEL, ol, o->data);
+		op = oe;	/* every line is new */
+	}
+
+	/* device properties are always in the same order */
+	np = n->data;
+	ne = n->data + n->len;
+	while (np < ne) {
+		l = strchr(np, '\n') - np + 1;
+		p = op < oe ? strchr(op, '\n') + 1 : oe;
+		if (p - op != l || memcmp(op, np, l))
+			textPrintf(d, "%.*s", l, np);
+		op = p;
+		np += l;
+	}
+}
+
+/* Send pending subscriber output without blocking, returns -1 on error */
+int subscriberFlush(struct subscriber *c)
+{
+	int n;
+
+	while (c->outpos < c->out.len) {
+		n = send(c->fd, c->out.data + c->outpos, c->out.len - c->outpos,
+			 MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+		}
+		c->outpos += n;
+	}
+	c->out.len = 0;
+	c->outpos = 0;
+	if (c->out.size > SUB_OUT_KEEP) {
+		/* snapshot sent, do not hold its buffer for small updates */
+		free(c->out.data);
+		memset(&c->out, 0, sizeof(c->out));
+	}
+	return 0;
+}
+
+/* Queue subscription snapshot (state after update seq), returns 0 on success */
+int subscriberSnapshot(struct subscriber *c, const struct textbuf *sect,
+		       unsigned long seq)
+{
+	struct textbuf *b;
+	int i;
+
+	b = &c->out;
+	if (b->len - c->outpos > SUB_OUT_LIMIT) {
+		logprintf(logfd, LOG_WARN,
+			  "subscriber [%d] is not reading, disconnected\n", c->fd);
+		return -1;
+	}
+#ifdef BUILDSTAMP
+	textPrintf(b, "#INFO: %s build %s\n", BANNER, BUILDSTAMP);
+#else
+	textPrintf(b, "#INFO: %s\n", BANNER);
+#endif
+	textPrintf(b, "#%s %lu\n#%s\n", TXTMSG_SNAP, seq, TXTMSG_HDR);
+	for(i = 0; i < MAX_SENSORS; i++)
+		if (sect[i].len)
+			textPrintf(b, "%s", sect[i].data);
+	if (textPrintf(b, "#%s\n", TXTMSG_EOT))
+		return -1;
+	return subscriberFlush(c);
+}
+
+/* Read subscriber commands, returns -1 if client is gone */
+int subscriberCommands(struct subscriber *c, const struct textbuf *sect,
+		       unsigned long seq)
+{
+	int n;
+	char *p, *e;
+
+	n = recv(c->fd, c->cmd + c->cmdlen, SUB_CMD_SIZE - 1 - c->cmdlen,
+		 MSG_DONTWAIT);
+	if (n <= 0)
+		return n == -1 && (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+	c->cmdlen += n;
+	c->cmd[c->cmdlen] = '\0';
+	p = c->cmd;
+	while ((e = strchr(p, '\n')) != NULL) {
+		*e = '\0';
+		if (e > p && e[-1] == '\r')
+			e[-1] = '\0';
+		if (!strcmp(p, TXTCMD_RESYNC)) {
+			logprintf(logfd, LOG_INFO,
+				  "subscriber [%d] requested resync at %lu\n",
+				  c->fd, seq);
+			if (subscriberSnapshot(c, sect, seq))
+				return -1;
+		}
+		p = e + 1;
+	}
+	c->cmdlen -= p - c->cmd;
+	if (c->cmdlen == SUB_CMD_SIZE - 1)
+		c->cmdlen = 0;		/* garbage */
+	memmove(c->cmd, p, c->cmdlen);
+	return 0;
 }
 
-/* ************* */
-/* *  Threads  * */
-/* ************* */
+/* Close subscriber connection */
+void subscriberClose(struct subscriber *c)
+{
+	close(c->fd);
+	c->fd = -1;
+	free(c->out.data);
+	memset(&c->out, 0, sizeof(c->out));
+	c->outpos = 0;
+}
 
-/* Radio daemon client thread */
-void *radioDaemonThread(void *arg)
+/* Subscription thread */
+/* (subscribers get full snapshot on connect and on RESYNC request, */
+/* then changed lines are pushed with increasing sequence number, */
+/* at most once per push interval; sockets never block this thread, */
+/* client still sending previous output misses update and sees gap in */
+/* sequence) */
+void *subscriberThread(void *arg)
 {
-	char radbuf[RADBUF_SIZE + 1];
-	char *msgptr, *msgend;
-	int msglen;
 	sigset_t blkset;
-	struct radmsg rm;
+	int i, n, fd, t;
+	unsigned long ver, seq;
+	long long now, tick;
+	struct pollfd pfd[MAX_SUBSCRIBERS + 1];
+	struct subscriber sub[MAX_SUBSCRIBERS];
+	struct textbuf sect[MAX_SENSORS], cur, tmp, msg;
 
 	sigfillset(&blkset);
 	pthread_sigmask(SIG_BLOCK, &blkset, NULL);
 
-	/* function loop - never ends, send signal to exit */
+	memset(sect, 0, sizeof(sect));
+	memset(&cur, 0, sizeof(cur));
+	memset(&msg, 0, sizeof(msg));
+	memset(sub, 0, sizeof(sub));
+	for(i = 0; i < MAX_SUBSCRIBERS; i++)
+		sub[i].fd = -1;
+	ver = 0;
+	seq = 0;
+	tick = monotonicMs() + pushint;
+
 	for(;;) {
-		do
-			msglen = recv(radfd, radbuf, RADBUF_SIZE, 0);
-		while (msglen == -1 && errno == EINTR);
-		if (msglen <= 0) {
-			close(radfd);
-			radfd = connectRadioSrv(&radsin);
+		/* wait for subscribers and their commands until next tick */
+		pfd[0].fd = subfd;
+		pfd[0].events = POLLIN;
+		for(i = 0; i < MAX_SUBSCRIBERS; i++) {
+			pfd[i + 1].fd = sub[i].fd;
+			pfd[i + 1].events = POLLIN;
+			if (sub[i].outpos < sub[i].out.len)
+				pfd[i + 1].events |= POLLOUT;
+		}
+		now = monotonicMs();
+		t = tick > now ? tick - now : 0;
+		if (poll(pfd, MAX_SUBSCRIBERS + 1, t) > 0) {
+			if (pfd[0].revents & POLLIN) {
+				fd = accept(subfd, NULL, NULL);
+				for(i = 0; fd >= 0 && i < MAX_SUBSCRIBERS; i++)
+					if (sub[i].fd < 0)
+						break;
+				if (fd >= 0 && i == MAX_SUBSCRIBERS) {
+					logprintf(logfd, LOG_WARN,
+						  "too many subscribers, client [%d] rejected\n",
+						  fd);
+					close(fd);
+				} else if (fd >= 0) {
+					fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+					sub[i].fd = fd;
+					sub[i].cmdlen = 0;
+					logprintf(logfd, LOG_INFO,
+						  "subscriber [%d] connected\n", fd);
+					if (subscriberSnapshot(&sub[i], sect, seq))
+						subscriberClose(&sub[i]);
+				}
+			}
+			for(i = 0; i < MAX_SUBSCRIBERS; i++) {
+				/* drain output, then read commands */
+				if (sub[i].fd < 0 ||
+				    ((!(pfd[i + 1].revents & POLLOUT) ||
+				      !subscriberFlush(&sub[i])) &&
+				     (!(pfd[i + 1].revents & (POLLIN | POLLHUP | POLLERR)) ||
+				      !subscriberCommands(&sub[i], sect, seq))))
+					continue;
+				logprintf(logfd, LOG_INFO,
+					  "subscriber [%d] disconnected\n", sub[i].fd);
+				subscriberClose(&sub[i]);
+			}
+		}
+		now = monotonicMs();
+		if (now < tick)
 			continue;
+		tick += pushint;
+		if (tick <= now)
+			tick = now + pushint;
+
+		/* collect changes since last push */
+		msg.len = 0;
+		textPrintf(&msg, "#%s %lu\n", TXTMSG_UPD, seq + 1);
+		n = msg.len;
+		sem_wait(&sensem);
+		if (ver != senstblver) {
+			for(i = 0; i < MAX_SENSORS; i++) {
+				if (!(sensdirty[i] & SD_PUSH))
+					continue;
+				formatSensor(i, &cur);
+				sectionDelta(&msg, &sect[i], &cur);
+				tmp = sect[i];
+				sect[i] = cur;
+				cur = tmp;
+				sensdirty[i] &= ~SD_PUSH;
+			}
+			ver = senstblver;
 		}
-		radbuf[msglen] = 0;
-		msgptr = radbuf;
-		do {
-			msgptr = strstr(msgptr, RADMSG_HDR);
-			if (msgptr == NULL)
-				break;
-			msgend = strstr(msgptr, RADMSG_EOT);
-			if (msgend == NULL)
-				break;
-			if (sscanf(msgptr + 4, "%lu.%u;%d;%d;%d;0x%X;%d;0x%llX;",
-			    &rm.tsec, &rm.tmsec, &rm.codelen, &rm.repeats,
-			    &rm.interval, &rm.type, &rm.bits, &rm.code) != 8)
+		sem_post(&sensem);
+		if (msg.len == n)
+			continue;
+
+		/* updates are not queued behind unsent output */
+		seq++;
+		textPrintf(&msg, "#%s\n", TXTMSG_EOT);
+		for(i = 0; i < MAX_SUBSCRIBERS; i++) {
+			if (sub[i].fd < 0)
 				continue;
-			sensorTableClean();
-			sensorRadioUpdate(&rm);
-			msgptr = msgend + 5;
-		} while (msgptr < radbuf + msglen);
-		logprintf(logfd, LOG_INFO, "received update packet from server\n");
-	}	/* thread main loop ends here */
+			if (sub[i].outpos < sub[i].out.len) {
+				logprintf(logfd, LOG_WARN,
+					  "subscriber [%d] is busy, update %lu skipped\n",
+					  sub[i].fd, seq);
+				continue;
+			}
+			/* only part socket did not take is kept */
+			n = send(sub[i].fd, msg.data, msg.len,
+				 MSG_NOSIGNAL | MSG_DONTWAIT);
+			if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+				n = 0;
+			if (n == msg.len ||
+			    (n >= 0 && !textPrintf(&sub[i].out, "%s", msg.data + n)))
+				continue;
+			logprintf(logfd, LOG_INFO,
+				  "subscriber [%d] write error, disconnected\n",
+				  sub[i].fd);
+			subscriberClose(&sub[i]);
+		}
+	}
 }
 
-/* I2C sensor reading thread */
-void *i2cSensorThread(void *arg)
+/* Close client connection */
+/* Epoll data of client connection: slot tag and generation, so that */
+/* events of evicted connection are not delivered to next one in slot */
+unsigned long long clientEpollData(const struct clientconn *cc)
 {
-	sigset_t blkset;
-	int i;
-	struct timeval ts;
-        struct sensorentry *s;
-	struct i2centry *c;
-	struct datahtu21d *dht2;
-	struct databmp180 *dbm1;
-	struct databh1750 *dbh1;
-	struct databme280 *dbm2;
-	double v0, v1, v2;
+	return (unsigned long long)cc->gen << 32 |
+	       (EPOLL_TAG_CLIENT + (cc - clconns));
+}
 
-	sigfillset(&blkset);
-	pthread_sigmask(SIG_BLOCK, &blkset, NULL);
+void closeClient(struct clientconn *cc)
+{
+	epoll_ctl(epfd, EPOLL_CTL_DEL, cc->fd, NULL);
+	close(cc->fd);
+	logprintf(logfd, LOG_INFO, "client [%d] disconnected\n", cc->fd);
+	cc->fd = -1;
+	snapshotRelease(cc);
+}
+
+/* Decode %XX escapes in place */
+void urlDecode(char *p)
+{
+	char *d;
+	unsigned int c;
+
+	for(d = p; *p; d++)
+		if (*p == '%' && sscanf(p + 1, "%2x", &c) == 1) {
+			*d = c;
+			p += 3;
+		} else
+			*d = *p++;
+	*d = '\0';
+}
+
+/* Build response to request at beginning of buffer (eof: no more data */
+/* will come), returns length of request or 0 if it is not complete */
+/* (text query is list of patterns ended with empty line, HTTP query */
+/* is GET with patterns separated by ';' as path, history is requested */
+/* by HISTORY line before patterns or by URL parameters) */
+int buildQueryResponse(struct clientconn *cc, int eof)
+{
+	static struct textbuf body;
+	struct querypat q[MAX_QUERY_PATTERNS];
+	struct histquery hq;
+	char *e, *p, *t, *sp, *hp, all[] = "/*";
+	const char *err;
+	int n, len, ok;
+
+	cc->req[cc->reqlen] = '\0';
+	cc->http = !strncmp(cc->req, "GET ", 4);
+	if (cc->http) {
+		e = strstr(cc->req, "\r\n\r\n");
+		len = e != NULL ? e - cc->req + 4 : 0;
+		if (e == NULL && (e = strstr(cc->req, "\n\n")) != NULL)
+			len = e - cc->req + 2;
+		if (e == NULL)
+			return 0;
+		*e = '\0';
+		p = cc->req + 4;
+		t = strchr(p, ' ');
+		if (t != NULL)
+			*t++ = '\0';
+		cc->keep = t != NULL && !strncmp(t, "HTTP/1.1", 8);
+		if (t != NULL && strcasestr(t, "\nConnection: close"))
+			cc->keep = 0;
+		else if (t != NULL && strcasestr(t, "\nConnection: keep-alive"))
+			cc->keep = 1;
+		hp = strchr(p, '?');
+		if (hp != NULL) {
+			*hp++ = '\0';
+			urlDecode(hp);
+		}
+		urlDecode(p);
+		if (!strcmp(p, "/"))
+			p = all;
+	} else {
+		e = cc->req;
+		while ((e = strchr(e, '\n')) != NULL)
+			if (*++e == '\n' || (e[0] == '\r' && e[1] == '\n'))
+				break;
+		if (cc->req[0] == '\n' || cc->req[0] == '\r')
+			e = cc->req;
+		/* nothing but whitespace left when client closed */
+		if (e == NULL && (!eof || !cc->req[strspn(cc->req, " \t\r\n")]))
+			return 0;
+		len = e != NULL ? e - cc->req + (*e == '\r' ? 2 : 1) : cc->reqlen;
+		if (e != NULL)
+			*e = '\0';
+		cc->keep = !eof;
+		p = cc->req;
+		hp = NULL;
+		if (!strncmp(p, TXTCMD_HISTORY, strlen(TXTCMD_HISTORY)) &&
+		    strchr(" \r\n", p[strlen(TXTCMD_HISTORY)])) {
+			hp = p + strlen(TXTCMD_HISTORY);
+			p = hp + strcspn(hp, "\n");
+			if (*p)
+				*p++ = '\0';
+		}
+	}
+
+	/* same pattern handling for both */
+	ok = 1;
+	err = "invalid pattern";
+	if (hp != NULL) {
+		ok = !parseHistory(hp, cc->http ? "&" : " \r", &hq);
+		err = "invalid history parameters";
+		/* raw samples may still be read from store */
+		if (ok && histpool == NULL && !(storerun && hq.level < 0)) {
+			ok = 0;
+			err = "history disabled";
+		}
+	}
+	n = 0;
+	for(t = strtok_r(p, cc->http ? ";" : "\r\n", &sp); t != NULL && ok;
+	    t = strtok_r(NULL, cc->http ? ";" : "\r\n", &sp))
+		ok = n < MAX_QUERY_PATTERNS && !parsePattern(t, &q[n++]);
+	if (!n)
+		parsePattern("/*", &q[n++]);
+	body.len = 0;
+	cc->out.len = 0;
+	cc->outpos = 0;
+	if (cc->http) {
+		if (ok) {
+			textPrintf(&body, "{");
+			if (hp != NULL)
+				queryHistory(&body, q, n, &hq, 1);
+			else
+				querySensors(&body, q, n, 1);
+			textPrintf(&body, "}\n");
+		} else
+			textPrintf(&body, "{\"error\":\"%s\"}\n", err);
+		textPrintf(&cc->out, "HTTP/1.1 %s\r\n"
+			   "Content-Type: application/json\r\n"
+			   "Content-Length: %zu\r\n"
+			   "Connection: %s\r\n\r\n%s",
+			   ok ? "200 OK" : "400 Bad Request", body.len,
+			   cc->keep ? "keep-alive" : "close", body.data);
+		if (body.size > CLIENT_OUT_KEEP) {
+			/* do not hold memory of large response */
+			free(body.data);
+			memset(&body, 0, sizeof(body));
+		}
+	} else {
+#ifdef BUILDSTAMP
+		textPrintf(&cc->out, "#INFO: %s build %s\n", BANNER, BUILDSTAMP);
+#else
+		textPrintf(&cc->out, "#INFO: %s\n", BANNER);
+#endif
+		if (ok) {
+			textPrintf(&cc->out, "#%s\n", TXTMSG_HDR);
+			if (hp != NULL)
+				queryHistory(&cc->out, q, n, &hq, 0);
+			else
+				querySensors(&cc->out, q, n, 0);
+			textPrintf(&cc->out, "#%s\n", TXTMSG_EOT);
+		} else
+			textPrintf(&cc->out, "#%s %s\n", TXTMSG_ERR, err);
+	}
+	return len;
+}
+
+/* Handle client connection event */
+/* (message is sent without blocking, query requests are answered */
+/* one by one and keep-alive connection waits for next one) */
+void serveClient(struct clientconn *cc, unsigned int events)
+{
+	struct epoll_event ev;
+	struct textbuf *out;
+	int n, len, eof;
 
+	if (cc->fd < 0)
+		return;
+	if (events & EPOLLERR) {
+		closeClient(cc);
+		return;
+	}
+	eof = 0;
 	for(;;) {
-		sem_wait(&sensem);
-		for(i = 0; i < MAX_SENSORS; i++) {
-			s = &senstbl[i];
-			if (s->bus == SB_I2C) {
-				c = (struct i2centry *)(s->data);
-				if (s->type == ST_I2C_HTU21D) {
-					gettimeofday(&ts, NULL);
-					v0 = HTU21D_getHumidity(c->fd);
-					v1 = HTU21D_getTemperature(c->fd);
-					if (v0 < 0.0 || v0 > 100.0 ||
-					    v1 < -40.0 || v1 > 125.0)
-						continue;
-					s->tsec = ts.tv_sec;
-					s->tmsec = ts.tv_usec / 1000;
-					dht2 = (struct datahtu21d *)(s->data);
-					dht2->humid.cur = v0;
-					dht2->humid.min = MIN(v0, dht2->humid.min);
-					dht2->humid.max = MAX(v0, dht2->humid.max);
-					dht2->temp.cur = v1;
-					dht2->temp.min = MIN(v1, dht2->temp.min);
-					dht2->temp.max = MAX(v1, dht2->temp.max);
-					if (debugflag)
-						logprintf(logfd, LOG_DEBUG,
-							  "sensor \"%s\" [%d] read complete (h=%.1lf, t=%.1lf)\n",
-							  s->label, i, v0, v1);
-				} else if (s->type == ST_I2C_BMP180) {
-					gettimeofday(&ts, NULL);
-					v0 = BMP180_getPressureFP(c->fd, BMP180_OSS_MODE_UHR, &v1);
-					if (v0 < 300.0 || v0 > 1100.0 ||
-					    v1 < -40.0 || v1 > 85.0)
-						continue;
-					s->tsec = ts.tv_sec;
-					s->tmsec = ts.tv_usec / 1000;
-					dbm1 = (struct databmp180 *)(s->data);
-					dbm1->press.cur = v0;
-					dbm1->press.min = MIN(v0, dbm1->press.min);
-					dbm1->press.max = MAX(v0, dbm1->press.max);
-					dbm1->temp.cur = v1;
-					dbm1->temp.min = MIN(v1, dbm1->temp.min);
-					dbm1->temp.max = MAX(v1, dbm1->temp.max);
-					if (debugflag)
-						logprintf(logfd, LOG_DEBUG,
-							  "sensor \"%s\" [%d] read complete (p=%.1lf, t=%.1lf)\n",
-							  s->label, i, v0, v1);
-				} else if (s->type == ST_I2C_BH1750) {
-					gettimeofday(&ts, NULL);
-					v0 = BH1750_getLx(c->fd);
-					if (v0 < 0.0)
-						continue;
-					s->tsec = ts.tv_sec;
-					s->tmsec = ts.tv_usec / 1000;
-					dbh1 = (struct databh1750 *)(s->data);
-					dbh1->light.cur = v0;
-					dbh1->light.min = MIN(v0, dbh1->light.min);
-					dbh1->light.max = MAX(v0, dbh1->light.max);
-					if (debugflag)
-						logprintf(logfd, LOG_DEBUG,
-							  "sensor \"%s\" [%d] read complete (l=%.1lf)\n",
-							  s->label, i, v0);
-				} else if (s->type == ST_I2C_BME280) {
-					gettimeofday(&ts, NULL);
-					BME280_setupFullMode(c->fd);	/* required for forced mode */
-					if (BME280_getSensorData(c->fd, &v0, &v1, &v2))
-						continue;
-					s->tsec = ts.tv_sec;
-					s->tmsec = ts.tv_usec / 1000;
-					dbm2 = (struct databme280 *)(s->data);
-					dbm2->temp.cur = v0;
-					dbm2->temp.min = MIN(v0, dbm2->temp.min);
-					dbm2->temp.max = MAX(v0, dbm2->temp.max);
-					dbm2->press.cur = v1;
-					dbm2->press.min = MIN(v1, dbm2->press.min);
-					dbm2->press.max = MAX(v1, dbm2->press.max);
-					dbm2->humid.cur = v2;
-					dbm2->humid.min = MIN(v2, dbm2->humid.min);
-					dbm2->humid.max = MAX(v2, dbm2->humid.max);
-					if (debugflag)
-						logprintf(logfd, LOG_DEBUG,
-							  "sensor \"%s\" [%d] read complete (p=%.1lf, t=%.1lf, h=%.1lf)\n",
-							  s->label, i, v1, v0, v2);
+		/* shared message or own query response */
+		out = cc->snap != NULL ? &cc->snap->buf : &cc->out;
+		while (cc->outpos < out->len) {
+			n = send(cc->fd, out->data + cc->outpos,
+				 out->len - cc->outpos, MSG_NOSIGNAL | MSG_DONTWAIT);
+			if (n == -1) {
+				if (errno == EINTR)
+					continue;
+				if (errno != EAGAIN && errno != EWOULDBLOCK) {
+					logprintf(logfd, LOG_WARN,
+						  "client [%d] write error\n", cc->fd);
+					closeClient(cc);
+					return;
+				}
+				if (!cc->pollout) {
+					memset(&ev, 0, sizeof(ev));
+					ev.events = EPOLLOUT;
+					ev.data.u64 = clientEpollData(cc);
+					epoll_ctl(epfd, EPOLL_CTL_MOD, cc->fd, &ev);
+					cc->pollout = 1;
 				}
+				return;		/* wait for EPOLLOUT */
 			}
+			cc->outpos += n;
 		}
-		sem_post(&sensem);
-		sleep(i2cdelay);
+		if (out->len) {
+			if (cc->snap != NULL)
+				snapshotRelease(cc);
+			else if (cc->out.size > CLIENT_OUT_KEEP) {
+				/* do not hold memory of large response */
+				free(cc->out.data);
+				memset(&cc->out, 0, sizeof(cc->out));
+			}
+			cc->out.len = 0;
+			cc->outpos = 0;
+			if (!cc->keep) {
+				closeClient(cc);
+				return;
+			}
+		}
+		if (cc->pollout) {
+			memset(&ev, 0, sizeof(ev));
+			ev.events = EPOLLIN | EPOLLRDHUP;
+			ev.data.u64 = clientEpollData(cc);
+			epoll_ctl(epfd, EPOLL_CTL_MOD, cc->fd, &ev);
+			cc->pollout = 0;
+		}
+
+		/* next request may be buffered already */
+		len = cc->query ? buildQueryResponse(cc, eof) : 0;
+		if (len) {
+			cc->reqlen -= len;
+			memmove(cc->req, cc->req + len, cc->reqlen);
+			continue;
+		}
+		if (eof || cc->reqlen >= QUERY_REQ_SIZE - 1) {
+			closeClient(cc);
+			return;
+		}
+		n = recv(cc->fd, cc->req + cc->reqlen,
+			 QUERY_REQ_SIZE - 1 - cc->reqlen, MSG_DONTWAIT);
+		if (n == -1 && (errno == EAGAIN || errno == EINTR))
+			return;
+		if (n <= 0)
+			eof = 1;
+		else
+			cc->reqlen += n;
+	}
+}
+
+/* Accept client (query: query client) connections, oldest one is */
+/* dropped when table is full */
+void acceptClients(int query)
+{
+	int i, j, fd;
+	struct sockaddr_in sin;
+	socklen_t slen;
+	struct epoll_event ev;
+	struct clientconn *cc;
+	struct snapshot *sn;
+
+	for(;;) {
+		slen = sizeof(sin);
+		fd = accept4(query ? qryfd : srvfd, (struct sockaddr *)&sin, &slen,
+			     SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd == -1) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			return;
+		}
+		j = 0;
+		for(i = 0; i < MAX_CLIENT_CONNS; i++) {
+			if (clconns[i].fd == -1)
+				break;
+			if (clconns[i].since < clconns[j].since)
+				j = i;
+		}
+		if (i == MAX_CLIENT_CONNS) {
+			closeClient(&clconns[j]);
+			i = j;
+		}
+		cc = &clconns[i];
+		cc->gen = ++clgen;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN | EPOLLRDHUP;
+		ev.data.u64 = clientEpollData(cc);
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+			close(fd);
+			continue;
+		}
+		logprintf(logfd, LOG_INFO,
+			  "client %s [%d] connected successfully\n",
+			  inet_ntoa(sin.sin_addr), fd);
+		cc->fd = fd;
+		cc->since = time(NULL);
+		cc->query = query;
+		cc->reqlen = 0;
+		cc->out.len = 0;
+		cc->outpos = 0;
+		cc->pollout = 0;
+		if (query)
+			continue;
+
+		/* sensor list is sent at once and connection is closed, */
+		/* clients share message formatted since last change */
+		cc->keep = 0;
+		sn = formatMessage();
+		if (sn == NULL) {
+			closeClient(cc);
+			continue;
+		}
+		if (debugflag)
+			logprintf(logfd, LOG_DEBUG,
+				  "sending message to client [%d], %zu bytes\n", fd,
+				  sn->buf.len);
+		cc->snap = sn;
+		sn->refs++;
+		serveClient(cc, 0);
 	}
 }
 
@@ -977,9 +3104,9 @@ void *i2cSensorThread(void *arg)
 /* ************************* */
 
 /* Sensor initialization */
-int initHTU21D(int idx)
+int initHTU21D(void)
 {
-	int fd;
+	int fd, idx;
 	struct timeval ts;
         struct sensorentry *s;
 	struct datahtu21d *dht2;
@@ -1000,12 +3127,17 @@ int initHTU21D(int idx)
 	} while (h < 0.0 || h > 100.0 || t < -40.0 || t > 125.0);
 
 	gettimeofday(&ts, NULL);
+	sem_wait(&sensem);
+	idx = sensorEntryNew(SB_I2C, ST_I2C_HTU21D, HTU21D_I2C_ADDR);
+	if (idx < 0) {
+		sem_post(&sensem);
+		close(fd);
+		return -1;
+	}
 	s = &senstbl[idx];
 	s->tsec = ts.tv_sec;
 	s->tmsec = ts.tv_usec / 1000;
-	s->interval = i2cdelay * 1000;
-	s->bus = SB_I2C;
-	s->type = ST_I2C_HTU21D;
+	s->interval = i2cint[ST_I2C_HTU21D] * 1000;
 	strncpy(s->label, SL_HTU21D, SENSOR_LABEL);
 	s->data = malloc(sizeof(struct datahtu21d));
 	dht2 = (struct datahtu21d *)(s->data);
@@ -1020,13 +3152,16 @@ int initHTU21D(int idx)
 	dht2->temp.min = t;
 	dht2->temp.max = t;
 	strncpy(dht2->temp.unit, "C", UNIT_LABEL);
+	storeRestoreSensor(idx);
+	sensorExpiryUpdate(idx);
+	sem_post(&sensem);
 
-	return fd;
+	return idx;
 }
 
-int initBMP180(int idx)
+int initBMP180(void)
 {
-	int fd;
+	int fd, idx;
 	struct timeval ts;
         struct sensorentry *s;
 	struct databmp180 *dbm1;
@@ -1050,12 +3185,17 @@ int initBMP180(int idx)
 	p = BMP180_getPressureFP(fd, BMP180_OSS_MODE_UHR, &t);
 
 	gettimeofday(&ts, NULL);
+	sem_wait(&sensem);
+	idx = sensorEntryNew(SB_I2C, ST_I2C_BMP180, BMP180_I2C_ADDR);
+	if (idx < 0) {
+		sem_post(&sensem);
+		close(fd);
+		return -1;
+	}
 	s = &senstbl[idx];
 	s->tsec = ts.tv_sec;
 	s->tmsec = ts.tv_usec / 1000;
-	s->interval = i2cdelay * 1000;
-	s->bus = SB_I2C;
-	s->type = ST_I2C_BMP180;
+	s->interval = i2cint[ST_I2C_BMP180] * 1000;
 	strncpy(s->label, SL_BMP180, SENSOR_LABEL);
 	s->data = malloc(sizeof(struct databmp180));
 	dbm1 = (struct databmp180 *)(s->data);
@@ -1070,13 +3210,16 @@ int initBMP180(int idx)
 	dbm1->temp.min = t;
 	dbm1->temp.max = t;
 	strncpy(dbm1->temp.unit, "C", UNIT_LABEL);
+	storeRestoreSensor(idx);
+	sensorExpiryUpdate(idx);
+	sem_post(&sensem);
 
-	return fd;
+	return idx;
 }
 
-int initBH1750(int idx)
+int initBH1750(void)
 {
-	int fd;
+	int fd, idx;
 	struct timeval ts;
         struct sensorentry *s;
 	struct databh1750 *dbh1;
@@ -1095,12 +3238,17 @@ int initBH1750(int idx)
 	l = BH1750_getLx(fd);
 
 	gettimeofday(&ts, NULL);
+	sem_wait(&sensem);
+	idx = sensorEntryNew(SB_I2C, ST_I2C_BH1750, BH1750_I2C_ADDR);
+	if (idx < 0) {
+		sem_post(&sensem);
+		close(fd);
+		return -1;
+	}
 	s = &senstbl[idx];
 	s->tsec = ts.tv_sec;
 	s->tmsec = ts.tv_usec / 1000;
-	s->interval = i2cdelay * 1000;
-	s->bus = SB_I2C;
-	s->type = ST_I2C_BH1750;
+	s->interval = i2cint[ST_I2C_BH1750] * 1000;
 	strncpy(s->label, SL_BH1750, SENSOR_LABEL);
 	s->data = malloc(sizeof(struct databh1750));
 	dbh1 = (struct databh1750 *)(s->data);
@@ -1111,13 +3259,16 @@ int initBH1750(int idx)
 	dbh1->light.min = l;
 	dbh1->light.max = l;
 	strncpy(dbh1->light.unit, "lx", UNIT_LABEL);
+	storeRestoreSensor(idx);
+	sensorExpiryUpdate(idx);
+	sem_post(&sensem);
 
-	return fd;
+	return idx;
 }
 
-int initBME280(int idx, int alt)
+int initBME280(int alt)
 {
-	int fd, id;
+	int fd, id, idx;
 	struct timeval ts;
         struct sensorentry *s;
 	struct databme280 *dbm2;
@@ -1151,12 +3302,17 @@ int initBME280(int idx, int alt)
 		return -3;
 
 	gettimeofday(&ts, NULL);
+	sem_wait(&sensem);
+	idx = sensorEntryNew(SB_I2C, ST_I2C_BME280, id);
+	if (idx < 0) {
+		sem_post(&sensem);
+		close(fd);
+		return -1;
+	}
 	s = &senstbl[idx];
 	s->tsec = ts.tv_sec;
 	s->tmsec = ts.tv_usec / 1000;
-	s->interval = i2cdelay * 1000;
-	s->bus = SB_I2C;
-	s->type = ST_I2C_BME280;
+	s->interval = i2cint[ST_I2C_BME280] * 1000;
 	strncpy(s->label, SL_BME280, SENSOR_LABEL);
 	s->data = malloc(sizeof(struct databme280));
 	dbm2 = (struct databme280 *)(s->data);
@@ -1175,8 +3331,36 @@ int initBME280(int idx, int alt)
 	dbm2->humid.min = h;
 	dbm2->humid.max = h;
 	strncpy(dbm2->humid.unit, "%", UNIT_LABEL);
+	storeRestoreSensor(idx);
+	sensorExpiryUpdate(idx);
+	sem_post(&sensem);
 
-	return fd;
+	return idx;
+}
+
+/* Parse per-type I2C intervals ("type=seconds[,type=seconds...]"), */
+/* returns 0 on success */
+int parseI2CIntervals(const char *arg)
+{
+	char label[SENSOR_LABEL];
+	int i, t, l;
+
+	while (*arg) {
+		if (sscanf(arg, "%15[^=,]=%d%n", label, &t, &l) != 2 || t <= 0)
+			return -1;
+		for(i = ST_I2C_HTU21D; i <= ST_I2C_BME280; i++)
+			if (!strcmp(label, i2clabel[i]))
+				break;
+		if (i > ST_I2C_BME280)
+			return -1;
+		i2cint[i] = t;
+		arg += l;
+		if (*arg == ',')
+			arg++;
+		else if (*arg)
+			return -1;
+	}
+	return 0;
 }
 
 /* ************ */
@@ -1187,17 +3371,22 @@ int initBME280(int idx, int alt)
 
 int main(int argc, char *argv[])
 {
-	char msgbuf[BUFFER_SIZE + 1];
-	int opt;
-	int srvport, radport;
-	struct sockaddr_in srvsin, clin;
+	int opt, i, n;
+	int srvport, radport, subport, qryport;
+	struct sockaddr_in srvsin;
 	int pidfd;
 	struct sigaction sa;
+	struct epoll_event ev, evs[MAX_EPOLL_EVENTS];
+	unsigned int tag;
+	eventfd_t expcnt;
+	long long wait;
 	int radflag, idx, ena;
-	int clfd, clen, len;
 	uid_t uid;
 	gid_t gid;
 	char username[MAX_USERNAME + 1];
+	char mcaddr[INET_ADDRSTRLEN];
+	char *p;
+	long long t0;
 
 	/* get process name */
 	strncpy(progname, basename(argv[0]), PATH_MAX);
@@ -1210,8 +3399,19 @@ int main(int argc, char *argv[])
 	logfd = -1;
 	srvfd = -1;
 	radfd = -1;
+	subfd = -1;
+	qryfd = -1;
+	for(i = 0; i < MAX_CLIENT_CONNS; i++)
+		clconns[i].fd = -1;
+	radlastts = 0;
+	radmcport = 0;
 	netclrun = 0;
 	i2ctrun = 0;
+	subtrun = 0;
+	i2cbusy = 0;
+	memset(sensdirty, SD_RESPONSE | SD_PUSH, MAX_SENSORS);	/* format all first */
+	senstblver = 1;
+	respver = 0;
 	mrstflag = 0;
 	rdelflag = 0;
 
@@ -1219,11 +3419,21 @@ int main(int argc, char *argv[])
 	debugflag = 0;
 	radflag = 0;
 	i2cdelay = 0;
+	memset(i2cint, 0, sizeof(i2cint));
 	memset(username, 0, MAX_USERNAME + 1);
 	memset((char *)&srvsin, 0, sizeof(srvsin));
 	srvsin.sin_family = AF_INET;
 	inet_aton(SERVER_ADDR, &srvsin.sin_addr);
 	srvport = SERVER_PORT;
+	subport = 0;
+	qryport = 0;
+	pushint = PUSH_INTERVAL_MS;
+	histkb = HISTORY_MEM_KB;
+	storedir[0] = 0;
+	storesize = STORE_SEGMENT_MB;
+	storesegs = STORE_SEGMENTS;
+	storerun = 0;
+	storestop = 0;
 	memset((char *)&radsin, 0, sizeof(radsin));
 	radsin.sin_family = AF_INET;
 	radport = 0;
@@ -1233,13 +3443,19 @@ int main(int argc, char *argv[])
 	strcat(pidfname, progname);
 	strcat(pidfname, ".pid");
 
-	while((opt = getopt(argc, argv, "du:i:l:P:r:t:h:p:V")) != -1) {
+	while((opt = getopt(argc, argv, "du:i:I:l:P:r:t:m:s:h:p:S:c:q:H:J:V")) != -1) {
 		if (opt == 'd')
 			debugflag = 1;
 		else if (opt == 'u')
 			strncpy(username, optarg, MAX_USERNAME);
 		else if (opt == 'i')
 			sscanf(optarg, "%d", &i2cdelay);
+		else if (opt == 'I') {
+			if (parseI2CIntervals(optarg)) {
+				dprintf(STDERR_FILENO, "Invalid I2C interval specification.\n");
+				exit(EXIT_FAILURE);
+			}
+		}
 		else if (opt == 'l')
 			strncpy(logfname, optarg, PATH_MAX);
 		else if (opt == 'P')
@@ -1255,6 +3471,22 @@ int main(int argc, char *argv[])
 		}
 		else if (opt == 't')
 			sscanf(optarg, "%d", &radport);
+		else if (opt == 'm') {
+			if (sscanf(optarg, "%15[0-9.]:%d", mcaddr, &radmcport) != 2 ||
+			    !inet_aton(mcaddr, &radmcgroup) ||
+			    !IN_MULTICAST(ntohl(radmcgroup.s_addr))) {
+				dprintf(STDERR_FILENO, "Invalid multicast group specification.\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if (opt == 's') {
+			if (optarg[0] != '/' ||
+			    strlen(optarg) >= sizeof(radshmname)) {
+				dprintf(STDERR_FILENO, "Invalid shared memory name (must be /name).\n");
+				exit(EXIT_FAILURE);
+			}
+			strcpy(radshmname, optarg);
+		}
 		else if (opt == 'h') {
 			if (!inet_aton(optarg, &srvsin.sin_addr)) {
 				dprintf(STDERR_FILENO, "Invalid IPv4 address specification.\n");
@@ -1263,6 +3495,33 @@ int main(int argc, char *argv[])
 		}
 		else if (opt == 'p')
 			sscanf(optarg, "%d", &srvport);
+		else if (opt == 'S')
+			sscanf(optarg, "%d", &subport);
+		else if (opt == 'q')
+			sscanf(optarg, "%d", &qryport);
+		else if (opt == 'c') {
+			if (sscanf(optarg, "%d", &pushint) != 1 || pushint <= 0) {
+				dprintf(STDERR_FILENO, "Invalid push interval.\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if (opt == 'H') {
+			if (sscanf(optarg, "%d", &histkb) != 1 || histkb < 0) {
+				dprintf(STDERR_FILENO, "Invalid history memory size.\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if (opt == 'J') {
+			strncpy(storedir, optarg, PATH_MAX);
+			if ((p = strchr(storedir, ':')) != NULL) {
+				*p = 0;
+				sscanf(p + 1, "%d:%d", &storesize, &storesegs);
+			}
+			if (storedir[0] != '/') {
+				dprintf(STDERR_FILENO, "Invalid store directory (must be absolute).\n");
+				exit(EXIT_FAILURE);
+			}
+		}
 		else if (opt == 'V') {
 			verShow();
 			exit(EXIT_SUCCESS);
@@ -1295,29 +3554,59 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
+	if (radport && radmcport) {
+		dprintf(STDERR_FILENO, "Flags -r and -m are mutually exclusive.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if ((radport || radmcport) && radshmname[0]) {
+		dprintf(STDERR_FILENO, "Flag -s excludes -r and -m.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for(i = ST_I2C_HTU21D; i <= ST_I2C_BME280; i++) {
+		if (i2cint[i] && !i2cdelay) {
+			dprintf(STDERR_FILENO, "Flag -I requires -i.\n");
+			exit(EXIT_FAILURE);
+		}
+		if (!i2cint[i])
+			i2cint[i] = i2cdelay;
+	}
+
+	if (radmcport)
+		radflag = 2;
+	else if (radshmname[0])
+		radflag = 3;
+
 	if (!radflag && !i2cdelay) {
 		dprintf(STDERR_FILENO, "No sensor data source selected, specify at least one (radio daemon, I2C or both).\n");
 		exit(EXIT_FAILURE);
 	}
 
+	if (!qryport)
+		histkb = 0;	/* history is available only to queries */
+
+	if (storesize < 1 || storesize > 1024 || storesegs < 0) {
+		dprintf(STDERR_FILENO, "Invalid store specification (segment size 1-1024 MB).\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if ((subport && subport == srvport) || (qryport && qryport == srvport) ||
+	    (subport && subport == qryport)) {
+		dprintf(STDERR_FILENO, "Server, subscription and query ports must differ.\n");
+		exit(EXIT_FAILURE);
+	}
+
 	srvsin.sin_port = htons(srvport);
 	radsin.sin_port = htons(radport);
 
 	/* initialize log */
-	if (debugflag)
-		logfd = STDOUT_FILENO;
-	else {
-		if (logfname[0]) {
-			logfd = open(logfname, O_CREAT | O_APPEND | O_SYNC | O_WRONLY, FILE_UMASK);
-			if (logfd == -1) {
-				dprintf(STDERR_FILENO, "Unable to open log file '%s': %s\n",
-					logfname, strerror(errno));
-				exit(EXIT_FAILURE);
-			}
-		} else
-			logfd = -1;
+	logfd = DaemonLog_open(progname, logfname, debugflag);
+	if (logfd == -2) {
+		dprintf(STDERR_FILENO, "Unable to open log file '%s': %s\n",
+			logfname, strerror(errno));
+		exit(EXIT_FAILURE);
 	}
-	sem_init(&logsem, 0, 1);
 
 	/* change scheduling priority */
 	if (changeSched()) {
@@ -1338,7 +3627,7 @@ int main(int argc, char *argv[])
 #endif
 
 	/* show UID/GID */
-	logprintf(logfd, LOG_NOTICE, "running as UID=%ld GID=%ld\n", uid, gid);
+	logprintf(logfd, LOG_NOTICE, "running as UID=%ld GID=%ld\n", (long)uid, (long)gid);
 
 	/* check if pid file exists */
 	pidfd = open(pidfname, O_PATH, FILE_UMASK);
@@ -1350,7 +3639,7 @@ int main(int argc, char *argv[])
 		if (!debugflag)
 			logprintf(logfd, LOG_ERROR, "unable to create PID file %s: %s\n",
 				  pidfname, strerror(errno));
-		close(logfd);
+		DaemonLog_close();
 		exit(EXIT_FAILURE);
 	}
 
@@ -1361,7 +3650,7 @@ int main(int argc, char *argv[])
 				strerror(errno));
 			logprintf(logfd, LOG_ERROR, "unable to fork to background: %s\n",
 				  strerror(errno));
-			close(logfd);
+			DaemonLog_close();
 			exit(EXIT_FAILURE);
 		} else {
 			procpid = getpid();
@@ -1369,6 +3658,10 @@ int main(int argc, char *argv[])
 				  procpid);
 		}
 
+	/* start log writer (threads do not survive fork) */
+	if (DaemonLog_start())
+		logprintf(logfd, LOG_WARN, "unable to start log writer thread\n");
+
 	/* populate pid file (new PID after daemonize()) */
 	pidfd = open(pidfname, O_CREAT | O_WRONLY, FILE_UMASK);
 	if (pidfd < 0) {
@@ -1398,7 +3691,7 @@ int main(int argc, char *argv[])
 	sigaction(SIGUSR2, &sa, NULL);
 
 	/* setup proxy server */
-	srvfd = socket(AF_INET, SOCK_STREAM, 0);
+	srvfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
 	if (srvfd == -1) {
 		if (!debugflag)
 			logprintf(logfd, LOG_ERROR, "unable to create server socket: %s\n",
@@ -1446,16 +3739,129 @@ int main(int argc, char *argv[])
 				strerror(errno));
 		endProcess(EXIT_FAILURE);
 	}
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd == -1) {
+		if (!debugflag)
+			logprintf(logfd, LOG_ERROR, "unable to create epoll instance: %s\n",
+				  strerror(errno));
+		else
+			dprintf(STDERR_FILENO, "Unable to create epoll instance: %s\n",
+				strerror(errno));
+		endProcess(EXIT_FAILURE);
+	}
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u32 = EPOLL_TAG_SERVER;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, srvfd, &ev);
+	expfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (expfd == -1) {
+		if (!debugflag)
+			logprintf(logfd, LOG_ERROR, "unable to create eventfd: %s\n",
+				  strerror(errno));
+		else
+			dprintf(STDERR_FILENO, "Unable to create eventfd: %s\n",
+				strerror(errno));
+		endProcess(EXIT_FAILURE);
+	}
+	ev.data.u32 = EPOLL_TAG_EXPIRY;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, expfd, &ev);
 	logprintf(logfd, LOG_NOTICE, "accepting client TCP connections on %s port %d\n",
 		  inet_ntoa(srvsin.sin_addr), srvport);
 
-	/* initialize sensor list */
-	memset(senstbl, 0, MAX_SENSORS * sizeof(struct sensorentry));
+	/* setup subscription server (optional) */
+	if (subport) {
+		srvsin.sin_port = htons(subport);
+		subfd = socket(AF_INET, SOCK_STREAM, 0);
+		if (subfd == -1 ||
+		    setsockopt(subfd, SOL_SOCKET, SO_REUSEADDR, &ena, sizeof(int)) == -1 ||
+		    bind(subfd, (struct sockaddr *)&srvsin, sizeof(srvsin)) == -1 ||
+		    listen(subfd, MAX_CLNT_QUEUE) == -1) {
+			if (!debugflag)
+				logprintf(logfd, LOG_ERROR, "unable to setup subscription socket: %s\n",
+					  strerror(errno));
+			else
+				dprintf(STDERR_FILENO, "Unable to setup subscription socket: %s\n",
+					strerror(errno));
+			endProcess(EXIT_FAILURE);
+		}
+		logprintf(logfd, LOG_NOTICE, "accepting subscribers on %s port %d (push interval %d ms)\n",
+			  inet_ntoa(srvsin.sin_addr), subport, pushint);
+	}
+
+	/* setup query server (optional) */
+	if (qryport) {
+		srvsin.sin_port = htons(qryport);
+		qryfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.u32 = EPOLL_TAG_QUERY;
+		if (qryfd == -1 ||
+		    setsockopt(qryfd, SOL_SOCKET, SO_REUSEADDR, &ena, sizeof(int)) == -1 ||
+		    bind(qryfd, (struct sockaddr *)&srvsin, sizeof(srvsin)) == -1 ||
+		    listen(qryfd, MAX_CLNT_QUEUE) == -1 ||
+		    epoll_ctl(epfd, EPOLL_CTL_ADD, qryfd, &ev) == -1) {
+			if (!debugflag)
+				logprintf(logfd, LOG_ERROR, "unable to setup query socket: %s\n",
+					  strerror(errno));
+			else
+				dprintf(STDERR_FILENO, "Unable to setup query socket: %s\n",
+					strerror(errno));
+			endProcess(EXIT_FAILURE);
+		}
+		logprintf(logfd, LOG_NOTICE, "accepting queries on %s port %d\n",
+			  inet_ntoa(srvsin.sin_addr), qryport);
+	}
+
+	/* initialize sensor list and history */
+	sensorTableInit();
 	sem_init(&sensem, 0, 1);
+	if (historyInit()) {
+		if (!debugflag)
+			logprintf(logfd, LOG_ERROR, "unable to allocate history memory\n");
+		else
+			dprintf(STDERR_FILENO, "Unable to allocate history memory.\n");
+		endProcess(EXIT_FAILURE);
+	}
+
+	/* restore latest values and start store writer (optional, before */
+	/* any sensor is added) */
+	if (storedir[0]) {
+		if (SensorStore_open(&store, storedir,
+				     storesize * (1048576ULL / SENSORSTORE_RECSIZE),
+				     storesegs)) {
+			if (!debugflag)
+				logprintf(logfd, LOG_ERROR, "unable to use store directory %s: %s\n",
+					  storedir, strerror(errno));
+			else
+				dprintf(STDERR_FILENO, "Unable to use store directory %s: %s\n",
+					storedir, strerror(errno));
+			endProcess(EXIT_FAILURE);
+		}
+		t0 = monotonicMs();
+		if ((n = storeRestore()) < 0)
+			logprintf(logfd, LOG_WARN, "unable to read store: %s\n",
+				  strerror(errno));
+		else
+			logprintf(logfd, LOG_NOTICE, "restored %d sensor values from store in %lld ms\n",
+				  n, monotonicMs() - t0);
+		sem_init(&storesem, 0, 0);
+		if (pthread_create(&storethread, NULL, storeThread, NULL)) {
+			if (!debugflag)
+				logprintf(logfd, LOG_ERROR, "cannot start store writer thread\n");
+			else
+				dprintf(STDERR_FILENO, "Cannot start store writer thread.\n");
+			endProcess(EXIT_FAILURE);
+		}
+		storerun = 1;
+		logprintf(logfd, LOG_NOTICE, "appending samples to store in %s (%d MB segments, %d kept)\n",
+			  storedir, storesize, storesegs);
+	}
 
 	/* start network client thread (optional) */
 	if (radflag) {
-		if (pthread_create(&netcltthread, NULL, radioDaemonThread, NULL)) {
+		if (pthread_create(&netcltthread, NULL, radflag == 3 ? radioShmThread :
+				   radflag == 2 ? radioMcastThread : radioDaemonThread,
+				   NULL)) {
 			if (!debugflag)
 				logprintf(logfd, LOG_ERROR, "cannot start network client thread\n");
 			else
@@ -1467,69 +3873,74 @@ int main(int argc, char *argv[])
 
 	/* start I2C sensor read thread (optional) */
 	if (i2cdelay) {
-		idx = 0;
 		wiringPiSetupGpio();
-		if (initHTU21D(idx) >= 0) {
+		if ((idx = initHTU21D()) >= 0)
 			logprintf(logfd, LOG_NOTICE, "htu21d I2C sensor at %d,0x%02X [%d] added to monitor\n",
 				  RPI3I2C_BUS, HTU21D_I2C_ADDR, idx);
-			idx++;
-		}
-		if (initBMP180(idx) >= 0) {
+		if ((idx = initBMP180()) >= 0)
 			logprintf(logfd, LOG_NOTICE, "bmp180 I2C sensor at %d,0x%02X [%d] added to monitor\n",
 				  RPI3I2C_BUS, BMP180_I2C_ADDR, idx);
-			idx++;
-		} else if (initBME280(idx, 0) >= 0) {
+		else if ((idx = initBME280(0)) >= 0)
 			logprintf(logfd, LOG_NOTICE, "bme280 I2C sensor at %d,0x%02X [%d] added to monitor\n",
 				  RPI3I2C_BUS, BME280_I2C_DEF_ADDR, idx);
-			idx++;
-		}
-		if (initBME280(idx, 1) >= 0) {
+		if ((idx = initBME280(1)) >= 0)
 			logprintf(logfd, LOG_NOTICE, "bme280 I2C sensor at %d,0x%02X [%d] added to monitor\n",
 				  RPI3I2C_BUS, BME280_I2C_ALT_ADDR, idx);
-			idx++;
-		}
-		if (initBH1750(idx) >= 0) {
+		if ((idx = initBH1750()) >= 0)
 			logprintf(logfd, LOG_NOTICE, "bh1750 I2C sensor at %d,0x%02X [%d] added to monitor\n",
 				  RPI3I2C_BUS, BH1750_I2C_ADDR, idx);
-			idx++;
-		}
 		if (pthread_create(&i2cthread, NULL, i2cSensorThread, NULL)) {
 			logprintf(logfd, LOG_WARN, "cannot start I2C thread, skipping I2C devices\n");
-			memset(senstbl, 0, MAX_SENSORS * sizeof(struct sensorentry));
+			sem_wait(&sensem);
+			for(i = 0; i < MAX_SENSORS; i++)
+				if (senstbl[i].bus == SB_I2C)
+					sensorEntryDelete(i);
+			sem_post(&sensem);
 			i2cdelay = 0;
 		} else
 			i2ctrun = 1;
 	}
 
+	/* start subscription thread (optional) */
+	if (subport) {
+		if (pthread_create(&subthread, NULL, subscriberThread, NULL)) {
+			if (!debugflag)
+				logprintf(logfd, LOG_ERROR, "cannot start subscription thread\n");
+			else
+				dprintf(STDERR_FILENO, "Cannot start subscription thread.\n");
+			endProcess(EXIT_FAILURE);
+		}
+		subtrun = 1;
+	}
+
 	/* function loop - never ends, send signal to exit */
+	/* (clients are served concurrently by single epoll loop, */
+	/* sensors are removed when their expiry is due) */
 	for(;;) {
-		/* clients are accepted, updated and disconnected immediately
-		 * one by one so listen backlog should be big enough to keep
-		 * them all in queue */
-		clen = sizeof(struct sockaddr_in);
-		clfd = accept(srvfd, (struct sockaddr *)&clin, &clen);
-		logprintf(logfd, LOG_INFO,
-			  "client %s [%d] connected successfully\n",
-			  inet_ntoa(clin.sin_addr), clfd);
-		if (rdelflag) {
-			sensorRadioRemoveAll();
-			rdelflag = 0;
-		}
-		sensorTableClean();
-		if (mrstflag) {
-			sensorResetMinMax();
-			mrstflag = 0;
+		sensorHousekeeping();
+		wait = sensorTableClean();
+		if (wait < 0 || wait > HOUSEKEEPING_MS)
+			wait = HOUSEKEEPING_MS;
+		n = epoll_wait(epfd, evs, MAX_EPOLL_EVENTS, wait);
+		if (n == -1) {
+			if (errno != EINTR)
+				logprintf(logfd, LOG_ERROR, "epoll_wait() failed: %s\n",
+					  strerror(errno));
+			continue;
 		}
-		len = formatMessage(msgbuf, BUFFER_SIZE);
-		if (debugflag)
-			logprintf(logfd, LOG_DEBUG,
-				  "sending message to client [%d], %d bytes\n", clfd, len);
-		if (send(clfd, msgbuf, len, MSG_NOSIGNAL) == -1) {
-			logprintf(logfd, LOG_WARN,
-				  "client [%d] write error\n", clfd);
+		for(i = 0; i < n; i++) {
+			tag = evs[i].data.u64 & 0xFFFFFFFF;
+			if (tag == EPOLL_TAG_SERVER)
+				acceptClients(0);
+			else if (tag == EPOLL_TAG_QUERY)
+				acceptClients(1);
+			else if (tag == EPOLL_TAG_EXPIRY)
+				eventfd_read(expfd, &expcnt);
+			else if (clconns[tag - EPOLL_TAG_CLIENT].gen ==
+				 evs[i].data.u64 >> 32)
+				/* stale if slot was reused within this batch */
+				serveClient(&clconns[tag - EPOLL_TAG_CLIENT],
+					    evs[i].events);
 		}
-		close(clfd);
-		logprintf(logfd, LOG_INFO,
-			  "client [%d] disconnected\n", clfd);
 	}
 }
@@ -0,0 +1,261 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define DEFAULT_HOST		"127.0.0.1"
+#define DEFAULT_PORT		5444
+#define DEFAULT_CLIENTS		32
+#define DEFAULT_DURATION_SEC	10
+#define SLOW_RCVBUF		1024	/* receive buffer of slow clients */
+#define RECV_CHUNK		65536
+#define MSG_END			"#END\n"
+
+extern char *optarg;
+extern int optind, opterr, optopt;
+
+struct loadclient {
+	int fd;
+	long long start;		/* request start (us) */
+	size_t len;			/* response bytes received */
+	char tail[sizeof(MSG_END)];	/* last bytes of response */
+};
+
+struct loadclient *clients;
+struct sockaddr_in srvsin;
+char *request;
+int reqlen, epfd;
+unsigned int *lat;		/* response times in us */
+size_t nlat, latsize;
+unsigned long errors, bytes;
+
+/* Show help */
+void help(char *progname)
+{
+	printf("\nUsage:\n\t%s [-r ipaddr] [-p tcpport] [-q patterns] [-n clients] [-s slow]\n"
+	       "\t\t[-d seconds]\n\n", progname);
+	puts("Where:");
+	puts("\t-r ipaddr   - IPv4 address of sensorproxy server (optional)");
+	printf("\t-p tcpport  - TCP port of sensorproxy server (optional, default %d)\n", DEFAULT_PORT);
+	puts("\t-q patterns - send query (patterns separated by ';', port must be query");
+	puts("\t              port), default is to read sensor list (optional)");
+	printf("\t-n clients  - clients requesting concurrently (optional, default %d)\n", DEFAULT_CLIENTS);
+	puts("\t-s slow     - additional clients that connect and never read (optional)");
+	printf("\t-d seconds  - test duration (optional, default %d)\n", DEFAULT_DURATION_SEC);
+	puts("\nEach client repeats request as soon as previous response is complete,");
+	puts("response time percentiles are reported at the end.\n");
+}
+
+/* Monotonic time in us */
+long long monotonicUs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/* Store response time sample */
+void addLatency(long long us)
+{
+	unsigned int *p;
+
+	if (nlat == latsize) {
+		latsize = latsize ? latsize * 2 : 65536;
+		p = realloc(lat, latsize * sizeof(*lat));
+		if (p == NULL) {
+			fputs("Out of memory for latency samples.\n", stderr);
+			exit(EXIT_FAILURE);
+		}
+		lat = p;
+	}
+	lat[nlat++] = us > 0xFFFFFFFFLL ? 0xFFFFFFFFU : us;
+}
+
+/* Open connection and start request, returns -1 on error */
+int clientStart(struct loadclient *c, int slow)
+{
+	struct epoll_event ev;
+	int rcvbuf;
+
+	c->fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (c->fd == -1)
+		return -1;
+	if (slow) {
+		rcvbuf = SLOW_RCVBUF;
+		setsockopt(c->fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+	}
+	c->start = monotonicUs();
+	c->len = 0;
+	memset(c->tail, 0, sizeof(c->tail));
+	if (connect(c->fd, (struct sockaddr *)&srvsin, sizeof(srvsin)) == -1) {
+		close(c->fd);
+		c->fd = -1;
+		return -1;
+	}
+	if (request != NULL) {
+		send(c->fd, request, reqlen, MSG_NOSIGNAL);
+		shutdown(c->fd, SHUT_WR);
+	}
+	if (slow)
+		return 0;
+	fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL) | O_NONBLOCK);
+	ev.events = EPOLLIN;
+	ev.data.ptr = c;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev);
+	return 0;
+}
+
+/* Read response, returns 1 when connection is finished */
+int clientRead(struct loadclient *c)
+{
+	char buf[RECV_CHUNK];
+	int n, l, t;
+
+	for(;;) {
+		n = recv(c->fd, buf, sizeof(buf), 0);
+		if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return 0;
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		/* keep last bytes to check message end */
+		l = sizeof(MSG_END) - 1;
+		if (n >= l)
+			memcpy(c->tail, buf + n - l, l);
+		else {
+			t = l - n;
+			memmove(c->tail, c->tail + n, t);
+			memcpy(c->tail + t, buf, n);
+		}
+		c->len += n;
+	}
+	if (!n && !strcmp(c->tail, MSG_END)) {
+		addLatency(monotonicUs() - c->start);
+		bytes += c->len;
+	} else
+		errors++;
+	epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	c->fd = -1;
+	return 1;
+}
+
+int cmpUint(const void *a, const void *b)
+{
+	unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* ********** */
+/* *  MAIN  * */
+/* ********** */
+
+int main(int argc, char *argv[])
+{
+	int opt, port, nclients, nslow, duration, i, n;
+	char *p;
+	struct epoll_event evs[64];
+	struct loadclient *c;
+	long long start, now;
+	double el;
+
+	/* get parameters */
+	memset((char *)&srvsin, 0, sizeof(srvsin));
+	srvsin.sin_family = AF_INET;
+	inet_aton(DEFAULT_HOST, &srvsin.sin_addr);
+	port = DEFAULT_PORT;
+	nclients = DEFAULT_CLIENTS;
+	nslow = 0;
+	duration = DEFAULT_DURATION_SEC;
+	request = NULL;
+	while((opt = getopt(argc, argv, "hr:p:q:n:s:d:")) != -1) {
+		if (opt == 'r') {
+			if (!inet_aton(optarg, &srvsin.sin_addr)) {
+				fputs("Invalid IPv4 address specification.\n", stderr);
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if (opt == 'p')
+			sscanf(optarg, "%d", &port);
+		else if (opt == 'q') {
+			/* one pattern per line */
+			reqlen = asprintf(&request, "%s\n", optarg);
+			for(p = request; (p = strchr(p, ';')) != NULL; p++)
+				*p = '\n';
+		}
+		else if (opt == 'n')
+			sscanf(optarg, "%d", &nclients);
+		else if (opt == 's')
+			sscanf(optarg, "%d", &nslow);
+		else if (opt == 'd')
+			sscanf(optarg, "%d", &duration);
+		else if (opt == '?' || opt == 'h') {
+			help(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (nclients < 1 || nslow < 0 || duration < 1 || reqlen < 0) {
+		help(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	srvsin.sin_port = htons(port);
+
+	clients = calloc(nclients + nslow, sizeof(*clients));
+	epfd = epoll_create1(0);
+	if (clients == NULL || epfd == -1) {
+		fprintf(stderr, "Unable to set up clients: %s\n", strerror (errno));
+		exit(EXIT_FAILURE);
+	}
+	/* slow clients stay connected with response stuck in server */
+	for(i = nclients; i < nclients + nslow; i++)
+		if (clientStart(&clients[i], 1) == -1) {
+			fprintf(stderr, "Unable to connect to server: %s\n", strerror (errno));
+			exit(EXIT_FAILURE);
+		}
+	printf("Running %d clients (%d slow) against server %s port %d for %d s...\n",
+	       nclients, nslow, inet_ntoa(srvsin.sin_addr), port, duration);
+	fflush(stdout);
+
+	/* test loop */
+	start = monotonicUs();
+	for(i = 0; i < nclients; i++)
+		if (clientStart(&clients[i], 0) == -1)
+			errors++;
+	while ((now = monotonicUs()) < start + duration * 1000000LL) {
+		n = epoll_wait(epfd, evs, 64, 100);
+		for(i = 0; i < n; i++) {
+			c = evs[i].data.ptr;
+			if (clientRead(c) && clientStart(c, 0) == -1)
+				errors++;
+		}
+		/* retry clients that failed to connect */
+		for(i = 0; i < nclients; i++)
+			if (clients[i].fd == -1 && clientStart(&clients[i], 0) == -1)
+				errors++;
+	}
+	el = (now - start) / 1000000.0;
+
+	/* report */
+	printf("Responses %zu (%.0f/s, %.1f MB/s), errors %lu\n", nlat, nlat / el,
+	       bytes / el / 1048576, errors);
+	if (!nlat)
+		return 1;
+	qsort(lat, nlat, sizeof(*lat), cmpUint);
+	printf("Response time p50 %.3f  p90 %.3f  p99 %.3f  max %.3f ms\n",
+	       lat[nlat / 2] / 1000.0, lat[nlat * 90 / 100] / 1000.0,
+	       lat[nlat * 99 / 100] / 1000.0, lat[nlat - 1] / 1000.0);
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,295 @@
+/*
+ * **********************************************
+ *  This library contains append-only store of
+ *  sensor samples written by sensorproxy
+ *  (segment files with sparse time index) and
+ *  its memory-mapped reader
+ * **********************************************
+ */
+
+/*
+ * Writer appends fixed size binary records to current
+ * segment with plain write() and leaves flushing to the
+ * caller, so many samples reach the disk with single
+ * fdatasync(). Every SENSORSTORE_INDEX_STEP records newest
+ * timestamp so far and record number go to index file.
+ * Full segment is closed, next one starts with following
+ * record and oldest segments above limit are removed.
+ * Reader maps whole segment and finds first record of
+ * time range by index.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "sensorstore_lib.h"
+
+static const struct segfile_fmt storefmt = {
+	SENSORSTORE_PREFIX, SENSORSTORE_SEGMENT, SENSORSTORE_MAGIC,
+	SENSORSTORE_VERSION, SENSORSTORE_RECSIZE
+};
+
+static void putFloat(unsigned char *p, float f)
+{
+	unsigned int v;
+
+	memcpy(&v, &f, sizeof(v));
+	SegFile_putLE(p, v, 4);
+}
+
+static float getFloat(const unsigned char *p)
+{
+	unsigned int v;
+	float f;
+
+	v = SegFile_getLE(p, 4);
+	memcpy(&f, &v, sizeof(f));
+	return f;
+}
+
+/* FNV-1a hash of record body */
+static unsigned int checksum(const unsigned char *p, int n)
+{
+	unsigned int h;
+
+	h = 2166136261U;
+	while (n--)
+		h = (h ^ *p++) * 16777619U;
+	return h;
+}
+
+/* Create segment starting with record timestamp */
+static int newSegment(struct sensorstore *st, unsigned long long ts)
+{
+	if (SegFile_create(&storefmt, st->dir, ts, st->maxsegs, &st->fd,
+			   &st->idxfd))
+		return -1;
+	st->segrecs = 0;
+	st->maxts = 0;
+	return 0;
+}
+
+/* Pack record */
+void SensorStore_packRec(unsigned char *p, const struct sensorstore_rec *r)
+{
+	SegFile_putLE(p, r->ts, 8);
+	p[8] = r->bus;
+	p[9] = r->val;
+	SegFile_putLE(p + 10, r->type, 2);
+	SegFile_putLE(p + 12, r->key, 4);
+	putFloat(p + 16, r->cur);
+	putFloat(p + 20, r->min);
+	putFloat(p + 24, r->max);
+	SegFile_putLE(p + 28, checksum(p, 28), 4);
+}
+
+/* Unpack record */
+int SensorStore_unpackRec(const unsigned char *p, struct sensorstore_rec *r)
+{
+	if (SegFile_getLE(p + 28, 4) != checksum(p, 28))
+		return -1;
+	r->ts = SegFile_getLE(p, 8);
+	r->bus = p[8];
+	r->val = p[9];
+	r->type = SegFile_getLE(p + 10, 2);
+	r->key = SegFile_getLE(p + 12, 4);
+	r->cur = getFloat(p + 16);
+	r->min = getFloat(p + 20);
+	r->max = getFloat(p + 24);
+	return 0;
+}
+
+/* Prepare writer */
+int SensorStore_open(struct sensorstore *st, const char *dir,
+		     unsigned long long maxrecs, int maxsegs)
+{
+	if (SegFile_checkDir(&storefmt, dir, sizeof(st->dir)))
+		return -1;
+	if (eaccess(dir, W_OK | X_OK) == -1)	/* as privileged user */
+		return -1;
+	strcpy(st->dir, dir);
+	st->fd = -1;
+	st->idxfd = -1;
+	st->segrecs = 0;
+	st->maxrecs = maxrecs;
+	st->maxsegs = maxsegs;
+	st->maxts = 0;
+	st->records = 0;
+	st->segs = NULL;
+	st->nsegs = 0;
+	st->map = NULL;
+	return 0;
+}
+
+/* Append records */
+int SensorStore_write(struct sensorstore *st, const unsigned char *recs,
+		      int count)
+{
+	unsigned long long n, i, ts;
+
+	while (count > 0) {
+		ts = SegFile_getLE(recs, 8);
+		if (st->fd < 0 && newSegment(st, ts))
+			return -1;
+		/* up to next index point or end of segment */
+		n = SENSORSTORE_INDEX_STEP - st->segrecs % SENSORSTORE_INDEX_STEP;
+		if (n > st->maxrecs - st->segrecs)
+			n = st->maxrecs - st->segrecs;
+		if (n > count)
+			n = count;
+		if (st->segrecs && !(st->segrecs % SENSORSTORE_INDEX_STEP))
+			SegFile_indexAdd(st->idxfd, st->maxts, st->segrecs);
+		if (SegFile_writeAll(st->fd, recs, n * SENSORSTORE_RECSIZE)) {
+			/* record may be partial, never append after it */
+			SensorStore_close(st);
+			return -1;
+		}
+		for(i = 0; i < n; i++) {
+			ts = SegFile_getLE(recs + i * SENSORSTORE_RECSIZE, 8);
+			if (ts > st->maxts)
+				st->maxts = ts;
+		}
+		st->segrecs += n;
+		st->records += n;
+		recs += n * SENSORSTORE_RECSIZE;
+		count -= n;
+		if (st->segrecs >= st->maxrecs) {
+			SensorStore_sync(st);	/* last chance for this segment */
+			SensorStore_close(st);
+		}
+	}
+	return 0;
+}
+
+/* Flush segment and index */
+int SensorStore_sync(struct sensorstore *st)
+{
+	if (st->fd < 0)
+		return 0;
+	if (fdatasync(st->fd) == -1)
+		return -1;
+	fdatasync(st->idxfd);	/* index is a hint */
+	return 0;
+}
+
+/* Close current segment */
+void SensorStore_close(struct sensorstore *st)
+{
+	if (st->fd >= 0)
+		close(st->fd);
+	if (st->idxfd >= 0)
+		close(st->idxfd);
+	st->fd = -1;
+	st->idxfd = -1;
+}
+
+/* List segments */
+int SensorStore_openReader(struct sensorstore *st, const char *dir)
+{
+	int n;
+
+	if (SegFile_checkDir(&storefmt, dir, sizeof(st->dir)))
+		return -1;
+	n = SegFile_list(&storefmt, dir, &st->segs);
+	if (n < 0)
+		return -1;
+	strcpy(st->dir, dir);
+	st->nsegs = n;
+	st->cur = -1;
+	st->fd = -1;
+	st->idxfd = -1;
+	st->map = NULL;
+	st->maplen = 0;
+	st->recs = NULL;
+	st->nrecs = 0;
+	return n;
+}
+
+/* Timestamp of first record from segment name */
+unsigned long long SensorStore_segmentTime(struct sensorstore *st, int i)
+{
+	return SegFile_time(&storefmt, st->segs[i]);
+}
+
+/* Find segment by time */
+int SensorStore_findSegment(struct sensorstore *st, unsigned long long ts)
+{
+	int i;
+
+	for(i = st->nsegs - 1; i > 0; i--)
+		if (SensorStore_segmentTime(st, i) <= ts)
+			break;
+	return i > 0 ? i : 0;
+}
+
+/* Map segment */
+long long SensorStore_map(struct sensorstore *st, int i)
+{
+	char path[PATH_MAX];
+	struct stat sb;
+	int fd;
+	void *m;
+
+	if (i < 0 || i >= st->nsegs || st->segs[i] == NULL)
+		return -1;
+	SegFile_path(path, &storefmt, st->dir, st->segs[i], SENSORSTORE_SEGMENT);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &sb) == -1 || sb.st_size < SENSORSTORE_HDRSIZE) {
+		close(fd);
+		return -1;
+	}
+	if (st->cur == i && st->maplen == (size_t)sb.st_size) {
+		close(fd);
+		return st->nrecs;	/* not grown since */
+	}
+	m = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (m == MAP_FAILED)
+		return -1;
+	if (st->map != NULL)
+		munmap(st->map, st->maplen);
+	st->map = m;
+	st->maplen = sb.st_size;
+	st->cur = i;
+	st->recs = st->map + SENSORSTORE_HDRSIZE;
+	st->nrecs = (st->maplen - SENSORSTORE_HDRSIZE) / SENSORSTORE_RECSIZE;
+	if (SegFile_checkHeader(&storefmt, st->map))
+		st->nrecs = 0;	/* not ours, nothing to read */
+	madvise(st->map, st->maplen, MADV_SEQUENTIAL);
+	return st->nrecs;
+}
+
+/* Find first record of time range in mapped segment */
+unsigned long long SensorStore_seek(struct sensorstore *st, unsigned long long ts)
+{
+	unsigned long long rec;
+
+	if (st->cur < 0)
+		return 0;
+	rec = SegFile_indexFind(&storefmt, st->dir, st->segs[st->cur], ts);
+	return rec < st->nrecs ? rec : st->nrecs;
+}
+
+/* Unmap segment and free segment list */
+void SensorStore_closeReader(struct sensorstore *st)
+{
+	if (st->map != NULL)
+		munmap(st->map, st->maplen);
+	st->map = NULL;
+	st->cur = -1;
+	if (st->segs != NULL)
+		SegFile_freeList(st->segs, st->nsegs);
+	st->segs = NULL;
+	st->nsegs = 0;
+}
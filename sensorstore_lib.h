@@ -0,0 +1,106 @@
+#ifndef _SENSORSTORE_LIB_H_
+#define _SENSORSTORE_LIB_H_
+
+#include <stddef.h>
+#include <limits.h>
+
+#include "segfile_lib.h"
+
+/* Append-only store of sensor value samples written by sensorproxy */
+
+/* Store directory holds segments (see segfile_lib.h) named
+     shst-TTTTTTTTTTTTTTTT.dat   timestamp of first record in ms
+     shst-TTTTTTTTTTTTTTTT.idx   index entry every SENSORSTORE_INDEX_STEP
+                                 records, timestamp is the newest one
+                                 before that record
+   Segment header has magic "SHST".
+   Record (one sample of one sensor value):
+     0  u64  timestamp (ms since Epoch)
+     8  u8   sensor bus
+     9  u8   value number within sensor
+    10  u16  sensor type
+    12  u32  sensor key (identity on bus)
+    16  f32  current value
+    20  f32  minimum
+    24  f32  maximum
+    28  u32  checksum (FNV-1a of bytes 0-27)
+   All numbers are little-endian. Records are appended in arrival order,
+   timestamps are mostly but not strictly ascending. Partial record at
+   the end of segment (writer crashed) and damaged ones are ignored. */
+
+#define SENSORSTORE_MAGIC	0x54534853	/* "SHST" */
+#define SENSORSTORE_VERSION	1
+#define SENSORSTORE_HDRSIZE	SEGFILE_HDRSIZE
+#define SENSORSTORE_RECSIZE	32
+#define SENSORSTORE_INDEX_STEP	256	/* records per index entry */
+#define SENSORSTORE_PREFIX	"shst-"
+#define SENSORSTORE_SEGMENT	".dat"
+
+struct sensorstore_rec {
+	unsigned long long ts;
+	int bus, val, type;
+	unsigned int key;
+	float cur, min, max;
+};
+
+struct sensorstore {
+	char dir[PATH_MAX];
+	int fd, idxfd;			/* current segment, -1 if none */
+	unsigned long long segrecs;	/* writer: records in current segment */
+	unsigned long long maxrecs;	/* writer: segment size limit */
+	int maxsegs;			/* writer: segments kept (0 - all) */
+	unsigned long long maxts;	/* writer: newest record in segment */
+	unsigned long long records;	/* writer: records written */
+	char **segs;			/* reader: segment names, sorted */
+	int nsegs, cur;			/* reader: mapped segment, -1 if none */
+	unsigned char *map;		/* reader: mapping of current segment */
+	size_t maplen;
+	const unsigned char *recs;	/* reader: first record in mapping */
+	unsigned long long nrecs;	/* reader: complete records mapped */
+};
+
+/* Pack record (SENSORSTORE_RECSIZE bytes) */
+void SensorStore_packRec(unsigned char *p, const struct sensorstore_rec *r);
+
+/* Unpack record, returns 0 if checksum is valid */
+int SensorStore_unpackRec(const unsigned char *p, struct sensorstore_rec *r);
+
+/* Prepare writer for store directory, segment is created with first */
+/* record (writer), returns 0 on success */
+int SensorStore_open(struct sensorstore *st, const char *dir,
+		     unsigned long long maxrecs, int maxsegs);
+
+/* Append packed records, segment is rotated when full, nothing is */
+/* flushed to disk (writer), returns 0 on success */
+int SensorStore_write(struct sensorstore *st, const unsigned char *recs,
+		      int count);
+
+/* Flush written records and index to disk (writer), returns 0 on success */
+int SensorStore_sync(struct sensorstore *st);
+
+/* Close current segment, next record starts new one (writer) */
+void SensorStore_close(struct sensorstore *st);
+
+/* List segments in store directory (reader), returns number of segments */
+/* or -1 on error */
+int SensorStore_openReader(struct sensorstore *st, const char *dir);
+
+/* Timestamp of first record in segment (reader) */
+unsigned long long SensorStore_segmentTime(struct sensorstore *st, int i);
+
+/* Last segment that starts not later than ts (in ms), 0 if none (reader) */
+int SensorStore_findSegment(struct sensorstore *st, unsigned long long ts);
+
+/* Map segment read-only, records are available at st->recs, mapping is */
+/* reused when segment has not grown (reader), returns number of complete */
+/* records or -1 on error */
+long long SensorStore_map(struct sensorstore *st, int i);
+
+/* Number of first record in mapped segment that may be not older than */
+/* ts (in ms), all preceding ones are older (reader) */
+unsigned long long SensorStore_seek(struct sensorstore *st, unsigned long long ts);
+
+/* Unmap segment and free segment list (reader) */
+void SensorStore_closeReader(struct sensorstore *st);
+
+#endif